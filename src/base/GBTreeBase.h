@@ -36,6 +36,8 @@ const int RT_INVALID_NODE		  = -1015;
 const int RT_MEMCPY_ERROR        = -1016;
 const int RT_END_OF_NODE         = -1017;
 const int RT_DUPLICATE_FULL      = -1018;
+const int RT_END_OF_FILE        = -1019;
+const int RT_RECORD_DELETED      = -1020;
 const int RT_GEOHASH_ERROR		  = -1030;
 const int RT_GEOQUERY_INVALID_RANGE = -1040;
 
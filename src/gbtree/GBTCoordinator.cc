@@ -0,0 +1,330 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  GBTCoordinator.cc
+ *
+ *    Description:  scatter-gather queries over shard server processes
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <unistd.h>
+#include <algorithm>
+#include <limits>
+#include "../pathmanager/PathManager.h"
+#include "GBTCoordinator.h"
+#include "Geohash.h"
+
+const uint32_t GBTCoordinator::REQUEST_RANGE;
+const uint32_t GBTCoordinator::REQUEST_NEAREST;
+const uint32_t GBTCoordinator::REQUEST_STOP;
+
+static bool recordCloser(const ShardRecord& r1, const ShardRecord& r2)
+{
+	return r1.distance < r2.distance;
+}
+
+/*
+ * a peer that went away fails the send with EPIPE instead of raising
+ * SIGPIPE, which would kill the process
+ */
+static RT writeFully(int fd, const void* buffer, size_t length)
+{
+	const char* ptr = (const char*) buffer;
+	while (length > 0) {
+		ssize_t n = ::send(fd, ptr, length, MSG_NOSIGNAL);
+		if (n < 0)
+			return RT_FILE_WRITE_FAILED;
+		ptr += n;
+		length -= n;
+	}
+	return 0;
+}
+
+/*
+ * returns RT_END_OF_FILE if the peer closed the connection before the first byte
+ */
+static RT readFully(int fd, void* buffer, size_t length)
+{
+	char* ptr = (char*) buffer;
+	size_t got = 0;
+	while (got < length) {
+		ssize_t n = ::read(fd, ptr + got, length - got);
+		if (n < 0)
+			return RT_FILE_READ_FAILED;
+		if (n == 0)
+			return (got == 0) ? RT_END_OF_FILE : RT_FILE_READ_FAILED;
+		got += n;
+	}
+	return 0;
+}
+
+GBTCoordinator::GBTCoordinator()
+{
+}
+
+GBTCoordinator::~GBTCoordinator()
+{
+	stop();
+}
+
+int GBTCoordinator::First(int i, int servers)
+{
+	return (i * GBTShardedTable::SHARD_COUNT + servers - 1) / servers;
+}
+
+int GBTCoordinator::ServerOf(int shard, int servers)
+{
+	return shard * servers / GBTShardedTable::SHARD_COUNT;
+}
+
+std::string GBTCoordinator::SocketPath(const std::string& table, int i)
+{
+	char suffix[16];
+	snprintf(suffix, sizeof(suffix), ".sock.%d", i);
+	return PathManager::data_directory + table + suffix;
+}
+
+RT GBTCoordinator::start(const std::string& table, int servers)
+{
+	RT rc;
+
+	if (!pids.empty() || servers <= 0 || servers > GBTShardedTable::SHARD_COUNT)
+		return RT_INVALID_ATTRIBUTE;
+	if ((rc = sharded.open(table)) < 0)
+		return rc;
+	this->table = table;
+
+	for (int i = 0; i < servers; i++) {
+		std::string path = SocketPath(table, i);
+		struct sockaddr_un address;
+		if (path.size() >= sizeof(address.sun_path)) {
+			stop();
+			return RT_FILE_OPEN_FAILED;
+		}
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		strcpy(address.sun_path, path.c_str());
+
+		// listen before the fork, so the connect below cannot miss the server
+		int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		unlink(path.c_str());
+		if (listen_fd < 0 || bind(listen_fd, (struct sockaddr*) &address, sizeof(address)) < 0
+				|| listen(listen_fd, 1) < 0) {
+			if (listen_fd >= 0)
+				::close(listen_fd);
+			stop();
+			return RT_FILE_OPEN_FAILED;
+		}
+
+		pid_t pid = fork();
+		if (pid < 0) {
+			::close(listen_fd);
+			stop();
+			return RT_FILE_OPEN_FAILED;
+		}
+		if (pid == 0) {
+			// the server does not need the connections to the other servers
+			for (size_t j = 0; j < fds.size(); j++)
+				::close(fds[j]);
+			rc = Serve(table, First(i, servers), First(i + 1, servers), listen_fd);
+			::close(listen_fd);
+			unlink(path.c_str());
+			_exit(rc < 0 ? 1 : 0);
+		}
+		::close(listen_fd);
+		pids.push_back(pid);
+
+		int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0 || connect(fd, (struct sockaddr*) &address, sizeof(address)) < 0) {
+			if (fd >= 0)
+				::close(fd);
+			stop();
+			return RT_FILE_OPEN_FAILED;
+		}
+		fds.push_back(fd);
+	}
+	return 0;
+}
+
+RT GBTCoordinator::stop()
+{
+	RT rc = 0;
+	ShardRequest request;
+	memset(&request, 0, sizeof(request));
+	request.type = REQUEST_STOP;
+
+	for (size_t i = 0; i < pids.size(); i++) {
+		if (i < fds.size()) {
+			writeFully(fds[i], &request, sizeof(request));
+			::close(fds[i]);
+		} else {
+			// never connected
+			kill(pids[i], SIGTERM);
+		}
+		int status;
+		if (waitpid(pids[i], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+			rc = RT_FILE_CLOSE_FAILED;
+	}
+	pids.clear();
+	fds.clear();
+	return rc;
+}
+
+RT GBTCoordinator::Serve(const std::string& table, int first, int last, int listen_fd)
+{
+	RT rc;
+	GBTShardedTable shards;
+
+	if ((rc = shards.open(table, first, last)) < 0)
+		return rc;
+
+	int fd = accept(listen_fd, NULL, NULL);
+	if (fd < 0)
+		return RT_FILE_OPEN_FAILED;
+
+	ShardRequest request;
+	std::vector<ShardRecord> records;
+	while ((rc = readFully(fd, &request, sizeof(request))) == 0) {
+		if (request.type == REQUEST_STOP)
+			break;
+
+		ShardReply reply;
+		records.clear();
+		if (request.type == REQUEST_RANGE)
+			reply.status = shards.rangeQuery(request.first_key, request.second_key, records);
+		else if (request.type == REQUEST_NEAREST)
+			reply.status = shards.nearest(request.first_key, records, request.count,
+					request.min_distance, request.max_distance, request.bound);
+		else
+			reply.status = RT_INVALID_ATTRIBUTE;
+		reply.count = records.size();
+
+		if ((rc = writeFully(fd, &reply, sizeof(reply))) < 0)
+			break;
+		if (!records.empty() && (rc = writeFully(fd, &records[0], records.size() * sizeof(ShardRecord))) < 0)
+			break;
+	}
+	::close(fd);
+	return (rc == RT_END_OF_FILE) ? 0 : rc;
+}
+
+RT GBTCoordinator::send(int server, const ShardRequest& request)
+{
+	return writeFully(fds[server], &request, sizeof(request));
+}
+
+RT GBTCoordinator::receive(int server, std::vector<ShardRecord>& outputs)
+{
+	RT rc;
+	ShardReply reply;
+
+	if ((rc = readFully(fds[server], &reply, sizeof(reply))) < 0)
+		return rc;
+	size_t old_size = outputs.size();
+	outputs.resize(old_size + reply.count);
+	if (reply.count > 0 && (rc = readFully(fds[server], &outputs[old_size], reply.count * sizeof(ShardRecord))) < 0)
+		return rc;
+	return reply.status;
+}
+
+/*
+ * every request is sent before any reply is read, so the servers work at
+ * the same time. a failed server still has its reply read, which keeps
+ * the connections in step for the next query. so does a failed send: the
+ * servers sent to before it have their replies read before returning.
+ */
+RT GBTCoordinator::rangeQuery(uint64_t left_down, uint64_t right_up, std::vector<ShardRecord>& outputs)
+{
+	RT rc = 0, rt;
+	int servers = fds.size();
+
+	std::vector<bool> targets(servers, false);
+	const std::vector<int>& shards = sharded.getShards();
+	for (size_t i = 0; i < shards.size(); i++) {
+		if (GBTShardedTable::ShardOverlaps(shards[i], left_down, right_up))
+			targets[ServerOf(shards[i], servers)] = true;
+	}
+
+	ShardRequest request;
+	memset(&request, 0, sizeof(request));
+	request.type = REQUEST_RANGE;
+	request.first_key = left_down;
+	request.second_key = right_up;
+	std::vector<bool> sent(servers, false);
+	for (int i = 0; i < servers && rc == 0; i++) {
+		if (targets[i] && (rc = send(i, request)) == 0)
+			sent[i] = true;
+	}
+	for (int i = 0; i < servers; i++) {
+		if (sent[i] && (rt = receive(i, outputs)) != 0 && rc == 0)
+			rc = rt;
+	}
+	return rc;
+}
+
+RT GBTCoordinator::nearest(uint64_t address, std::vector<ShardRecord>& outputs, size_t count,
+		double min_distance, double max_distance)
+{
+	RT rc = 0, rt;
+	int servers = fds.size();
+	double latitude, longitude;
+
+	if ((rt = geohash_decode_64(address, &latitude, &longitude)) != GEOHASH_OK)
+		return rt;
+	if (servers == 0)
+		return 0;
+
+	ShardRequest request;
+	memset(&request, 0, sizeof(request));
+	request.type = REQUEST_NEAREST;
+	request.count = count;
+	request.first_key = address;
+	request.min_distance = min_distance;
+	request.max_distance = max_distance;
+	request.bound = std::numeric_limits<double>::max();
+
+	// the server of the point sets the bound for the others
+	std::vector<ShardRecord> answers;
+	int home = ServerOf(GBTShardedTable::ShardOf(address), servers);
+	if ((rt = send(home, request)) < 0)
+		return rt;
+	if ((rt = receive(home, answers)) != 0)
+		return rt;
+	std::sort(answers.begin(), answers.end(), recordCloser);
+	if (answers.size() >= count && count > 0)
+		request.bound = answers[count - 1].distance;
+
+	std::vector<bool> targets(servers, false);
+	const std::vector<int>& shards = sharded.getShards();
+	for (size_t i = 0; i < shards.size(); i++) {
+		int server = ServerOf(shards[i], servers);
+		if (server != home && GBTShardedTable::ShardDistance(shards[i], latitude, longitude) <= request.bound)
+			targets[server] = true;
+	}
+	std::vector<bool> sent(servers, false);
+	for (int i = 0; i < servers && rc == 0; i++) {
+		if (targets[i] && (rc = send(i, request)) == 0)
+			sent[i] = true;
+	}
+	for (int i = 0; i < servers; i++) {
+		if (sent[i] && (rt = receive(i, answers)) != 0 && rc == 0)
+			rc = rt;
+	}
+	if (rc != 0)
+		return rc;
+
+	std::stable_sort(answers.begin(), answers.end(), recordCloser);
+	if (answers.size() > count)
+		answers.resize(count);
+	outputs.insert(outputs.end(), answers.begin(), answers.end());
+	return 0;
+}
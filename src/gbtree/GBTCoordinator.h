@@ -0,0 +1,121 @@
+/*
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+#ifndef GBTCOORDINATOR_H_
+#define GBTCOORDINATOR_H_
+
+#include <sys/types.h>
+#include <string>
+#include <vector>
+#include "../base/GBTreeBase.h"
+#include "GBTShardedTable.h"
+
+/**
+ * a query sent from the coordinator to a shard server
+ */
+typedef struct {
+	uint32_t type;          // one of GBTCoordinator::REQUEST_*
+	uint32_t count;         // nearest: number of answers
+	uint64_t first_key;     // range: left_down. nearest: the address
+	uint64_t second_key;    // range: right_up
+	double   min_distance;  // nearest
+	double   max_distance;  // nearest
+	double   bound;         // nearest: farthest answer still wanted
+} ShardRequest;
+
+/**
+ * the header of a reply. count ShardRecords follow it.
+ */
+typedef struct {
+	int32_t  status;
+	uint32_t count;
+} ShardReply;
+
+/**
+ * scatter-gather queries over shard server processes.
+ * start() forks one server per slice of the shards of a GBTShardedTable;
+ * server i serves the shards [First(i), First(i+1)) over a Unix socket
+ * under the data directory. a query is sent to the servers whose shards
+ * it touches and the replies are merged. the requests are plain structs
+ * in host byte order, so the servers must run on the same machine.
+ */
+class GBTCoordinator {
+  public:
+	static const uint32_t REQUEST_RANGE   = 1;
+	static const uint32_t REQUEST_NEAREST = 2;
+	static const uint32_t REQUEST_STOP    = 3;
+
+	GBTCoordinator();
+	~GBTCoordinator();
+
+	/**
+	 * fork the shard servers of a sharded table and connect to them.
+	 * @param table[IN] the table name
+	 * @param servers[IN] the number of servers, at most SHARD_COUNT
+	 * @return error code. 0 if no error
+	 */
+	RT start(const std::string& table, int servers);
+
+	/**
+	 * stop the servers and wait for them to exit.
+	 * @return error code. 0 if no error
+	 */
+	RT stop();
+
+	/**
+	 * range query on the servers whose shards overlap the box.
+	 * see GBTShardedTable::rangeQuery.
+	 * @return error code. 0 if no error
+	 */
+	RT rangeQuery(uint64_t left_down, uint64_t right_up, std::vector<ShardRecord>& outputs);
+
+	/**
+	 * nearest query. the server of the point answers first and the count-th
+	 * distance it returns is pushed as the bound to the servers that have a
+	 * shard within it. the answers are merged into the global top count.
+	 * see GBTShardedTable::nearest.
+	 * @return error code. 0 if no error
+	 */
+	RT nearest(uint64_t address, std::vector<ShardRecord>& outputs, size_t count = 50,
+			double min_distance = 0.0, double max_distance = 0.0);
+
+	/**
+	 * @return the first shard of server i out of servers
+	 */
+	static int First(int i, int servers);
+
+	/**
+	 * @return the server of a shard
+	 */
+	static int ServerOf(int shard, int servers);
+
+	/**
+	 * @return the path of the socket of server i
+	 */
+	static std::string SocketPath(const std::string& table, int i);
+
+  private:
+	/**
+	 * serve the shards [first, last) on listen_fd until a REQUEST_STOP.
+	 * runs in the forked server process.
+	 */
+	static RT Serve(const std::string& table, int first, int last, int listen_fd);
+
+	/**
+	 * send a request to a server.
+	 */
+	RT send(int server, const ShardRequest& request);
+
+	/**
+	 * receive the reply of a server and append its records to outputs.
+	 */
+	RT receive(int server, std::vector<ShardRecord>& outputs);
+
+	GBTShardedTable    sharded;  // the shards of the table, to route queries
+	std::string        table;
+	std::vector<pid_t> pids;     // server processes
+	std::vector<int>   fds;      // connections to the servers
+};
+
+#endif
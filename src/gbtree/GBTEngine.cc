@@ -20,63 +20,88 @@
 #include <sys/times.h>
 #include <stdlib.h>
 #include <inttypes.h>
+#include <unistd.h>
 #include "../pathmanager/PathManager.h"
 #include "../storagemanager/GBTFile.h"
 #include "GBTEngine.h"
 #include "GBTTable.h"
 #include "GBTreeIndex.h"
+#include "GBTLoader.h"
+#include "GBTSorter.h"
 #include "Geohash.h"
 #include "GeoQuery.h"
-RT GBTEngine::load(const std::string& table, const std::string& loadfile, bool index)
+
+size_t GBTEngine::load_memory = 256 << 20;
+int GBTEngine::page_size = GBTFile::PAGE_SIZE;
+
+RT GBTEngine::load(const std::string& table, const std::string& loadfile, bool index, bool append)
 {
 	RT ans;
 	
-	FILE *data_file = fopen(loadfile.c_str(), "r");
-	if(data_file == NULL){
+	GBTLoader loader;
+	if(loader.open(loadfile) < 0){
 		fprintf(stderr, "open data file error!\n");
 		return RT_FILE_OPEN_FAILED;
 	}
 
+	// a plain load starts from empty files
+	if(!append){
+		unlink(("data/" + table + ".tbl").c_str());
+		unlink(("data/" + table + ".idx").c_str());
+	}
+
 	GBTTable table_file;
-	if((ans = table_file.open("data/" + table+".tbl", 'w')) < 0){
+	if((ans = table_file.open("data/" + table+".tbl", 'w', page_size)) < 0){
 		fprintf(stderr, "open table file error!\n");
-		fclose(data_file);
+		loader.close();
 		table_file.close(); 
 		return RT_FILE_OPEN_FAILED;
 	}
 
 	GBTreeIndex index_file(index);
-	if((ans = index_file.open("data/"+table+".idx", 'w')) < 0){
+	if((ans = index_file.open("data/"+table+".idx", 'w', page_size)) < 0){
 		fprintf(stderr, "open index file error!\n");
-		fclose(data_file);
+		loader.close();
 		table_file.close();
 		index_file.close();
 		return RT_FILE_OPEN_FAILED;
 	}
 	
-	uint64_t key;
-	char data_string[1024];
-	double lng, lat;
-	std::string value;
+	// a load writes many pages; they go to disk together in PageId order
+	table_file.writeBack(GBTFile::LOAD_WRITE_BACK_PAGES);
+	index_file.writeBack(GBTFile::LOAD_WRITE_BACK_PAGES);
+
+	// an empty index is built bottom up from the sorted (key, rid) pairs,
+	// otherwise the sorted pairs are merged into its leaves.
+	bool bulk = (index_file.getTreeHeight() == 0);
+	GBTSorter sorter(load_memory, PathManager::GetRunPrefix(table));
+
 	RecordId rcid;
+	std::vector<LoadRecord> records;
 	int count = 0;
-	while(fgets(data_string, 1024, data_file) != NULL){
-		if(parseLoadLine(data_string, lng, lat, value) == 0){
-			key = 0;
-			if(geohash_encode_64(lat, lng, &key) != GEOHASH_OK)
-				return RT_GEOHASH_ERROR;
+	// the loader parses and geohashes a batch of lines on worker threads;
+	// the records are then stored in file order.
+	while((ans = loader.nextBatch(records)) == 0){
+		for(size_t i = 0; i < records.size(); i++){
+			const LoadRecord& record = records[i];
+			if(record.status != 0){
+				loader.close();
+				table_file.close();
+				index_file.close();
+				return record.status;
+			}
 
-			if((ans = table_file.append(key, value, rcid)) < 0){
+			if((ans = table_file.append(record.key, record.value, record.value_len, rcid)) < 0){
 				fprintf(stderr, "insert the data into table failed!");
-				fclose(data_file);
+				loader.close();
 				table_file.close();
 				index_file.close();
 				return ans;
 			}
 
-			if((ans = index_file.insert(key, rcid)) < 0){
+			if((ans = sorter.add(record.key, rcid)) < 0){
 				fprintf(stderr, "Error ID: %d,insert the data into index file failed!", ans);
-				fclose(data_file);
+				loader.close();
 				table_file.close();
 				index_file.close();
 				return ans;
@@ -84,9 +109,37 @@ RT GBTEngine::load(const std::string& table, const std::string& loadfile, bool i
 			count++;
 		}
 	}
+	if(ans != RT_END_OF_FILE){
+		fprintf(stderr, "read the data file failed!");
+		loader.close();
+		table_file.close();
+		index_file.close();
+		return ans;
+	}
+
+	uint64_t key;
+	if((ans = sorter.finish()) == 0)
+		ans = bulk ? index_file.bulkLoadBegin() : index_file.mergeBegin();
+	if(ans == 0){
+		while((ans = sorter.next(key, rcid)) == 0){
+			ans = bulk ? index_file.bulkLoadAppend(key, rcid) : index_file.mergeAppend(key, rcid);
+			if(ans < 0)
+				break;
+		}
+		if(ans == RT_END_OF_FILE)
+			ans = bulk ? index_file.bulkLoadEnd() : index_file.mergeEnd();
+	}
+	sorter.close();
+	if(ans < 0){
+		fprintf(stderr, "Error ID: %d,build the index file failed!", ans);
+		loader.close();
+		table_file.close();
+		index_file.close();
+		return ans;
+	}
 
 	fprintf(stdout, "the number of pages is %d. ", index_file.getPageCount());
-	fclose(data_file);
+	loader.close();
 	table_file.close();
 	index_file.close();
 
@@ -117,15 +170,13 @@ RT GBTEngine::load(const std::string& table, const std::string& loadfile, bool i
 }
 RT GBTEngine::parseLoadLine(char* line, double& lng, double& lat, std::string& value)
 {
-	const char* delimiter = ",\r\n";
-
-	char *pch = NULL;
-	pch = strtok(line, delimiter);
-	lng = atof(pch);
-	pch = strtok(NULL, delimiter);
-	lat = atof(pch);
-	pch = strtok(NULL, delimiter);
-	value.assign(pch);
+	RT rc;
+	LoadRecord record;
+	if((rc = GBTLoader::parseLine(line, line + strlen(line), record)) < 0)
+		return rc;
+	lng = record.lng;
+	lat = record.lat;
+	value.assign(record.value, record.value_len);
 	return 0;
 }
 
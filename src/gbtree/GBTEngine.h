@@ -24,6 +24,18 @@ typedef struct _NearResult{
  */
 class GBTEngine {
  public:
+
+  /* *
+   * memory budget in bytes for sorting the index entries of a load.
+   * a larger load is sorted externally in runs under data_directory.
+   * */
+  static size_t load_memory;
+
+  /* *
+   * the page size of the table and index files a load creates.
+   * files that exist keep the page size they were created with.
+   * */
+  static int page_size;
     
   /**
    * executes a SELECT statement.
@@ -49,12 +61,20 @@ class GBTEngine {
 
   /**
    * load a table from a load file.
+   * the load file is either "lng,lat,value" text lines or a columnar file;
+   * see ColumnarHeader in GBTLoader.h for the columnar layout.
+   * the (key, rid) pairs are sorted with a GBTSorter within load_memory.
+   * an empty index is built bottom up from the sorted pairs; otherwise the
+   * pairs are merged into the leaves of the existing index in key order.
    * @param table[IN] the table name in the LOAD command
    * @param loadfile[IN] the file name of the load file
    * @param index[IN] true if "WITH INDEX" option was specified
+   * @param append[IN] false to replace the table and index files,
+   *                   true to add the load file to them. the values are
+   *                   appended to the tail of the table file.
    * @return error code. 0 if no error
    */
-  static RT load(const std::string& table, const std::string& loadfile, bool index);
+  static RT load(const std::string& table, const std::string& loadfile, bool index, bool append = false);
 
   /**
    * parse a line from the load file into the (key, value) pair.
@@ -0,0 +1,277 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  GBTLoader.cc
+ *
+ *    Description:  parallel reader for text and columnar load files
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <string.h>
+#include <charconv>
+#include <thread>
+#include "GBTLoader.h"
+#include "Geohash.h"
+
+static inline bool isDelimiter(char c)
+{
+	return c == ',' || c == '\r' || c == '\n';
+}
+
+/* *
+ * find the next token in [p, end) the way strtok(p, ",\r\n") does:
+ * leading delimiters are skipped and the token ends at the next delimiter.
+ * @return false if there is no token left
+ * */
+static bool nextToken(const char*& p, const char* end, const char*& tb, const char*& te)
+{
+	while (p < end && isDelimiter(*p))
+		++p;
+	if (p == end)
+		return false;
+	tb = p;
+	while (p < end && !isDelimiter(*p))
+		++p;
+	te = p;
+	return true;
+}
+
+static bool parseDouble(const char* begin, const char* end, double& out)
+{
+	while (begin < end && (*begin == ' ' || *begin == '\t'))
+		++begin;
+	if (begin < end && *begin == '+')
+		++begin;
+	std::from_chars_result res = std::from_chars(begin, end, out);
+	return res.ec == std::errc() && res.ptr != begin;
+}
+
+GBTLoader::GBTLoader()
+{
+	offset = 0;
+	workers = std::thread::hardware_concurrency();
+	if (workers < 1)
+		workers = 1;
+	columnar = false;
+	count = 0;
+	lngs = lats = NULL;
+	value_offsets = keys = NULL;
+	blob = NULL;
+	blob_size = 0;
+}
+
+RT GBTLoader::open(const std::string& loadfile)
+{
+	RT rc;
+
+	offset = 0;
+	columnar = false;
+	if ((rc = map.open(loadfile)) < 0)
+		return rc;
+
+	if (map.size() >= sizeof(COLUMNAR_MAGIC) &&
+			memcmp(map.data(), COLUMNAR_MAGIC, sizeof(COLUMNAR_MAGIC)) == 0) {
+		if ((rc = openColumnar()) < 0) {
+			map.close();
+			return rc;
+		}
+	}
+	return 0;
+}
+
+RT GBTLoader::openColumnar()
+{
+	ColumnarHeader header;
+
+	if (map.size() < sizeof(ColumnarHeader))
+		return RT_INVALID_FILE_FORMAT;
+	memcpy(&header, map.data(), sizeof(ColumnarHeader));
+	if (header.version != COLUMNAR_VERSION)
+		return RT_INVALID_FILE_FORMAT;
+
+	// every column has n entries of 8 bytes except value_offset, which has n+1.
+	// check the sizes before multiplying so a corrupt count cannot overflow.
+	uint64_t columns = (header.flags & COLUMNAR_HAS_KEYS) ? 4 : 3;
+	uint64_t limit = map.size() / sizeof(uint64_t);
+	if (header.count >= limit / columns)
+		return RT_INVALID_FILE_FORMAT;
+	uint64_t fixed = sizeof(ColumnarHeader) + (columns * header.count + 1) * sizeof(uint64_t);
+	if (fixed > map.size() || header.blob_size > map.size() - fixed)
+		return RT_INVALID_FILE_FORMAT;
+
+	const char* column = map.data() + sizeof(ColumnarHeader);
+	count = header.count;
+	lngs = (const double*) column;
+	column += count * sizeof(double);
+	lats = (const double*) column;
+	column += count * sizeof(double);
+	value_offsets = (const uint64_t*) column;
+	column += (count + 1) * sizeof(uint64_t);
+	keys = NULL;
+	if (header.flags & COLUMNAR_HAS_KEYS) {
+		keys = (const uint64_t*) column;
+		column += count * sizeof(uint64_t);
+	}
+	blob = column;
+	blob_size = header.blob_size;
+	columnar = true;
+	return 0;
+}
+
+RT GBTLoader::close()
+{
+	offset = 0;
+	columnar = false;
+	return map.close();
+}
+
+RT GBTLoader::parseLine(const char* begin, const char* end, LoadRecord& record)
+{
+	const char *tb, *te;
+	const char *p = begin;
+
+	if (!nextToken(p, end, tb, te) || !parseDouble(tb, te, record.lng))
+		return RT_INVALID_ATTRIBUTE;
+	if (!nextToken(p, end, tb, te) || !parseDouble(tb, te, record.lat))
+		return RT_INVALID_ATTRIBUTE;
+	if (!nextToken(p, end, tb, te))
+		return RT_INVALID_ATTRIBUTE;
+	record.value = tb;
+	record.value_len = te - tb;
+
+	record.key = 0;
+	if (geohash_encode_64(record.lat, record.lng, &record.key) != GEOHASH_OK)
+		record.status = RT_GEOHASH_ERROR;
+	else
+		record.status = 0;
+	return 0;
+}
+
+void GBTLoader::parseBlock(const char* begin, const char* end, std::vector<LoadRecord>* records)
+{
+	LoadRecord record;
+	const char* line = begin;
+
+	while (line < end) {
+		const char* eol = (const char*) memchr(line, '\n', end - line);
+		if (eol == NULL)
+			eol = end;
+		if (parseLine(line, eol, record) == 0)
+			records->push_back(record);
+		line = eol + 1;
+	}
+}
+
+void GBTLoader::encodeBlock(LoadRecord* begin, LoadRecord* end)
+{
+	for (LoadRecord* record = begin; record != end; ++record) {
+		record->key = 0;
+		if (geohash_encode_64(record->lat, record->lng, &record->key) != GEOHASH_OK)
+			record->status = RT_GEOHASH_ERROR;
+	}
+}
+
+RT GBTLoader::nextBatch(std::vector<LoadRecord>& records)
+{
+	if (columnar)
+		return nextColumnarBatch(records);
+	return nextTextBatch(records);
+}
+
+RT GBTLoader::nextColumnarBatch(std::vector<LoadRecord>& records)
+{
+	records.clear();
+	if (offset >= count)
+		return RT_END_OF_FILE;
+
+	uint64_t first = offset;
+	uint64_t last = first + (uint64_t)workers * COLUMNAR_BATCH;
+	if (last > count)
+		last = count;
+	offset = last;
+
+	records.resize(last - first);
+	for (uint64_t i = first; i < last; i++) {
+		LoadRecord& record = records[i - first];
+		uint64_t begin = value_offsets[i];
+		uint64_t end = value_offsets[i + 1];
+		if (begin > end || end > blob_size)
+			return RT_INVALID_FILE_FORMAT;
+		record.lng = lngs[i];
+		record.lat = lats[i];
+		record.value = blob + begin;
+		record.value_len = (end - begin > (uint64_t)INT32_MAX) ? INT32_MAX : (int)(end - begin);
+		record.key = (keys != NULL) ? keys[i] : 0;
+		record.status = 0;
+	}
+	if (keys != NULL)
+		return 0;
+
+	// no key column: geohash the batch on the worker threads
+	size_t n = records.size();
+	size_t per = (n + workers - 1) / workers;
+	if (per == n) {
+		encodeBlock(&records[0], &records[0] + n);
+	} else {
+		std::vector<std::thread> threads;
+		for (size_t begin = 0; begin < n; begin += per) {
+			size_t end = (begin + per > n) ? n : begin + per;
+			threads.push_back(std::thread(encodeBlock, &records[0] + begin, &records[0] + end));
+		}
+		for (size_t i = 0; i < threads.size(); i++)
+			threads[i].join();
+	}
+	return 0;
+}
+
+RT GBTLoader::nextTextBatch(std::vector<LoadRecord>& records)
+{
+	const char* data = map.data();
+	size_t size = map.size();
+
+	records.clear();
+	if (offset >= size)
+		return RT_END_OF_FILE;
+
+	// cut the next (workers * BLOCK_SIZE) bytes into blocks that end right after a newline
+	std::vector<const char*> bounds;
+	bounds.push_back(data + offset);
+	for (int i = 0; i < workers && offset < size; i++) {
+		size_t stop = offset + BLOCK_SIZE;
+		if (stop >= size) {
+			stop = size;
+		} else {
+			const char* eol = (const char*) memchr(data + stop, '\n', size - stop);
+			stop = (eol == NULL) ? size : (eol - data) + 1;
+		}
+		offset = stop;
+		bounds.push_back(data + offset);
+	}
+
+	int blocks = bounds.size() - 1;
+	std::vector<std::vector<LoadRecord> > parsed(blocks);
+	if (blocks == 1) {
+		parseBlock(bounds[0], bounds[1], &parsed[0]);
+	} else {
+		std::vector<std::thread> threads;
+		for (int i = 0; i < blocks; i++)
+			threads.push_back(std::thread(parseBlock, bounds[i], bounds[i+1], &parsed[i]));
+		for (int i = 0; i < blocks; i++)
+			threads[i].join();
+	}
+
+	// concatenate the blocks in file order
+	size_t total = 0;
+	for (int i = 0; i < blocks; i++)
+		total += parsed[i].size();
+	records.reserve(total);
+	for (int i = 0; i < blocks; i++)
+		records.insert(records.end(), parsed[i].begin(), parsed[i].end());
+
+	return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+#ifndef GBTLOADER_H_
+#define GBTLOADER_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "../base/GBTreeBase.h"
+#include "../storagemanager/GBTMappedFile.h"
+
+/**
+ * one parsed tuple of a load file.
+ * value points into the mapped load file and is NOT null terminated,
+ * so a LoadRecord is only valid while its GBTLoader is open.
+ */
+typedef struct {
+	uint64_t    key;        // geohash of (lat, lng)
+	double      lng;
+	double      lat;
+	const char* value;      // first byte of the value field
+	int         value_len;  // length of the value field
+	int         status;     // 0, or RT_GEOHASH_ERROR if lng/lat cannot be encoded
+} LoadRecord;
+
+/**
+ * header of a columnar load file. all integers and doubles are stored in
+ * host byte order and every column starts at an 8-byte boundary:
+ *
+ *   offset 0   char     magic[8]          "GBTCOL01"
+ *   offset 8   uint32_t version           COLUMNAR_VERSION
+ *   offset 12  uint32_t flags             COLUMNAR_HAS_KEYS
+ *   offset 16  uint64_t count             number of records (n)
+ *   offset 24  uint64_t blob_size         size of the value blob in bytes
+ *   offset 32  double   lng[n]
+ *              double   lat[n]
+ *              uint64_t value_offset[n+1] value i is blob[value_offset[i], value_offset[i+1])
+ *              uint64_t key[n]            only if (flags & COLUMNAR_HAS_KEYS); precomputed geohash
+ *              char     blob[blob_size]
+ */
+typedef struct {
+	char     magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint64_t count;
+	uint64_t blob_size;
+} ColumnarHeader;
+
+const char COLUMNAR_MAGIC[8] = {'G', 'B', 'T', 'C', 'O', 'L', '0', '1'};
+const uint32_t COLUMNAR_VERSION = 1;
+const uint32_t COLUMNAR_HAS_KEYS = 0x1;
+
+/**
+ * reads a load file, which is either a text file of "lng,lat,value" lines
+ * or a columnar file (see ColumnarHeader). the format is detected by the magic.
+ * the file is mapped into memory. a text file is cut into blocks at line
+ * boundaries and the blocks of a batch are parsed and geohashed on worker
+ * threads; a columnar file is read straight from its columns.
+ */
+class GBTLoader {
+  public:
+	/* *
+	 * bytes of input parsed by one worker per batch
+	 * */
+	static const size_t BLOCK_SIZE = 4 << 20;
+
+	/* *
+	 * records of a columnar file returned by one worker per batch
+	 * */
+	static const size_t COLUMNAR_BATCH = 1 << 16;
+
+	GBTLoader();
+
+	/**
+	 * map the load file and detect its format.
+	 * @param loadfile[IN] the file name of the load file
+	 * @return error code. 0 if no error. RT_INVALID_FILE_FORMAT if a columnar file is malformed
+	 */
+	RT open(const std::string& loadfile);
+
+	/**
+	 * unmap the load file. records returned so far become invalid.
+	 * @return error code. 0 if no error
+	 */
+	RT close();
+
+	/**
+	 * read the next batch of the load file. records come out in file order;
+	 * text lines that cannot be parsed are skipped.
+	 * @param records[OUT] the parsed records. cleared first.
+	 * @return 0 if a batch was read, RT_END_OF_FILE at the end of the file,
+	 *         RT_INVALID_FILE_FORMAT if a value offset of a columnar file is out of range
+	 */
+	RT nextBatch(std::vector<LoadRecord>& records);
+
+	/**
+	 * parse one "lng,lat,value" line. the line does not need to be null terminated.
+	 * @param begin[IN] first byte of the line
+	 * @param end[IN] one past the last byte of the line
+	 * @param record[OUT] the parsed record; the value points into the line
+	 * @return error code. 0 if no error
+	 */
+	static RT parseLine(const char* begin, const char* end, LoadRecord& record);
+
+  private:
+	/**
+	 * parse every line in [begin, end) into records.
+	 */
+	static void parseBlock(const char* begin, const char* end, std::vector<LoadRecord>* records);
+
+	/**
+	 * geohash the records in [begin, end) whose key column is absent.
+	 */
+	static void encodeBlock(LoadRecord* begin, LoadRecord* end);
+
+	/**
+	 * validate the header of a columnar file and set up the column pointers.
+	 */
+	RT openColumnar();
+
+	RT nextTextBatch(std::vector<LoadRecord>& records);
+	RT nextColumnarBatch(std::vector<LoadRecord>& records);
+
+	GBTMappedFile map;  // the mapped load file
+	size_t offset;      // text: the first byte not parsed yet; columnar: the first record not read yet
+	int workers;        // number of parser threads
+
+	// columns of a columnar file. columnar is false for a text file
+	bool            columnar;
+	uint64_t        count;
+	const double*   lngs;
+	const double*   lats;
+	const uint64_t* value_offsets;
+	const uint64_t* keys;       // NULL if the file has no key column
+	const char*     blob;
+	uint64_t        blob_size;
+};
+
+#endif
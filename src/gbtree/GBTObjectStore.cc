@@ -0,0 +1,229 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  GBTObjectStore.cc
+ *
+ *    Description:  latest position per moving object
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <algorithm>
+#include "../pathmanager/PathManager.h"
+#include "GBTObjectStore.h"
+#include "Geohash.h"
+
+GBTObjectStore::GBTObjectStore()
+	: index_file(true)  // several objects may share a position
+{
+	slot_count = 0;
+	slots_per_page = 0;
+	opened = false;
+}
+
+RT GBTObjectStore::open(const std::string& table)
+{
+	RT rc;
+	char page[GBTFile::MAX_PAGE_SIZE];
+
+	if (opened)
+		return RT_FILE_OPEN_FAILED;
+
+	if ((rc = table_file.open(PathManager::GetTablePath(table), 'w')) < 0)
+		return rc;
+	if ((rc = index_file.open(PathManager::GetIndexPath(table), 'w')) < 0) {
+		table_file.close();
+		return rc;
+	}
+	if ((rc = object_file.open(PathManager::GetObjectPath(table), 'w')) < 0) {
+		table_file.close();
+		index_file.close();
+		return rc;
+	}
+	slots_per_page = object_file.pageSize() / sizeof(ObjectSlot);
+
+	objects.clear();
+	free_slots.clear();
+	slot_count = object_file.endPid() * slots_per_page;
+	for (PageId pid = 0; pid < object_file.endPid(); pid++) {
+		if ((rc = object_file.read(pid, page)) < 0) {
+			close();
+			return rc;
+		}
+		const ObjectSlot* slots = (const ObjectSlot*) page;
+		for (int i = 0; i < slots_per_page; i++) {
+			int slot = pid * slots_per_page + i;
+			if (slots[i].rid.pid < 0) {
+				free_slots.push_back(slot);
+				continue;
+			}
+			ObjectEntry entry;
+			entry.key = slots[i].key;
+			entry.rid = slots[i].rid;
+			entry.slot = slot;
+			objects[slots[i].oid] = entry;
+		}
+	}
+	// hand out the low slots first
+	std::reverse(free_slots.begin(), free_slots.end());
+
+	opened = true;
+	return 0;
+}
+
+RT GBTObjectStore::close()
+{
+	RT rc = 0, rt;
+
+	if ((rt = object_file.close()) < 0) rc = rt;
+	if ((rt = index_file.close()) < 0) rc = rt;
+	if ((rt = table_file.close()) < 0) rc = rt;
+	objects.clear();
+	free_slots.clear();
+	slot_count = 0;
+	opened = false;
+	return rc;
+}
+
+RT GBTObjectStore::writeSlot(int slot, const ObjectSlot& object)
+{
+	RT rc;
+	char page[GBTFile::MAX_PAGE_SIZE];
+	PageId pid = slot / slots_per_page;
+	ObjectSlot* slots = (ObjectSlot*) page;
+
+	if (pid < object_file.endPid()) {
+		if ((rc = object_file.read(pid, page)) < 0)
+			return rc;
+	} else {
+		memset(page, 0, object_file.pageSize());
+		for (int i = 0; i < slots_per_page; i++)
+			slots[i].rid.pid = -1;
+	}
+	slots[slot % slots_per_page] = object;
+	return object_file.write(pid, page);
+}
+
+RT GBTObjectStore::update(uint64_t oid, double longitude, double latitude, const std::string& value)
+{
+	uint64_t key = 0;
+	if (geohash_encode_64(latitude, longitude, &key) != GEOHASH_OK)
+		return RT_GEOHASH_ERROR;
+	return update(oid, key, value.data(), value.size());
+}
+
+/*
+ * the new record and index entry are added before the old ones are taken
+ * out, and every step is undone if a later one fails, so the object is
+ * never left without an entry or with two.
+ */
+RT GBTObjectStore::update(uint64_t oid, uint64_t key, const char* value, int length)
+{
+	RT rc;
+	RecordId rid;
+
+	if (!opened)
+		return RT_INVALID_FILE_MODE;
+
+	std::unordered_map<uint64_t, ObjectEntry>::iterator it = objects.find(oid);
+	bool found = (it != objects.end());
+
+	if ((rc = table_file.append(key, value, length, rid)) < 0)
+		return rc;
+	if ((rc = index_file.insert(key, rid)) < 0) {
+		table_file.remove(rid);
+		return rc;
+	}
+	if (found && (rc = index_file.remove(it->second.key, it->second.rid)) < 0) {
+		index_file.remove(key, rid);
+		table_file.remove(rid);
+		return rc;
+	}
+
+	int slot;
+	if (found)
+		slot = it->second.slot;
+	else if (!free_slots.empty())
+		slot = free_slots.back();
+	else
+		slot = slot_count;
+
+	ObjectSlot object;
+	object.oid = oid;
+	object.key = key;
+	object.rid = rid;
+	if ((rc = writeSlot(slot, object)) < 0) {
+		if (found)
+			index_file.insert(it->second.key, it->second.rid);
+		index_file.remove(key, rid);
+		table_file.remove(rid);
+		return rc;
+	}
+
+	if (found) {
+		// the previous record is dead now
+		table_file.remove(it->second.rid);
+		it->second.key = key;
+		it->second.rid = rid;
+		return 0;
+	}
+
+	if (!free_slots.empty()) {
+		free_slots.pop_back();
+	} else {
+		// the rest of the new page is free
+		slot_count += slots_per_page;
+		for (int i = slot_count - 1; i > slot; i--)
+			free_slots.push_back(i);
+	}
+
+	ObjectEntry entry;
+	entry.key = key;
+	entry.rid = rid;
+	entry.slot = slot;
+	objects[oid] = entry;
+	return 0;
+}
+
+RT GBTObjectStore::remove(uint64_t oid)
+{
+	RT rc;
+
+	if (!opened)
+		return RT_INVALID_FILE_MODE;
+
+	std::unordered_map<uint64_t, ObjectEntry>::iterator it = objects.find(oid);
+	if (it == objects.end())
+		return RT_NO_SUCH_RECORD;
+
+	ObjectSlot object;
+	object.oid = 0;
+	object.key = 0;
+	object.rid.pid = -1;
+	object.rid.sid = 0;
+	if ((rc = index_file.remove(it->second.key, it->second.rid)) < 0)
+		return rc;
+	if ((rc = writeSlot(it->second.slot, object)) < 0) {
+		index_file.insert(it->second.key, it->second.rid);
+		return rc;
+	}
+	table_file.remove(it->second.rid);
+
+	free_slots.push_back(it->second.slot);
+	objects.erase(it);
+	return 0;
+}
+
+RT GBTObjectStore::find(uint64_t oid, uint64_t& key, RecordId& rid) const
+{
+	std::unordered_map<uint64_t, ObjectEntry>::const_iterator it = objects.find(oid);
+	if (it == objects.end())
+		return RT_NO_SUCH_RECORD;
+	key = it->second.key;
+	rid = it->second.rid;
+	return 0;
+}
@@ -0,0 +1,115 @@
+/*
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+#ifndef GBTOBJECTSTORE_H_
+#define GBTOBJECTSTORE_H_
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "../base/GBTreeBase.h"
+#include "../storagemanager/GBTFile.h"
+#include "GBTTable.h"
+#include "GBTreeIndex.h"
+
+/**
+ * the current position of one object as stored in the object file
+ */
+typedef struct {
+	uint64_t oid;   // object id
+	uint64_t key;   // geohash of the current position
+	RecordId rid;   // current record in the table. pid is -1 for a free slot
+} ObjectSlot;
+
+/**
+ * a table that keeps only the latest position of every moving object.
+ * the object file maps an object id to the (key, rid) of its current
+ * record, so an update replaces the index entry of the previous position
+ * instead of adding one. the index therefore holds one entry per object
+ * and the range and nearest queries of GeoQuery only see current positions.
+ * the previous record is tombstoned in the table.
+ *
+ * the table and index files are owned by the store; do not load them
+ * with GBTEngine::load as well.
+ */
+class GBTObjectStore {
+  public:
+	GBTObjectStore();
+
+	/**
+	 * open the table, index and object files of a table, creating them if
+	 * they do not exist, and read the object map into memory.
+	 * @param table[IN] the table name
+	 * @return error code. 0 if no error
+	 */
+	RT open(const std::string& table);
+
+	/**
+	 * close the files.
+	 * @return error code. 0 if no error
+	 */
+	RT close();
+
+	/**
+	 * set the position of an object, adding the object if it is new.
+	 * the index entry of the previous position is replaced; on failure the
+	 * index, table and object file are left as they were before the call.
+	 * @param oid[IN] the object id
+	 * @param longitude[IN] the new longitude
+	 * @param latitude[IN] the new latitude
+	 * @param value[IN] the record value stored with the new position
+	 * @return error code. 0 if no error
+	 */
+	RT update(uint64_t oid, double longitude, double latitude, const std::string& value);
+
+	/**
+	 * the same as above with the geohash key already computed.
+	 */
+	RT update(uint64_t oid, uint64_t key, const char* value, int length);
+
+	/**
+	 * remove an object with its index entry and table record.
+	 * @param oid[IN] the object id
+	 * @return error code. RT_NO_SUCH_RECORD if the object is unknown
+	 */
+	RT remove(uint64_t oid);
+
+	/**
+	 * look up the current position of an object.
+	 * @param oid[IN] the object id
+	 * @param key[OUT] the geohash of the current position
+	 * @param rid[OUT] the record of the current position
+	 * @return error code. RT_NO_SUCH_RECORD if the object is unknown
+	 */
+	RT find(uint64_t oid, uint64_t& key, RecordId& rid) const;
+
+	/**
+	 * @return the number of objects in the store
+	 */
+	size_t getObjectCount() const { return objects.size(); }
+
+  private:
+	typedef struct {
+		uint64_t key;
+		RecordId rid;
+		int      slot;  // slot in the object file
+	} ObjectEntry;
+
+	/**
+	 * write one slot of the object file. a new page is filled with free slots.
+	 */
+	RT writeSlot(int slot, const ObjectSlot& object);
+
+	GBTTable    table_file;
+	GBTreeIndex index_file;
+	GBTFile     object_file;
+
+	std::unordered_map<uint64_t, ObjectEntry> objects;
+	std::vector<int> free_slots;
+	int  slot_count;  // slots in the object file, used or free
+	int  slots_per_page;  // object slots per page of the object file
+	bool opened;
+};
+
+#endif
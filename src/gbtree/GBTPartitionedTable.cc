@@ -0,0 +1,169 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  GBTPartitionedTable.cc
+ *
+ *    Description:  table partitioned by day
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include "../pathmanager/PathManager.h"
+#include "../util/Parallel.h"
+#include "GBTPartitionedTable.h"
+
+const int64_t GBTPartitionedTable::PARTITION_SECONDS;
+
+GBTPartitionedTable::GBTPartitionedTable()
+{
+	writer_partition = -1;
+}
+
+std::string GBTPartitionedTable::PartitionName(const std::string& table, int partition)
+{
+	char suffix[16];
+	snprintf(suffix, sizeof(suffix), ".%d", partition);
+	return table + suffix;
+}
+
+/*
+ * a partition is an index file named "table.n.idx" in the data directory
+ */
+RT GBTPartitionedTable::open(const std::string& table)
+{
+	std::vector<std::string> suffixes;
+	if (!PathManager::ListTables(table + ".", suffixes))
+		return RT_FILE_OPEN_FAILED;
+
+	this->table = table;
+	partitions.clear();
+	for (size_t i = 0; i < suffixes.size(); i++) {
+		if (suffixes[i].find_first_not_of("0123456789") == std::string::npos)
+			partitions.push_back(atoi(suffixes[i].c_str()));
+	}
+	std::sort(partitions.begin(), partitions.end());
+	return 0;
+}
+
+RT GBTPartitionedTable::close()
+{
+	RT rc = 0;
+	if (writer_partition >= 0)
+		rc = writer.close();
+	writer_partition = -1;
+	return rc;
+}
+
+RT GBTPartitionedTable::append(int64_t timestamp, double longitude, double latitude, const std::string& value)
+{
+	RT rc;
+
+	if (timestamp < 0)
+		return RT_INVALID_ATTRIBUTE;
+	int partition = timestamp / PARTITION_SECONDS;
+
+	// positions mostly arrive in time order, so only one partition is kept open
+	if (partition != writer_partition) {
+		if ((rc = close()) < 0)
+			return rc;
+		if ((rc = writer.open(PartitionName(table, partition), 'w')) < 0)
+			return rc;
+		writer_partition = partition;
+		std::vector<int>::iterator it = std::lower_bound(partitions.begin(), partitions.end(), partition);
+		if (it == partitions.end() || *it != partition)
+			partitions.insert(it, partition);
+	}
+	return writer.append(timestamp, longitude, latitude, value);
+}
+
+RT GBTPartitionedTable::query(uint64_t left_down, uint64_t right_up, int64_t begin, int64_t end, std::vector<PartitionRecord>& outputs)
+{
+	if (begin > end)
+		return RT_INVALID_ATTRIBUTE;
+
+	// the partitions that overlap the window
+	std::vector<int> targets;
+	for (size_t i = 0; i < partitions.size(); i++) {
+		int64_t first = partitions[i] * PARTITION_SECONDS;
+		if (first <= end && begin < first + PARTITION_SECONDS)
+			targets.push_back(partitions[i]);
+	}
+	if (targets.empty())
+		return 0;
+
+	// flush the partition being appended to before it is read
+	if (writer_partition >= 0 && std::binary_search(targets.begin(), targets.end(), writer_partition)) {
+		RT rc = close();
+		if (rc < 0)
+			return rc;
+	}
+
+	std::vector<std::vector<RecordId> > found(targets.size());
+	std::vector<RT> status(targets.size(), 0);
+	ParallelFor(targets.size(), [&](size_t i) {
+		GBTTrajectory trajectory;
+		if ((status[i] = trajectory.open(PartitionName(table, targets[i]), 'r')) < 0)
+			return;
+		status[i] = trajectory.query(left_down, right_up, begin, end, found[i]);
+		trajectory.close();
+	});
+
+	for (size_t i = 0; i < targets.size(); i++) {
+		if (status[i] < 0)
+			return status[i];
+		PartitionRecord record;
+		record.partition = targets[i];
+		for (size_t j = 0; j < found[i].size(); j++) {
+			record.rid = found[i][j];
+			outputs.push_back(record);
+		}
+	}
+	return 0;
+}
+
+RT GBTPartitionedTable::read(const PartitionRecord& record, int64_t& timestamp, uint64_t& address, std::string& value) const
+{
+	RT rc;
+	GBTTrajectory trajectory;
+
+	if ((rc = trajectory.open(PartitionName(table, record.partition), 'r')) < 0)
+		return rc;
+	rc = trajectory.read(record.rid, timestamp, address, value);
+	trajectory.close();
+	return rc;
+}
+
+RT GBTPartitionedTable::drop(int partition)
+{
+	RT rc;
+	std::vector<int>::iterator it = std::lower_bound(partitions.begin(), partitions.end(), partition);
+	if (it == partitions.end() || *it != partition)
+		return RT_NO_SUCH_RECORD;
+
+	if (partition == writer_partition && (rc = close()) < 0)
+		return rc;
+
+	std::string name = PartitionName(table, partition);
+	if (unlink(PathManager::GetIndexPath(name).c_str()) < 0)
+		return RT_FILE_CLOSE_FAILED;
+	unlink(PathManager::GetTablePath(name).c_str());
+	partitions.erase(it);
+	return 0;
+}
+
+RT GBTPartitionedTable::dropBefore(int64_t timestamp)
+{
+	RT rc;
+	while (!partitions.empty() && (partitions[0] + 1) * PARTITION_SECONDS <= timestamp) {
+		if ((rc = drop(partitions[0])) < 0)
+			return rc;
+	}
+	return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+#ifndef GBTPARTITIONEDTABLE_H_
+#define GBTPARTITIONEDTABLE_H_
+
+#include <string>
+#include <vector>
+#include "../base/GBTreeBase.h"
+#include "GBTTable.h"
+#include "GBTTrajectory.h"
+
+/**
+ * a record of a partitioned table
+ */
+typedef struct {
+	int      partition;  // the partition holding the record
+	RecordId rid;        // the record in the partition table
+} PartitionRecord;
+
+/**
+ * a table of timestamped positions split into one partition per day.
+ * partition n holds the timestamps [n * PARTITION_SECONDS,
+ * (n + 1) * PARTITION_SECONDS) in the trajectory table named
+ * "table.n", i.e. its own .tbl/.idx pair under the data directory.
+ * a query scans the partitions of its time window on parallel threads,
+ * and an expired partition is dropped by unlinking its two files.
+ */
+class GBTPartitionedTable {
+  public:
+	/* *
+	 * seconds covered by one partition
+	 * */
+	static const int64_t PARTITION_SECONDS = 86400;
+
+	GBTPartitionedTable();
+
+	/**
+	 * open a partitioned table and find its partitions.
+	 * @param table[IN] the table name
+	 * @return error code. 0 if no error
+	 */
+	RT open(const std::string& table);
+
+	/**
+	 * close the partition being appended to.
+	 * @return error code. 0 if no error
+	 */
+	RT close();
+
+	/**
+	 * append a position to the partition of its timestamp,
+	 * creating the partition if it does not exist.
+	 * @param timestamp[IN] seconds since the epoch
+	 * @param longitude[IN] the longitude
+	 * @param latitude[IN] the latitude
+	 * @param value[IN] the record value
+	 * @return error code. 0 if no error
+	 */
+	RT append(int64_t timestamp, double longitude, double latitude, const std::string& value);
+
+	/**
+	 * find the positions inside a box during a time window.
+	 * see GBTTrajectory::query.
+	 * @return error code. 0 if no error
+	 */
+	RT query(uint64_t left_down, uint64_t right_up, int64_t begin, int64_t end, std::vector<PartitionRecord>& outputs);
+
+	/**
+	 * read a record found by query().
+	 * @return error code. 0 if no error
+	 */
+	RT read(const PartitionRecord& record, int64_t& timestamp, uint64_t& address, std::string& value) const;
+
+	/**
+	 * drop a partition by unlinking its files.
+	 * @param partition[IN] the partition to drop
+	 * @return error code. RT_NO_SUCH_RECORD if there is no such partition
+	 */
+	RT drop(int partition);
+
+	/**
+	 * drop every partition that ends before a timestamp.
+	 * @param timestamp[IN] the oldest timestamp to keep
+	 * @return error code. 0 if no error
+	 */
+	RT dropBefore(int64_t timestamp);
+
+	/**
+	 * @return the partitions of the table in ascending order
+	 */
+	const std::vector<int>& getPartitions() const { return partitions; }
+
+	/**
+	 * @return the table name of a partition
+	 */
+	static std::string PartitionName(const std::string& table, int partition);
+
+  private:
+	std::string      table;
+	std::vector<int> partitions;        // sorted
+	GBTTrajectory    writer;            // the partition being appended to
+	int              writer_partition;  // -1 if none
+};
+
+#endif
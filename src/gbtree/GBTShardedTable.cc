@@ -0,0 +1,323 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  GBTShardedTable.cc
+ *
+ *    Description:  table sharded by geohash prefix
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <limits>
+#include "../pathmanager/PathManager.h"
+#include "../util/Distance.h"
+#include "../util/Parallel.h"
+#include "GBTShardedTable.h"
+#include "GBTEngine.h"
+#include "GBTLoader.h"
+#include "GBTSorter.h"
+#include "GBTreeIndex.h"
+#include "Geohash.h"
+
+static const uint64_t LATITUDE_HOLDER = UINT64_C(0x5555555555555555);
+static const uint64_t LONGITUDE_HOLDER = UINT64_C(0xaaaaaaaaaaaaaaaa);
+
+static const int SHARD_SHIFT = 64 - GBTShardedTable::SHARD_BITS;
+
+static_assert(GBTShardedTable::SHARD_BITS % 2 == 0, "a shard must be a rectangular cell");
+
+static bool recordCloser(const ShardRecord& r1, const ShardRecord& r2)
+{
+	return r1.distance < r2.distance;
+}
+
+std::string GBTShardedTable::ShardName(const std::string& table, int shard)
+{
+	char suffix[16];
+	snprintf(suffix, sizeof(suffix), ".s%d", shard);
+	return table + suffix;
+}
+
+RT GBTShardedTable::open(const std::string& table, int first, int last)
+{
+	std::vector<std::string> suffixes;
+	if (!PathManager::ListTables(table + ".s", suffixes))
+		return RT_FILE_OPEN_FAILED;
+
+	this->table = table;
+	shards.clear();
+	for (size_t i = 0; i < suffixes.size(); i++) {
+		if (suffixes[i].find_first_not_of("0123456789") != std::string::npos)
+			continue;
+		int shard = atoi(suffixes[i].c_str());
+		if (first <= shard && shard < last && shard < SHARD_COUNT)
+			shards.push_back(shard);
+	}
+	std::sort(shards.begin(), shards.end());
+	return 0;
+}
+
+bool GBTShardedTable::hasShard(int shard) const
+{
+	return std::binary_search(shards.begin(), shards.end(), shard);
+}
+
+RT GBTShardedTable::load(const std::string& loadfile, bool index, bool append)
+{
+	RT rc = 0;
+
+	GBTLoader loader;
+	if ((rc = loader.open(loadfile)) < 0)
+		return rc;
+
+	// a plain load starts from empty shards
+	if (!append) {
+		for (size_t i = 0; i < shards.size(); i++) {
+			std::string name = ShardName(table, shards[i]);
+			unlink(PathManager::GetTablePath(name).c_str());
+			unlink(PathManager::GetIndexPath(name).c_str());
+		}
+		shards.clear();
+	}
+
+	// the table file of a shard is opened when its first record shows up
+	std::vector<GBTTable*> tables(SHARD_COUNT, (GBTTable*) NULL);
+	GBTSorter sorter(GBTEngine::load_memory, PathManager::GetRunPrefix(table));
+	std::vector<LoadRecord> records;
+	RecordId rid;
+
+	while (rc == 0 && (rc = loader.nextBatch(records)) == 0) {
+		for (size_t i = 0; i < records.size() && rc == 0; i++) {
+			const LoadRecord& record = records[i];
+			if ((rc = record.status) != 0)
+				break;
+			int shard = ShardOf(record.key);
+			if (tables[shard] == NULL) {
+				tables[shard] = new GBTTable();
+				if ((rc = tables[shard]->open(PathManager::GetTablePath(ShardName(table, shard)), 'w')) < 0)
+					break;
+				tables[shard]->writeBack(GBTFile::LOAD_WRITE_BACK_PAGES);
+			}
+			if ((rc = tables[shard]->append(record.key, record.value, record.value_len, rid)) < 0)
+				break;
+			rc = sorter.add(record.key, rid);
+		}
+	}
+	if (rc == RT_END_OF_FILE)
+		rc = 0;
+	for (int i = 0; i < SHARD_COUNT; i++) {
+		if (tables[i] != NULL) {
+			tables[i]->close();
+			delete tables[i];
+		}
+	}
+	loader.close();
+
+	// the pairs come out in key order, and so one shard after the other
+	uint64_t key;
+	int current = -1;
+	bool bulk = false;
+	GBTreeIndex* index_file = NULL;
+	if (rc == 0)
+		rc = sorter.finish();
+	while (rc == 0) {
+		if ((rc = sorter.next(key, rid)) < 0)
+			break;
+		int shard = ShardOf(key);
+		if (shard != current) {
+			if (index_file != NULL) {
+				rc = bulk ? index_file->bulkLoadEnd() : index_file->mergeEnd();
+				index_file->close();
+				delete index_file;
+				index_file = NULL;
+				if (rc < 0)
+					break;
+			}
+			current = shard;
+			index_file = new GBTreeIndex(index);
+			if ((rc = index_file->open(PathManager::GetIndexPath(ShardName(table, shard)), 'w')) < 0)
+				break;
+			index_file->writeBack(GBTFile::LOAD_WRITE_BACK_PAGES);
+			bulk = (index_file->getTreeHeight() == 0);
+			if ((rc = bulk ? index_file->bulkLoadBegin() : index_file->mergeBegin()) < 0)
+				break;
+			if (!hasShard(shard))
+				shards.insert(std::lower_bound(shards.begin(), shards.end(), shard), shard);
+		}
+		rc = bulk ? index_file->bulkLoadAppend(key, rid) : index_file->mergeAppend(key, rid);
+	}
+	if (rc == RT_END_OF_FILE) {
+		rc = 0;
+		if (index_file != NULL)
+			rc = bulk ? index_file->bulkLoadEnd() : index_file->mergeEnd();
+	}
+	if (index_file != NULL) {
+		index_file->close();
+		delete index_file;
+	}
+	sorter.close();
+	return rc;
+}
+
+RT GBTShardedTable::findPoint(uint64_t address, ShardRecord& output) const
+{
+	int shard = ShardOf(address);
+	if (!hasShard(shard))
+		return GEOQUERY_NOT_FOUND;
+	output.shard = shard;
+	output.distance = 0.0;
+	return GeoQuery::FindPoint(ShardName(table, shard).c_str(), address, output.rid);
+}
+
+/*
+ * the keys of a shard share the prefix, so the lowest key of the shard is
+ * its left-down corner and the highest its right-up corner.
+ */
+bool GBTShardedTable::ShardOverlaps(int shard, uint64_t left_down, uint64_t right_up)
+{
+	uint64_t low = (uint64_t)shard << SHARD_SHIFT;
+	uint64_t high = low | ((UINT64_C(1) << SHARD_SHIFT) - 1);
+
+	return (low & LONGITUDE_HOLDER) <= (right_up & LONGITUDE_HOLDER)
+		&& (high & LONGITUDE_HOLDER) >= (left_down & LONGITUDE_HOLDER)
+		&& (low & LATITUDE_HOLDER) <= (right_up & LATITUDE_HOLDER)
+		&& (high & LATITUDE_HOLDER) >= (left_down & LATITUDE_HOLDER);
+}
+
+RT GBTShardedTable::rangeQuery(uint64_t left_down, uint64_t right_up, std::vector<ShardRecord>& outputs) const
+{
+	std::vector<int> targets;
+	for (size_t i = 0; i < shards.size(); i++) {
+		if (ShardOverlaps(shards[i], left_down, right_up))
+			targets.push_back(shards[i]);
+	}
+
+	std::vector<std::vector<RecordId> > found(targets.size());
+	std::vector<RT> status(targets.size(), 0);
+	ParallelFor(targets.size(), [&](size_t i) {
+		status[i] = GeoQuery::RangeQuery(ShardName(table, targets[i]).c_str(), left_down, right_up, found[i]);
+	});
+
+	for (size_t i = 0; i < targets.size(); i++) {
+		if (status[i] != GEOQUERY_OK)
+			return status[i];
+		ShardRecord record;
+		record.shard = targets[i];
+		record.distance = 0.0;
+		for (size_t j = 0; j < found[i].size(); j++) {
+			record.rid = found[i][j];
+			outputs.push_back(record);
+		}
+	}
+	return 0;
+}
+
+/*
+ * a shard is a cell of (2^(SHARD_BITS/2))^2 in latitude and longitude.
+ * the latitude bits of the prefix are the even ones, as in the geohash.
+ */
+double GBTShardedTable::ShardDistance(int shard, double latitude, double longitude)
+{
+	int cells = 1 << (SHARD_BITS / 2);
+	int lat_index = 0, lng_index = 0;
+	for (int i = SHARD_BITS / 2 - 1; i >= 0; i--) {
+		lat_index = (lat_index << 1) | ((shard >> (2 * i)) & 1);
+		lng_index = (lng_index << 1) | ((shard >> (2 * i + 1)) & 1);
+	}
+	double lat_low = -90.0 + 180.0 * lat_index / cells;
+	double lat_high = lat_low + 180.0 / cells;
+	double lng_low = -180.0 + 360.0 * lng_index / cells;
+	double lng_high = lng_low + 360.0 / cells;
+
+	double lat = std::min(std::max(latitude, lat_low), lat_high);
+	double distance = std::numeric_limits<double>::max();
+	// the cell may be closer across the antimeridian
+	for (int wrap = -1; wrap <= 1; wrap++) {
+		double lng = std::min(std::max(longitude + 360.0 * wrap, lng_low), lng_high);
+		distance = std::min(distance, LatLon2Dist(latitude, longitude + 360.0 * wrap, lat, lng));
+	}
+	return distance;
+}
+
+RT GBTShardedTable::nearest(uint64_t address, std::vector<ShardRecord>& outputs, size_t count,
+		double min_distance, double max_distance, double bound) const
+{
+	RT rt;
+	double latitude, longitude;
+
+	if ((rt = geohash_decode_64(address, &latitude, &longitude)) != GEOHASH_OK)
+		return rt;
+
+	auto search = [&](int shard, std::vector<ShardRecord>& answers) -> RT {
+		// the bound also limits the rings Nearest searches
+		double limit = max_distance;
+		if (bound < std::numeric_limits<double>::max() && bound > min_distance)
+			limit = (max_distance > 0) ? std::min(max_distance, bound) : bound;
+		std::vector<NearestResult> found;
+		RT rc = GeoQuery::Nearest(ShardName(table, shard).c_str(), address, found, count, min_distance, limit);
+		// a bound below the precision of the finest ring leaves none to search
+		if (rc == GEOQUERY_INTERNAL_ERROR && limit != max_distance)
+			rc = GeoQuery::Nearest(ShardName(table, shard).c_str(), address, found, count, min_distance, max_distance);
+		ShardRecord record;
+		record.shard = shard;
+		for (size_t i = 0; i < found.size(); i++) {
+			if (found[i].distance > bound)
+				continue;
+			record.rid = found[i].rid;
+			record.distance = found[i].distance;
+			answers.push_back(record);
+		}
+		return rc;
+	};
+
+	// the shard of the point gives the first bound
+	std::vector<ShardRecord> answers;
+	int home = ShardOf(address);
+	if (hasShard(home) && (rt = search(home, answers)) != GEOQUERY_OK)
+		return rt;
+	std::sort(answers.begin(), answers.end(), recordCloser);
+	if (answers.size() >= count && count > 0)
+		bound = std::min(bound, answers[count - 1].distance);
+
+	std::vector<int> targets;
+	for (size_t i = 0; i < shards.size(); i++) {
+		if (shards[i] != home && ShardDistance(shards[i], latitude, longitude) <= bound)
+			targets.push_back(shards[i]);
+	}
+
+	std::vector<std::vector<ShardRecord> > found(targets.size());
+	std::vector<RT> status(targets.size(), 0);
+	ParallelFor(targets.size(), [&](size_t i) {
+		status[i] = search(targets[i], found[i]);
+	});
+	for (size_t i = 0; i < targets.size(); i++) {
+		if (status[i] != GEOQUERY_OK)
+			return status[i];
+		answers.insert(answers.end(), found[i].begin(), found[i].end());
+	}
+
+	std::stable_sort(answers.begin(), answers.end(), recordCloser);
+	if (answers.size() > count)
+		answers.resize(count);
+	outputs.insert(outputs.end(), answers.begin(), answers.end());
+	return 0;
+}
+
+RT GBTShardedTable::read(const ShardRecord& record, uint64_t& key, std::string& value) const
+{
+	RT rc;
+	GBTTable table_file;
+
+	if ((rc = table_file.open(PathManager::GetTablePath(ShardName(table, record.shard)), 'r')) < 0)
+		return rc;
+	rc = table_file.read(record.rid, key, value);
+	table_file.close();
+	return rc;
+}
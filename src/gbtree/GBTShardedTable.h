@@ -0,0 +1,130 @@
+/*
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+#ifndef GBTSHARDEDTABLE_H_
+#define GBTSHARDEDTABLE_H_
+
+#include <limits>
+#include <string>
+#include <vector>
+#include "../base/GBTreeBase.h"
+#include "GBTTable.h"
+#include "GeoQuery.h"
+
+/**
+ * a record of a sharded table
+ */
+typedef struct {
+	int      shard;     // the shard holding the record
+	RecordId rid;       // the record in the shard table
+	double   distance;  // distance to the query point, nearest() only
+} ShardRecord;
+
+/**
+ * a table split by the top SHARD_BITS bits of the geohash.
+ * shard s holds the keys with prefix s in the plain table named
+ * "table.s<s>", with its own .tbl/.idx pair, so every shard covers one
+ * cell of a 16 x 16 grid. the router sends a query only to the
+ * shards whose cell it touches and queries several shards in parallel.
+ */
+class GBTShardedTable {
+  public:
+	/* *
+	 * bits of the geohash prefix that selects the shard.
+	 * it must be even so that a shard is a rectangular cell.
+	 * */
+	static const int SHARD_BITS = 8;
+	static const int SHARD_COUNT = 1 << SHARD_BITS;
+
+	/**
+	 * find the shards of a table.
+	 * a shard server opens only the shards it serves.
+	 * @param table[IN] the table name
+	 * @param first[IN] the first shard to open
+	 * @param last[IN] one past the last shard to open
+	 * @return error code. 0 if no error
+	 */
+	RT open(const std::string& table, int first = 0, int last = SHARD_COUNT);
+
+	/**
+	 * load a load file into the shards, as GBTEngine::load does for one table.
+	 * the (key, rid) pairs of all shards are sorted together, which puts
+	 * them in shard order, and the index of each shard is built in turn.
+	 * @param loadfile[IN] the file name of the load file
+	 * @param index[IN] true for an index with duplicate keys
+	 * @param append[IN] false to replace the shards, true to add to them
+	 * @return error code. 0 if no error
+	 */
+	RT load(const std::string& loadfile, bool index, bool append = false);
+
+	/**
+	 * find a point in its shard. see GeoQuery::FindPoint.
+	 * @return error code. GEOQUERY_NOT_FOUND if the shard does not exist
+	 */
+	RT findPoint(uint64_t address, ShardRecord& output) const;
+
+	/**
+	 * range query on the shards whose cell overlaps the box.
+	 * see GeoQuery::RangeQuery.
+	 * @return error code. 0 if no error
+	 */
+	RT rangeQuery(uint64_t left_down, uint64_t right_up, std::vector<ShardRecord>& outputs) const;
+
+	/**
+	 * nearest query. the shard of the point is searched first; then every
+	 * shard whose cell is closer than the count-th answer so far is searched
+	 * in parallel and the answers are merged by distance.
+	 * see GeoQuery::Nearest.
+	 * @param bound[IN] answers farther than bound are not wanted, e.g. because
+	 *                  the caller already has count closer ones elsewhere
+	 * @return error code. 0 if no error
+	 */
+	RT nearest(uint64_t address, std::vector<ShardRecord>& outputs, size_t count = 50,
+			double min_distance = 0.0, double max_distance = 0.0,
+			double bound = std::numeric_limits<double>::max()) const;
+
+	/**
+	 * read a record found by a query.
+	 * @return error code. 0 if no error
+	 */
+	RT read(const ShardRecord& record, uint64_t& key, std::string& value) const;
+
+	/**
+	 * @return the shards of the table in ascending order
+	 */
+	const std::vector<int>& getShards() const { return shards; }
+
+	/**
+	 * @return the shard of a key
+	 */
+	static int ShardOf(uint64_t key) { return (int)(key >> (64 - SHARD_BITS)); }
+
+	/**
+	 * @return the table name of a shard
+	 */
+	static std::string ShardName(const std::string& table, int shard);
+
+	/**
+	 * the smallest distance between a point and the cell of a shard,
+	 * in the unit of LatLon2Dist.
+	 */
+	static double ShardDistance(int shard, double latitude, double longitude);
+
+	/**
+	 * @return true if the cell of the shard overlaps the box
+	 */
+	static bool ShardOverlaps(int shard, uint64_t left_down, uint64_t right_up);
+
+  private:
+
+	/**
+	 * @return true if the table has the shard
+	 */
+	bool hasShard(int shard) const;
+
+	std::string      table;
+	std::vector<int> shards;  // sorted
+};
+
+#endif
@@ -0,0 +1,341 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  GBTSorter.cc
+ *
+ *    Description:  external merge sort of (key, rid) pairs
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <algorithm>
+#include "GBTSorter.h"
+
+const size_t GBTSorter::RUN_IO_SIZE;
+const size_t GBTSorter::MIN_RUN_BUFFER;
+
+static inline bool entryLess(const SortEntry& e1, const SortEntry& e2)
+{
+	if (e1.key != e2.key)
+		return e1.key < e2.key;
+	return e1.rid < e2.rid;
+}
+
+GBTSorter::GBTSorter(size_t memory_budget, const std::string& run_prefix)
+{
+	prefix = run_prefix;
+	// the merge needs a write buffer and at least two run buffers
+	budget = std::max(memory_budget, RUN_IO_SIZE + 2 * MIN_RUN_BUFFER);
+	run_count = 0;
+	buffer_pos = 0;
+	in_memory = false;
+}
+
+GBTSorter::~GBTSorter()
+{
+	close();
+}
+
+std::string GBTSorter::runPath(int run) const
+{
+	char suffix[16];
+	snprintf(suffix, sizeof(suffix), "%d", run);
+	return prefix + suffix;
+}
+
+RT GBTSorter::add(uint64_t key, const RecordId& rid)
+{
+	RT rc;
+	size_t limit = budget / sizeof(SortEntry);
+
+	if (buffer.size() == limit) {
+		if ((rc = spill()) < 0)
+			return rc;
+	}
+	// grow by hand so the buffer never holds more than the budget
+	if (buffer.size() == buffer.capacity())
+		buffer.reserve(std::min(std::max(2 * buffer.capacity(), (size_t)1024), limit));
+
+	SortEntry entry;
+	entry.key = key;
+	entry.rid = rid;
+	buffer.push_back(entry);
+	return 0;
+}
+
+RT GBTSorter::writeRun(const SortEntry* entries, size_t n, int fd)
+{
+	const char* ptr = (const char*) entries;
+	size_t left = n * sizeof(SortEntry);
+
+	while (left > 0) {
+		ssize_t written = ::write(fd, ptr, std::min(left, RUN_IO_SIZE));
+		if (written < 0)
+			return RT_FILE_WRITE_FAILED;
+		ptr += written;
+		left -= written;
+	}
+	return 0;
+}
+
+RT GBTSorter::spill()
+{
+	RT rc;
+	int run = run_count;
+
+	std::sort(buffer.begin(), buffer.end(), entryLess);
+
+	int fd = ::open(runPath(run).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return RT_FILE_OPEN_FAILED;
+	rc = writeRun(&buffer[0], buffer.size(), fd);
+	::close(fd);
+	if (rc < 0)
+		return rc;
+
+	run_count++;
+	runs.push_back(run);
+	buffer.clear();
+	return 0;
+}
+
+RT GBTSorter::openRun(int run, RunReader& reader, size_t buffer_bytes)
+{
+	reader.fd = ::open(runPath(run).c_str(), O_RDONLY);
+	if (reader.fd < 0)
+		return RT_FILE_OPEN_FAILED;
+	reader.capacity = std::max(buffer_bytes / sizeof(SortEntry), (size_t)1);
+	reader.buffer = new SortEntry[reader.capacity];
+	reader.size = 0;
+	reader.pos = 0;
+	::posix_fadvise(reader.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	return fillRun(reader);
+}
+
+RT GBTSorter::fillRun(RunReader& reader)
+{
+	char* ptr = (char*) reader.buffer;
+	size_t want = reader.capacity * sizeof(SortEntry);
+	size_t got = 0;
+
+	while (got < want) {
+		ssize_t n = ::read(reader.fd, ptr + got, want - got);
+		if (n < 0)
+			return RT_FILE_READ_FAILED;
+		if (n == 0)
+			break;
+		got += n;
+	}
+	if (got % sizeof(SortEntry) != 0)
+		return RT_INVALID_FILE_FORMAT;
+	reader.size = got / sizeof(SortEntry);
+	reader.pos = 0;
+	return 0;
+}
+
+void GBTSorter::closeRun(RunReader& reader)
+{
+	if (reader.fd >= 0)
+		::close(reader.fd);
+	delete[] reader.buffer;
+	reader.fd = -1;
+	reader.buffer = NULL;
+}
+
+/*
+ * a reader whose buffer is empty is exhausted and loses against every other reader
+ */
+bool GBTSorter::readerLess(int a, int b) const
+{
+	const RunReader& ra = readers[a];
+	const RunReader& rb = readers[b];
+	if (ra.pos == ra.size)
+		return false;
+	if (rb.pos == rb.size)
+		return true;
+	return entryLess(ra.buffer[ra.pos], rb.buffer[rb.pos]);
+}
+
+/*
+ * leaves are k..2k-1 of an implicit binary tree, leaf i at k+i.
+ * play every match bottom up, keep the loser in the node and pass the winner on.
+ */
+void GBTSorter::buildTree()
+{
+	int k = readers.size();
+	std::vector<int> winner(2 * k);
+
+	tree.assign(k, 0);
+	for (int i = 0; i < k; i++)
+		winner[k + i] = i;
+	for (int n = k - 1; n > 0; n--) {
+		int a = winner[2 * n];
+		int b = winner[2 * n + 1];
+		if (readerLess(b, a))
+			std::swap(a, b);
+		winner[n] = a;
+		tree[n] = b;
+	}
+	tree[0] = (k == 1) ? 0 : winner[1];
+}
+
+/*
+ * the current entry of leaf changed: replay its matches up to the root
+ */
+void GBTSorter::replay(int leaf)
+{
+	int k = readers.size();
+	int winner = leaf;
+
+	for (int n = (leaf + k) / 2; n > 0; n /= 2) {
+		if (readerLess(tree[n], winner))
+			std::swap(tree[n], winner);
+	}
+	tree[0] = winner;
+}
+
+RT GBTSorter::mergeRuns(int first, int last)
+{
+	RT rc = 0;
+	int n = last - first;
+	int run = run_count;
+	size_t per_run = (budget - RUN_IO_SIZE) / n;
+
+	readers.assign(n, RunReader());
+	for (int i = 0; i < n; i++) {
+		readers[i].fd = -1;
+		readers[i].buffer = NULL;
+	}
+	for (int i = 0; i < n && rc == 0; i++)
+		rc = openRun(runs[first + i], readers[i], per_run);
+
+	int fd = -1;
+	if (rc == 0) {
+		fd = ::open(runPath(run).c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		if (fd < 0)
+			rc = RT_FILE_OPEN_FAILED;
+	}
+
+	if (rc == 0) {
+		size_t out_capacity = RUN_IO_SIZE / sizeof(SortEntry);
+		std::vector<SortEntry> out;
+		out.reserve(out_capacity);
+
+		buildTree();
+		while (rc == 0) {
+			RunReader& reader = readers[tree[0]];
+			if (reader.pos == reader.size)
+				break;  // the winner is exhausted, so all are
+			out.push_back(reader.buffer[reader.pos++]);
+			if (out.size() == out_capacity) {
+				rc = writeRun(&out[0], out.size(), fd);
+				out.clear();
+			}
+			if (reader.pos == reader.size && rc == 0)
+				rc = fillRun(reader);
+			replay(tree[0]);
+		}
+		if (rc == 0 && !out.empty())
+			rc = writeRun(&out[0], out.size(), fd);
+	}
+
+	for (int i = 0; i < n; i++)
+		closeRun(readers[i]);
+	readers.clear();
+	if (fd >= 0)
+		::close(fd);
+	if (rc < 0)
+		return rc;
+
+	// the merged runs are no longer needed
+	for (int i = first; i < last; i++)
+		::unlink(runPath(runs[i]).c_str());
+	runs.erase(runs.begin() + first, runs.begin() + last);
+	run_count++;
+	runs.push_back(run);
+	return 0;
+}
+
+RT GBTSorter::finish()
+{
+	RT rc;
+
+	if (runs.empty()) {
+		// everything fits in memory: no run file is written
+		std::sort(buffer.begin(), buffer.end(), entryLess);
+		in_memory = true;
+		buffer_pos = 0;
+		return 0;
+	}
+
+	if (!buffer.empty() && (rc = spill()) < 0)
+		return rc;
+	std::vector<SortEntry>().swap(buffer);
+
+	// merge groups of runs until every remaining run gets a large enough read buffer
+	size_t fan_in = std::max((budget - RUN_IO_SIZE) / MIN_RUN_BUFFER, (size_t)2);
+	while (runs.size() > fan_in) {
+		if ((rc = mergeRuns(0, fan_in)) < 0)
+			return rc;
+	}
+
+	int k = runs.size();
+	size_t per_run = budget / k;
+	readers.assign(k, RunReader());
+	for (int i = 0; i < k; i++) {
+		readers[i].fd = -1;
+		readers[i].buffer = NULL;
+	}
+	for (int i = 0; i < k; i++) {
+		if ((rc = openRun(runs[i], readers[i], per_run)) < 0)
+			return rc;
+	}
+	buildTree();
+	return 0;
+}
+
+RT GBTSorter::next(uint64_t& key, RecordId& rid)
+{
+	RT rc;
+
+	if (in_memory) {
+		if (buffer_pos == buffer.size())
+			return RT_END_OF_FILE;
+		key = buffer[buffer_pos].key;
+		rid = buffer[buffer_pos].rid;
+		buffer_pos++;
+		return 0;
+	}
+
+	if (readers.empty())
+		return RT_END_OF_FILE;
+	RunReader& reader = readers[tree[0]];
+	if (reader.pos == reader.size)
+		return RT_END_OF_FILE;
+	key = reader.buffer[reader.pos].key;
+	rid = reader.buffer[reader.pos].rid;
+	reader.pos++;
+	if (reader.pos == reader.size && (rc = fillRun(reader)) < 0)
+		return rc;
+	replay(tree[0]);
+	return 0;
+}
+
+void GBTSorter::close()
+{
+	for (size_t i = 0; i < readers.size(); i++)
+		closeRun(readers[i]);
+	readers.clear();
+	for (size_t i = 0; i < runs.size(); i++)
+		::unlink(runPath(runs[i]).c_str());
+	runs.clear();
+	std::vector<SortEntry>().swap(buffer);
+	in_memory = false;
+}
@@ -0,0 +1,122 @@
+/*
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+#ifndef GBTSORTER_H_
+#define GBTSORTER_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "../base/GBTreeBase.h"
+#include "GBTTable.h"
+
+/**
+ * one (key, rid) pair to sort
+ */
+typedef struct {
+	uint64_t key;
+	RecordId rid;
+} SortEntry;
+
+/**
+ * external merge sort of (key, rid) pairs in (key, rid) order.
+ * pairs are collected in a buffer bounded by the memory budget; a full
+ * buffer is sorted and spilled to a run file with large sequential writes.
+ * finish() merges the runs with a loser tree and next() streams the result.
+ * if nothing was spilled the buffer is sorted in memory and no file is written.
+ */
+class GBTSorter {
+  public:
+	/* *
+	 * size of one sequential write to a run file
+	 * */
+	static const size_t RUN_IO_SIZE = 1 << 20;
+
+	/* *
+	 * smallest read buffer per run during the merge. when the budget cannot give
+	 * every run this much, groups of runs are merged into longer runs first.
+	 * */
+	static const size_t MIN_RUN_BUFFER = 64 << 10;
+
+	/**
+	 * @param memory_budget[IN] bytes the sorter may use for its buffers
+	 * @param run_prefix[IN] run files are named run_prefix followed by a number
+	 */
+	GBTSorter(size_t memory_budget, const std::string& run_prefix);
+	~GBTSorter();
+
+	/**
+	 * add a pair. may spill a sorted run to disk.
+	 * @return error code. 0 if no error
+	 */
+	RT add(uint64_t key, const RecordId& rid);
+
+	/**
+	 * stop adding and prepare the merge.
+	 * @return error code. 0 if no error
+	 */
+	RT finish();
+
+	/**
+	 * read the next pair in (key, rid) order.
+	 * @return 0 if a pair was read, RT_END_OF_FILE when all pairs were read
+	 */
+	RT next(uint64_t& key, RecordId& rid);
+
+	/**
+	 * release the buffers and delete the run files.
+	 */
+	void close();
+
+	/**
+	 * @return the number of runs written to disk
+	 */
+	int getRunCount() const { return run_count; }
+
+  private:
+	/**
+	 * a run file read sequentially through a buffer
+	 */
+	struct RunReader {
+		int fd;
+		SortEntry* buffer;
+		size_t capacity;  // entries in buffer
+		size_t size;      // entries read into buffer
+		size_t pos;       // next entry in buffer
+	};
+
+	RT spill();
+	RT writeRun(const SortEntry* entries, size_t n, int fd);
+	RT openRun(int run, RunReader& reader, size_t buffer_bytes);
+	RT fillRun(RunReader& reader);
+	void closeRun(RunReader& reader);
+
+	/**
+	 * merge the runs [first, last) into a new run.
+	 */
+	RT mergeRuns(int first, int last);
+
+	/**
+	 * loser tree over the open run readers.
+	 */
+	void buildTree();
+	void replay(int leaf);
+	bool readerLess(int a, int b) const;
+
+	std::string runPath(int run) const;
+
+	std::string prefix;
+	size_t budget;
+	int run_count;     // runs ever created; used to name new runs
+	std::vector<int> runs;  // runs that still have to be merged
+
+	std::vector<SortEntry> buffer;  // unsorted pairs not spilled yet
+	size_t buffer_pos;              // next pair of buffer to return when nothing was spilled
+	bool in_memory;                 // finish() kept everything in buffer
+
+	std::vector<RunReader> readers;  // merge inputs
+	std::vector<int> tree;           // tree[0] is the winner, tree[1..k-1] hold losers
+};
+
+#endif
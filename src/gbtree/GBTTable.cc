@@ -31,7 +31,7 @@ static char* slotPtr(char* page, int n);
 static void readSlot(const char* page, int n, uint64_t& key, std::string& value);
 
 // write the record to the n'th slot in the page
-static void writeSlot(char* page, int n, uint64_t key, const std::string& value);
+static void writeSlot(char* page, int n, uint64_t key, const char* value, int length);
 
 // get # records stored in the page
 static int getRecordCount(const char* page);
@@ -39,36 +39,23 @@ static int getRecordCount(const char* page);
 // update # records stored in the page
 static void setRecordCount(char* page, int count);
 
+// test and set the tombstone of the n'th slot in the page
+static bool isTombstone(const char* page, int pageSize, int n);
+static void setTombstone(char* page, int pageSize, int n);
 
-//
-// helper functions for RecordId manipulation
-//
-
-// postfix record id iterator
-RecordId operator++ (RecordId& rid, int)
+// the tombstone bitmap lives in the unused bytes behind the last slot
+static constexpr bool bitmapFits(int pageSize)
 {
-  RecordId prid(rid);
-
-  // if the end of a page is reached, move to the next page
-  if (++rid.sid >= GBTTable::RECORDS_PER_PAGE) {
-    rid.pid++;
-    rid.sid = 0;
-  }
-
-  return prid;
+  return sizeof(int) + (sizeof(uint64_t) + GBTTable::MAX_VALUE_LENGTH) * GBTTable::recordsPerPage(pageSize)
+    + GBTTable::tombstoneBytes(pageSize) <= (size_t) pageSize;
 }
+static_assert(bitmapFits(4096) && bitmapFits(8192) && bitmapFits(16384) && bitmapFits(32768) &&
+    bitmapFits(65536), "no room for the tombstone bitmap");
 
-// prefix record id iterator
-RecordId& operator++ (RecordId& rid)
-{
-  // if the end of a page is reached, move to the next page
-  if (++rid.sid >= GBTTable::RECORDS_PER_PAGE) {
-    rid.pid++;
-    rid.sid = 0;
-  } 
 
-  return rid;
-}
+//
+// helper functions for RecordId manipulation
+//
 
 // RecordId comparators
 bool operator < (const RecordId& r1, const RecordId& r2)
@@ -114,20 +101,23 @@ GBTTable::GBTTable()
 {
   erid.pid = 0;
   erid.sid = 0;
+  records_per_page = recordsPerPage(GBTFile::PAGE_SIZE);
 }
 
 GBTTable::GBTTable(const string& filename, char mode)
 {
+  records_per_page = recordsPerPage(GBTFile::PAGE_SIZE);
   open(filename, mode);
 }
 
-RT GBTTable::open(const string& filename, char mode)
+RT GBTTable::open(const string& filename, char mode, int pageSize)
 {
   RT   rc;
-  char page[GBTFile::PAGE_SIZE];
+  char page[GBTFile::MAX_PAGE_SIZE];
 
   // open the page file
-  if ((rc = pf.open(filename, mode)) < 0) return rc;
+  if ((rc = pf.open(filename, mode, pageSize)) < 0) return rc;
+  records_per_page = recordsPerPage(pf.pageSize());
   
   //
   // in the rest of this function, we set the end record id
@@ -155,7 +145,7 @@ RT GBTTable::open(const string& filename, char mode)
 
   // get # records in the last page
   erid.sid = getRecordCount(page);
-  if (erid.sid >= RECORDS_PER_PAGE) {
+  if (erid.sid >= records_per_page) {
     // the last page is full. advance the end record id to the next page.
     erid.pid++;
     erid.sid = 0;
@@ -172,29 +162,71 @@ RT GBTTable::close()
   return pf.close();
 }
 
+RT GBTTable::writeBack(size_t pages)
+{
+  return pf.writeBack(pages);
+}
+
 RT GBTTable::read(const RecordId& rid, uint64_t& key, string& value) const
 {
   RT   rc;
-  char page[GBTFile::PAGE_SIZE];
+  char page[GBTFile::MAX_PAGE_SIZE];
   
   // check whether the rid is in the valid range
   if (rid.pid < 0 || rid.pid > erid.pid) return RT_INVALID_RID;
-  if (rid.sid < 0 || rid.sid >= GBTTable::RECORDS_PER_PAGE) return RT_INVALID_RID;
+  if (rid.sid < 0 || rid.sid >= records_per_page) return RT_INVALID_RID;
   if (rid >= erid) return RT_INVALID_RID;
   
   // read the page containing the record
   if ((rc = pf.read(rid.pid, page)) < 0) return rc;
 
+  // a removed record cannot be read
+  if (isTombstone(page, pf.pageSize(), rid.sid)) return RT_RECORD_DELETED;
+
   // read the record from the slot in the page
   readSlot(page, rid.sid, key, value);
 
   return 0;
 }
 
+RT GBTTable::remove(const RecordId& rid)
+{
+  RT   rc;
+  char page[GBTFile::MAX_PAGE_SIZE];
+
+  // check whether the rid is in the valid range
+  if (rid.pid < 0 || rid.sid < 0 || rid.sid >= records_per_page) return RT_INVALID_RID;
+  if (rid >= erid) return RT_INVALID_RID;
+
+  if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+  if (isTombstone(page, pf.pageSize(), rid.sid)) return RT_RECORD_DELETED;
+
+  setTombstone(page, pf.pageSize(), rid.sid);
+  return pf.write(rid.pid, page);
+}
+
+RT GBTTable::isDeleted(const RecordId& rid, bool& deleted) const
+{
+  RT   rc;
+  char page[GBTFile::MAX_PAGE_SIZE];
+
+  if (rid.pid < 0 || rid.sid < 0 || rid.sid >= records_per_page) return RT_INVALID_RID;
+  if (rid >= erid) return RT_INVALID_RID;
+
+  if ((rc = pf.read(rid.pid, page)) < 0) return rc;
+  deleted = isTombstone(page, pf.pageSize(), rid.sid);
+  return 0;
+}
+
 RT GBTTable::append(uint64_t key, const std::string& value, RecordId& rid)
+{
+  return append(key, value.c_str(), (int)value.size(), rid);
+}
+
+RT GBTTable::append(uint64_t key, const char* value, int length, RecordId& rid)
 {
   RT   rc;
-  char page[GBTFile::PAGE_SIZE];
+  char page[GBTFile::MAX_PAGE_SIZE];
 
   // unless we are writing to the the first slot of an empty page,
   // we have to read the page first
@@ -203,11 +235,11 @@ RT GBTTable::append(uint64_t key, const std::string& value, RecordId& rid)
   } else {
     // if this is the first slot of an empty page
     // we can simply initialize the page with zeros
-    memset(page, 0, GBTFile::PAGE_SIZE);
+    memset(page, 0, pf.pageSize());
   }
     
   // write the record to the first empty slot 
-  writeSlot(page, erid.sid, key, value);
+  writeSlot(page, erid.sid, key, value, length);
 
   // the first four bytes in the page stores # records in the page.
   // update this number.
@@ -219,8 +251,12 @@ RT GBTTable::append(uint64_t key, const std::string& value, RecordId& rid)
   // we need to output the rid of the record slot
   rid = erid;
 
-  // advance the end record id by one to the next empty slot
-  ++erid;
+  // advance the end record id by one to the next empty slot.
+  // if the end of a page is reached, move to the next page
+  if (++erid.sid >= records_per_page) {
+    erid.pid++;
+    erid.sid = 0;
+  }
 
   return 0;
 }
@@ -245,6 +281,18 @@ static void setRecordCount(char* page, int count)
   memcpy(page, &count, sizeof(int));
 }
 
+static bool isTombstone(const char* page, int pageSize, int n)
+{
+  const char* bitmap = page + pageSize - GBTTable::tombstoneBytes(pageSize);
+  return (bitmap[n / 8] >> (n % 8)) & 1;
+}
+
+static void setTombstone(char* page, int pageSize, int n)
+{
+  char* bitmap = page + pageSize - GBTTable::tombstoneBytes(pageSize);
+  bitmap[n / 8] |= (1 << (n % 8));
+}
+
 static char* slotPtr(char* page, int n) 
 {
   // compute the location of the n'th slot in a page.
@@ -266,7 +314,7 @@ static void readSlot(const char* page, int n, uint64_t& key, std::string& value)
   value.assign(ptr + sizeof(uint64_t));
 }
 
-static void writeSlot(char* page, int n, uint64_t key, const std::string& value)
+static void writeSlot(char* page, int n, uint64_t key, const char* value, int length)
 {
   // compute the location of the record
   char *ptr = slotPtr(page, n);
@@ -275,11 +323,8 @@ static void writeSlot(char* page, int n, uint64_t key, const std::string& value)
   memcpy(ptr, &key, sizeof(uint64_t));
 
   // store the value. 
-  if ((int)value.size() >= GBTTable::MAX_VALUE_LENGTH) {
-    // when the string is longer than MAX_VALUE_LENGTH, truncate it.
-    memcpy(ptr + sizeof(uint64_t), value.c_str(), GBTTable::MAX_VALUE_LENGTH -1);
-    *(ptr + sizeof(uint64_t) + GBTTable::MAX_VALUE_LENGTH - 1) = 0;
-  } else {
-    strcpy(ptr + sizeof(uint64_t), value.c_str());
-  }
+  // when the string is longer than MAX_VALUE_LENGTH, truncate it.
+  if (length >= GBTTable::MAX_VALUE_LENGTH) length = GBTTable::MAX_VALUE_LENGTH - 1;
+  memcpy(ptr + sizeof(uint64_t), value, length);
+  *(ptr + sizeof(uint64_t) + length) = 0;
 }
@@ -27,10 +27,6 @@ typedef struct {
 // helper functions for RecordId
 // 
 
-// RecordId iterators
-RecordId& operator++ (RecordId& rid);
-RecordId  operator++ (RecordId& rid, int);
-
 // RecordId comparators
 bool operator> (const RecordId& r1, const RecordId& r2);
 bool operator< (const RecordId& r1, const RecordId& r2);
@@ -48,10 +44,24 @@ class GBTTable {
   // maximum length of the value field
   static const int MAX_VALUE_LENGTH = 100;  
 
-  // number of record slots per page
-  static const int RECORDS_PER_PAGE = (GBTFile::PAGE_SIZE - sizeof(int))/ (sizeof(uint64_t) + MAX_VALUE_LENGTH);  
-    // Note that we subtract sizeof(int) from PAGE_SIZE because the first
+  // number of record slots in a page of pageSize bytes
+  static constexpr int recordsPerPage(int pageSize)
+  {
+    return (pageSize - sizeof(int)) / (sizeof(uint64_t) + MAX_VALUE_LENGTH);
+    // Note that we subtract sizeof(int) from the page size because the first
     // four bytes in the page is used to store # records in the page.
+  }
+
+  // bytes of the tombstone bitmap at the end of every page.
+  // bit n is set when slot n was removed.
+  static constexpr int tombstoneBytes(int pageSize)
+  {
+    return (recordsPerPage(pageSize) + 7) / 8;
+  }
+
+  // row numbers step by the slots of the largest page, so that they do
+  // not depend on the page size of the table
+  static const int ROW_STRIDE = (GBTFile::MAX_PAGE_SIZE - sizeof(int)) / (sizeof(uint64_t) + MAX_VALUE_LENGTH);
 
   GBTTable();
   GBTTable(const std::string& filename, char mode);
@@ -61,9 +71,10 @@ class GBTTable {
    * when opened in 'w' mode, if the file does not exist, it is created.
    * @param filename[IN] the name of the file to open
    * @param mode[IN] 'r' for read, 'w' for write
+   * @param pageSize[IN] the page size of a new file; see GBTFile::open()
    * @return error code. 0 if no error
    */
-  RT open(const std::string& filename, char mode);
+  RT open(const std::string& filename, char mode, int pageSize = GBTFile::PAGE_SIZE);
 
   /**
    * close the file.
@@ -71,6 +82,13 @@ class GBTTable {
    */
   RT close();
 
+  /**
+   * keep up to pages written pages in memory; see GBTFile::writeBack().
+   * @param pages[IN] the most dirty pages to keep, 0 to write through
+   * @return error code. 0 if no error
+   */
+  RT writeBack(size_t pages);
+
   /**
    * read a record from the file. note that every record is a (key, value) pair.
    * @param rid[IN] the id of the record to read
@@ -91,15 +109,74 @@ class GBTTable {
    */
   RT append(uint64_t key, const std::string& value, RecordId& rid);
 
+  /**
+   * append a new record at the end of the file.
+   * the value does not need to be null terminated.
+   * @param key[IN] the record key
+   * @param value[IN] the first byte of the record value
+   * @param length[IN] the length of the record value
+   * @param rid[OUT] the location of the stored record
+   * @return error code. 0 if no error
+   */
+  RT append(uint64_t key, const char* value, int length, RecordId& rid);
+
+  /**
+   * remove a record by setting its tombstone. the slot is not reused;
+   * read() reports RT_RECORD_DELETED for it from now on.
+   * @param rid[IN] the id of the record to remove
+   * @return error code. 0 if no error
+   */
+  RT remove(const RecordId& rid);
+
+  /**
+   * @param rid[IN] the id of a record
+   * @param deleted[OUT] true if the record was removed
+   * @return error code. 0 if no error
+   */
+  RT isDeleted(const RecordId& rid, bool& deleted) const;
+
   /**
    * note the +1 part. The rid of the last record is endRid()-1.
    * @return (last record id + 1) of the GBTTable
    */
   const RecordId& endRid() const;
 
+  /**
+   * @return the number of record slots in a page of the file
+   */
+  int recordsPerPage() const { return records_per_page; }
+
+  /**
+   * the row number of a record, pid * ROW_STRIDE + sid.
+   * the index stores it in 32 bits instead of the 8-byte RecordId.
+   * @param rid[IN] the id of a record
+   * @return the row number. -1 if rid is not a slot of a table page
+   *         or its row number does not fit in 32 bits
+   */
+  static int64_t rowNumber(const RecordId& rid)
+  {
+    if (rid.pid < 0 || rid.sid < 0 || rid.sid >= ROW_STRIDE)
+      return -1;
+    int64_t row = (int64_t) rid.pid * ROW_STRIDE + rid.sid;
+    return (row > (int64_t) UINT32_MAX) ? -1 : row;
+  }
+
+  /**
+   * @param row[IN] a row number from rowNumber()
+   * @return the id of the record
+   */
+  static RecordId rowRecord(int64_t row)
+  {
+    RecordId rid;
+    rid.pid = row / ROW_STRIDE;
+    rid.sid = row % ROW_STRIDE;
+    return rid;
+  }
+
  private:
   GBTFile pf;     // the GBTFile used to store the records
   RecordId erid;   // the last record id of the file + 1
+  int records_per_page;  // record slots in a page of pf
 };
 
 #endif
@@ -0,0 +1,172 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  GBTTrajectory.cc
+ *
+ *    Description:  positions indexed on time bucket and geohash
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+#define __STDC_FORMAT_MACROS
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include "../pathmanager/PathManager.h"
+#include "GBTTrajectory.h"
+#include "GeoQuery.h"
+#include "Geohash.h"
+
+const int64_t GBTTrajectory::BUCKET_SECONDS;
+
+static const int ADDRESS_SHIFT = GBTTrajectory::BUCKET_BITS;
+static const int BUCKET_SHIFT = 64 - GBTTrajectory::BUCKET_BITS;
+static const uint64_t CELL_MASK = (UINT64_C(1) << BUCKET_SHIFT) - 1;
+static const uint64_t LATITUDE_HOLDER = UINT64_C(0x5555555555555555) & CELL_MASK;
+static const uint64_t LONGITUDE_HOLDER = UINT64_C(0xaaaaaaaaaaaaaaaa) & CELL_MASK;
+
+/* *
+ * move a cell one step along the axis of holder, unless it is at the edge.
+ * */
+static uint64_t StepCell(uint64_t cell, uint64_t holder, bool up)
+{
+	uint64_t axis = cell & holder;
+	if (up ? axis == holder : axis == 0)
+		return cell;
+	axis = up ? ((axis | ~holder) + 1) & holder : (axis - 1) & holder;
+	return (cell & ~holder) | axis;
+}
+
+GBTTrajectory::GBTTrajectory()
+	: index_file(true)  // many positions share a cell and a bucket
+{
+}
+
+RT GBTTrajectory::open(const std::string& table, char mode)
+{
+	RT rc;
+
+	if ((rc = table_file.open(PathManager::GetTablePath(table), mode)) < 0)
+		return rc;
+	if ((rc = index_file.open(PathManager::GetIndexPath(table), mode)) < 0) {
+		table_file.close();
+		return rc;
+	}
+	// positions are only appended, so the writer keeps pages back
+	if (mode == 'w') {
+		table_file.writeBack(GBTFile::LOAD_WRITE_BACK_PAGES);
+		index_file.writeBack(GBTFile::LOAD_WRITE_BACK_PAGES);
+	}
+	return 0;
+}
+
+RT GBTTrajectory::close()
+{
+	RT rc = index_file.close();
+	RT rt = table_file.close();
+	return (rc < 0) ? rc : rt;
+}
+
+RT GBTTrajectory::MakeKey(int64_t timestamp, uint64_t address, uint64_t& key)
+{
+	if (timestamp < 0 || timestamp / BUCKET_SECONDS >= ((int64_t)1 << BUCKET_BITS))
+		return RT_INVALID_ATTRIBUTE;
+	uint64_t bucket = timestamp / BUCKET_SECONDS;
+	key = (bucket << BUCKET_SHIFT) | (address >> ADDRESS_SHIFT);
+	return 0;
+}
+
+RT GBTTrajectory::append(int64_t timestamp, double longitude, double latitude, const std::string& value)
+{
+	RT rc;
+	RecordId rid;
+	uint64_t address = 0, key;
+	char record[GBTTable::MAX_VALUE_LENGTH];
+
+	if (geohash_encode_64(latitude, longitude, &address) != GEOHASH_OK)
+		return RT_GEOHASH_ERROR;
+	if ((rc = MakeKey(timestamp, address, key)) < 0)
+		return rc;
+
+	int length = snprintf(record, sizeof(record), "%" PRId64 ",%s", timestamp, value.c_str());
+	if (length >= (int)sizeof(record))
+		length = sizeof(record) - 1;
+	if ((rc = table_file.append(address, record, length, rid)) < 0)
+		return rc;
+	return index_file.insert(key, rid);
+}
+
+RT GBTTrajectory::read(const RecordId& rid, int64_t& timestamp, uint64_t& address, std::string& value) const
+{
+	RT rc;
+	std::string record;
+
+	if ((rc = table_file.read(rid, address, record)) < 0)
+		return rc;
+	size_t comma = record.find(',');
+	if (comma == std::string::npos)
+		return RT_INVALID_FILE_FORMAT;
+	timestamp = strtoll(record.c_str(), NULL, 10);
+	value.assign(record, comma + 1, std::string::npos);
+	return 0;
+}
+
+RT GBTTrajectory::query(uint64_t left_down, uint64_t right_up, int64_t begin, int64_t end, std::vector<RecordId>& outputs)
+{
+	RT rc;
+	uint64_t first, last;
+
+	if (begin > end)
+		return RT_INVALID_ATTRIBUTE;
+	if (begin < 0)
+		begin = 0;
+	if ((rc = MakeKey(begin, 0, first)) < 0)
+		return rc;
+	if (MakeKey(end, 0, last) < 0)
+		MakeKey(((int64_t)1 << BUCKET_BITS) * BUCKET_SECONDS - 1, 0, last);
+	first >>= BUCKET_SHIFT;
+	last >>= BUCKET_SHIFT;
+
+	// the key keeps the cell of a position, not its full geohash, so the
+	// cells on the edge of the box hold positions on both sides of it.
+	// widen the box by one cell to take them in, and check the full
+	// address of every position found in them.
+	uint64_t inner_low = left_down >> ADDRESS_SHIFT;
+	uint64_t inner_high = right_up >> ADDRESS_SHIFT;
+	uint64_t low = StepCell(StepCell(inner_low, LATITUDE_HOLDER, false), LONGITUDE_HOLDER, false);
+	uint64_t high = StepCell(StepCell(inner_high, LATITUDE_HOLDER, true), LONGITUDE_HOLDER, true);
+
+	std::vector<RecordId> found;
+	std::vector<uint64_t> keys;
+	for (uint64_t bucket = first; bucket <= last; bucket++) {
+		uint64_t prefix = bucket << BUCKET_SHIFT;
+		found.clear();
+		keys.clear();
+		if ((rc = GeoQuery::RangeQuery(index_file, prefix | low, prefix | high, found, &keys)) != GEOQUERY_OK)
+			return rc;
+
+		// a bucket inside the window needs no timestamp check
+		int64_t bucket_begin = bucket * BUCKET_SECONDS;
+		int64_t bucket_end = bucket_begin + BUCKET_SECONDS - 1;
+		bool whole_bucket = (begin <= bucket_begin && bucket_end <= end);
+		for (size_t i = 0; i < found.size(); i++) {
+			bool inner_cell = GeoQuery::InRange(keys[i] & CELL_MASK, inner_low, inner_high);
+			if (whole_bucket && inner_cell) {
+				outputs.push_back(found[i]);
+				continue;
+			}
+			int64_t timestamp;
+			uint64_t address;
+			std::string value;
+			if ((rc = read(found[i], timestamp, address, value)) < 0)
+				return rc;
+			if (begin <= timestamp && timestamp <= end &&
+					(inner_cell || GeoQuery::InRange(address, left_down, right_up)))
+				outputs.push_back(found[i]);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,107 @@
+/*
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+#ifndef GBTTRAJECTORY_H_
+#define GBTTRAJECTORY_H_
+
+#include <string>
+#include <vector>
+#include "../base/GBTreeBase.h"
+#include "GBTTable.h"
+#include "GBTreeIndex.h"
+
+/**
+ * a table of timestamped positions indexed on time and space.
+ * the index key is the time bucket of the timestamp in the upper
+ * BUCKET_BITS bits followed by the upper bits of the geohash:
+ *
+ *   | bucket (20 bits) | geohash >> 20 (44 bits) |
+ *
+ * so the positions of one bucket form a contiguous key range that is
+ * still in Z-order, and a box and time window query only scans the
+ * buckets of the window. the 44 geohash bits keep 22 bits per axis,
+ * a cell of about 5 meters.
+ *
+ * a table record keeps the full geohash as its key and
+ * "timestamp,value" as its value. the index keys are not plain geohashes,
+ * so the GeoQuery nearest query does not apply to a trajectory table.
+ */
+class GBTTrajectory {
+  public:
+	/* *
+	 * bits of the time bucket at the top of the key
+	 * */
+	static const int BUCKET_BITS = 20;
+
+	/* *
+	 * seconds per time bucket. 2^20 hours cover timestamps up to 2089.
+	 * */
+	static const int64_t BUCKET_SECONDS = 3600;
+
+	GBTTrajectory();
+
+	/**
+	 * open the table and index files of a trajectory table.
+	 * @param table[IN] the table name
+	 * @param mode[IN] 'r' for read, 'w' for write
+	 * @return error code. 0 if no error
+	 */
+	RT open(const std::string& table, char mode);
+
+	/**
+	 * close the files.
+	 * @return error code. 0 if no error
+	 */
+	RT close();
+
+	/**
+	 * append a position to the table and index it.
+	 * @param timestamp[IN] seconds since the epoch
+	 * @param longitude[IN] the longitude
+	 * @param latitude[IN] the latitude
+	 * @param value[IN] the record value
+	 * @return error code. RT_INVALID_ATTRIBUTE if the timestamp is out of range
+	 */
+	RT append(int64_t timestamp, double longitude, double latitude, const std::string& value);
+
+	/**
+	 * find the positions inside a box during a time window.
+	 * every bucket of the window is scanned with GeoQuery::RangeQuery;
+	 * the records of the first and last bucket are read back to check
+	 * their timestamps, and the records in the cells on the edge of the
+	 * box to check their full geohash.
+	 * @param left_down[IN] geohash of the left-down corner of the box
+	 * @param right_up[IN] geohash of the right-up corner of the box
+	 * @param begin[IN] the first second of the window
+	 * @param end[IN] the last second of the window
+	 * @param outputs[OUT] the records found
+	 * @return error code. 0 if no error
+	 */
+	RT query(uint64_t left_down, uint64_t right_up, int64_t begin, int64_t end, std::vector<RecordId>& outputs);
+
+	/**
+	 * read a record of the table.
+	 * @param rid[IN] the record
+	 * @param timestamp[OUT] the timestamp of the position
+	 * @param address[OUT] the full geohash of the position
+	 * @param value[OUT] the record value
+	 * @return error code. 0 if no error
+	 */
+	RT read(const RecordId& rid, int64_t& timestamp, uint64_t& address, std::string& value) const;
+
+	/**
+	 * compute the index key of a position.
+	 * @param timestamp[IN] seconds since the epoch
+	 * @param address[IN] the geohash of the position
+	 * @param key[OUT] the index key
+	 * @return error code. RT_INVALID_ATTRIBUTE if the timestamp is out of range
+	 */
+	static RT MakeKey(int64_t timestamp, uint64_t address, uint64_t& key);
+
+  private:
+	GBTTable    table_file;
+	GBTreeIndex index_file;
+};
+
+#endif
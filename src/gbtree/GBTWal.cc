@@ -0,0 +1,279 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  GBTWal.cc
+ *
+ *    Description:  write-ahead log of an index with group commit
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <chrono>
+#include "GBTWal.h"
+
+int GBTWal::commit_delay = 1000;
+
+GBTWal::GBTWal()
+{
+	fd = -1;
+	page_size = GBTFile::PAGE_SIZE;
+	file_end = 0;
+	appended = 0;
+	durable = 0;
+	syncing = false;
+	failed = 0;
+}
+
+GBTWal::~GBTWal()
+{
+	close();
+}
+
+RT GBTWal::open(const std::string& filename, int pageSize)
+{
+	struct stat statbuf;
+
+	if (fd >= 0)
+		return RT_FILE_OPEN_FAILED;
+	fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+	if (fd < 0)
+		return RT_FILE_OPEN_FAILED;
+	if (::fstat(fd, &statbuf) < 0) {
+		::close(fd);
+		fd = -1;
+		return RT_FILE_OPEN_FAILED;
+	}
+	file_end = statbuf.st_size;
+	page_size = pageSize;
+	buffer.clear();
+	appended = durable = 0;
+	syncing = false;
+	failed = 0;
+	return 0;
+}
+
+RT GBTWal::close()
+{
+	RT rc = 0;
+
+	if (fd < 0)
+		return 0;
+	if (appended > durable)
+		rc = commit(appended, 1);
+	::close(fd);
+	fd = -1;
+	return rc;
+}
+
+/*
+ * FNV-1a
+ */
+uint32_t GBTWal::checksumOf(const char* data, size_t size, uint32_t seed)
+{
+	uint32_t hash = seed;
+	for (size_t i = 0; i < size; i++) {
+		hash ^= (unsigned char) data[i];
+		hash *= 16777619u;
+	}
+	return hash;
+}
+
+RT GBTWal::writeAt(const char* data, size_t size, off_t offset)
+{
+	while (size > 0) {
+		ssize_t written = ::pwrite(fd, data, size, offset);
+		if (written < 0)
+			return RT_FILE_WRITE_FAILED;
+		data += written;
+		size -= written;
+		offset += written;
+	}
+	return 0;
+}
+
+RT GBTWal::read(std::map<PageId, std::vector<char> >& pages, std::vector<LogRecord>& records)
+{
+	std::vector<char> log(file_end);
+	std::map<PageId, std::vector<char> > images;
+
+	pages.clear();
+	records.clear();
+	for (off_t got = 0; got < file_end; ) {
+		ssize_t n = ::pread(fd, &log[got], file_end - got, got);
+		if (n < 0)
+			return RT_FILE_READ_FAILED;
+		if (n == 0)
+			break;
+		got += n;
+	}
+
+	// a torn or unknown record ends the log
+	for (size_t pos = 0; pos + sizeof(LogRecord) <= log.size(); ) {
+		LogRecord record;
+		memcpy(&record, &log[pos], sizeof(record));
+		size_t size = sizeof(LogRecord);
+		if (record.type == LOG_PAGE)
+			size += page_size;
+		if (record.type < LOG_INSERT || record.type > LOG_CHECKPOINT || pos + size > log.size())
+			break;
+		if (checksumOf(&log[pos] + sizeof(uint32_t), size - sizeof(uint32_t), 2166136261u) != record.checksum)
+			break;
+
+		if (record.type == LOG_PAGE) {
+			const char* image = &log[pos] + sizeof(LogRecord);
+			images[(PageId) record.key].assign(image, image + page_size);
+		} else if (record.type == LOG_CHECKPOINT) {
+			// the records in front are in the images
+			pages.swap(images);
+			images.clear();
+			records.clear();
+		} else {
+			records.push_back(record);
+		}
+		pos += size;
+	}
+	return 0;
+}
+
+RT GBTWal::append(int type, uint64_t key, const RecordId& rid, uint64_t newKey, uint64_t& lsn)
+{
+	LogRecord record;
+
+	memset(&record, 0, sizeof(record));
+	record.type = type;
+	record.key = key;
+	record.rid = rid;
+	record.new_key = newKey;
+	record.checksum = checksumOf((const char*) &record + sizeof(uint32_t),
+			sizeof(record) - sizeof(uint32_t), 2166136261u);
+
+	std::lock_guard<std::mutex> guard(lock);
+	buffer.insert(buffer.end(), (const char*) &record, (const char*) &record + sizeof(record));
+	appended += sizeof(record);
+	lsn = appended;
+	filled.notify_all();
+	return failed;
+}
+
+/*
+ * The writer that finds nobody syncing leads: it waits until each running
+ * writer has a record in the buffer or commit_delay passed, takes the
+ * whole buffer, writes and syncs it without the lock, and wakes the
+ * writers whose records went with it. The others wait for it, and one of
+ * those whose records came too late leads the next sync. The end of the
+ * file only moves once the batch is synced; if it fails, every commit
+ * returns the error from then on.
+ */
+RT GBTWal::commit(uint64_t lsn, int writers)
+{
+	std::unique_lock<std::mutex> guard(lock);
+
+	while (durable < lsn) {
+		if (failed < 0)
+			return failed;
+		if (syncing) {
+			synced.wait(guard);
+			continue;
+		}
+		syncing = true;
+		if (writers > 1 && commit_delay > 0) {
+			size_t wanted = writers * sizeof(LogRecord);
+			filled.wait_for(guard, std::chrono::microseconds(commit_delay),
+					[&] { return buffer.size() >= wanted; });
+		}
+
+		std::vector<char> batch;
+		batch.swap(buffer);
+		uint64_t end = appended;
+		off_t offset = file_end;
+		guard.unlock();
+
+		RT rc = writeAt(batch.empty() ? NULL : &batch[0], batch.size(), offset);
+		if (rc == 0 && ::fdatasync(fd) < 0)
+			rc = RT_FILE_WRITE_FAILED;
+
+		guard.lock();
+		syncing = false;
+		if (rc == 0) {
+			file_end = offset + batch.size();
+			durable = end;
+		} else {
+			failed = rc;
+		}
+		synced.notify_all();
+	}
+	return 0;
+}
+
+RT GBTWal::checkpoint(const std::vector<std::pair<PageId, const char*> >& pages)
+{
+	RT rc;
+
+	// commit fails only by a failed write or sync, which is handled below
+	commit(appended, 1);
+
+	// a sync still running writes at file_end
+	std::unique_lock<std::mutex> guard(lock);
+	while (syncing)
+		synced.wait(guard);
+	if (failed < 0) {
+		// the images hold the records lost with the failed batch and those
+		// appended since; cut off what the failed write left behind
+		if (::ftruncate(fd, file_end) < 0)
+			return RT_FILE_WRITE_FAILED;
+		buffer.clear();
+	}
+
+	std::vector<char> batch;
+	LogRecord record;
+	for (size_t i = 0; i <= pages.size(); i++) {
+		memset(&record, 0, sizeof(record));
+		record.type = (i < pages.size()) ? LOG_PAGE : LOG_CHECKPOINT;
+		record.key = (i < pages.size()) ? pages[i].first : 0;
+		uint32_t checksum = checksumOf((const char*) &record + sizeof(uint32_t),
+				sizeof(record) - sizeof(uint32_t), 2166136261u);
+		if (i < pages.size())
+			checksum = checksumOf(pages[i].second, page_size, checksum);
+		record.checksum = checksum;
+		batch.insert(batch.end(), (const char*) &record, (const char*) &record + sizeof(record));
+		if (i < pages.size())
+			batch.insert(batch.end(), pages[i].second, pages[i].second + page_size);
+	}
+	if ((rc = writeAt(&batch[0], batch.size(), file_end)) == 0 && ::fdatasync(fd) < 0)
+		rc = RT_FILE_WRITE_FAILED;
+	if (rc < 0) {
+		failed = rc;
+		return rc;
+	}
+	file_end += batch.size();
+	if (failed < 0) {
+		durable = appended;
+		failed = 0;
+	}
+	return 0;
+}
+
+RT GBTWal::reset()
+{
+	std::lock_guard<std::mutex> guard(lock);
+
+	if (!buffer.empty())
+		return RT_INVALID_FILE_FORMAT;
+	if (::ftruncate(fd, 0) < 0 || ::fdatasync(fd) < 0)
+		return RT_FILE_WRITE_FAILED;
+	file_end = 0;
+	return 0;
+}
+
+size_t GBTWal::size()
+{
+	std::lock_guard<std::mutex> guard(lock);
+	return file_end + buffer.size();
+}
@@ -0,0 +1,141 @@
+/*
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+#ifndef GBTWAL_H_
+#define GBTWAL_H_
+
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include "../base/GBTreeBase.h"
+#include "../storagemanager/GBTFile.h"
+#include "GBTTable.h"
+
+/**
+ * one record of the log. LOG_PAGE records are followed by the page image
+ * and keep the page id in key. checksum covers the rest of the record and
+ * the image, so a record torn by a crash ends the log.
+ */
+typedef struct {
+	uint32_t checksum;
+	int32_t  type;
+	uint64_t key;
+	RecordId rid;
+	uint64_t new_key;
+} LogRecord;
+
+/**
+ * write-ahead log of an index: the inserts, removes and updates since the
+ * index file was last brought up to date.
+ *
+ * records are appended to a buffer and made durable by commit(). writers
+ * that commit at the same time share one fdatasync: the first one writes
+ * and syncs everything appended so far while the others wait, and if more
+ * writers are running it first waits up to commit_delay for them to append.
+ *
+ * a checkpoint logs the images of the pages about to be written in place,
+ * followed by a LOG_CHECKPOINT record. a crash while the pages are written
+ * is repaired by writing the images again; the log is emptied once the
+ * pages are on disk.
+ *
+ * a failed write or sync leaves the end of the log unknown. the failure
+ * sticks: append() and commit() return it until a checkpoint rewrites the
+ * log behind its last good record.
+ */
+class GBTWal {
+  public:
+	static const int LOG_INSERT = 1;
+	static const int LOG_REMOVE = 2;
+	static const int LOG_UPDATE = 3;
+	static const int LOG_PAGE = 4;
+	static const int LOG_CHECKPOINT = 5;
+
+	/* *
+	 * microseconds a commit waits for the other running writers to append
+	 * their records, so that they share its fdatasync
+	 * */
+	static int commit_delay;
+
+	GBTWal();
+	~GBTWal();
+
+	/**
+	 * open the log, creating it if it does not exist. nothing is removed.
+	 * @param pageSize[IN] the page size of the index, the size of the images
+	 * @return error code. 0 if no error
+	 */
+	RT open(const std::string& filename, int pageSize = GBTFile::PAGE_SIZE);
+
+	/**
+	 * write the records appended so far and close the log.
+	 * @return error code. 0 if no error
+	 */
+	RT close();
+
+	/**
+	 * read the log for recovery: the images of the last complete
+	 * checkpoint, and the records behind it in log order.
+	 * @return error code. 0 if no error
+	 */
+	RT read(std::map<PageId, std::vector<char> >& pages, std::vector<LogRecord>& records);
+
+	/**
+	 * append a record to the buffer.
+	 * @param lsn[OUT] the log position to commit() for the record
+	 * @return error code. the error of a failed write or sync, if any
+	 */
+	RT append(int type, uint64_t key, const RecordId& rid, uint64_t newKey, uint64_t& lsn);
+
+	/**
+	 * wait until the log is durable up to lsn.
+	 * @param writers[IN] the writers running, this one included
+	 * @return error code. 0 if no error
+	 */
+	RT commit(uint64_t lsn, int writers);
+
+	/**
+	 * make the records appended so far durable, then log the page images
+	 * and a LOG_CHECKPOINT record and sync them. after a failed write or
+	 * sync the records are dropped instead, since the images hold them,
+	 * and the images are written behind the last good record.
+	 * @return error code. 0 if no error
+	 */
+	RT checkpoint(const std::vector<std::pair<PageId, const char*> >& pages);
+
+	/**
+	 * empty the log once the checkpoint reached the index file.
+	 * @return error code. 0 if no error
+	 */
+	RT reset();
+
+	/**
+	 * @return the bytes in the log, written or not
+	 */
+	size_t size();
+
+  private:
+	GBTWal(const GBTWal&);
+	GBTWal& operator=(const GBTWal&);
+
+	static uint32_t checksumOf(const char* data, size_t size, uint32_t seed);
+	RT writeAt(const char* data, size_t size, off_t offset);
+
+	int fd;
+	int page_size;             // bytes of a page image
+	off_t file_end;            // bytes written to the file and synced
+	std::vector<char> buffer;  // records appended and not written yet
+	uint64_t appended;         // log position behind the last record appended
+	uint64_t durable;          // log position up to which the log is synced
+	bool syncing;              // a writer is writing and syncing for the others
+	RT failed;                 // the error of a failed write or sync, 0 if none
+
+	std::mutex lock;
+	std::condition_variable synced;  // a sync ended
+	std::condition_variable filled;  // a record was appended
+};
+
+#endif
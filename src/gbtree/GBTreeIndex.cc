@@ -16,23 +16,139 @@
  * =====================================================================================
  */
 
+#include <unistd.h>
+#include <algorithm>
+#include <thread>
 #include "GBTreeIndex.h"
 
+const int GBTreeIndex::LATCH_COUNT;
+const int GBTreeIndex::MEMORY_CHUNK_SIZE;
+const int GBTreeIndex::MEMORY_CHUNKS;
+
+bool GBTreeIndex::write_ahead_log = false;
+
+// the log of an index file is the file name with this appended
+static const char* LOG_EXTENSION = ".wal";
+
+/*
+ * A page held in memory. page keeps the file format; the page ids in it
+ * are swizzled into children (non-leaf) or next (leaf).
+ */
+struct GBTMemoryNode {
+	char* page;                  /// page_size bytes
+	PageId pid;
+	int type;                    /// MEMORY_FREE, MEMORY_LEAF or MEMORY_NON_LEAF
+	GBTMemoryNode* next;         /// the next leaf
+	GBTMemoryNode** children;    /// the children of a non-leaf node in order
+	bool dirty;                  /// not written back yet
+};
+
+static const int MEMORY_FREE = 0;
+static const int MEMORY_LEAF = 1;
+static const int MEMORY_NON_LEAF = 2;
+
+static inline int pageKeyCount(const char* page, int max)
+{
+	int count;
+	memcpy(&count, page, sizeof(int));
+	// a page read while a writer changes it may hold anything
+	return (count < 0 || count > max) ? max : count;
+}
+
+static inline const nl_struct* nonLeafEntries(const char* page)
+{
+	return (const nl_struct*) (page + sizeof(int) * 2);
+}
+
+/*
+ * The child for searchKey: behind the last separator smaller than it,
+ * as in GBTNonLeafNode::locateChildIndex().
+ */
+static int childLowerBound(const char* page, uint64_t searchKey, int maxKeys)
+{
+	const nl_struct* entries = nonLeafEntries(page);
+	int low = 0, high = pageKeyCount(page, maxKeys);
+	while (low < high) {
+		int mid = (low + high) / 2;
+		if (entries[mid].key < searchKey)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
 GBTreeIndex::GBTreeIndex(bool duplicate)
 {
 	this->duplicate_key = duplicate;
+	page_size = GBTFile::PAGE_SIZE;
+	node_keys = GBTNonLeafNode::maxKeys(page_size);
+	for (int i = 0; i < LATCH_COUNT; i++)
+		latches[i] = 0;
+	tree_latch = 0;
+	epoch = 0;
+	version_count = 0;
+	in_memory = false;
+	memory_chunks = NULL;
+	memory_root = NULL;
+	memory_info_dirty = false;
+	last_leaf = 0;
+	last_key = 0;
+	append_run = 0;
+	split_fill = 50;
+	logging = false;
+	log_writers = 0;
+}
+
+/*
+ * The version of a latch once no writer holds it.
+ */
+static uint64_t readLatch(const std::atomic<uint64_t>& latch)
+{
+	uint64_t version;
+	while ((version = latch.load(std::memory_order_acquire)) & 1)
+		std::this_thread::yield();
+	return version;
+}
+
+/*
+ * Whether nothing was written under the latch since version was read.
+ */
+static bool validLatch(const std::atomic<uint64_t>& latch, uint64_t version)
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return latch.load(std::memory_order_relaxed) == version;
 }
 /*
  * Open the index file in read or write mode.
  * Under 'w' mode, the index file should be created if it does not exist.
  * @param indexname[IN] the name of the index file
  * @param mode[IN] 'r' for read, 'w' for write
+ * @param pageSize[IN] the page size of a file created; an existing file keeps its own
  * @return error code. 0 if no error
  */
-RT GBTreeIndex::open(const std::string& indexname, char mode)
+RT GBTreeIndex::open(const std::string& indexname, char mode, int pageSize)
+{
+	RT rc;
+	if ((rc = pf.open(indexname, mode, pageSize)) < 0) return rc;
+	page_size = pf.pageSize();
+	node_keys = GBTNonLeafNode::maxKeys(page_size);
+	bulk_leaf = GBTLeafNode(duplicate_key, page_size);
+	merge_held_leaf = GBTLeafNode(duplicate_key, page_size);
+	if ((rc = readTreeInfo()) < 0) return rc;
+	last_leaf = 0;
+
+	// a log left behind by a crash is replayed before the index is used
+	logging = false;
+	log_name = indexname + LOG_EXTENSION;
+	if ((mode == 'w' || mode == 'W') && (write_ahead_log || ::access(log_name.c_str(), F_OK) == 0))
+		return recover();
+	return 0;
+}
+
+RT GBTreeIndex::readTreeInfo()
 {
 	RT rc;
-	if ((rc = pf.open(indexname, mode)) < 0) return rc;
 
 	// get rootPid and treeHeight
 	if ((rc = pf.read(0, treeInfo_buffer)) < 0) {
@@ -43,6 +159,9 @@ RT GBTreeIndex::open(const std::string& indexname, char mode)
 	}
 	memcpy(&rootPid, treeInfo_buffer, sizeof(rootPid));
 	memcpy(&treeHeight, treeInfo_buffer + sizeof(rootPid), sizeof(treeHeight));
+	memcpy(&freePid, treeInfo_buffer + sizeof(rootPid) + sizeof(treeHeight), sizeof(freePid));
+	memcpy(&epoch, treeInfo_buffer + sizeof(rootPid) + sizeof(treeHeight) + sizeof(freePid), sizeof(epoch));
+	newPid = (pf.endPid() > 0) ? pf.endPid() : 1; // page 0 holds the tree info
 
 	if (!treeHeight)
 		rootPid = -1;
@@ -50,288 +169,2339 @@ RT GBTreeIndex::open(const std::string& indexname, char mode)
 	return 0;
 }
 
+/*
+ * Write the page images of the last complete checkpoint again, replay
+ * the writes logged behind it, and checkpoint the result, which leaves
+ * the log empty. Without write_ahead_log the log is removed afterwards.
+ */
+RT GBTreeIndex::recover()
+{
+	RT rc;
+	std::map<PageId, std::vector<char> > pages;
+	std::vector<LogRecord> records;
+
+	if ((rc = wal.open(log_name, page_size)) < 0) return rc;
+	pf.holdDirty(true);
+	logging = true;
+	if ((rc = wal.read(pages, records)) < 0) return rc;
+
+	std::map<PageId, std::vector<char> >::const_iterator it;
+	for (it = pages.begin(); it != pages.end(); ++it) {
+		if ((rc = pf.write(it->first, &it->second[0])) < 0) return rc;
+	}
+	if (!pages.empty() && (rc = readTreeInfo()) < 0) return rc;
+
+	for (size_t i = 0; i < records.size(); i++) {
+		const LogRecord& record = records[i];
+		if (record.type == GBTWal::LOG_INSERT)
+			rc = insertTree(record.key, record.rid);
+		else if (record.type == GBTWal::LOG_REMOVE)
+			rc = removeTree(record.key, record.rid);
+		else
+			rc = updateTree(record.key, record.new_key, record.rid);
+		if (rc < 0) return rc;
+	}
+	publishVersion();
+
+	if ((rc = checkpointLog()) < 0) return rc;
+	if (!write_ahead_log) {
+		wal.close();
+		::unlink(log_name.c_str());
+		pf.holdDirty(false);
+		logging = false;
+	}
+	return 0;
+}
+
 /*
  * Close the index file.
  * @return error code. 0 if no error
  */
 RT GBTreeIndex::close()
 {
+	RT rc = 0;
+
+	if (in_memory) {
+		rc = checkpoint();
+		freeMemoryNodes();
+	} else if (logging) {
+		rc = checkpoint();
+	}
+	if (logging) {
+		// a clean close leaves no log behind
+		wal.close();
+		if (rc == 0)
+			::unlink(log_name.c_str());
+		logging = false;
+	}
+	if (rc < 0) {
+		pf.close();
+		return rc;
+	}
     return pf.close();
 }
 
 /*
- * Insert (key, RecordId) pair to the index.
- * @param key[IN] the key for the value inserted into the index
- * @param rid[IN] the RecordId for the record being inserted into the index
- * @return error code. 0 if no error
+ * Load every page of the file, then walk the tree from the root to learn
+ * which pages are leaves and non-leaf nodes and swizzle them. Pages that
+ * the walk does not reach are free pages.
  */
-RT GBTreeIndex::insert(uint64_t key, const RecordId& rid)
+RT GBTreeIndex::openInMemory(const std::string& indexname)
 {
 	RT rc;
-	GBTLeafNode leaf(duplicate_key);
-
-	if (rootPid == -1) { // we have an empty tree
-		if ((rc = leaf.insert(key, rid)) < 0) return rc;
-		
-		if ((rc = leaf.write(1, pf)) < 0) return rc;
 
-		rootPid = 1;
-		treeHeight = 1;
+	if ((rc = open(indexname, 'w')) < 0) return rc;
 
-		// update tree info
-		if ((rc = updateTreeInfo()) < 0) return rc;
+	memory_chunks = new GBTMemoryNode**[MEMORY_CHUNKS]();
+	char page[GBTFile::MAX_PAGE_SIZE];
+	for (PageId pid = 1; pid < pf.endPid(); pid++) {
+		if ((rc = pf.read(pid, page)) < 0) {
+			freeMemoryNodes();
+			pf.close();
+			return rc;
+		}
+		writeMemoryNode(pid, page, MEMORY_FREE)->dirty = false;
+	}
+	if (treeHeight > 0 && (rc = loadMemoryNodes(rootPid, 1)) < 0) {
+		freeMemoryNodes();
+		pf.close();
+		return rc;
+	}
 
-	} else {
-		if (treeHeight == 1) { // the root is also the leaf node
-			leaf.read(1, pf);
+	memory_root = (treeHeight > 0) ? memoryNode(rootPid) : NULL;
+	memory_info_dirty = false;
+	in_memory = true;
+	return 0;
+}
 
-			if (leaf.getKeyCount() == GBTLeafNode::MAX_KEY_PER_NODE) { // full node
-				GBTLeafNode sibling(duplicate_key);
-				uint64_t siblingKey;
-				if ((rc = leaf.insertAndSplit(key, rid, sibling, siblingKey)) < 0) return rc;
+RT GBTreeIndex::loadMemoryNodes(PageId pid, int level)
+{
+	RT rc;
+	GBTMemoryNode* node = memoryNode(pid);
 
-				// update 2 nodes
-				if ((rc = leaf.setNextNodePtr(2)) < 0) return rc;
-				if ((rc = leaf.write(1, pf)) < 0)	return rc;
-				if ((rc = sibling.write(2, pf)) < 0) return rc;
+	if (node == NULL)
+		return RT_INVALID_PID;
+	if (level == treeHeight) {
+		node->type = MEMORY_LEAF;
+		swizzle(node);
+		// overflow pages have no parent: they are found behind the leaf
+		while (node->next != NULL && node->next->type == MEMORY_FREE &&
+				GBTLeafNode::overflowOf(node->next->page)) {
+			node = node->next;
+			node->type = MEMORY_LEAF;
+			swizzle(node);
+		}
+		return 0;
+	}
 
-				// create a new root
-				GBTNonLeafNode root;
-				if ((rc = root.initializeRoot(1, siblingKey, 2)) < 0) return rc;
-				if ((rc = root.write(3, pf)) < 0) return rc;
+	node->type = MEMORY_NON_LEAF;
+	swizzle(node);
+	int count = pageKeyCount(node->page, node_keys);
+	for (int i = 0; i <= count; i++) {
+		if (node->children[i] == NULL)
+			return RT_INVALID_PID;
+		if ((rc = loadMemoryNodes(node->children[i]->pid, level + 1)) < 0) return rc;
+	}
+	return 0;
+}
 
-				rootPid = 3;
+RT GBTreeIndex::checkpoint()
+{
+	std::lock_guard<std::mutex> guard(writer_lock);
+	return checkpointLocked();
+}
 
-				treeHeight = 2;
-				// update treeInfo
-				if ((rc = updateTreeInfo()) < 0) return rc;
+RT GBTreeIndex::writeBack(size_t pages)
+{
+	std::lock_guard<std::mutex> guard(writer_lock);
+	return pf.writeBack(pages);
+}
 
-			} else {
-				if ((rc = leaf.insert(key, rid)) < 0) return rc;
-				if ((rc = leaf.write(1, pf)) < 0) return rc;
-			}
+/*
+ * Write the changed pages in pid order, then the tree info, and flush
+ * them out of the write-back pages of the file.
+ */
+RT GBTreeIndex::checkpointLocked()
+{
+	RT rc;
 
-		} else { // we have at least 2 levels
-			uint64_t midKey;
-			if((rc = insertHelper(-1, 1, rootPid, key, rid, midKey)) < 0)
-				return rc;
+	if (!in_memory)
+		return logging ? checkpointLog() : pf.flush();
+	for (int c = 0; c < MEMORY_CHUNKS; c++) {
+		if (memory_chunks[c] == NULL)
+			continue;
+		for (int i = 0; i < MEMORY_CHUNK_SIZE; i++) {
+			GBTMemoryNode* node = memory_chunks[c][i];
+			if (node == NULL || !node->dirty)
+				continue;
+			if ((rc = pf.write(node->pid, node->page)) < 0) return rc;
+			node->dirty = false;
 		}
 	}
-
-    return 0;
+	if (memory_info_dirty) {
+		if ((rc = pf.write(0, treeInfo_buffer)) < 0) return rc;
+		memory_info_dirty = false;
+	}
+	return logging ? checkpointLog() : pf.flush();
 }
 
-
-RT GBTreeIndex::insertHelper(PageId parentNode, int currentLevel, PageId currentNode, const uint64_t &key, const RecordId &rid, uint64_t& midKey) {
+/*
+ * The images of the dirty pages go to the log before the pages are
+ * written in place, so that a crash in between is repaired from the log.
+ */
+RT GBTreeIndex::checkpointLog()
+{
 	RT rc;
+	std::vector<std::pair<PageId, const char*> > pages;
 
-	if (currentLevel == treeHeight) { // leaf
-		GBTLeafNode leaf(duplicate_key);
-		if ((rc = leaf.read(currentNode, pf)) < 0) return rc;
-		if (leaf.getKeyCount() == GBTLeafNode::MAX_KEY_PER_NODE) { // full node
-			GBTLeafNode sibling(duplicate_key);
-			if ((rc = leaf.insertAndSplit(key, rid, sibling, midKey)) < 0) return rc;
+	pf.dirtyPages(pages);
+	if (pages.empty() && wal.size() == 0)
+		return 0;
+	if ((rc = wal.checkpoint(pages)) < 0) return rc;
+	if ((rc = pf.flush()) < 0) return rc;
+	if ((rc = pf.sync()) < 0) return rc;
+	return wal.reset();
+}
 
-			// update 2 nodes
-			if ((rc = leaf.setNextNodePtr(pf.endPid())) < 0) return rc;
-			if ((rc = leaf.write(currentNode, pf)) < 0)	return rc;
-			if ((rc = sibling.write(pf.endPid(), pf)) < 0) return rc;
+/*
+ * Log a write the writer has done. A checkpoint is taken when the dirty
+ * pages reach the write-back limit or the log grows too long.
+ */
+RT GBTreeIndex::logWrite(int type, uint64_t key, const RecordId& rid, uint64_t newKey, uint64_t& lsn)
+{
+	if (!logging)
+		return 0;
+	RT rc = wal.append(type, key, rid, newKey, lsn);
+	// the file holds the pages of a logged index whatever its limit; one
+	// that writes through is checkpointed at the load limit
+	size_t limit = pf.writeBackLimit();
+	if (limit == 0)
+		limit = GBTFile::LOAD_WRITE_BACK_PAGES;
+	if (pf.dirtyCount() >= limit ||
+			wal.size() >= CHECKPOINT_LOG_SIZE)
+		return checkpointLocked();
+	// a failed log stays failed until the next checkpoint rewrites it
+	return rc;
+}
 
-			return 1; 
+RT GBTreeIndex::commitLog(uint64_t lsn)
+{
+	if (lsn == 0)
+		return 0;
+	return wal.commit(lsn, log_writers);
+}
 
-		} else {
-			if ((rc = leaf.insert(key, rid)) < 0) return rc;
-			if ((rc = leaf.write(currentNode, pf)) < 0) return rc;
-			return 0;
+void GBTreeIndex::freeMemoryNodes()
+{
+	if (memory_chunks == NULL)
+		return;
+	for (int c = 0; c < MEMORY_CHUNKS; c++) {
+		if (memory_chunks[c] == NULL)
+			continue;
+		for (int i = 0; i < MEMORY_CHUNK_SIZE; i++) {
+			if (memory_chunks[c][i] != NULL) {
+				delete[] memory_chunks[c][i]->children;
+				delete[] memory_chunks[c][i]->page;
+				delete memory_chunks[c][i];
+			}
 		}
-	} else {
-		// read the content of the current node
-		GBTNonLeafNode non_leaf;
-		if ((rc = non_leaf.read(currentNode, pf)) < 0) return rc;
-		
-		// determine the child node
-		PageId childNode = 0;
-		if ((rc = non_leaf.locateChildPtr(key, childNode)) < 0) return rc;
-		
-	    /**
-	     * 
-	     * @ Author : edward liu
-	     * @ Date : 3/19/2014
-	     */
-		if(childNode == 0) return 0;
+		delete[] memory_chunks[c];
+	}
+	delete[] memory_chunks;
+	memory_chunks = NULL;
+	memory_root = NULL;
+	in_memory = false;
+}
 
-		// follow this child node to the leaf
-		if ((rc = insertHelper(currentNode, currentLevel+1, childNode, key, rid, midKey)) <= 0) return rc;
+GBTMemoryNode* GBTreeIndex::memoryNode(PageId pid) const
+{
+	if (pid <= 0 || pid >= MEMORY_CHUNKS * MEMORY_CHUNK_SIZE)
+		return NULL;
+	GBTMemoryNode** chunk = memory_chunks[pid / MEMORY_CHUNK_SIZE];
+	return chunk ? chunk[pid % MEMORY_CHUNK_SIZE] : NULL;
+}
 
-		// rc now contains the siblingKey. We have to determine if the current non-leaf node is full
-		// to push the key to the upper level
+/*
+ * Store a page in its node, creating the node on the first write.
+ * Only the writer calls this; a node is never deleted before close().
+ */
+GBTMemoryNode* GBTreeIndex::writeMemoryNode(PageId pid, const char* page, int type)
+{
+	GBTMemoryNode**& chunk = memory_chunks[pid / MEMORY_CHUNK_SIZE];
+	if (chunk == NULL)
+		chunk = new GBTMemoryNode*[MEMORY_CHUNK_SIZE]();
+	GBTMemoryNode*& slot = chunk[pid % MEMORY_CHUNK_SIZE];
+	if (slot == NULL) {
+		GBTMemoryNode* node = new GBTMemoryNode;
+		node->page = new char[page_size];
+		node->pid = pid;
+		node->next = NULL;
+		node->children = NULL;
+		slot = node;
+	}
 
-		if (non_leaf.getKeyCount() == GBTNonLeafNode::MAX_KEY_PER_NODE) { // full
-			uint64_t newMidKey;
-			GBTNonLeafNode nf_sibling;
-			if ((rc = non_leaf.insertAndSplit(midKey, pf.endPid()-1, nf_sibling, newMidKey)) < 0) return rc;
+	// the file only grows at checkpoint(), so keep allocatePage() from
+	// handing out a page that is only in memory, as pf.endPid() does on disk
+	if (newPid <= pid)
+		newPid = pid + 1;
 
-			// update non_leaf
-			if ((rc = non_leaf.write(currentNode, pf)) < 0) return rc;
+	GBTMemoryNode* node = slot;
+	memcpy(node->page, page, page_size);
+	node->type = type;
+	node->dirty = true;
+	swizzle(node);
+	return node;
+}
 
-			// update new sibling
-			int nf_sibling_pid = pf.endPid();
-			if ((rc = nf_sibling.write(nf_sibling_pid, pf)) < 0) return rc;
+/*
+ * Turn the page ids of a node into pointers. A page id whose node does
+ * not exist yet gets an empty node, which its own write fills in.
+ */
+void GBTreeIndex::swizzle(GBTMemoryNode* node)
+{
+	if (node->type == MEMORY_LEAF) {
+		PageId next;
+		memcpy(&next, node->page + (page_size - sizeof(int)), sizeof(int));
+		node->next = (next > 0) ? memoryNode(next) : NULL;
+		if (next > 0 && node->next == NULL) {
+			char empty[GBTFile::MAX_PAGE_SIZE];
+			memset(empty, 0, page_size);
+			node->next = writeMemoryNode(next, empty, MEMORY_FREE);
+		}
+		return;
+	}
+	if (node->type != MEMORY_NON_LEAF)
+		return;
 
-			// are we at the root node?
-			if (currentLevel == 1) {
-				// create a new root
-				GBTNonLeafNode newRoot;
-				if ((rc = newRoot.initializeRoot(currentNode, newMidKey, nf_sibling_pid)) < 0) return rc;
+	if (node->children == NULL)
+		node->children = new GBTMemoryNode*[node_keys + 1]();
+	int count = pageKeyCount(node->page, node_keys);
+	for (int i = 0; i <= count; i++) {
+		PageId child;
+		if (i == 0)
+			memcpy(&child, node->page + sizeof(int), sizeof(PageId));
+		else
+			child = nonLeafEntries(node->page)[i - 1].pid;
+		GBTMemoryNode* child_node = memoryNode(child);
+		if (child_node == NULL && child > 0) {
+			char empty[GBTFile::MAX_PAGE_SIZE];
+			memset(empty, 0, page_size);
+			child_node = writeMemoryNode(child, empty, MEMORY_FREE);
+		}
+		node->children[i] = child_node;
+	}
+}
 
-				// write to disk
-				PageId newRoot_pid = pf.endPid();
-				if ((rc = newRoot.write(newRoot_pid, pf)) < 0) return rc;
+RT GBTreeIndex::readNode(PageId pid, GBTLeafNode& node) const
+{
+	if (!in_memory)
+		return node.read(pid, pf);
+	GBTMemoryNode* memory = memoryNode(pid);
+	if (memory == NULL)
+		return RT_INVALID_PID;
+	return node.load(memory->page);
+}
 
-				// update rootPid and treeHeight
-				rootPid = newRoot_pid;
-				++treeHeight;
+RT GBTreeIndex::readNode(PageId pid, GBTNonLeafNode& node) const
+{
+	if (!in_memory)
+		return node.read(pid, pf);
+	GBTMemoryNode* memory = memoryNode(pid);
+	if (memory == NULL)
+		return RT_INVALID_PID;
+	return node.load(memory->page);
+}
 
-				if ((rc = updateTreeInfo()) < 0) return rc;
+RT GBTreeIndex::writeNode(PageId pid, const GBTLeafNode& node)
+{
+	if (!in_memory)
+		return pf.write(pid, node.getBuffer());
+	if (pid <= 0 || pid >= MEMORY_CHUNKS * MEMORY_CHUNK_SIZE)
+		return RT_INVALID_PID;
+	writeMemoryNode(pid, node.getBuffer(), MEMORY_LEAF);
+	return 0;
+}
 
-				return 0;
-			} else {
-				midKey = newMidKey;
-				return 1;
-			}
-		} else {
-			if(currentLevel == (treeHeight-1))
-			{
-		    	GBTLeafNode child_leaf(duplicate_key);
-		    	if ((rc = child_leaf.read(childNode, pf)) < 0) return rc;
-		    	if ((rc = non_leaf.insert(midKey, child_leaf.getNextNodePtr())) < 0) return rc;
-		    	// write
-		    	if ((rc = non_leaf.write(currentNode, pf)) < 0) return rc;
-			}
-			else
-			{
-				if((rc = non_leaf.insert(midKey, pf.endPid() - 1)) < 0) return rc;
-				//write
-				if((rc = non_leaf.write(currentNode, pf)) < 0) return rc;
-			}
+RT GBTreeIndex::writeNode(PageId pid, const GBTNonLeafNode& node)
+{
+	if (!in_memory)
+		return pf.write(pid, node.getBuffer());
+	if (pid <= 0 || pid >= MEMORY_CHUNKS * MEMORY_CHUNK_SIZE)
+		return RT_INVALID_PID;
+	writeMemoryNode(pid, node.getBuffer(), MEMORY_NON_LEAF);
+	return 0;
+}
 
-			return 0;
-		}
-	}
+RT GBTreeIndex::readPage(PageId pid, char* page) const
+{
+	if (!in_memory)
+		return pf.read(pid, page);
+	GBTMemoryNode* memory = memoryNode(pid);
+	if (memory == NULL)
+		return RT_INVALID_PID;
+	memcpy(page, memory->page, page_size);
+	return 0;
+}
 
+RT GBTreeIndex::writePage(PageId pid, const char* page)
+{
+	if (!in_memory)
+		return pf.write(pid, page);
+	if (pid <= 0 || pid >= MEMORY_CHUNKS * MEMORY_CHUNK_SIZE)
+		return RT_INVALID_PID;
+	writeMemoryNode(pid, page, MEMORY_FREE);
 	return 0;
 }
 
+bool GBTreeIndex::hasPage(PageId pid) const
+{
+	if (!in_memory)
+		return pid < pf.endPid();
+	return memoryNode(pid) != NULL;
+}
+
 /*
- * Find the leaf-node index entry whose key value is larger than or 
- * equal to searchKey, and output the location of the entry in IndexCursor.
- * IndexCursor is a "pointer" to a B+tree leaf-node entry consisting of
- * the PageId of the node and the SlotID of the index entry.
- * Note that, for range queries, we need to scan the B+tree leaf nodes.
- * For example, if the query is "key > 1000", we should scan the leaf
- * nodes starting with the key value 1000. For this reason,
- * it is better to return the location of the leaf node entry 
- * for a given searchKey, instead of returning the RecordId
- * associated with the searchKey directly.
- * Once the location of the index entry is identified and returned 
- * from this function, you should call readForward() to retrieve the
- * actual (key, rid) pair from the index.
- * @param key[IN] the key to find.
- * @param cursor[OUT] the cursor pointing to the first index entry
- *                    with the key value.
- * @return error code. 0 if no error.
+ * Insert (key, RecordId) pair to the index.
+ * @param key[IN] the key for the value inserted into the index
+ * @param rid[IN] the RecordId for the record being inserted into the index
+ * @return error code. 0 if no error
  */
-RT GBTreeIndex::locate(uint64_t searchKey, IndexCursor& cursor)
+RT GBTreeIndex::insert(uint64_t key, const RecordId& rid)
 {
-	if (treeHeight == 0) {
-		return RT_NO_SUCH_RECORD;
-	}
 	RT rc;
-	int pid = rootPid; // read the root first
-	if (treeHeight != 1) {
-		GBTNonLeafNode nl_node;
-		for (int current_level = 1; current_level < treeHeight; ++current_level) {
-			if ((rc = nl_node.read(pid, pf)) < 0) return rc;
-			if ((rc = nl_node.locateChildPtr(searchKey, pid)) < 0) return rc;
+	uint64_t lsn = 0;
+
+	log_writers++;
+	{
+		std::vector<int> locked;
+		std::lock_guard<std::mutex> guard(writer_lock);
+
+		// keys that arrive in order form a run of appends to the right edge
+		append_run = (append_run > 0 && key >= last_key) ? append_run + 1 : 1;
+		last_key = key;
+
+		bool done;
+		if ((rc = insertLastLeaf(key, rid, done)) == 0 && !done &&
+				(rc = lockInsertPath(key, rid, locked)) == 0) {
+			rc = insertTree(key, rid);
+			publishVersion();
+			unlock(locked);
 		}
+		if (rc == 0)
+			rc = logWrite(GBTWal::LOG_INSERT, key, rid, 0, lsn);
 	}
+	// the commit waits outside the writer lock, so later writers join its sync
+	if (rc == 0)
+		rc = commitLog(lsn);
+	log_writers--;
+	return rc;
+}
 
-	// read the leaf
-	GBTLeafNode l_node;
-	if ((rc = l_node.read(pid, pf)) < 0) return rc;
-	if ((rc = l_node.locate(searchKey, cursor.eid)) < 0) return rc;
-	cursor.pid = pid;
+/*
+ * A key behind the separator in front of the rightmost leaf belongs to
+ * that leaf. Unless the leaf splits, it is written without a descent
+ * from the root; a leaf that got a next page since it was remembered is
+ * no longer the rightmost one.
+ */
+RT GBTreeIndex::insertLastLeaf(uint64_t key, const RecordId& rid, bool& done)
+{
+	RT rc;
 
-	return 0;
+	done = false;
+	if (last_leaf == 0 || (last_has_low && key <= last_low))
+		return 0;
+	GBTLeafNode leaf(duplicate_key, page_size);
+	if ((rc = readNode(last_leaf, leaf)) < 0) return rc;
+	if (leaf.getNextNodePtr() != 0 || leaf.isFull(key, rid))
+		return 0;
+
+	std::vector<int> locked(1, last_leaf % LATCH_COUNT);
+	latches[locked[0]].fetch_add(1, std::memory_order_acq_rel);
+	if ((rc = leaf.insert(key, rid)) == 0 && (rc = preservePage(last_leaf)) == 0)
+		rc = writeNode(last_leaf, leaf);
+	publishVersion();
+	unlock(locked);
+	done = true;
+	return rc;
 }
 
 /*
- * Read the (key, rid) pair at the location specified by the index cursor,
- * and move foward the cursor to the next entry.
- * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
- * @param key[OUT] the key stored at the index cursor location.
- * @param rid[OUT] the RecordId stored at the index cursor location.
- * @return error code. 0 if no error
+ * Only this writer changes the tree, so the descent needs no validation.
+ * A latch is listed by its number, LATCH_COUNT stands for the tree latch.
  */
-RT GBTreeIndex::readForward(IndexCursor& cursor, uint64_t& key, RecordId& rid)
+RT GBTreeIndex::lockInsertPath(uint64_t key, const RecordId& rid, std::vector<int>& locked)
 {
 	RT rc;
-	GBTLeafNode l_node;
+	std::vector<PathEntry> path;
+	PageId leafPid;
 
-	if ((rc = l_node.read(cursor.pid, pf)) < 0) return rc;
+	locked.clear();
+	if (rootPid == -1) {
+		locked.push_back(LATCH_COUNT);
+	} else {
+		if ((rc = findPath(key, path, leafPid)) < 0) return rc;
+		GBTLeafNode leaf(duplicate_key, page_size);
+		if ((rc = readNode(leafPid, leaf)) < 0) return rc;
+		locked.push_back(leafPid % LATCH_COUNT);
 
-	if (cursor.eid == l_node.getKeyCount()) { // move to the next sibling
-			int next_pid = l_node.getNextNodePtr();
-			if (next_pid == 0) { // no more sibling
-				return RT_END_OF_TREE;
-			} else {
-				cursor.pid = next_pid;
-				cursor.eid = 0;
-				if ((rc = l_node.read(cursor.pid, pf)) < 0) return rc;
-			}
-	}
+		// remember the rightmost leaf for the appends that follow
+		if (leaf.getNextNodePtr() == 0) {
+			bool hasUpper;
+			uint64_t upper;
+			if ((rc = leafBounds(path, last_has_low, last_low, hasUpper, upper)) < 0) return rc;
+			last_leaf = leafPid;
+		}
 
+		// overflow pages and the leaves behind them are latched with the tree
+		if (duplicate_key) {
+			PageId chainPid;
+			GBTLeafNode chain(duplicate_key, page_size);
+			if ((rc = firstOverflow(leaf, chainPid, chain)) < 0) return rc;
+			if (chainPid != 0 || leaf.isFull(key, rid)) {
+				lockTree(locked);
+				return 0;
+			}
+		}
 
-	l_node.readEntry(cursor.eid, key, rid);
-	cursor.eid++;
+		// a full node splits and changes its parent as well
+		bool split = leaf.isFull(key, rid);
+		for (int level = (int) path.size() - 1; level >= 0 && split; level--) {
+			GBTNonLeafNode node(page_size);
+			if ((rc = readNode(path[level].pid, node)) < 0) return rc;
+			locked.push_back(path[level].pid % LATCH_COUNT);
+			split = (node.getKeyCount() == node_keys);
+		}
+		if (split)
+			locked.push_back(LATCH_COUNT);
+	}
 
+	std::sort(locked.begin(), locked.end());
+	locked.erase(std::unique(locked.begin(), locked.end()), locked.end());
+	for (size_t i = 0; i < locked.size(); i++) {
+		std::atomic<uint64_t>& latch = (locked[i] == LATCH_COUNT) ? tree_latch : latches[locked[i]];
+		latch.fetch_add(1, std::memory_order_acq_rel);
+	}
 	return 0;
 }
-RT GBTreeIndex::loadLeafNode(PageId pid, GBTLeafNode& node)
+
+void GBTreeIndex::lockTree(std::vector<int>& locked)
 {
-	RT rt;
-	if ((rt = node.read(pid, pf)) < 0)
-		return rt;
-	return 0;
+	locked.clear();
+	for (int i = 0; i <= LATCH_COUNT; i++) {
+		std::atomic<uint64_t>& latch = (i == LATCH_COUNT) ? tree_latch : latches[i];
+		latch.fetch_add(1, std::memory_order_acq_rel);
+		locked.push_back(i);
+	}
 }
 
-
-/**
-* Write rootPid & treeHeight to pagePid = 0
-*/
-RT GBTreeIndex::updateTreeInfo() {
-	// update rootPid and treeHeight
-	memcpy(treeInfo_buffer, &rootPid, sizeof(rootPid));
-	memcpy(treeInfo_buffer + sizeof(rootPid), &treeHeight, sizeof(treeHeight));
-	return pf.write(0, treeInfo_buffer);
+void GBTreeIndex::unlock(std::vector<int>& locked)
+{
+	for (size_t i = 0; i < locked.size(); i++) {
+		std::atomic<uint64_t>& latch = (locked[i] == LATCH_COUNT) ? tree_latch : latches[locked[i]];
+		latch.fetch_add(1, std::memory_order_release);
+	}
+	locked.clear();
 }
 
-RT GBTreeIndex::pointToSmallestKey(IndexCursor& cursor) {
-	if (treeHeight == 0) {
-		return RT_NO_SUCH_RECORD;
-	}
+RT GBTreeIndex::insertTree(uint64_t key, const RecordId& rid)
+{
 	RT rc;
-	int pid = rootPid; // read the root first
-	if (treeHeight != 1) {
-		GBTNonLeafNode nl_node;
-		for (int current_level = 1; current_level < treeHeight; ++current_level) {
-			if ((rc = nl_node.read(pid, pf)) < 0) return rc;
-			if ((rc = nl_node.getLeftSiblingPid(pid)) < 0) return rc;
-		}
+
+	if (rootPid == -1) { // we have an empty tree
+		GBTLeafNode leaf(duplicate_key, page_size);
+		PageId pid;
+		if ((rc = leaf.insert(key, rid)) < 0) return rc;
+		if ((rc = allocatePage(pid)) < 0) return rc;
+		if ((rc = writeNode(pid, leaf)) < 0) return rc;
+
+		rootPid = pid;
+		treeHeight = 1;
+
+		// update tree info
+		return updateTreeInfo();
+	}
+
+	uint64_t midKey;
+	PageId siblingPid;
+	split_fill = 50;
+	if ((rc = insertHelper(1, rootPid, key, rid, midKey, siblingPid)) <= 0)
+		return rc;
+
+	// the root was split: create a new root
+	GBTNonLeafNode root(page_size);
+	PageId pid;
+	if ((rc = root.initializeRoot(rootPid, midKey, siblingPid)) < 0) return rc;
+	if ((rc = allocatePage(pid)) < 0) return rc;
+	if ((rc = writeNode(pid, root)) < 0) return rc;
+
+	rootPid = pid;
+	++treeHeight;
+	return updateTreeInfo();
+}
+
+/*
+ * Start a bottom-up build of an empty index.
+ * @return error code. 0 if no error
+ */
+RT GBTreeIndex::bulkLoadBegin()
+{
+	RT rc;
+
+	if (rootPid != -1)
+		return RT_INVALID_NODE;
+
+	// a load is not logged: it starts and ends with a checkpoint, and
+	// its pages are written back as usual in between
+	if (logging) {
+		if ((rc = checkpointLog()) < 0) return rc;
+		pf.holdDirty(false);
+	}
+
+	bulk_leaf = GBTLeafNode(duplicate_key, page_size);
+	bulk_pid = 1;  // page 0 holds the tree info
+	bulk_pending = false;
+	bulk_children.clear();
+	free_pids.clear();
+	// the leaves overwrite the pages of an emptied index, free or not
+	freePid = 0;
+	return 0;
+}
+
+/*
+ * Add the next (key, rid) pair of a bulk load.
+ * A pair is held back until the next one arrives, so that without
+ * duplicate keys only the last pair of equal keys is stored.
+ */
+RT GBTreeIndex::bulkLoadAppend(uint64_t key, const RecordId& rid)
+{
+	RT rc;
+
+	if (bulk_pending) {
+		if (!duplicate_key && key == bulk_key) {
+			bulk_rid = rid;
+			return 0;
+		}
+		if (bulk_leaf.isFull(bulk_key, bulk_rid)) {
+			if ((rc = bulkFlushLeaf(bulk_pid + 1)) < 0) return rc;
+			bulk_pid++;
+		}
+		if ((rc = bulk_leaf.append(bulk_key, bulk_rid)) < 0) return rc;
+	}
+
+	bulk_key = key;
+	bulk_rid = rid;
+	bulk_pending = true;
+	return 0;
+}
+
+/*
+ * Write a finished leaf and remember its (max key, pid) for the parent level.
+ */
+RT GBTreeIndex::bulkWriteLeaf(GBTLeafNode& leaf, PageId pid, PageId next)
+{
+	RT rc;
+	uint64_t key;
+	RecordId rid;
+
+	if ((rc = leaf.readEntry(leaf.getKeyCount() - 1, key, rid)) < 0) return rc;
+	if ((rc = leaf.setNextNodePtr(next)) < 0) return rc;
+	if ((rc = writeNode(pid, leaf)) < 0) return rc;
+	bulk_children.push_back(std::make_pair(key, pid));
+	return 0;
+}
+
+/*
+ * Write the leaf being filled and start a new one.
+ */
+RT GBTreeIndex::bulkFlushLeaf(PageId next)
+{
+	RT rc;
+
+	if ((rc = bulkWriteLeaf(bulk_leaf, bulk_pid, next)) < 0) return rc;
+	bulk_leaf = GBTLeafNode(duplicate_key, page_size);
+	return 0;
+}
+
+/*
+ * Build one non-leaf level over bulk_children. The children are spread
+ * evenly over as few nodes as possible; every node gets at least two children.
+ * On return bulk_children holds the (max key, pid) of the new nodes.
+ */
+RT GBTreeIndex::bulkBuildLevel()
+{
+	RT rc;
+	std::vector<std::pair<uint64_t, PageId> > parents;
+	int n = bulk_children.size();
+	int per_node = node_keys + 1;
+	int nodes = (n + per_node - 1) / per_node;
+
+	int first = 0;
+	for (int i = 0; i < nodes; i++) {
+		int count = n / nodes + (i < n % nodes ? 1 : 0);
+		GBTNonLeafNode node(page_size);
+		if ((rc = node.initializeRoot(bulk_children[first].second,
+				bulk_children[first].first, bulk_children[first+1].second)) < 0) return rc;
+		for (int j = first + 2; j < first + count; j++) {
+			if ((rc = node.append(bulk_children[j-1].first, bulk_children[j].second)) < 0) return rc;
+		}
+
+		PageId pid;
+		if ((rc = newNonLeafPage(pid)) < 0) return rc;
+		if ((rc = writeNode(pid, node)) < 0) return rc;
+		parents.push_back(std::make_pair(bulk_children[first + count - 1].first, pid));
+		first += count;
+	}
+
+	bulk_children.swap(parents);
+	return 0;
+}
+
+/*
+ * Finish a bulk load: write the last leaf, build the levels above it
+ * and store the new root.
+ */
+RT GBTreeIndex::bulkLoadEnd()
+{
+	RT rc;
+
+	if (logging)
+		pf.holdDirty(true);
+	if (!bulk_pending)
+		return 0;  // nothing was loaded; the index stays empty
+
+	if (bulk_leaf.isFull(bulk_key, bulk_rid)) {
+		if ((rc = bulkFlushLeaf(bulk_pid + 1)) < 0) return rc;
+		bulk_pid++;
+	}
+	if ((rc = bulk_leaf.append(bulk_key, bulk_rid)) < 0) return rc;
+	if ((rc = bulkFlushLeaf(0)) < 0) return rc;
+	bulk_pending = false;
+
+	treeHeight = 1;
+	while (bulk_children.size() > 1) {
+		if ((rc = bulkBuildLevel()) < 0) return rc;
+		treeHeight++;
+	}
+	rootPid = bulk_children[0].second;
+	bulk_children.clear();
+
+	if ((rc = updateTreeInfo()) < 0) return rc;
+	publishVersion();
+	return logging ? checkpointLog() : 0;
+}
+
+RT GBTreeIndex::newNonLeafPage(PageId& pid)
+{
+	if (free_pids.empty())
+		return allocatePage(pid);
+	pid = free_pids.back();
+	free_pids.pop_back();
+	return 0;
+}
+
+/*
+ * Start merging a sorted batch into the index: list every leaf with the
+ * largest key routed to it, and remember the non-leaf pages for reuse.
+ * @return error code. 0 if no error
+ */
+RT GBTreeIndex::mergeBegin()
+{
+	RT rc;
+
+	if (rootPid == -1)
+		return RT_INVALID_NODE;
+
+	// not logged, like a bulk load
+	if (logging) {
+		if ((rc = checkpointLog()) < 0) return rc;
+		pf.holdDirty(false);
+	}
+
+	last_leaf = 0;
+	merge_leaves.clear();
+	free_pids.clear();
+	bulk_children.clear();
+	if ((rc = mergeCollect(rootPid, 1, UINT64_MAX)) < 0) return rc;
+
+	merge_pos = 0;
+	merge_loaded = false;
+	merge_split = false;
+	merge_held = false;
+	bulk_pending = false;
+	return 0;
+}
+
+/*
+ * Walk the subtree at pid. locateChildPtr() sends a key to the first child
+ * whose separator is >= key, so the separator in front of a child is the
+ * largest key of that child; the last child inherits the bound of its parent.
+ */
+RT GBTreeIndex::mergeCollect(PageId pid, int level, uint64_t bound)
+{
+	RT rc;
+
+	if (level == treeHeight) {
+		merge_leaves.push_back(std::make_pair(bound, pid));
+		return 0;
+	}
+
+	GBTNonLeafNode node(page_size);
+	if ((rc = readNode(pid, node)) < 0) return rc;
+	free_pids.push_back(pid);
+
+	std::vector<std::pair<uint64_t, PageId> > children;
+	PageId child;
+	uint64_t key;
+	if ((rc = node.getLeftSiblingPid(child)) < 0) return rc;
+	for (int i = 0; i < node.getKeyCount(); i++) {
+		PageId next;
+		if ((rc = node.readEntry(i, key, next)) < 0) return rc;
+		children.push_back(std::make_pair(key, child));
+		child = next;
+	}
+	children.push_back(std::make_pair(bound, child));
+
+	for (size_t i = 0; i < children.size(); i++) {
+		if ((rc = mergeCollect(children[i].second, level + 1, children[i].first)) < 0) return rc;
+	}
+	return 0;
+}
+
+/*
+ * Add the next pair of a merge. As in bulkLoadAppend(), a pair is held
+ * back so that without duplicate keys the last pair of equal keys wins.
+ */
+RT GBTreeIndex::mergeAppend(uint64_t key, const RecordId& rid)
+{
+	RT rc;
+
+	if (bulk_pending) {
+		if (!duplicate_key && key == bulk_key) {
+			bulk_rid = rid;
+			return 0;
+		}
+		if ((rc = mergeEntry(bulk_key, bulk_rid)) < 0) return rc;
+	}
+
+	bulk_key = key;
+	bulk_rid = rid;
+	bulk_pending = true;
+	return 0;
+}
+
+/*
+ * Store one pair: finish the leaves in front of its key range, read the
+ * leaf of its key range if this is its first pair, then write the old
+ * entries in front of the pair and the pair itself.
+ */
+RT GBTreeIndex::mergeEntry(uint64_t key, const RecordId& rid)
+{
+	RT rc;
+
+	while (key > merge_leaves[merge_pos].first) {
+		if ((rc = mergeNextLeaf()) < 0) return rc;
+	}
+
+	if (!merge_loaded) {
+		GBTLeafNode leaf(duplicate_key, page_size);
+		uint64_t old_key;
+		RecordId old_rid;
+
+		bulk_pid = merge_leaves[merge_pos].second;
+		if ((rc = readNode(bulk_pid, leaf)) < 0) return rc;
+		merge_entries.clear();
+		for (int i = 0; i < leaf.getKeyCount(); i++) {
+			leaf.readEntry(i, old_key, old_rid);
+			merge_entries.push_back(std::make_pair(old_key, old_rid));
+		}
+		merge_next_leaf = leaf.getNextNodePtr();
+
+		// overflow pages behind the leaf are merged into it and freed; the
+		// long run of equal keys is then spread over leaves like in a bulk load
+		while (merge_next_leaf > 0) {
+			if ((rc = readNode(merge_next_leaf, leaf)) < 0) return rc;
+			if (!leaf.isOverflow())
+				break;
+			for (int i = 0; i < leaf.getKeyCount(); i++) {
+				leaf.readEntry(i, old_key, old_rid);
+				merge_entries.push_back(std::make_pair(old_key, old_rid));
+			}
+			free_pids.push_back(merge_next_leaf);
+			merge_split = true;
+			merge_next_leaf = leaf.getNextNodePtr();
+		}
+		merge_next_entry = 0;
+		bulk_leaf = GBTLeafNode(duplicate_key, page_size);
+		merge_loaded = true;
+	}
+
+	// equal old keys stay in front of the new pair, or are replaced by it
+	while (merge_next_entry < merge_entries.size() && merge_entries[merge_next_entry].first <= key) {
+		const std::pair<uint64_t, RecordId>& entry = merge_entries[merge_next_entry++];
+		if (!duplicate_key && entry.first == key)
+			continue;
+		if ((rc = mergeOutput(entry.first, entry.second)) < 0) return rc;
+	}
+	return mergeOutput(key, rid);
+}
+
+/*
+ * Append a pair to the leaf being written. A full leaf is held back and
+ * the following pairs go to a new page chained behind it; the page held
+ * before that one is written, as it stays full.
+ */
+RT GBTreeIndex::mergeOutput(uint64_t key, const RecordId& rid)
+{
+	RT rc;
+
+	if (bulk_leaf.isFull(key, rid)) {
+		if (merge_held && (rc = bulkWriteLeaf(merge_held_leaf, merge_held_pid, bulk_pid)) < 0) return rc;
+		merge_held_leaf = bulk_leaf;
+		merge_held_pid = bulk_pid;
+		merge_held = true;
+		bulk_leaf = GBTLeafNode(duplicate_key, page_size);
+		if ((rc = allocatePage(bulk_pid)) < 0) return rc;
+		merge_split = true;
+	}
+	return bulk_leaf.append(key, rid);
+}
+
+/*
+ * Move on to the next leaf. If the current leaf received pairs, its
+ * remaining old entries are written and the last page is chained to
+ * the old next leaf. If the leaf overflowed, the held full page and the
+ * last page share their entries evenly, so that neither is left nearly
+ * empty or completely full for the next merge.
+ */
+RT GBTreeIndex::mergeNextLeaf()
+{
+	RT rc;
+
+	if (merge_loaded) {
+		while (merge_next_entry < merge_entries.size()) {
+			const std::pair<uint64_t, RecordId>& entry = merge_entries[merge_next_entry++];
+			if ((rc = mergeOutput(entry.first, entry.second)) < 0) return rc;
+		}
+		if (merge_held) {
+			int held_count = merge_held_leaf.getKeyCount();
+			int last_count = bulk_leaf.getKeyCount();
+			int keep = (held_count + last_count + 1) / 2;
+			GBTLeafNode last(duplicate_key, page_size);
+			uint64_t key;
+			RecordId rid;
+
+			// with packed leaves the shared entries may span too many
+			// keys for one page; then both pages stay as they are
+			rc = 0;
+			for (int i = keep; i < held_count && rc == 0; i++) {
+				merge_held_leaf.readEntry(i, key, rid);
+				rc = last.append(key, rid);
+			}
+			for (int i = 0; i < last_count && rc == 0; i++) {
+				bulk_leaf.readEntry(i, key, rid);
+				rc = last.append(key, rid);
+			}
+			if (rc == 0) {
+				merge_held_leaf.updateTotalKeys(keep);
+				bulk_leaf = last;
+			} else if (rc != RT_NODE_FULL) {
+				return rc;
+			}
+			if ((rc = bulkWriteLeaf(merge_held_leaf, merge_held_pid, bulk_pid)) < 0) return rc;
+			merge_held = false;
+		}
+		if ((rc = bulkFlushLeaf(merge_next_leaf)) < 0) return rc;
+		merge_loaded = false;
+	} else {
+		bulk_children.push_back(merge_leaves[merge_pos]);
+	}
+	merge_pos++;
+	return 0;
+}
+
+/*
+ * Finish a merge. The non-leaf levels only change if a leaf overflowed;
+ * then they are rebuilt over the new list of leaves.
+ */
+RT GBTreeIndex::mergeEnd()
+{
+	RT rc;
+
+	if (logging)
+		pf.holdDirty(true);
+	if (bulk_pending) {
+		if ((rc = mergeEntry(bulk_key, bulk_rid)) < 0) return rc;
+		bulk_pending = false;
+	}
+	while (merge_pos < merge_leaves.size()) {
+		if ((rc = mergeNextLeaf()) < 0) return rc;
+	}
+	merge_leaves.clear();
+	merge_entries.clear();
+
+	if (merge_split) {
+		treeHeight = 1;
+		while (bulk_children.size() > 1) {
+			if ((rc = bulkBuildLevel()) < 0) return rc;
+			treeHeight++;
+		}
+		rootPid = bulk_children[0].second;
+		if ((rc = updateTreeInfo()) < 0) return rc;
+
+		// the new levels may need fewer nodes than the old ones
+		for (size_t i = 0; i < free_pids.size(); i++) {
+			if ((rc = freePage(free_pids[i])) < 0) return rc;
+		}
+	}
+	bulk_children.clear();
+	free_pids.clear();
+	publishVersion();
+	return logging ? checkpointLog() : 0;
+}
+
+/*
+ * Insert (key, rid) into the subtree at currentNode.
+ * @return 1 if currentNode was split; the new sibling behind it is
+ *         siblingPid and midKey separates the two. 0 if not split.
+ */
+RT GBTreeIndex::insertHelper(int currentLevel, PageId currentNode, const uint64_t &key, const RecordId &rid, uint64_t& midKey, PageId& siblingPid) {
+	RT rc;
+
+	if (currentLevel == treeHeight) { // leaf
+		GBTLeafNode leaf(duplicate_key, page_size);
+		if ((rc = readNode(currentNode, leaf)) < 0) return rc;
+		if (duplicate_key) {
+			bool done;
+			rc = insertDuplicate(currentNode, leaf, key, rid, midKey, siblingPid, done);
+			if (rc < 0 || done) return rc;
+		}
+		if (leaf.isFull(key, rid)) { // full node
+			// a split at the right edge of the tree leaves the leaf full
+			// instead of half empty: to APPEND_FILL, or completely in a
+			// run of appends, where no smaller key is expected to follow
+			if (leaf.getNextNodePtr() == 0) {
+				uint64_t lastKey;
+				RecordId lastRid;
+				if ((rc = leaf.readEntry(leaf.getKeyCount() - 1, lastKey, lastRid)) < 0) return rc;
+				if (key >= lastKey)
+					split_fill = (append_run >= APPEND_RUN) ? 100 : APPEND_FILL;
+			}
+			GBTLeafNode sibling(duplicate_key, page_size);
+			if ((rc = leaf.insertAndSplit(key, rid, sibling, midKey, split_fill)) < 0) return rc;
+			if ((rc = allocatePage(siblingPid)) < 0) return rc;
+
+			// update 2 nodes. the sibling goes first, so a reader that
+			// follows the next pointer of the leaf finds it written
+			if ((rc = leaf.setNextNodePtr(siblingPid)) < 0) return rc;
+			if ((rc = writeNode(siblingPid, sibling)) < 0) return rc;
+			if ((rc = preservePage(currentNode)) < 0) return rc;
+			if ((rc = writeNode(currentNode, leaf)) < 0)	return rc;
+
+			return 1; 
+
+		} else {
+			if ((rc = leaf.insert(key, rid)) < 0) return rc;
+			if ((rc = preservePage(currentNode)) < 0) return rc;
+			if ((rc = writeNode(currentNode, leaf)) < 0) return rc;
+			return 0;
+		}
+	} else {
+		// read the content of the current node
+		GBTNonLeafNode non_leaf(page_size);
+		if ((rc = readNode(currentNode, non_leaf)) < 0) return rc;
+		
+		// determine the child node
+		PageId childNode = 0;
+		int childIndex;
+		if ((rc = non_leaf.locateChildIndex(key, childIndex)) < 0) return rc;
+		if ((rc = non_leaf.getChildPtr(childIndex, childNode)) < 0) return rc;
+		
+	    /**
+	     * 
+	     * @ Author : edward liu
+	     * @ Date : 3/19/2014
+	     */
+		if(childNode == 0) return 0;
+
+		// follow this child node to the leaf
+		uint64_t childKey;
+		PageId childSibling;
+		if ((rc = insertHelper(currentLevel+1, childNode, key, rid, childKey, childSibling)) <= 0) return rc;
+
+		// the child was split. We have to determine if the current non-leaf node is full
+		// to push the key to the upper level
+		if (non_leaf.getKeyCount() == node_keys) { // full
+			// the right edge splits like the leaf below it
+			int fill = (childIndex == non_leaf.getKeyCount()) ? split_fill : 50;
+			GBTNonLeafNode nf_sibling(page_size);
+			if ((rc = non_leaf.insertAtAndSplit(childIndex, childKey, childSibling, nf_sibling, midKey, fill)) < 0) return rc;
+			if ((rc = allocatePage(siblingPid)) < 0) return rc;
+
+			if ((rc = writeNode(siblingPid, nf_sibling)) < 0) return rc;
+			if ((rc = preservePage(currentNode)) < 0) return rc;
+			if ((rc = writeNode(currentNode, non_leaf)) < 0) return rc;
+			return 1;
+		} else {
+			// the new sibling goes right behind the child that was split
+			if ((rc = non_leaf.insertAt(childIndex, childKey, childSibling)) < 0) return rc;
+			if ((rc = preservePage(currentNode)) < 0) return rc;
+			if ((rc = writeNode(currentNode, non_leaf)) < 0) return rc;
+			return 0;
+		}
+	}
+
+	return 0;
+}
+
+RT GBTreeIndex::firstOverflow(GBTLeafNode& leaf, PageId& pid, GBTLeafNode& page)
+{
+	RT rc;
+	PageId next = leaf.getNextNodePtr();
+
+	pid = 0;
+	if (!duplicate_key || next <= 0)
+		return 0;
+	if ((rc = readNode(next, page)) < 0) return rc;
+	if (page.isOverflow())
+		pid = next;
+	return 0;
+}
+
+/*
+ * The leaf never holds keys above its chain. A key equal to the chain
+ * goes to the leaf while it has room, then to the first overflow page,
+ * then to a new overflow page in front of the others. A leaf that is
+ * full of one key starts a chain instead of failing to split.
+ */
+RT GBTreeIndex::insertDuplicate(PageId leafPid, GBTLeafNode& leaf, uint64_t key, const RecordId& rid,
+		uint64_t& midKey, PageId& siblingPid, bool& done)
+{
+	RT rc;
+	PageId chainPid;
+	GBTLeafNode chain(duplicate_key, page_size);
+	uint64_t chainKey, first;
+	RecordId r;
+
+	done = false;
+	if ((rc = firstOverflow(leaf, chainPid, chain)) < 0) return rc;
+	if (chainPid != 0) {
+		if ((rc = chain.readEntry(0, chainKey, r)) < 0) return rc;
+		if (key < chainKey || (key == chainKey && !leaf.isFull(key, rid)))
+			return 0;
+	} else {
+		int count = leaf.getKeyCount();
+		if (count == 0 || !leaf.isFull(key, rid))
+			return 0;
+		leaf.readEntry(0, first, r);
+		leaf.readEntry(count - 1, chainKey, r);
+		if (first != key || chainKey != key)
+			return 0;
+	}
+	done = true;
+
+	if (key > chainKey) {
+		// a new leaf behind the last overflow page
+		PageId lastPid = chainPid;
+		for (;;) {
+			PageId next = chain.getNextNodePtr();
+			GBTLeafNode page(duplicate_key, page_size);
+			if (next <= 0) break;
+			if ((rc = readNode(next, page)) < 0) return rc;
+			if (!page.isOverflow()) break;
+			lastPid = next;
+			chain = page;
+		}
+		GBTLeafNode sibling(duplicate_key, page_size);
+		if ((rc = sibling.insert(key, rid)) < 0) return rc;
+		if ((rc = allocatePage(siblingPid)) < 0) return rc;
+		if ((rc = sibling.setNextNodePtr(chain.getNextNodePtr())) < 0) return rc;
+		if ((rc = writeNode(siblingPid, sibling)) < 0) return rc;
+		if ((rc = chain.setNextNodePtr(siblingPid)) < 0) return rc;
+		if ((rc = preservePage(lastPid)) < 0) return rc;
+		if ((rc = writeNode(lastPid, chain)) < 0) return rc;
+		midKey = chainKey;
+		return 1;
+	}
+
+	if (chainPid != 0 && !chain.isFull(key, rid)) {
+		if ((rc = chain.insert(key, rid)) < 0) return rc;
+		if ((rc = preservePage(chainPid)) < 0) return rc;
+		return writeNode(chainPid, chain);
+	}
+
+	// the new page is written before the leaf points to it
+	GBTLeafNode page(duplicate_key, page_size);
+	PageId pid;
+	page.setOverflow(true);
+	if ((rc = page.insert(key, rid)) < 0) return rc;
+	if ((rc = page.setNextNodePtr(leaf.getNextNodePtr())) < 0) return rc;
+	if ((rc = allocatePage(pid)) < 0) return rc;
+	if ((rc = writeNode(pid, page)) < 0) return rc;
+	if ((rc = leaf.setNextNodePtr(pid)) < 0) return rc;
+	if ((rc = preservePage(leafPid)) < 0) return rc;
+	return writeNode(leafPid, leaf);
+}
+
+RT GBTreeIndex::removeOverflow(PageId prevPid, PageId pid, GBTLeafNode& page)
+{
+	RT rc;
+
+	if (page.getKeyCount() > 0) {
+		if ((rc = preservePage(pid)) < 0) return rc;
+		return writeNode(pid, page);
+	}
+	GBTLeafNode prev(duplicate_key, page_size);
+	if ((rc = readNode(prevPid, prev)) < 0) return rc;
+	if ((rc = prev.setNextNodePtr(page.getNextNodePtr())) < 0) return rc;
+	if ((rc = preservePage(prevPid)) < 0) return rc;
+	if ((rc = writeNode(prevPid, prev)) < 0) return rc;
+	return freePage(pid);
+}
+
+/*
+ * The chain holds one key, which is not below any key of the leaf, so
+ * its entries go to the end of the leaf.
+ */
+RT GBTreeIndex::pullOverflow(PageId leafPid, GBTLeafNode& leaf, bool& chained)
+{
+	RT rc;
+	PageId pid;
+	GBTLeafNode page(duplicate_key, page_size);
+	uint64_t key;
+	RecordId rid;
+
+	chained = false;
+	while (true) {
+		if ((rc = firstOverflow(leaf, pid, page)) < 0) return rc;
+		if (pid == 0)
+			return 0;
+		int count = page.getKeyCount();
+		while (count > 0) {
+			page.readEntry(count - 1, key, rid);
+			if (leaf.isFull(key, rid))
+				break;
+			if ((rc = leaf.append(key, rid)) < 0) return rc;
+			if ((rc = page.remove(count - 1)) < 0) return rc;
+			count--;
+		}
+		if (count > 0) {
+			chained = true;
+			if ((rc = preservePage(pid)) < 0) return rc;
+			return writeNode(pid, page);
+		}
+		// the leaf is written by the caller
+		if ((rc = leaf.setNextNodePtr(page.getNextNodePtr())) < 0) return rc;
+		if ((rc = freePage(pid)) < 0) return rc;
+	}
+}
+
+/*
+ * Descend from the root to the leaf searchKey belongs to.
+ */
+RT GBTreeIndex::findPath(uint64_t searchKey, std::vector<PathEntry>& path, PageId& leafPid)
+{
+	RT rc;
+	GBTNonLeafNode node(page_size);
+	PathEntry entry;
+
+	path.clear();
+	leafPid = rootPid;
+	for (int level = 1; level < treeHeight; level++) {
+		entry.pid = leafPid;
+		if ((rc = readNode(entry.pid, node)) < 0) return rc;
+		if ((rc = node.locateChildIndex(searchKey, entry.child)) < 0) return rc;
+		if ((rc = node.getChildPtr(entry.child, leafPid)) < 0) return rc;
+		path.push_back(entry);
+	}
+	return 0;
+}
+
+/*
+ * Step to the next leaf: go up to the first node that has a child behind
+ * the one taken, and down its leftmost path.
+ */
+RT GBTreeIndex::nextLeafPath(std::vector<PathEntry>& path, PageId& leafPid)
+{
+	RT rc;
+	GBTNonLeafNode node(page_size);
+	int level = path.size() - 1;
+
+	while (level >= 0) {
+		if ((rc = readNode(path[level].pid, node)) < 0) return rc;
+		if (path[level].child < node.getKeyCount())
+			break;
+		level--;
+	}
+	if (level < 0)
+		return RT_END_OF_TREE;
+
+	path[level].child++;
+	if ((rc = node.getChildPtr(path[level].child, leafPid)) < 0) return rc;
+	for (size_t i = level + 1; i < path.size(); i++) {
+		path[i].pid = leafPid;
+		path[i].child = 0;
+		if ((rc = readNode(leafPid, node)) < 0) return rc;
+		if ((rc = node.getChildPtr(0, leafPid)) < 0) return rc;
+	}
+	return 0;
+}
+
+/*
+ * A leaf holds keys in (lower, upper], where upper is the separator behind
+ * it and lower the one in front of it, taken from the lowest node on the
+ * path that has one. Keys equal to a separator may also sit on its right.
+ */
+RT GBTreeIndex::leafBounds(const std::vector<PathEntry>& path,
+		bool& hasLower, uint64_t& lower, bool& hasUpper, uint64_t& upper)
+{
+	RT rc;
+	GBTNonLeafNode node(page_size);
+	PageId pid;
+
+	hasLower = hasUpper = false;
+	for (int level = path.size() - 1; level >= 0 && !(hasLower && hasUpper); level--) {
+		if ((rc = readNode(path[level].pid, node)) < 0) return rc;
+		if (!hasUpper && path[level].child < node.getKeyCount()) {
+			if ((rc = node.readEntry(path[level].child, upper, pid)) < 0) return rc;
+			hasUpper = true;
+		}
+		if (!hasLower && path[level].child > 0) {
+			if ((rc = node.readEntry(path[level].child - 1, lower, pid)) < 0) return rc;
+			hasLower = true;
+		}
+	}
+	return 0;
+}
+
+/*
+ * Find the (key, rid) pair. The leaf key is routed to holds it, unless
+ * key equals the separator behind that leaf: then equal keys may continue
+ * in the following leaves.
+ */
+RT GBTreeIndex::findEntry(uint64_t key, const RecordId& rid, std::vector<PathEntry>& path,
+		PageId& leafPid, GBTLeafNode& leaf, int& eid, PageId& prevPid)
+{
+	RT rc;
+	uint64_t k;
+	RecordId r;
+
+	prevPid = 0;
+	if (treeHeight == 0)
+		return RT_NO_SUCH_RECORD;
+	if ((rc = findPath(key, path, leafPid)) < 0) return rc;
+
+	while (true) {
+		if ((rc = readNode(leafPid, leaf)) < 0) return rc;
+		if (leaf.locate(key, eid) == 0) {
+			for (; eid < leaf.getKeyCount(); eid++) {
+				leaf.readEntry(eid, k, r);
+				if (k != key)
+					return RT_NO_SUCH_RECORD;
+				if (r == rid)
+					return 0;
+			}
+		}
+
+		// then the overflow pages behind the leaf
+		PageId pid = leafPid;
+		GBTLeafNode page(duplicate_key, page_size);
+		PageId next;
+		while (duplicate_key && (next = (pid == leafPid ? leaf : page).getNextNodePtr()) > 0) {
+			if ((rc = readNode(next, page)) < 0) return rc;
+			if (!page.isOverflow())
+				break;
+			for (eid = 0; eid < page.getKeyCount(); eid++) {
+				page.readEntry(eid, k, r);
+				if (k != key)
+					break;
+				if (r == rid) {
+					prevPid = pid;
+					leafPid = next;
+					leaf = page;
+					return 0;
+				}
+			}
+			pid = next;
+		}
+
+		bool hasLower, hasUpper;
+		uint64_t lower, upper;
+		if ((rc = leafBounds(path, hasLower, lower, hasUpper, upper)) < 0) return rc;
+		if (!hasUpper || upper != key)
+			return RT_NO_SUCH_RECORD;
+		if ((rc = nextLeafPath(path, leafPid)) < 0)
+			return (rc == RT_END_OF_TREE) ? RT_NO_SUCH_RECORD : rc;
+	}
+}
+
+/*
+ * Remove the (key, rid) pair from the index.
+ * @param key[IN] the key of the pair
+ * @param rid[IN] the RecordId of the pair
+ * @return error code. 0 if no error
+ */
+RT GBTreeIndex::remove(uint64_t key, const RecordId& rid)
+{
+	RT rc;
+	uint64_t lsn = 0;
+
+	log_writers++;
+	{
+		std::vector<int> locked;
+		std::lock_guard<std::mutex> guard(writer_lock);
+
+		// merges may free pages anywhere on the path: latch the whole tree
+		lockTree(locked);
+		last_leaf = 0;
+		rc = removeTree(key, rid);
+		publishVersion();
+		unlock(locked);
+		if (rc == 0)
+			rc = logWrite(GBTWal::LOG_REMOVE, key, rid, 0, lsn);
+	}
+	if (rc == 0)
+		rc = commitLog(lsn);
+	log_writers--;
+	return rc;
+}
+
+RT GBTreeIndex::removeTree(uint64_t key, const RecordId& rid)
+{
+	RT rc;
+	std::vector<PathEntry> path;
+	PageId leafPid;
+	GBTLeafNode leaf(duplicate_key, page_size);
+	int eid;
+	PageId prevPid;
+
+	if ((rc = findEntry(key, rid, path, leafPid, leaf, eid, prevPid)) < 0) return rc;
+	if ((rc = leaf.remove(eid)) < 0) return rc;
+	return prevPid ? removeOverflow(prevPid, leafPid, leaf) : removeFixLeaf(path, leafPid, leaf);
+}
+
+/*
+ * Change the key of a pair, inside its leaf if newKey belongs there.
+ */
+RT GBTreeIndex::update(uint64_t oldKey, uint64_t newKey, const RecordId& rid)
+{
+	RT rc;
+	uint64_t lsn = 0;
+
+	log_writers++;
+	{
+		std::vector<int> locked;
+		std::lock_guard<std::mutex> guard(writer_lock);
+
+		lockTree(locked);
+		last_leaf = 0;
+		rc = updateTree(oldKey, newKey, rid);
+		publishVersion();
+		unlock(locked);
+		if (rc == 0)
+			rc = logWrite(GBTWal::LOG_UPDATE, oldKey, rid, newKey, lsn);
+	}
+	if (rc == 0)
+		rc = commitLog(lsn);
+	log_writers--;
+	return rc;
+}
+
+RT GBTreeIndex::updateTree(uint64_t oldKey, uint64_t newKey, const RecordId& rid)
+{
+	RT rc;
+	std::vector<PathEntry> path;
+	PageId leafPid;
+	GBTLeafNode leaf(duplicate_key, page_size);
+	int eid;
+	PageId prevPid;
+
+	if ((rc = findEntry(oldKey, rid, path, leafPid, leaf, eid, prevPid)) < 0) return rc;
+	if (prevPid != 0) {
+		if ((rc = leaf.remove(eid)) < 0) return rc;
+		if ((rc = removeOverflow(prevPid, leafPid, leaf)) < 0) return rc;
+		return insertTree(newKey, rid);
+	}
+
+	bool hasLower, hasUpper;
+	uint64_t lower, upper;
+	if ((rc = leafBounds(path, hasLower, lower, hasUpper, upper)) < 0) return rc;
+
+	bool sameLeaf = (!hasLower || newKey > lower) && (!hasUpper || newKey <= upper);
+	if (sameLeaf && !duplicate_key) {
+		// without duplicate keys newKey would replace another pair and shrink the leaf
+		int other;
+		uint64_t k;
+		RecordId r;
+		if (leaf.locate(newKey, other) == 0 && leaf.readEntry(other, k, r) == 0 && k == newKey && r != rid)
+			sameLeaf = false;
+	}
+
+	if (sameLeaf && duplicate_key) {
+		// a key above the overflow pages behind the leaf must not go into it
+		PageId chainPid;
+		GBTLeafNode chain(duplicate_key, page_size);
+		if ((rc = firstOverflow(leaf, chainPid, chain)) < 0) return rc;
+		if (chainPid != 0)
+			sameLeaf = false;
+	}
+
+	if (sameLeaf) {
+		if ((rc = leaf.remove(eid)) < 0) return rc;
+		if ((rc = leaf.insert(newKey, rid)) < 0) return rc;
+		if ((rc = preservePage(leafPid)) < 0) return rc;
+		return writeNode(leafPid, leaf);
+	}
+
+	if ((rc = leaf.remove(eid)) < 0) return rc;
+	if ((rc = removeFixLeaf(path, leafPid, leaf)) < 0) return rc;
+	return insertTree(newKey, rid);
+}
+
+/*
+ * Write a leaf after a removal. A leaf below half full takes entries from
+ * the sibling behind it (or in front of it for the last child); if both
+ * fit in one leaf, the right one is merged into the left one, which keeps
+ * the leaf chain intact, and its separator is removed from the parent.
+ */
+RT GBTreeIndex::removeFixLeaf(std::vector<PathEntry>& path, PageId leafPid, GBTLeafNode& leaf)
+{
+	RT rc;
+
+	// a leaf with overflow pages is refilled from them first
+	if (leaf.getKeyCount() < leaf.maxKeyCount() / 2) {
+		bool chained;
+		if ((rc = pullOverflow(leafPid, leaf, chained)) < 0) return rc;
+		if (chained) {
+			if ((rc = preservePage(leafPid)) < 0) return rc;
+			return writeNode(leafPid, leaf);
+		}
+	}
+
+	if (path.empty()) { // the leaf is the root
+		if (leaf.getKeyCount() > 0) {
+			if ((rc = preservePage(leafPid)) < 0) return rc;
+			return writeNode(leafPid, leaf);
+		}
+		rootPid = -1;
+		treeHeight = 0;
+		if ((rc = updateTreeInfo()) < 0) return rc;
+		return freePage(leafPid);
+	}
+	if (leaf.getKeyCount() >= leaf.maxKeyCount() / 2) {
+		if ((rc = preservePage(leafPid)) < 0) return rc;
+		return writeNode(leafPid, leaf);
+	}
+
+	PathEntry& parentEntry = path.back();
+	GBTNonLeafNode parent(page_size);
+	if ((rc = readNode(parentEntry.pid, parent)) < 0) return rc;
+
+	int leftChild = (parentEntry.child < parent.getKeyCount()) ? parentEntry.child : parentEntry.child - 1;
+	PageId leftPid, rightPid;
+	if ((rc = parent.getChildPtr(leftChild, leftPid)) < 0) return rc;
+	if ((rc = parent.getChildPtr(leftChild + 1, rightPid)) < 0) return rc;
+
+	GBTLeafNode sibling(duplicate_key, page_size);
+	if ((rc = readNode(leftPid == leafPid ? rightPid : leftPid, sibling)) < 0) return rc;
+	GBTLeafNode& left = (leftPid == leafPid) ? leaf : sibling;
+	GBTLeafNode& right = (leftPid == leafPid) ? sibling : leaf;
+
+	// overflow pages between the two leaves stay with the left one
+	if (left.getNextNodePtr() != rightPid) {
+		if ((rc = preservePage(leafPid)) < 0) return rc;
+		return writeNode(leafPid, leaf);
+	}
+
+	std::vector<std::pair<uint64_t, RecordId> > entries;
+	uint64_t key;
+	RecordId rid;
+	for (int i = 0; i < left.getKeyCount(); i++) {
+		left.readEntry(i, key, rid);
+		entries.push_back(std::make_pair(key, rid));
+	}
+	for (int i = 0; i < right.getKeyCount(); i++) {
+		right.readEntry(i, key, rid);
+		entries.push_back(std::make_pair(key, rid));
+	}
+	PageId rightNext = right.getNextNodePtr();
+
+	if (GBTLeafNode::fits(&entries[0], entries.size(), page_size)) {
+		GBTLeafNode merged(duplicate_key, page_size);
+		for (size_t i = 0; i < entries.size(); i++) {
+			if ((rc = merged.append(entries[i].first, entries[i].second)) < 0) return rc;
+		}
+		if ((rc = merged.setNextNodePtr(rightNext)) < 0) return rc;
+		if ((rc = preservePage(leftPid)) < 0) return rc;
+		if ((rc = writeNode(leftPid, merged)) < 0) return rc;
+		if ((rc = freePage(rightPid)) < 0) return rc;
+		if ((rc = parent.remove(leftChild)) < 0) return rc;
+		return removeFixNonLeaf(path, path.size() - 1, parent);
+	}
+
+	// share the entries evenly; the separator is the largest key on the left.
+	// packed leaves may not fit that way, then the old split is kept
+	size_t half = (entries.size() + 1) / 2;
+	if (!GBTLeafNode::fits(&entries[0], half, page_size) ||
+			!GBTLeafNode::fits(&entries[half], entries.size() - half, page_size))
+		half = left.getKeyCount();
+	GBTLeafNode newLeft(duplicate_key, page_size), newRight(duplicate_key, page_size);
+	for (size_t i = 0; i < entries.size(); i++) {
+		GBTLeafNode& node = (i < half) ? newLeft : newRight;
+		if ((rc = node.append(entries[i].first, entries[i].second)) < 0) return rc;
+	}
+	if ((rc = newLeft.setNextNodePtr(rightPid)) < 0) return rc;
+	if ((rc = newRight.setNextNodePtr(rightNext)) < 0) return rc;
+	if ((rc = preservePage(leftPid)) < 0) return rc;
+	if ((rc = writeNode(leftPid, newLeft)) < 0) return rc;
+	if ((rc = preservePage(rightPid)) < 0) return rc;
+	if ((rc = writeNode(rightPid, newRight)) < 0) return rc;
+	if ((rc = parent.setKey(leftChild, entries[half - 1].first)) < 0) return rc;
+	if ((rc = preservePage(parentEntry.pid)) < 0) return rc;
+	return writeNode(parentEntry.pid, parent);
+}
+
+/*
+ * Write a non-leaf node after it lost a child. Like removeFixLeaf(), but
+ * the separator in the parent moves down between the two nodes when they
+ * are merged or share their children, and a root left with a single
+ * child is replaced by that child.
+ */
+RT GBTreeIndex::removeFixNonLeaf(std::vector<PathEntry>& path, int level, GBTNonLeafNode& node)
+{
+	RT rc;
+	PageId pid = path[level].pid;
+
+	if (level == 0) { // the root
+		if (node.getKeyCount() > 0) {
+			if ((rc = preservePage(pid)) < 0) return rc;
+			return writeNode(pid, node);
+		}
+		if ((rc = node.getChildPtr(0, rootPid)) < 0) return rc;
+		--treeHeight;
+		if ((rc = updateTreeInfo()) < 0) return rc;
+		return freePage(pid);
+	}
+	if (node.getKeyCount() >= node_keys / 2) {
+		if ((rc = preservePage(pid)) < 0) return rc;
+		return writeNode(pid, node);
+	}
+
+	PathEntry& parentEntry = path[level - 1];
+	GBTNonLeafNode parent(page_size);
+	if ((rc = readNode(parentEntry.pid, parent)) < 0) return rc;
+
+	int leftChild = (parentEntry.child < parent.getKeyCount()) ? parentEntry.child : parentEntry.child - 1;
+	PageId leftPid, rightPid, child;
+	uint64_t separator, key;
+	if ((rc = parent.getChildPtr(leftChild, leftPid)) < 0) return rc;
+	if ((rc = parent.getChildPtr(leftChild + 1, rightPid)) < 0) return rc;
+	if ((rc = parent.readEntry(leftChild, separator, child)) < 0) return rc;
+
+	GBTNonLeafNode sibling(page_size);
+	if ((rc = readNode(leftPid == pid ? rightPid : leftPid, sibling)) < 0) return rc;
+	GBTNonLeafNode& left = (leftPid == pid) ? node : sibling;
+	GBTNonLeafNode& right = (leftPid == pid) ? sibling : node;
+
+	// children and the keys between them, with the separator between the two nodes
+	std::vector<PageId> children;
+	std::vector<uint64_t> keys;
+	if ((rc = left.getChildPtr(0, child)) < 0) return rc;
+	children.push_back(child);
+	for (int i = 0; i < left.getKeyCount(); i++) {
+		left.readEntry(i, key, child);
+		keys.push_back(key);
+		children.push_back(child);
+	}
+	keys.push_back(separator);
+	if ((rc = right.getChildPtr(0, child)) < 0) return rc;
+	children.push_back(child);
+	for (int i = 0; i < right.getKeyCount(); i++) {
+		right.readEntry(i, key, child);
+		keys.push_back(key);
+		children.push_back(child);
+	}
+
+	if (keys.size() <= (size_t) node_keys) {
+		GBTNonLeafNode merged(page_size);
+		if ((rc = merged.initializeRoot(children[0], keys[0], children[1])) < 0) return rc;
+		for (size_t i = 1; i < keys.size(); i++) {
+			if ((rc = merged.append(keys[i], children[i + 1])) < 0) return rc;
+		}
+		if ((rc = preservePage(leftPid)) < 0) return rc;
+		if ((rc = writeNode(leftPid, merged)) < 0) return rc;
+		if ((rc = freePage(rightPid)) < 0) return rc;
+		if ((rc = parent.remove(leftChild)) < 0) return rc;
+		return removeFixNonLeaf(path, level - 1, parent);
+	}
+
+	// share the children evenly; the key between the halves moves up
+	size_t half = children.size() / 2;
+	GBTNonLeafNode newLeft(page_size), newRight(page_size);
+	if ((rc = newLeft.initializeRoot(children[0], keys[0], children[1])) < 0) return rc;
+	for (size_t i = 1; i + 1 < half; i++) {
+		if ((rc = newLeft.append(keys[i], children[i + 1])) < 0) return rc;
+	}
+	if ((rc = newRight.initializeRoot(children[half], keys[half], children[half + 1])) < 0) return rc;
+	for (size_t i = half + 1; i < keys.size(); i++) {
+		if ((rc = newRight.append(keys[i], children[i + 1])) < 0) return rc;
+	}
+	if ((rc = preservePage(leftPid)) < 0) return rc;
+	if ((rc = writeNode(leftPid, newLeft)) < 0) return rc;
+	if ((rc = preservePage(rightPid)) < 0) return rc;
+	if ((rc = writeNode(rightPid, newRight)) < 0) return rc;
+	if ((rc = parent.setKey(leftChild, keys[half - 1])) < 0) return rc;
+	if ((rc = preservePage(parentEntry.pid)) < 0) return rc;
+	return writeNode(parentEntry.pid, parent);
+}
+
+/*
+ * Find the leaf-node index entry whose key value is larger than or 
+ * equal to searchKey, and output the location of the entry in IndexCursor.
+ * IndexCursor is a "pointer" to a B+tree leaf-node entry consisting of
+ * the PageId of the node and the SlotID of the index entry.
+ * Note that, for range queries, we need to scan the B+tree leaf nodes.
+ * For example, if the query is "key > 1000", we should scan the leaf
+ * nodes starting with the key value 1000. For this reason,
+ * it is better to return the location of the leaf node entry 
+ * for a given searchKey, instead of returning the RecordId
+ * associated with the searchKey directly.
+ * Once the location of the index entry is identified and returned 
+ * from this function, you should call readForward() to retrieve the
+ * actual (key, rid) pair from the index.
+ * @param key[IN] the key to find.
+ * @param cursor[OUT] the cursor pointing to the first index entry
+ *                    with the key value.
+ * @return error code. 0 if no error.
+ */
+RT GBTreeIndex::locate(uint64_t searchKey, IndexCursor& cursor) const
+{
+	if (in_memory)
+		return locateMemory(searchKey, cursor);
+
+	RT rc;
+	GBTLeafNode l_node(false, page_size);
+	PageId pid;
+
+	uint64_t version;
+
+	if ((rc = findLeaf(searchKey, false, pid, l_node, version)) < 0) return rc;
+	if ((rc = l_node.locate(searchKey, cursor.eid)) < 0) {
+		// the key may still follow in the next leaf or its overflow pages
+		if (l_node.getNextNodePtr() == 0) return rc;
+		cursor.eid = l_node.getKeyCount();
+	}
+	cursor.pid = pid;
+	cursor.version = version;
+	cursor.key = searchKey;
+	cursor.seen = 0;
+
+	return 0;
+}
+
+RT GBTreeIndex::findLeaf(uint64_t searchKey, bool leftmost, PageId& pid, GBTLeafNode& leaf, uint64_t& version) const
+{
+	RT rc;
+
+	for (;;) {
+		if ((rc = findLeafPid(searchKey, leftmost, pid, version)) < 0) return rc;
+		rc = readNode(pid, leaf);
+		if (validLatch(latchOf(pid), version))
+			return rc;
+	}
+}
+
+/*
+ * Optimistic descent. The version of a child is taken before the parent is
+ * validated, so a child pointer is only followed if it was current while
+ * the child was unchanged; on any change the descent starts over.
+ */
+RT GBTreeIndex::findLeafPid(uint64_t searchKey, bool leftmost, PageId& pid, uint64_t& version) const
+{
+	RT rc;
+	GBTNonLeafNode nl_node(page_size);
+
+	for (;;) {
+		uint64_t tree_version = readLatch(tree_latch);
+		int height = treeHeight;
+		pid = rootPid;
+		if (height == 0) {
+			if (!validLatch(tree_latch, tree_version)) continue;
+			return RT_NO_SUCH_RECORD;
+		}
+		version = readLatch(latchOf(pid));
+		if (!validLatch(tree_latch, tree_version)) continue;
+
+		bool restart = false;
+		for (int current_level = 1; current_level < height; ++current_level) {
+			PageId child;
+			if ((rc = readNode(pid, nl_node)) == 0)
+				rc = leftmost ? nl_node.getLeftSiblingPid(child) : nl_node.locateChildPtr(searchKey, child);
+			if (rc < 0) {
+				if (validLatch(latchOf(pid), version)) return rc;
+				restart = true;
+				break;
+			}
+			uint64_t child_version = readLatch(latchOf(child));
+			if (!validLatch(latchOf(pid), version)) {
+				restart = true;
+				break;
+			}
+			pid = child;
+			version = child_version;
+		}
+		if (restart) continue;
+		return 0;
+	}
+}
+
+void GBTreeIndex::prefetch(const uint64_t* keys, int count) const
+{
+	std::vector<PageId> pids;
+	PageId pid;
+	uint64_t version;
+
+	if (in_memory || !pf.prefetching())
+		return;
+	for (int i = 0; i < count; i++) {
+		if (findLeafPid(keys[i], false, pid, version) == 0)
+			pids.push_back(pid);
+	}
+	if (!pids.empty())
+		pf.prefetch(&pids[0], pids.size());
+}
+
+void GBTreeIndex::prefetchNext(GBTLeafNode& leaf) const
+{
+	PageId next = leaf.getNextNodePtr();
+	if (!in_memory && next != 0)
+		pf.prefetch(&next, 1);
+}
+
+RT GBTreeIndex::readLeaf(PageId pid, GBTLeafNode& leaf, uint64_t& version) const
+{
+	RT rc;
+
+	for (;;) {
+		version = readLatch(latchOf(pid));
+		rc = readNode(pid, leaf);
+		if (validLatch(latchOf(pid), version))
+			return rc;
+	}
+}
+
+/*
+ * Read the (key, rid) pair at the location specified by the index cursor,
+ * and move foward the cursor to the next entry.
+ * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+ * @param key[OUT] the key stored at the index cursor location.
+ * @param rid[OUT] the RecordId stored at the index cursor location.
+ * @return error code. 0 if no error
+ */
+RT GBTreeIndex::readForward(IndexCursor& cursor, uint64_t& key, RecordId& rid) const
+{
+	if (in_memory)
+		return readForwardMemory(cursor, key, rid);
+
+	RT rc;
+	GBTLeafNode l_node(false, page_size);
+	uint64_t version;
+	int skip = 0;
+
+	if ((rc = readLeaf(cursor.pid, l_node, version)) < 0) return rc;
+	if (version != cursor.version) {
+		// a writer changed the leaf: its entries may have moved
+		if ((rc = findLeaf(cursor.key, false, cursor.pid, l_node, version)) < 0) return rc;
+		if (l_node.locate(cursor.key, cursor.eid) < 0)
+			cursor.eid = l_node.getKeyCount();
+		skip = cursor.seen;
+	}
+
+	for (;;) {
+		while (cursor.eid >= l_node.getKeyCount()) { // move to the next sibling
+			int next_pid = l_node.getNextNodePtr();
+			if (next_pid == 0) { // no more sibling
+				return RT_END_OF_TREE;
+			} else {
+				cursor.pid = next_pid;
+				cursor.eid = 0;
+				if ((rc = readLeaf(cursor.pid, l_node, version)) < 0) return rc;
+				prefetchNext(l_node);
+			}
+		}
+
+		l_node.readEntry(cursor.eid, key, rid);
+		cursor.eid++;
+		if (skip > 0 && key == cursor.key) {
+			skip--;
+			continue;
+		}
+		break;
+	}
+
+	cursor.version = version;
+	if (key == cursor.key) {
+		cursor.seen++;
+	} else {
+		cursor.key = key;
+		cursor.seen = 1;
+	}
+	return 0;
+}
+/*
+ * findLeaf() over the swizzled pointers. The leaf is not copied: the
+ * caller reads it in place and validates version afterwards.
+ */
+RT GBTreeIndex::findMemoryLeaf(uint64_t searchKey, bool leftmost, const GBTMemoryNode*& leaf, uint64_t& version) const
+{
+	for (;;) {
+		uint64_t tree_version = readLatch(tree_latch);
+		int height = treeHeight;
+		const GBTMemoryNode* node = memory_root;
+		if (height == 0 || node == NULL) {
+			if (!validLatch(tree_latch, tree_version)) continue;
+			return RT_NO_SUCH_RECORD;
+		}
+		version = readLatch(latchOf(node->pid));
+		if (!validLatch(tree_latch, tree_version)) continue;
+
+		bool restart = false;
+		for (int current_level = 1; current_level < height; ++current_level) {
+			int index = leftmost ? 0 : childLowerBound(node->page, searchKey, node_keys);
+			const GBTMemoryNode* child = node->children ? node->children[index] : NULL;
+			if (child == NULL) {
+				if (validLatch(latchOf(node->pid), version)) return RT_INVALID_NODE;
+				restart = true;
+				break;
+			}
+			uint64_t child_version = readLatch(latchOf(child->pid));
+			if (!validLatch(latchOf(node->pid), version)) {
+				restart = true;
+				break;
+			}
+			node = child;
+			version = child_version;
+		}
+		if (restart) continue;
+
+		leaf = node;
+		return 0;
+	}
+}
+
+RT GBTreeIndex::locateMemory(uint64_t searchKey, IndexCursor& cursor) const
+{
+	RT rc;
+	const GBTMemoryNode* leaf;
+	uint64_t version;
+
+	for (;;) {
+		if ((rc = findMemoryLeaf(searchKey, false, leaf, version)) < 0) return rc;
+		int eid = GBTLeafNode::lowerBoundOf(leaf->page, page_size, searchKey);
+		int count = GBTLeafNode::keyCountOf(leaf->page, page_size);
+		PageId next = GBTLeafNode::nextNodeOf(leaf->page, page_size);
+		if (!validLatch(latchOf(leaf->pid), version)) continue;
+		if (eid == count && next == 0)
+			return RT_NO_SUCH_RECORD;
+
+		cursor.pid = leaf->pid;
+		cursor.eid = eid;
+		cursor.version = version;
+		cursor.key = searchKey;
+		cursor.seen = 0;
+		return 0;
+	}
+}
+
+/*
+ * As readForward(): entries are read in place, and a cursor whose leaf
+ * changed is found again from its key.
+ */
+RT GBTreeIndex::readForwardMemory(IndexCursor& cursor, uint64_t& key, RecordId& rid) const
+{
+	RT rc;
+
+	for (;;) {
+		const GBTMemoryNode* node = memoryNode(cursor.pid);
+		uint64_t version = readLatch(latchOf(cursor.pid));
+		int eid = cursor.eid;
+		int skip = 0;
+		if (node == NULL || version != cursor.version) {
+			if ((rc = findMemoryLeaf(cursor.key, false, node, version)) < 0) return rc;
+			eid = GBTLeafNode::lowerBoundOf(node->page, page_size, cursor.key);
+			skip = cursor.seen;
+		}
+
+		bool restart = false;
+		for (;;) {
+			if (eid >= GBTLeafNode::keyCountOf(node->page, page_size)) { // move to the next sibling
+				const GBTMemoryNode* next = node->next;
+				if (!validLatch(latchOf(node->pid), version)) {
+					restart = true;
+					break;
+				}
+				if (next == NULL) // no more sibling
+					return RT_END_OF_TREE;
+				node = next;
+				version = readLatch(latchOf(node->pid));
+				eid = 0;
+				continue;
+			}
+
+			GBTLeafNode::entryOf(node->page, page_size, eid, key, rid);
+			if (!validLatch(latchOf(node->pid), version)) {
+				restart = true;
+				break;
+			}
+			eid++;
+			if (skip > 0 && key == cursor.key) {
+				skip--;
+				continue;
+			}
+			break;
+		}
+		if (restart) continue;
+
+		cursor.pid = node->pid;
+		cursor.eid = eid;
+		cursor.version = version;
+		if (key == cursor.key) {
+			cursor.seen++;
+		} else {
+			cursor.key = key;
+			cursor.seen = 1;
+		}
+		return 0;
+	}
+}
+
+RT GBTreeIndex::pointToSmallestKeyMemory(IndexCursor& cursor) const
+{
+	RT rc;
+	const GBTMemoryNode* leaf;
+
+	if ((rc = findMemoryLeaf(0, true, leaf, cursor.version)) < 0) return rc;
+	cursor.pid = leaf->pid;
+	cursor.eid = 0;
+	cursor.key = 0;
+	cursor.seen = 0;
+	return 0;
+}
+
+RT GBTreeIndex::loadLeafNode(PageId pid, GBTLeafNode& node) const
+{
+	uint64_t version;
+	return readLeaf(pid, node, version);
+}
+
+
+/**
+* Write rootPid, treeHeight, the free page list and the epoch to pagePid = 0
+*/
+RT GBTreeIndex::updateTreeInfo() {
+	// update rootPid, treeHeight and the head of the free page list
+	memcpy(treeInfo_buffer, &rootPid, sizeof(rootPid));
+	memcpy(treeInfo_buffer + sizeof(rootPid), &treeHeight, sizeof(treeHeight));
+	memcpy(treeInfo_buffer + sizeof(rootPid) + sizeof(treeHeight), &freePid, sizeof(freePid));
+	// the root is tagged with the epoch the running write publishes it at
+	uint64_t root_epoch = epoch + 1;
+	memcpy(treeInfo_buffer + sizeof(rootPid) + sizeof(treeHeight) + sizeof(freePid), &root_epoch, sizeof(root_epoch));
+	if (in_memory) {
+		memory_root = (treeHeight > 0) ? memoryNode(rootPid) : NULL;
+		memory_info_dirty = true;
+		return 0;
+	}
+	return pf.write(0, treeInfo_buffer);
+}
+
+/*
+ * Take a page from the free page list, or a new page at the end of the file.
+ * The first four bytes of a free page hold the next free page (0 = none).
+ */
+RT GBTreeIndex::allocatePage(PageId& pid)
+{
+	RT rc;
+
+	if (freePid == 0) {
+		// pages handed out but not written yet are behind pf.endPid()
+		if (newPid < pf.endPid())
+			newPid = pf.endPid();
+		pid = newPid++;
+		return 0;
+	}
+
+	char page[GBTFile::MAX_PAGE_SIZE];
+	if ((rc = readPage(freePid, page)) < 0) return rc;
+	pid = freePid;
+	memcpy(&freePid, page, sizeof(freePid));
+	return updateTreeInfo();
+}
+
+/*
+ * Put a page that is no longer part of the tree on the free page list.
+ */
+RT GBTreeIndex::freePage(PageId pid)
+{
+	RT rc;
+	char page[GBTFile::MAX_PAGE_SIZE];
+
+	last_leaf = 0;
+	memset(page, 0, page_size);
+	memcpy(page, &freePid, sizeof(freePid));
+	if ((rc = preservePage(pid)) < 0) return rc;
+	if ((rc = writePage(pid, page)) < 0) return rc;
+	freePid = pid;
+	return updateTreeInfo();
+}
+
+RT GBTreeIndex::pointToSmallestKey(IndexCursor& cursor) const {
+	if (in_memory)
+		return pointToSmallestKeyMemory(cursor);
+
+	RT rc;
+	GBTLeafNode leaf(false, page_size);
+
+	if ((rc = findLeaf(0, true, cursor.pid, leaf, cursor.version)) < 0) return rc;
+	cursor.eid = 0;
+	cursor.key = 0;
+	cursor.seen = 0;
+
+	return 0;
+}
+
+/*
+ * Only the first write of a page in an epoch keeps its image. Pages past
+ * the end of the file are new and no snapshot can reach them.
+ */
+RT GBTreeIndex::preservePage(PageId pid)
+{
+	RT rc;
+	std::lock_guard<std::mutex> guard(version_lock);
+
+	if (!hasPage(pid))
+		return 0;
+	std::vector<PageVersion>& versions = page_versions[pid];
+	if (!versions.empty() && versions.back().epoch == epoch + 1)
+		return 0;
+
+	PageVersion version;
+	version.epoch = epoch + 1;
+	version.image.resize(page_size);
+	if ((rc = readPage(pid, &version.image[0])) < 0) return rc;
+	versions.push_back(version);
+	version_count++;
+	return 0;
+}
+
+/*
+ * A snapshot at epoch reads the oldest image replaced after epoch, or the
+ * page itself. The image is looked for after the page is read: a writer
+ * keeps the image before it writes, so a page read while it changed is
+ * always covered by an image.
+ */
+RT GBTreeIndex::readVersion(const IndexSnapshot& snapshot, PageId pid, char* page) const
+{
+	RT rc = readPage(pid, page);
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (version_count.load() == 0)
+		return rc;
+	std::lock_guard<std::mutex> guard(version_lock);
+
+	std::map<PageId, std::vector<PageVersion> >::const_iterator it = page_versions.find(pid);
+	if (it == page_versions.end())
+		return rc;
+	for (size_t i = 0; i < it->second.size(); i++) {
+		if (it->second[i].epoch > snapshot.epoch) {
+			memcpy(page, &it->second[i].image[0], page_size);
+			return 0;
+		}
+	}
+	return rc;
+}
+
+/*
+ * Called by a writer that still holds its latches. Without pinned
+ * snapshots the images of the write are not needed; a snapshot pinned
+ * while the write ran has the previous epoch and needs them.
+ */
+void GBTreeIndex::publishVersion()
+{
+	std::lock_guard<std::mutex> guard(version_lock);
+
+	epoch++;
+	if (pinned_epochs.empty()) {
+		page_versions.clear();
+		version_count = 0;
+	}
+}
+
+/*
+ * The tree latch covers rootPid and treeHeight; the epoch is taken under
+ * version_lock, so no write between the two can be missed.
+ */
+RT GBTreeIndex::pinSnapshot(IndexSnapshot& snapshot)
+{
+	for (;;) {
+		uint64_t tree_version = readLatch(tree_latch);
+		{
+			std::lock_guard<std::mutex> guard(version_lock);
+			snapshot.rootPid = rootPid;
+			snapshot.treeHeight = treeHeight;
+			snapshot.epoch = epoch;
+			pinned_epochs.insert(epoch);
+		}
+		if (validLatch(tree_latch, tree_version))
+			return 0;
+		releaseSnapshot(snapshot);
+	}
+}
+
+/*
+ * An image replaced at epoch e is only read by snapshots older than e.
+ * The images of a running write are kept even without pinned snapshots,
+ * for a snapshot that is pinned before the write ends.
+ */
+void GBTreeIndex::releaseSnapshot(const IndexSnapshot& snapshot)
+{
+	std::lock_guard<std::mutex> guard(version_lock);
+
+	std::multiset<uint64_t>::iterator pin = pinned_epochs.find(snapshot.epoch);
+	if (pin != pinned_epochs.end())
+		pinned_epochs.erase(pin);
+
+	uint64_t oldest = pinned_epochs.empty() ? epoch : *pinned_epochs.begin();
+	std::map<PageId, std::vector<PageVersion> >::iterator it = page_versions.begin();
+	while (it != page_versions.end()) {
+		std::vector<PageVersion>& versions = it->second;
+		size_t keep = 0;
+		while (keep < versions.size() && versions[keep].epoch <= oldest)
+			keep++;
+		versions.erase(versions.begin(), versions.begin() + keep);
+		version_count -= keep;
+		if (versions.empty())
+			page_versions.erase(it++);
+		else
+			++it;
+	}
+}
+
+/*
+ * A writer keeps a page version before it changes anything a snapshot
+ * can reach. In memory, while no version is kept, the tree is the same
+ * as the snapshot and is read in place.
+ */
+RT GBTreeIndex::locate(const IndexSnapshot& snapshot, uint64_t searchKey, IndexCursor& cursor) const
+{
+	RT rc;
+	char page[GBTFile::MAX_PAGE_SIZE];
+	PageId pid = snapshot.rootPid;
+
+	if (in_memory) {
+		rc = locateMemory(searchKey, cursor);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (version_count.load() == 0)
+			return rc;
+	}
+
+	if (snapshot.treeHeight == 0)
+		return RT_NO_SUCH_RECORD;
+
+	GBTNonLeafNode nl_node(page_size);
+	for (int current_level = 1; current_level < snapshot.treeHeight; ++current_level) {
+		if ((rc = readVersion(snapshot, pid, page)) < 0) return rc;
+		nl_node.load(page);
+		if ((rc = nl_node.locateChildPtr(searchKey, pid)) < 0) return rc;
+	}
+
+	GBTLeafNode l_node(false, page_size);
+	if ((rc = readVersion(snapshot, pid, page)) < 0) return rc;
+	l_node.load(page);
+	if ((rc = l_node.locate(searchKey, cursor.eid)) < 0) {
+		if (l_node.getNextNodePtr() == 0) return rc;
+		cursor.eid = l_node.getKeyCount();
+	}
+	cursor.pid = pid;
+	// no leaf has an odd version: a read in place finds the cursor again by key
+	cursor.version = 1;
+	cursor.key = searchKey;
+	cursor.seen = 0;
+
+	return 0;
+}
+
+/*
+ * The leaves of a snapshot never change. The cursor keeps its key for a
+ * later read in place.
+ */
+RT GBTreeIndex::readForward(const IndexSnapshot& snapshot, IndexCursor& cursor, uint64_t& key, RecordId& rid) const
+{
+	RT rc;
+	char page[GBTFile::MAX_PAGE_SIZE];
+	GBTLeafNode l_node(false, page_size);
+
+	if (in_memory) {
+		IndexCursor saved = cursor;
+		rc = readForwardMemory(cursor, key, rid);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (version_count.load() == 0)
+			return rc;
+		cursor = saved;
+	}
+
+	if ((rc = readVersion(snapshot, cursor.pid, page)) < 0) return rc;
+	l_node.load(page);
+
+	while (cursor.eid >= l_node.getKeyCount()) { // move to the next sibling
+		int next_pid = l_node.getNextNodePtr();
+		if (next_pid == 0) // no more sibling
+			return RT_END_OF_TREE;
+		cursor.pid = next_pid;
+		cursor.eid = 0;
+		if ((rc = readVersion(snapshot, cursor.pid, page)) < 0) return rc;
+		l_node.load(page);
+		prefetchNext(l_node);
+	}
+
+	l_node.readEntry(cursor.eid, key, rid);
+	cursor.eid++;
+	cursor.version = 1;
+	if (key == cursor.key) {
+		cursor.seen++;
+	} else {
+		cursor.key = key;
+		cursor.seen = 1;
+	}
+
+	return 0;
+}
+
+RT GBTreeIndex::pointToSmallestKey(const IndexSnapshot& snapshot, IndexCursor& cursor) const
+{
+	RT rc;
+	char page[GBTFile::MAX_PAGE_SIZE];
+	PageId pid = snapshot.rootPid;
+
+	if (in_memory) {
+		rc = pointToSmallestKeyMemory(cursor);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (version_count.load() == 0)
+			return rc;
+	}
+
+	if (snapshot.treeHeight == 0)
+		return RT_NO_SUCH_RECORD;
+
+	GBTNonLeafNode nl_node(page_size);
+	for (int current_level = 1; current_level < snapshot.treeHeight; ++current_level) {
+		if ((rc = readVersion(snapshot, pid, page)) < 0) return rc;
+		nl_node.load(page);
+		if ((rc = nl_node.getLeftSiblingPid(pid)) < 0) return rc;
 	}
 
 	cursor.eid = 0;
 	cursor.pid = pid;
+	cursor.version = 1;
+	cursor.key = 0;
+	cursor.seen = 0;
 
 	return 0;
 }
@@ -344,10 +2514,10 @@ int GBTreeIndex::getTotalCount() {
 	if ((rc = pointToSmallestKey(cursor)) < 0) return rc;
 
 	PageId pid = cursor.pid;
-	GBTLeafNode leaf;
+	GBTLeafNode leaf(false, page_size);
 
 	do {
-		if ((rc = leaf.read(pid, pf)) < 0) return rc;
+		if ((rc = readNode(pid, leaf)) < 0) return rc;
 		total += leaf.getKeyCount();
 	} while ((pid = leaf.getNextNodePtr()) != 0);
 
@@ -363,10 +2533,10 @@ int GBTreeIndex::getPageCount()
 	if ((rc = pointToSmallestKey(cursor)) < 0) return rc;
 
 	PageId pid = cursor.pid;
-	GBTLeafNode leaf;
+	GBTLeafNode leaf(false, page_size);
 
 	do {
-		if ((rc = leaf.read(pid, pf)) < 0) return rc;
+		if ((rc = readNode(pid, leaf)) < 0) return rc;
 		total++;
 	} while ((pid = leaf.getNextNodePtr()) != 0);
 
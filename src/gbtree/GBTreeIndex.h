@@ -9,11 +9,17 @@
 #ifndef GBTREEINDEX_H_
 #define GBTREEINDEX_H_
 
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
 #include <string>
+#include <vector>
 #include "../storagemanager/GBTFile.h"
 #include "../base/GBTreeBase.h"
 #include "GBTreeNode.h"
 #include "GBTTable.h"
+#include "GBTWal.h"
 /**
  * The data structure to point to a particular entry at a b+tree leaf node.
  * An IndexCursor consists of pid (PageId of the leaf node) and 
@@ -25,11 +31,54 @@ typedef struct {
   PageId  pid;  
   // The entry number inside the node
   int     eid;  
+  // The version of the leaf latch when the cursor was last moved. If the
+  // leaf changed since, the cursor is found again from key, skipping the
+  // seen entries with that key that were already read.
+  uint64_t version;
+  uint64_t key;
+  int      seen;
 } IndexCursor;
 
+/**
+ * A page of an index held in memory; see GBTreeIndex::openInMemory().
+ */
+struct GBTMemoryNode;
+
+/**
+ * A consistent read view of the index: the root and height published at
+ * epoch. Pages a writer changes after the view was pinned are read in
+ * the version they had at epoch.
+ */
+typedef struct {
+  PageId   rootPid;
+  int      treeHeight;
+  uint64_t epoch;
+} IndexSnapshot;
+
 /**
  * Implements a B-Tree index for bruinbase.
- * 
+ *
+ * Many threads may share one open index. Lookups (locate, readForward,
+ * pointToSmallestKey) take no locks: every page is covered by a versioned
+ * latch, and a reader that sees a version change while it descends
+ * restarts from the root. Writers are serialized among themselves.
+ * insert() only latches the leaf and the nodes it splits, so lookups
+ * elsewhere in the tree go on undisturbed; remove() and update() latch
+ * the whole tree. A scan with readForward sees every page consistently
+ * but may miss or repeat entries that a concurrent split moves.
+ * Bulk loads and merges must not run while the index is read.
+ *
+ * Each insert, remove or update publishes a new epoch. A writer copies a
+ * page before it overwrites it, and the copy is kept as long as a pinned
+ * snapshot older than the write may read it, so a scan through a
+ * snapshot sees the whole tree as it was when the snapshot was pinned.
+ *
+ * With write_ahead_log, insert, remove and update return once their
+ * record is in the log next to the index file (see GBTWal); the changed
+ * pages stay in memory until a checkpoint logs their images and writes
+ * them in place. Opening the file in 'w' mode replays a log left behind
+ * by a crash. Bulk loads and merges are not logged: they start and end
+ * with a checkpoint.
  */
 class GBTreeIndex {
  public:
@@ -44,24 +93,140 @@ class GBTreeIndex {
    * Under 'w' mode, the index file should be created if it does not exist.
    * @param indexname[IN] the name of the index file
    * @param mode[IN] 'r' for read, 'w' for write
+   * @param pageSize[IN] the page size of a file created; an existing file keeps its own
    * @return error code. 0 if no error
    */
-  RT open(const std::string& indexname, char mode);
+  RT open(const std::string& indexname, char mode, int pageSize = GBTFile::PAGE_SIZE);
+
+  /* *
+   * whether the indexes opened in 'w' mode keep a write-ahead log, so an
+   * insert, remove or update survives a crash once it returned.
+   * */
+  static bool write_ahead_log;
 
   /**
-   * Close the index file.
+   * Open the index file and load the whole tree into memory. Child and
+   * sibling page ids are swizzled into pointers between the in-memory
+   * nodes, so lookups and scans read the nodes in place without going
+   * through GBTFile. Writes change the nodes in memory and reach the file
+   * at checkpoint() or close(), in the page format of the file.
+   * @param indexname[IN] the name of the index file
+   * @return error code. 0 if no error
+   */
+  RT openInMemory(const std::string& indexname);
+
+  /**
+   * Write the pages changed in memory back to the index file: the nodes
+   * of an index held in memory, and the write-back pages of the file
+   * (see GBTFile::write_back_pages).
+   * @return error code. 0 if no error
+   */
+  RT checkpoint();
+
+  /**
+   * Keep up to pages written pages of the index file in memory, for a
+   * load or a run of inserts; see GBTFile::writeBack().
+   * @param pages[IN] the most dirty pages to keep, 0 to write through
+   * @return error code. 0 if no error
+   */
+  RT writeBack(size_t pages);
+
+  /**
+   * Close the index file. An index held in memory is written back first.
    * @return error code. 0 if no error
    */
   RT close();
     
   /**
    * Insert (key, RecordId) pair to the index.
+   * The rightmost leaf is remembered, so keys that go behind all others
+   * are appended without a descent from the root. Splits at the right
+   * edge keep the left node full rather than half full, so keys inserted
+   * in order fill their pages.
    * @param key[IN] the key for the value inserted into the index
    * @param rid[IN] the RecordId for the record being inserted into the index
    * @return error code. 0 if no error
    */
   RT insert(uint64_t key, const RecordId& rid);
 
+  /**
+   * Remove the (key, rid) pair from the index.
+   * A node that falls below half full borrows entries from a sibling
+   * under the same parent, or is merged with it if both fit in one node.
+   * Pages of merged nodes go to a free page list and are reused by
+   * later splits. The root shrinks when it is left with one child.
+   * @param key[IN] the key of the pair
+   * @param rid[IN] the RecordId of the pair
+   * @return error code. 0 if no error. RT_NO_SUCH_RECORD if the pair is not in the index
+   */
+  RT remove(uint64_t key, const RecordId& rid);
+
+  /**
+   * Change the key of the (oldKey, rid) pair to newKey, e.g. when an
+   * object moves. If newKey belongs to the same leaf, the pair is moved
+   * inside the leaf and only that leaf is written; otherwise this is a
+   * remove() followed by an insert().
+   * @param oldKey[IN] the current key of the pair
+   * @param newKey[IN] the new key
+   * @param rid[IN] the RecordId of the pair
+   * @return error code. 0 if no error. RT_NO_SUCH_RECORD if the pair is not in the index
+   */
+  RT update(uint64_t oldKey, uint64_t newKey, const RecordId& rid);
+
+  /**
+   * Start building an EMPTY index bottom up from (key, rid) pairs.
+   * The pairs are passed to bulkLoadAppend() in ascending key order
+   * (e.g. from a GBTSorter) and the build is completed by bulkLoadEnd().
+   * Leaves are filled completely and written one after another starting
+   * at page 1, so the leaf chain is physically sequential; the non-leaf
+   * levels are written behind the leaves.
+   * Without duplicate keys the last pair of a run of equal keys wins,
+   * as it does for insert().
+   * @return error code. 0 if no error. RT_INVALID_NODE if the index is not empty
+   */
+  RT bulkLoadBegin();
+
+  /**
+   * Add the next (key, rid) pair to a bulk load.
+   * @param key[IN] the key, not smaller than the previous one
+   * @param rid[IN] the RecordId of the record
+   * @return error code. 0 if no error
+   */
+  RT bulkLoadAppend(uint64_t key, const RecordId& rid);
+
+  /**
+   * Write the last leaf and build the non-leaf levels.
+   * @return error code. 0 if no error
+   */
+  RT bulkLoadEnd();
+
+  /**
+   * Start merging a sorted batch of (key, rid) pairs into a NON-EMPTY index.
+   * The pairs are passed to mergeAppend() in ascending key order and the
+   * merge is completed by mergeEnd(). Every leaf that receives pairs is
+   * read once and rewritten once; a leaf that overflows is continued on
+   * new pages chained behind it. Leaves that receive nothing are not touched.
+   * If any leaf overflowed, the non-leaf levels are rebuilt from the new
+   * list of leaves, reusing the pages of the old non-leaf nodes.
+   * Without duplicate keys a pair replaces the stored pair with the same key.
+   * @return error code. 0 if no error. RT_INVALID_NODE if the index is empty
+   */
+  RT mergeBegin();
+
+  /**
+   * Add the next (key, rid) pair to a merge.
+   * @param key[IN] the key, not smaller than the previous one
+   * @param rid[IN] the RecordId of the record
+   * @return error code. 0 if no error
+   */
+  RT mergeAppend(uint64_t key, const RecordId& rid);
+
+  /**
+   * Rewrite the last affected leaf and rebuild the non-leaf levels if needed.
+   * @return error code. 0 if no error
+   */
+  RT mergeEnd();
+
   /**
    * Find the leaf-node index entry whose key value is larger than or
    * equal to searchKey and output its location (i.e., the page id of the node
@@ -82,7 +247,17 @@ class GBTreeIndex {
    * with the key value
    * @return error code. 0 if no error.
    */
-  RT locate(uint64_t searchKey, IndexCursor& cursor);
+  RT locate(uint64_t searchKey, IndexCursor& cursor) const;
+
+  /**
+   * Start reading the leaves that hold the keys, all of them at once, so
+   * that the locate() calls that follow find them in the cache. The
+   * non-leaf nodes on the way are read now. Does nothing for an index
+   * held in memory.
+   * @param keys[IN] the keys that will be located
+   * @param count[IN] the number of keys
+   */
+  void prefetch(const uint64_t* keys, int count) const;
 
   /**
    * Read the (key, rid) pair at the location specified by the index cursor,
@@ -91,20 +266,41 @@ class GBTreeIndex {
    * @param key[OUT] the key stored at the index cursor location
    * @return error code. 0 if no error
    */
-  RT readForward(IndexCursor& cursor, uint64_t& key, RecordId& rid);
+  RT readForward(IndexCursor& cursor, uint64_t& key, RecordId& rid) const;
 
   /* *
    * load the leaf node from pid
    * @param pid[IN] page id
    * @param node[OUT] leaf node 
    * */
-  RT loadLeafNode(PageId pid, GBTLeafNode& node);
+  RT loadLeafNode(PageId pid, GBTLeafNode& node) const;
 
   
   /**
    * Go to the very left node. Make cursor points to this node
    */
-  RT pointToSmallestKey(IndexCursor& cursor);
+  RT pointToSmallestKey(IndexCursor& cursor) const;
+
+  /**
+   * Pin a read view of the current tree. The old page versions it needs
+   * are kept until it is released.
+   * @param snapshot[OUT] the read view
+   * @return error code. 0 if no error
+   */
+  RT pinSnapshot(IndexSnapshot& snapshot);
+
+  /**
+   * Release a read view. Page versions no pinned view needs are dropped.
+   */
+  void releaseSnapshot(const IndexSnapshot& snapshot);
+
+  /**
+   * locate(), readForward() and pointToSmallestKey() in a read view.
+   * The cursor is only valid with the snapshot it was positioned in.
+   */
+  RT locate(const IndexSnapshot& snapshot, uint64_t searchKey, IndexCursor& cursor) const;
+  RT readForward(const IndexSnapshot& snapshot, IndexCursor& cursor, uint64_t& key, RecordId& rid) const;
+  RT pointToSmallestKey(const IndexSnapshot& snapshot, IndexCursor& cursor) const;
 
   /**
    * get total number of entries
@@ -120,35 +316,312 @@ class GBTreeIndex {
   int getTreeHeight();
 
  private:
-	 char* treeInfo_buffer[GBTFile::PAGE_SIZE]; // mainly used to store the pagePid = 0, which contains
+	 char* treeInfo_buffer[GBTFile::MAX_PAGE_SIZE / sizeof(char*)]; // mainly used to store the pagePid = 0, which contains
 
 	/**
 	 * Helper function for insert() which supports recursive algorithm
 	 * @param currentLevel used to detect if the current Node is a leaf
 	 * @param currentNode start from this node to travel through the tree
-	 * @param key[OUT] the key stored at the index cursor location
-	 * @return rid[OUT] the RecordId stored at the index cursor location
+	 * @param key[IN] the key to insert
+	 * @param rid[IN] the RecordId to insert
+	 * @param midKey[OUT] the key separating currentNode from its new sibling
+	 * @param siblingPid[OUT] the new sibling if currentNode was split
+	 * @return 1 if currentNode was split, 0 if not, or an error code
 	 */
-	 RT insertHelper(PageId parentNode, int currentLevel, PageId currentNode, const uint64_t &key, const RecordId &rid, uint64_t& midKey);
+	 RT insertHelper(int currentLevel, PageId currentNode, const uint64_t &key, const RecordId &rid, uint64_t& midKey, PageId& siblingPid);
+
+	/**
+	 * A non-leaf node on the way from the root to a leaf, and the child taken.
+	 */
+	 typedef struct {
+		 PageId pid;
+		 int    child;
+	 } PathEntry;
+
+	 /**
+	  * Descend to the leaf searchKey belongs to, recording the non-leaf
+	  * nodes in path (path[0] is the root).
+	  */
+	 RT findPath(uint64_t searchKey, std::vector<PathEntry>& path, PageId& leafPid);
+
+	 /**
+	  * Move path and leafPid to the next leaf. RT_END_OF_TREE after the last leaf.
+	  */
+	 RT nextLeafPath(std::vector<PathEntry>& path, PageId& leafPid);
+
+	 /**
+	  * Find the (key, rid) pair. Equal keys may continue in the next leaves.
+	  * @param leaf[OUT] the leaf holding the pair, read from leafPid
+	  * @param eid[OUT] the entry of the pair in leaf
+	  * @param prevPid[OUT] the page in front of leafPid if leafPid is an
+	  *                     overflow page, 0 if it is a leaf of the tree
+	  */
+	 RT findEntry(uint64_t key, const RecordId& rid, std::vector<PathEntry>& path,
+			 PageId& leafPid, GBTLeafNode& leaf, int& eid, PageId& prevPid);
+
+	 /**
+	  * Overflow pages of duplicate keys. A leaf full of one key continues
+	  * in overflow pages chained behind it, which hold more entries of
+	  * that key and have no separator in a parent; scans walk them like
+	  * any leaf. firstOverflow() reads the first page of the chain behind
+	  * leaf (pid 0 if there is none). insertDuplicate() stores a pair in
+	  * the chain if it belongs there and sets done; a key above the chain
+	  * gets a new leaf behind it, returned like a split.
+	  */
+	 RT firstOverflow(GBTLeafNode& leaf, PageId& pid, GBTLeafNode& page);
+	 RT insertDuplicate(PageId leafPid, GBTLeafNode& leaf, uint64_t key, const RecordId& rid,
+			 uint64_t& midKey, PageId& siblingPid, bool& done);
+
+	 /**
+	  * Write an overflow page that lost an entry; an empty one is taken
+	  * out of the chain behind prevPid and freed.
+	  */
+	 RT removeOverflow(PageId prevPid, PageId pid, GBTLeafNode& page);
+
+	 /**
+	  * Move entries from the overflow pages behind a leaf into the leaf
+	  * until it is full or the chain is empty.
+	  * @param chained[OUT] whether overflow pages are left behind the leaf
+	  */
+	 RT pullOverflow(PageId leafPid, GBTLeafNode& leaf, bool& chained);
+
+	 /**
+	  * The keys a leaf may hold according to its path: (lower, upper].
+	  * A bound that does not exist is reported as false.
+	  */
+	 RT leafBounds(const std::vector<PathEntry>& path,
+			 bool& hasLower, uint64_t& lower, bool& hasUpper, uint64_t& upper);
+
+	 /**
+	  * Write a leaf that lost an entry, borrowing from or merging with a sibling if needed.
+	  */
+	 RT removeFixLeaf(std::vector<PathEntry>& path, PageId leafPid, GBTLeafNode& leaf);
+
+	 /**
+	  * Write the non-leaf node path[level] that lost an entry, borrowing
+	  * from or merging with a sibling if needed.
+	  */
+	 RT removeFixNonLeaf(std::vector<PathEntry>& path, int level, GBTNonLeafNode& node);
+
+	 /**
+	  * Page allocation. freed pages form a list whose head is stored in the tree info page.
+	  */
+	 RT allocatePage(PageId& pid);
+	 RT freePage(PageId pid);
 
 	  /**
 	  * Write rootPid & treeHeight to pagePid = 0
 	  */
 	  RT updateTreeInfo();
+	  RT readTreeInfo();
+
+	  /**
+	  * Write-ahead log: replay the log on open, log a write and wait for
+	  * it to be durable, and checkpoint the dirty pages through the log.
+	  */
+	  static const size_t CHECKPOINT_LOG_SIZE = 64 << 20;  /// log bytes that force a checkpoint
+	  RT recover();
+	  RT logWrite(int type, uint64_t key, const RecordId& rid, uint64_t newKey, uint64_t& lsn);
+	  RT commitLog(uint64_t lsn);
+	  RT checkpointLocked();
+	  RT checkpointLog();
+
+	  /**
+	  * Bulk load helpers: write the current leaf, and build one non-leaf
+	  * level above the (max key, pid) pairs in bulk_children.
+	  */
+	  RT bulkWriteLeaf(GBTLeafNode& leaf, PageId pid, PageId next);
+	  RT bulkFlushLeaf(PageId next);
+	  RT bulkBuildLevel();
+
+	  /**
+	  * Merge helpers: list the leaves with their key bounds, store one pair
+	  * into the leaf whose key range holds it, and finish the current leaf.
+	  */
+	  RT mergeCollect(PageId pid, int level, uint64_t bound);
+	  RT mergeEntry(uint64_t key, const RecordId& rid);
+	  RT mergeOutput(uint64_t key, const RecordId& rid);
+	  RT mergeNextLeaf();
+
+	  /**
+	  * A page for a new non-leaf node: a page freed by the merge if there
+	  * is one, otherwise a new page at the end of the file.
+	  */
+	  RT newNonLeafPage(PageId& pid);
+
+	  /**
+	  * Optimistic latches. A latch is a version that is odd while a writer
+	  * holds it. Pages share LATCH_COUNT latches by pid.
+	  */
+	  static const int LATCH_COUNT = 256;
+	  std::atomic<uint64_t>& latchOf(PageId pid) const { return latches[pid % LATCH_COUNT]; }
+
+	  /**
+	  * Descend to the leaf that holds searchKey, or to the leftmost leaf.
+	  * The leaf is returned as a consistent copy; restarts on a version change.
+	  */
+	  RT findLeaf(uint64_t searchKey, bool leftmost, PageId& pid, GBTLeafNode& leaf, uint64_t& version) const;
+	  RT findLeafPid(uint64_t searchKey, bool leftmost, PageId& pid, uint64_t& version) const;
+
+	  /**
+	  * A scan that steps into a leaf reads its next sibling ahead.
+	  */
+	  void prefetchNext(GBTLeafNode& leaf) const;
+
+	  /**
+	  * Read a consistent copy of a leaf and the version it was read at.
+	  */
+	  RT readLeaf(PageId pid, GBTLeafNode& leaf, uint64_t& version) const;
+
+	  /**
+	  * insert() without latching, for a writer that holds the latches it needs.
+	  */
+	  RT insertTree(uint64_t key, const RecordId& rid);
+	  RT updateTree(uint64_t oldKey, uint64_t newKey, const RecordId& rid);
+	  RT removeTree(uint64_t key, const RecordId& rid);
+
+	  /**
+	  * Latch the nodes an insert of (key, rid) changes: the leaf, every full
+	  * ancestor that will split and the node above the last one. The tree
+	  * latch is taken as well when the root splits.
+	  */
+	  RT lockInsertPath(uint64_t key, const RecordId& rid, std::vector<int>& locked);
+
+	  /**
+	  * Insert (key, rid) into the remembered rightmost leaf if it belongs
+	  * there and the leaf does not split.
+	  * @param done[OUT] whether the pair was inserted
+	  */
+	  RT insertLastLeaf(uint64_t key, const RecordId& rid, bool& done);
+
+	  /**
+	  * Page access that goes to the in-memory nodes when the index is held
+	  * in memory, and to the file otherwise.
+	  */
+	  RT readNode(PageId pid, GBTLeafNode& node) const;
+	  RT readNode(PageId pid, GBTNonLeafNode& node) const;
+	  RT writeNode(PageId pid, const GBTLeafNode& node);
+	  RT writeNode(PageId pid, const GBTNonLeafNode& node);
+	  RT readPage(PageId pid, char* page) const;
+	  RT writePage(PageId pid, const char* page);
+	  bool hasPage(PageId pid) const;
+
+	  /**
+	  * In-memory nodes. The nodes are found by pid in a table of chunks
+	  * that never moves, so readers can look them up while a writer adds
+	  * nodes. A written page is swizzled again: its child or next page ids
+	  * are turned into node pointers.
+	  */
+	  static const int MEMORY_CHUNK_SIZE = 1024;
+	  static const int MEMORY_CHUNKS = 1 << 16;
+	  GBTMemoryNode* memoryNode(PageId pid) const;
+	  GBTMemoryNode* writeMemoryNode(PageId pid, const char* page, int type);
+	  void swizzle(GBTMemoryNode* node);
+	  RT loadMemoryNodes(PageId pid, int level);
+	  void freeMemoryNodes();
+
+	  /**
+	  * Lookups in memory: descend the swizzled pointers to a leaf, and
+	  * read the leaf entries in place under its latch.
+	  */
+	  RT findMemoryLeaf(uint64_t searchKey, bool leftmost, const GBTMemoryNode*& leaf, uint64_t& version) const;
+	  RT locateMemory(uint64_t searchKey, IndexCursor& cursor) const;
+	  RT readForwardMemory(IndexCursor& cursor, uint64_t& key, RecordId& rid) const;
+	  RT pointToSmallestKeyMemory(IndexCursor& cursor) const;
+
+	  /**
+	  * Page versions. preservePage() keeps the image of a page before the
+	  * running write changes it; readVersion() reads a page as of a snapshot;
+	  * publishVersion() ends a write by advancing the epoch.
+	  */
+	  RT preservePage(PageId pid);
+	  RT readVersion(const IndexSnapshot& snapshot, PageId pid, char* page) const;
+	  void publishVersion();
+
+	  /**
+	  * Latch or release the whole tree, for writers that touch many nodes.
+	  */
+	  void lockTree(std::vector<int>& locked);
+	  void unlock(std::vector<int>& locked);
 	/* *
 	  * whether the b+ tree Index supports duplicate keys
 	  * */
 	 bool duplicate_key;
 
 	 GBTFile pf;         /// the GBTFile used to store the actual b+tree in disk
+	 int page_size;      /// the page size of pf
+	 int node_keys;      /// the most keys of a non-leaf node, GBTNonLeafNode::maxKeys(page_size)
 
 	 // rootPid and treeHeight
 	 PageId   rootPid;    /// the PageId of the root node
 	 int      treeHeight; /// the height of the tree
+	 PageId   freePid;    /// the first page of the free page list, 0 if none
+	 PageId   newPid;     /// the next page at the end of the file to hand out
 	 /// Note that the content of the above two variables will be gone when
 	 /// this class is destructed. Make sure to store the values of the two  
 	 /// variables in disk, so that they can be reconstructed when the index
 	 /// is opened again later.
+
+	 // state of a bulk load
+	 GBTLeafNode bulk_leaf;      /// the leaf being filled
+	 PageId      bulk_pid;       /// the page of bulk_leaf
+	 bool        bulk_pending;   /// a pair is held back in bulk_key/bulk_rid
+	 uint64_t    bulk_key;
+	 RecordId    bulk_rid;
+	 /// (max key, pid) of the finished nodes of the level being built
+	 std::vector<std::pair<uint64_t, PageId> > bulk_children;
+
+	 // state of a merge. the leaf being written is bulk_leaf at bulk_pid
+	 /// every leaf in key order with the largest key its parent sends to it
+	 std::vector<std::pair<uint64_t, PageId> > merge_leaves;
+	 size_t   merge_pos;     /// the leaf of merge_leaves the pairs go to
+	 bool     merge_loaded;  /// merge_entries holds the old entries of that leaf
+	 std::vector<std::pair<uint64_t, RecordId> > merge_entries;
+	 size_t   merge_next_entry; /// the first entry of merge_entries not written yet
+	 PageId   merge_next_leaf;  /// the old next pointer of the leaf
+	 bool     merge_split;   /// a leaf overflowed, so the non-leaf levels change
+	 bool        merge_held;       /// a full page of the leaf is held back
+	 GBTLeafNode merge_held_leaf;  /// to share its entries with the last page
+	 PageId      merge_held_pid;
+	 std::vector<PageId> free_pids; /// pages of the old non-leaf nodes
+
+	 // appends to the right edge of the tree
+	 static const int APPEND_FILL = 90;  /// percent a right edge split keeps in the left node
+	 static const int APPEND_RUN = 64;   /// the ordered inserts after which it keeps all
+	 PageId   last_leaf;     /// the rightmost leaf, 0 if not known
+	 bool     last_has_low;  /// a separator is in front of it:
+	 uint64_t last_low;      /// the keys above last_low go to it
+	 uint64_t last_key;      /// the key of the last insert
+	 int      append_run;    /// the inserts in a row whose keys did not go down
+	 int      split_fill;    /// the fill of the splits of the running insert
+
+	 // concurrency control
+	 mutable std::atomic<uint64_t> latches[LATCH_COUNT];
+	 mutable std::atomic<uint64_t> tree_latch;  /// guards rootPid and treeHeight
+	 std::mutex writer_lock;                    /// serializes the writers
+
+	 // write-ahead log
+	 GBTWal   wal;
+	 bool     logging;                  /// wal is open and the file holds its dirty pages
+	 std::atomic<int> log_writers;      /// the writers in insert, remove or update
+	 std::string log_name;
+
+	 // page versions for snapshots
+	 typedef struct {
+		 uint64_t epoch;            /// the write that replaced the image
+		 std::vector<char> image;
+	 } PageVersion;
+	 uint64_t epoch;                /// the last published epoch
+	 std::map<PageId, std::vector<PageVersion> > page_versions; /// oldest first
+	 std::multiset<uint64_t> pinned_epochs;
+	 mutable std::mutex version_lock;  /// guards the page versions, pins and epoch
+	 std::atomic<size_t> version_count; /// the number of page versions kept
+
+	 // the tree held in memory
+	 bool in_memory;
+	 GBTMemoryNode*** memory_chunks;   /// MEMORY_CHUNKS chunks of MEMORY_CHUNK_SIZE nodes
+	 GBTMemoryNode* memory_root;       /// the node of rootPid
+	 bool memory_info_dirty;           /// the tree info page changed in memory
 };
 
 
@@ -19,19 +19,359 @@
 #define __STDC_FORMAT_MACROS
 #include <inttypes.h>
 #include <stdio.h>
+#include <algorithm>
+#include <vector>
 #include "GBTreeNode.h"
-/**
- * Move pointer to the beginning of the buffer;
+
+bool GBTLeafNode::pack_keys = true;
+
+static inline bool slotLess(const l_struct& e1, const l_struct& e2)
+{
+	return e1.key < e2.key;
+}
+
+static inline bool hasRow(const RecordId& rid)
+{
+	return GBTTable::rowNumber(rid) >= 0;
+}
+
+/*
+ * The eid-th RecordId of a packed page, stored from rids on.
  */
+static inline RecordId ridAt(const char* rids, int eid, bool rows)
+{
+	RecordId rid;
+	if (rows) {
+		uint32_t row;
+		memcpy(&row, rids + eid * sizeof(uint32_t), sizeof(uint32_t));
+		return GBTTable::rowRecord(row);
+	}
+	memcpy(&rid, rids + eid * sizeof(RecordId), sizeof(RecordId));
+	return rid;
+}
 
-void GBTLeafNode::resetPtr() {
-	buffer_ptr = (l_struct*) (buffer + sizeof(int));
+static inline uint64_t loadWord(const char* ptr)
+{
+	uint64_t word;
+	memcpy(&word, ptr, sizeof(uint64_t));
+	return word;
 }
 
-GBTLeafNode::GBTLeafNode(bool duplicate) {
+/*
+ * The eid-th width-bit value packed from words on.
+ */
+static inline uint64_t unpackBits(const char* words, int eid, int width)
+{
+	if (width == 0)
+		return 0;
+	uint64_t bit = (uint64_t) eid * width;
+	const char* word = words + (bit >> 6) * sizeof(uint64_t);
+	int shift = bit & 63;
+	uint64_t value = loadWord(word) >> shift;
+	if (shift + width > 64)
+		value |= loadWord(word + sizeof(uint64_t)) << (64 - shift);
+	return (width == 64) ? value : (value & ((1ULL << width) - 1));
+}
+
+GBTLeafNode::GBTLeafNode(bool duplicate, int pageSize)
+{
+	setPageSize(pageSize);
 	duplicate_key = duplicate;
-	memset(buffer, 0, sizeof(buffer));
-	resetPtr();
+	count = 0;
+	next = 0;
+	wide = 0;
+	overflow = false;
+	unpacked = true;
+	stale = true;
+}
+
+GBTLeafNode::GBTLeafNode(const GBTLeafNode& node)
+{
+	setPageSize(node.page_size);
+	*this = node;
+}
+
+void GBTLeafNode::setPageSize(int pageSize)
+{
+	if (pageSize <= (int) sizeof(small_page)) {
+		buffer = small_page;
+		large_page.reset();
+	} else {
+		large_page.reset(new char[pageSize]);
+		buffer = large_page.get();
+	}
+	entries.reset();
+	page_size = pageSize;
+	max_keys = maxKeys(pageSize);
+	max_entries = maxEntries(pageSize);
+}
+
+/*
+ * Only what the node holds is copied: the page, and the entries if
+ * they were decoded.
+ */
+GBTLeafNode& GBTLeafNode::operator=(const GBTLeafNode& node)
+{
+	if (this == &node)
+		return *this;
+	if (page_size != node.page_size)
+		setPageSize(node.page_size);
+	memcpy(buffer, node.buffer, page_size);
+	if (node.unpacked && node.count > 0) {
+		if (!entries)
+			entries.reset(new l_struct[max_entries]);
+		memcpy(entries.get(), node.entries.get(), node.count * SLOT_SIZE);
+	}
+	duplicate_key = node.duplicate_key;
+	stale = node.stale;
+	count = node.count;
+	next = node.next;
+	wide = node.wide;
+	overflow = node.overflow;
+	unpacked = node.unpacked;
+	return *this;
+}
+
+int GBTLeafNode::keyWidth(uint64_t firstKey, uint64_t lastKey)
+{
+	uint64_t range = lastKey - firstKey;
+	return (range == 0) ? 0 : 64 - __builtin_clzll(range);
+}
+
+int GBTLeafNode::packedSize(int count, int width, bool rows)
+{
+	int words = (int) (((int64_t) count * width + 63) / 64);
+	int rid_size = rows ? sizeof(uint32_t) : sizeof(RecordId);
+	return PACKED_HEADER + count * rid_size + words * sizeof(uint64_t) + sizeof(PageId);
+}
+
+bool GBTLeafNode::fits(int count, uint64_t firstKey, uint64_t lastKey, bool rows, int pageSize)
+{
+	if (count <= maxKeys(pageSize))
+		return true;
+	return pack_keys && count <= maxEntries(pageSize) &&
+		packedSize(count, keyWidth(firstKey, lastKey), rows) <= pageSize;
+}
+
+bool GBTLeafNode::fits(const std::pair<uint64_t, RecordId>* pairs, int count, int pageSize)
+{
+	if (count <= maxKeys(pageSize))
+		return true;
+	bool rows = true;
+	for (int i = 0; i < count && rows; i++)
+		rows = hasRow(pairs[i].second);
+	return fits(count, pairs[0].first, pairs[count-1].first, rows, pageSize);
+}
+
+/*
+ * The number of entries of a page; width, base and rows are set for a
+ * packed page, width is -1 for a plain one. A count that cannot be right
+ * is cut to what the page can hold.
+ */
+int GBTLeafNode::readHeader(const char* page, int pageSize, int& width, uint64_t& base, bool& rows)
+{
+	int count;
+	memcpy(&count, page, sizeof(int));
+	count &= ~OVERFLOW_FLAG;
+	if (!(count & PACKED_FLAG)) {
+		width = -1;
+		rows = false;
+		int max = maxKeys(pageSize);
+		return (count < 0 || count > max) ? max : count;
+	}
+	rows = (count & ROWS_FLAG) != 0;
+	count &= ~(PACKED_FLAG | ROWS_FLAG);
+	memcpy(&width, page + sizeof(int), sizeof(int));
+	memcpy(&base, page + sizeof(int) * 2, sizeof(uint64_t));
+	if (width < 0 || width > 64)
+		width = 64;
+	if (count < 0 || count > maxEntries(pageSize) || packedSize(count, width, rows) > pageSize) {
+		int rid_bits = (rows ? sizeof(uint32_t) : sizeof(RecordId)) * 8;
+		count = (pageSize - PACKED_HEADER - sizeof(PageId) - sizeof(uint64_t)) * 8 / (rid_bits + width);
+	}
+	return count;
+}
+
+int GBTLeafNode::keyCountOf(const char* page, int pageSize)
+{
+	int width;
+	uint64_t base;
+	bool rows;
+	return readHeader(page, pageSize, width, base, rows);
+}
+
+void GBTLeafNode::entryOf(const char* page, int pageSize, int eid, uint64_t& key, RecordId& rid)
+{
+	int width;
+	uint64_t base;
+	bool rows;
+	int total_keys = readHeader(page, pageSize, width, base, rows);
+
+	// eid may come from an older count of a page that changed since
+	if (eid >= total_keys)
+		eid = total_keys - 1;
+	if (eid < 0) {
+		key = 0;
+		rid = RecordId();
+		return;
+	}
+	if (width < 0) {
+		const l_struct* entry = (const l_struct*) (page + sizeof(int)) + eid;
+		key = entry->key;
+		rid = entry->rid;
+		return;
+	}
+	const char* rids = page + PACKED_HEADER;
+	int rid_size = rows ? sizeof(uint32_t) : sizeof(RecordId);
+	rid = ridAt(rids, eid, rows);
+	key = base + unpackBits(rids + total_keys * rid_size, eid, width);
+}
+
+/*
+ * The first entry of a page whose key is >= searchKey.
+ */
+int GBTLeafNode::lowerBoundOf(const char* page, int pageSize, uint64_t searchKey)
+{
+	int width;
+	uint64_t base;
+	bool rows;
+	int low = 0, high = readHeader(page, pageSize, width, base, rows);
+
+	if (width < 0) {
+		const l_struct* slots = (const l_struct*) (page + sizeof(int));
+		while (low < high) {
+			int mid = (low + high) / 2;
+			if (slots[mid].key < searchKey)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+		return low;
+	}
+
+	// compare the packed values with searchKey - base
+	if (searchKey <= base)
+		return 0;
+	uint64_t target = searchKey - base;
+	int rid_size = rows ? sizeof(uint32_t) : sizeof(RecordId);
+	const char* words = page + PACKED_HEADER + high * rid_size;
+	while (low < high) {
+		int mid = (low + high) / 2;
+		if (unpackBits(words, mid, width) < target)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return low;
+}
+
+bool GBTLeafNode::overflowOf(const char* page)
+{
+	int count;
+	memcpy(&count, page, sizeof(int));
+	return (count & OVERFLOW_FLAG) != 0;
+}
+
+PageId GBTLeafNode::nextNodeOf(const char* page, int pageSize)
+{
+	PageId pid;
+	memcpy(&pid, page + (pageSize - sizeof(PageId)), sizeof(PageId));
+	return pid;
+}
+
+/*
+ * Decode the page into entries before the node is changed. entries is
+ * allocated here, so that nodes only read never allocate it.
+ */
+void GBTLeafNode::unpack()
+{
+	if (!entries)
+		entries.reset(new l_struct[max_entries]);
+	if (unpacked)
+		return;
+
+	int width;
+	uint64_t base;
+	bool rows;
+	const char* page = buffer;
+	count = readHeader(page, page_size, width, base, rows);
+	next = nextNodeOf(page, page_size);
+	overflow = overflowOf(page);
+	wide = 0;
+	if (width < 0) {
+		memcpy(entries.get(), page + sizeof(int), count * SLOT_SIZE);
+		for (int i = 0; i < count; i++)
+			wide += !hasRow(entries[i].rid);
+	} else {
+		const char* rids = page + PACKED_HEADER;
+		const char* words = rids + count * (rows ? sizeof(uint32_t) : sizeof(RecordId));
+		for (int i = 0; i < count; i++) {
+			entries[i].rid = ridAt(rids, i, rows);
+			entries[i].key = base + unpackBits(words, i, width);
+			if (!rows)
+				wide += !hasRow(entries[i].rid);
+		}
+	}
+	unpacked = true;
+	stale = false;
+}
+
+/*
+ * Pack the entries into buffer if they changed since it was read.
+ */
+const char* GBTLeafNode::getBuffer() const
+{
+	if (!stale)
+		return buffer;
+
+	memset(buffer, 0, page_size);
+	int width = (count > 0) ? keyWidth(entries[0].key, entries[count-1].key) : 0;
+	bool rows = (wide == 0);
+	if ((pack_keys || count > max_keys) && count > 0 &&
+			packedSize(count, width, rows) <= page_size) {
+		int header = count | PACKED_FLAG | (rows ? ROWS_FLAG : 0) | (overflow ? OVERFLOW_FLAG : 0);
+		uint64_t base = entries[0].key;
+		memcpy(buffer, &header, sizeof(int));
+		memcpy(buffer + sizeof(int), &width, sizeof(int));
+		memcpy(buffer + sizeof(int) * 2, &base, sizeof(uint64_t));
+
+		char* rids = buffer + PACKED_HEADER;
+		for (int i = 0; i < count; i++) {
+			if (rows) {
+				uint32_t row = GBTTable::rowNumber(entries[i].rid);
+				memcpy(rids + i * sizeof(uint32_t), &row, sizeof(uint32_t));
+			} else {
+				memcpy(rids + i * sizeof(RecordId), &entries[i].rid, sizeof(RecordId));
+			}
+		}
+
+		// every value goes to the word its first bit is in, and the
+		// bits that do not fit there to the next word
+		char* words = rids + count * (rows ? sizeof(uint32_t) : sizeof(RecordId));
+		uint64_t word = 0;
+		int filled = 0;
+		for (int i = 0; i < count && width > 0; i++) {
+			uint64_t value = entries[i].key - base;
+			word |= value << filled;
+			filled += width;
+			if (filled >= 64) {
+				memcpy(words, &word, sizeof(uint64_t));
+				words += sizeof(uint64_t);
+				filled -= 64;
+				word = (filled == 0) ? 0 : value >> (width - filled);
+			}
+		}
+		if (filled > 0)
+			memcpy(words, &word, sizeof(uint64_t));
+	} else {
+		int header = count | (overflow ? OVERFLOW_FLAG : 0);
+		memcpy(buffer, &header, sizeof(int));
+		if (count > 0)
+			memcpy(buffer + sizeof(int), entries.get(), count * SLOT_SIZE);
+	}
+	memcpy(buffer + (page_size - sizeof(PageId)), &next, sizeof(PageId));
+	stale = false;
+	return buffer;
 }
 
 /*
@@ -42,8 +382,20 @@ GBTLeafNode::GBTLeafNode(bool duplicate) {
  */
 RT GBTLeafNode::read(PageId pid, const GBTFile& pf)
 { 
+	if (pf.pageSize() != page_size)
+		return RT_INVALID_FILE_FORMAT;
+	unpacked = false;
+	stale = false;
 	return pf.read(pid, buffer);
 }
+
+RT GBTLeafNode::load(const char* page)
+{
+	memcpy(buffer, page, page_size);
+	unpacked = false;
+	stale = false;
+	return 0;
+}
     
 /*
  * Write the content of the node to the page pid in the GBTFile pf.
@@ -53,14 +405,18 @@ RT GBTLeafNode::read(PageId pid, const GBTFile& pf)
  */
 RT GBTLeafNode::write(PageId pid, GBTFile& pf)
 {
-	return pf.write(pid, buffer);
+	return pf.write(pid, getBuffer());
 }
 
 /*
  * Update total keys
  */
 void GBTLeafNode::updateTotalKeys(int count) {
-	memcpy(buffer, &count, sizeof(int));
+	unpack();
+	for (int i = count; i < this->count; i++)
+		wide -= !hasRow(entries[i].rid);
+	this->count = count;
+	stale = true;
 }
 		
 /*
@@ -69,10 +425,17 @@ void GBTLeafNode::updateTotalKeys(int count) {
  */
 int GBTLeafNode::getKeyCount()
 { 
-	// read first four bytes;
-	int count;
-	memcpy(&count, buffer, sizeof(int));
-	return count;
+	return unpacked ? count : keyCountOf(buffer, page_size);
+}
+
+bool GBTLeafNode::isFull(uint64_t key, const RecordId& rid)
+{
+	if (getKeyCount() < max_keys)
+		return false;
+
+	unpack();
+	return !fits(count + 1, std::min(entries[0].key, key), std::max(entries[count-1].key, key),
+		wide == 0 && hasRow(rid), page_size);
 }
 
 /*
@@ -83,37 +446,82 @@ int GBTLeafNode::getKeyCount()
  */
 RT GBTLeafNode::insert(uint64_t key, const RecordId& rid)
 {
-	int total_keys = getKeyCount();
+	unpack();
 
-	if(total_keys == MAX_KEY_PER_NODE) {
-		return RT_NODE_FULL;
-	}
-
-	resetPtr();
 	int index = 0;
+	if (locate(key, index) < 0)
+		index = count;
 
-	while ((index < total_keys) && key > buffer_ptr->key) {
-		++index;
-		++buffer_ptr;
-	}
 	//if there is duplicate key, override the old one.
-	if(!(this->duplicate_key) && (key == buffer_ptr->key))
+	if(!(this->duplicate_key) && index < count && key == entries[index].key)
 	{
-		buffer_ptr->rid = rid;
-		buffer_ptr->key = key;
+		// a row number may be lost, then the page may not fit any more
+		if (hasRow(entries[index].rid) && !hasRow(rid) &&
+				!fits(count, entries[0].key, entries[count-1].key, false, page_size))
+			return RT_NODE_FULL;
+		wide += !hasRow(rid) - !hasRow(entries[index].rid);
+		entries[index].rid = rid;
+		stale = true;
 		return 0;
 	}
 
+	if (isFull(key, rid)) {
+		return RT_NODE_FULL;
+	}
+
 	// shift all elements to the right if we don't insert at the end of the buffer
-	if (index != total_keys) shift_r(index);
+	memmove(&entries[index + 1], &entries[index], (count - index) * SLOT_SIZE);
 
 	// insert key & rid
-	buffer_ptr->rid = rid;
-	buffer_ptr->key = key;
+	entries[index].rid = rid;
+	entries[index].key = key;
 
 	// update the total keys
-	updateTotalKeys(total_keys + 1);
+	count++;
+	wide += !hasRow(rid);
+	stale = true;
+
+	return 0;
+}
+
+/*
+ * Append the (key, rid) pair after the last entry of the node.
+ * @param key[IN] the key to append
+ * @param rid[IN] the RecordId to append
+ * @return 0 if successful. Return an error code if the node is full.
+ */
+RT GBTLeafNode::append(uint64_t key, const RecordId& rid)
+{
+	unpack();
+
+	if (isFull(key, rid)) {
+		return RT_NODE_FULL;
+	}
 
+	entries[count].rid = rid;
+	entries[count].key = key;
+	count++;
+	wide += !hasRow(rid);
+	stale = true;
+	return 0;
+}
+
+/*
+ * Remove the eid-th (key, rid) pair of the node.
+ * @param eid[IN] the entry number to remove
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RT GBTLeafNode::remove(int eid)
+{
+	unpack();
+
+	if (eid < 0 || eid >= count)
+		return RT_NO_SUCH_RECORD;
+
+	wide -= !hasRow(entries[eid].rid);
+	memmove(&entries[eid], &entries[eid + 1], (count - eid - 1) * SLOT_SIZE);
+	count--;
+	stale = true;
 	return 0;
 }
 
@@ -125,106 +533,70 @@ RT GBTLeafNode::insert(uint64_t key, const RecordId& rid)
  * @param rid[IN] the RecordId to insert.
  * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
  * @param siblingKey[OUT] the first key in the sibling node after split.
+ * @param fill[IN] the percentage of the entries the node keeps.
  * @return 0 if successful. Return an error code if there is an error.
  */
 RT GBTLeafNode::insertAndSplit(uint64_t key, const RecordId& rid, 
-                              GBTLeafNode& sibling, uint64_t& siblingKey)
+                              GBTLeafNode& sibling, uint64_t& siblingKey, int fill)
 { 
-	RT rc;
-	bool duplicate = false;
-
 	if (sibling.getKeyCount() != 0)
 		return RT_INVALID_NODE;
 
+	unpack();
+	sibling.unpack();
 
-	int total_keys = getKeyCount();
-
-	// reset pointer
-	resetPtr();
-
-	// find the spot where the new key should be inserted
+	// all entries in order with the new one
 	int key_spot = 0;
-	while (key_spot != total_keys && key > buffer_ptr->key) {
-		++key_spot;
-		++buffer_ptr;
-	}
+	if (locate(key, key_spot) < 0)
+		key_spot = count;
+	std::vector<l_struct> all(&entries[0], &entries[count]);
+	l_struct entry;
+	entry.rid = rid;
+	entry.key = key;
 	//if there are duplicate keys. just override the old one.
-	if((!duplicate_key) && (key == buffer_ptr->key))
-		duplicate = true;
-
-	// middle of the node
-	resetPtr();
-	int middle_spot = total_keys / 2;
-	int insert_to_sibling = 0;
-	if(this->duplicate_key){
-		if((buffer_ptr->key) == ((buffer_ptr+total_keys-1)->key)){
-			if(key < buffer_ptr->key){
-				middle_spot = 0;
-				insert_to_sibling = 0;
-			}else if(key > buffer_ptr->key){
-				middle_spot = total_keys;
-				insert_to_sibling = 1;
-			}else{
-				return RT_DUPLICATE_FULL;
-			}
-		}
-		else if((buffer_ptr+middle_spot)->key == (buffer_ptr+total_keys-1)->key){
-			buffer_ptr += middle_spot;
-			while(buffer_ptr->key == (buffer_ptr-1)->key){
-				buffer_ptr--;
-				middle_spot--;
-			}
-			if(key >= buffer_ptr->key)
-				insert_to_sibling = 1;
-		}
-		else{
-			buffer_ptr += middle_spot;
-			while(buffer_ptr->key == (buffer_ptr+1)->key){
-				buffer_ptr++;
-				middle_spot++;
-			}
-			buffer_ptr++;
-			middle_spot++;
-			if(key > buffer_ptr->key)
-				insert_to_sibling = 1;
-		}
-	}else{
-		buffer_ptr += middle_spot;
-		if (key_spot >= middle_spot) {
-			insert_to_sibling = 1;
+	if (!duplicate_key && key_spot < count && entries[key_spot].key == key)
+		all[key_spot] = entry;
+	else
+		all.insert(all.begin() + key_spot, entry);
+	int total = all.size();
+	// wide_before[i]: entries before i without a row number
+	std::vector<int> wide_before(total + 1, 0);
+	for (int i = 0; i < total; i++)
+		wide_before[i+1] = wide_before[i] + !hasRow(all[i].rid);
+
+	// split as near to the fill spot as both halves fit a page. with
+	// duplicate keys, the entries of one key stay in one node.
+	int target = std::min(std::max((int) ((int64_t) total * fill / 100), 1), total - 1);
+	int middle_spot = -1;
+	for (int d = 0; d < total && middle_spot < 0; d++) {
+		for (int side = 0; side < 2 && middle_spot < 0; side++) {
+			int spot = side ? target + d : target - d;
+			if (spot < 1 || spot >= total || (side && d == 0))
+				continue;
+			if (duplicate_key && all[spot-1].key == all[spot].key)
+				continue;
+			if (fits(spot, all[0].key, all[spot-1].key, wide_before[spot] == 0, page_size) &&
+					fits(total - spot, all[spot].key, all[total-1].key,
+						wide_before[total] == wide_before[spot], page_size))
+				middle_spot = spot;
 		}
 	}
+	if (middle_spot < 0)
+		return duplicate_key ? RT_DUPLICATE_FULL : RT_NODE_FULL;
 
-	// copy right half to sibling
-	for (int i = middle_spot; i < total_keys; ++i, ++buffer_ptr) {
-		if ((rc = sibling.insert(buffer_ptr->key, buffer_ptr->rid)) < 0) return rc;
-	}
+	// copy right half to sibling, with the next pointer of the current node
+	sibling.count = total - middle_spot;
+	memcpy(sibling.entries.get(), &all[middle_spot], sibling.count * SLOT_SIZE);
+	sibling.next = next;
+	sibling.wide = wide_before[total] - wide_before[middle_spot];
+	sibling.stale = true;
 
-	// copy the next pointer if there exists one in the current Node
-	if (getNextNodePtr() != 0) {
-		sibling.setNextNodePtr(getNextNodePtr());
-	}
+	count = middle_spot;
+	wide = wide_before[middle_spot];
+	memcpy(entries.get(), &all[0], count * SLOT_SIZE);
+	stale = true;
 
-	if (!insert_to_sibling) {
-		updateTotalKeys(total_keys - 1); // make it non-full
-		if ((rc = insert(key, rid)) < 0) return rc;
-	} else {
-		if ((rc = sibling.insert(key, rid)) < 0) return rc;
-	}
-
-	int newCount;
-	if(duplicate && insert_to_sibling)
-		newCount = total_keys - sibling.getKeyCount();
-	else
-		newCount = total_keys + 1 - sibling.getKeyCount();
-	// update number of keys
-	updateTotalKeys(newCount);
-
-	uint64_t cur_key;
-	RecordId cur_rid;
-	if ((rc = readEntry( (newCount-1), cur_key, cur_rid)) < 0) return rc;
-
-	siblingKey = cur_key;
+	siblingKey = all[middle_spot - 1].key;
 
 #ifdef DEBUG
 	printf("Current Node: ");
@@ -246,20 +618,23 @@ RT GBTLeafNode::insertAndSplit(uint64_t key, const RecordId& rid,
  */
 RT GBTLeafNode::locate(uint64_t searchKey, int& eid)
 {
-	resetPtr();
-	int total_keys = getKeyCount();
-	int i;
-	for (i = 0; i < total_keys; ++i, ++buffer_ptr) {
-		if (buffer_ptr->key >= searchKey) {
-			eid = i;
-			break;
-		}
+	int i, total_keys;
+
+	if (unpacked) {
+		l_struct probe;
+		probe.key = searchKey;
+		total_keys = count;
+		i = std::lower_bound(entries.get(), entries.get() + count, probe, slotLess) - entries.get();
+	} else {
+		total_keys = keyCountOf(buffer, page_size);
+		i = lowerBoundOf(buffer, page_size, searchKey);
 	}
 
 	if (i >= total_keys) {
 		return RT_NO_SUCH_RECORD;
 	}
 
+	eid = i;
 	return 0;
 }
 
@@ -277,11 +652,12 @@ RT GBTLeafNode::readEntry(int eid, uint64_t& key, RecordId& rid)
 	if (eid < 0 || eid >= total_keys)
 		return RT_NO_SUCH_RECORD;
 
-	resetPtr();
-	buffer_ptr += eid;
-
-	key = buffer_ptr->key;
-	rid = buffer_ptr->rid;
+	if (unpacked) {
+		key = entries[eid].key;
+		rid = entries[eid].rid;
+	} else {
+		entryOf(buffer, page_size, eid, key, rid);
+	}
 
 	return 0;
 }
@@ -293,15 +669,19 @@ RT GBTLeafNode::readEntry(int eid, uint64_t& key, RecordId& rid)
  */
 PageId GBTLeafNode::getNextNodePtr()
 { 
-	int next_pageid;
-	/**
-	 * @ not 2(because there is only one count size in leaf node)
-	 * @ Author : edward liu
-	 * @ Date : 3/19/2014
-	 */
-	memcpy(&next_pageid, buffer + (GBTFile::PAGE_SIZE - sizeof(int)), sizeof(int));
+	return unpacked ? next : nextNodeOf(buffer, page_size);
+}
 
-	return next_pageid;
+bool GBTLeafNode::isOverflow()
+{
+	return unpacked ? overflow : overflowOf(buffer);
+}
+
+void GBTLeafNode::setOverflow(bool overflow)
+{
+	unpack();
+	this->overflow = overflow;
+	stale = true;
 }
 
 /*
@@ -311,21 +691,13 @@ PageId GBTLeafNode::getNextNodePtr()
  */
 RT GBTLeafNode::setNextNodePtr(PageId pid)
 { 
-	/**
-	 * @ no 2(because there is only one count size in leaf node)
-	 * @ Author : edward liu
-	 * @ Date : 3/19/2014
-	 */
-	memcpy(buffer + (GBTFile::PAGE_SIZE - sizeof(int)), &pid, sizeof(int));
+	unpack();
+	next = pid;
+	stale = true;
 
 	return 0;
 }
 
-void GBTLeafNode::shift_r(int index){
-	memmove(buffer_ptr + 1, buffer_ptr, (getKeyCount() - index) * SLOT_SIZE);
-}
-
-
 /////////// NON LEAF /////////////
 /**
  * Move pointer to the beginning of the buffer;
@@ -335,8 +707,16 @@ void GBTNonLeafNode::resetPtr() {
 	buffer_ptr = (nl_struct*) (buffer + sizeof(int) * 2);
 }
 
-GBTNonLeafNode::GBTNonLeafNode() {
-	memset(buffer, 0, sizeof(buffer));
+GBTNonLeafNode::GBTNonLeafNode(int pageSize)
+	: page_size(pageSize), max_keys(maxKeys(pageSize))
+{
+	if (pageSize <= (int) sizeof(small_page)) {
+		buffer = small_page;
+	} else {
+		large_page.reset(new char[pageSize]);
+		buffer = large_page.get();
+	}
+	memset(buffer, 0, page_size);
 	resetPtr();
 }
 
@@ -358,10 +738,18 @@ void GBTNonLeafNode::shift_r(int index){
 RT GBTNonLeafNode::read(PageId pid, const GBTFile& pf)
 {
 	RT rc;
+	if (pf.pageSize() != page_size) return RT_INVALID_FILE_FORMAT;
 	if ((rc = pf.read(pid, buffer)) < 0) return rc;
 	resetPtr();
 	return 0;
 }
+
+RT GBTNonLeafNode::load(const char* page)
+{
+	memcpy(buffer, page, page_size);
+	resetPtr();
+	return 0;
+}
     
 /*
  * Write the content of the node to the page pid in the GBTFile pf.
@@ -397,7 +785,7 @@ RT GBTNonLeafNode::insert(uint64_t key, PageId pid)
 {
 	int total_keys = getKeyCount();
 
-	if(total_keys == MAX_KEY_PER_NODE) {
+	if(total_keys == max_keys) {
 		return RT_NODE_FULL;
 	}
 
@@ -428,6 +816,66 @@ RT GBTNonLeafNode::insert(uint64_t key, PageId pid)
 	return 0;
 }
 
+/*
+ * Append the (key, pid) pair after the last entry of the node.
+ * @param key[IN] the key to append
+ * @param pid[IN] the PageId to append
+ * @return 0 if successful. Return an error code if the node is full.
+ */
+RT GBTNonLeafNode::append(uint64_t key, PageId pid)
+{
+	int total_keys = getKeyCount();
+
+	if (total_keys == max_keys) {
+		return RT_NODE_FULL;
+	}
+
+	resetPtr();
+	buffer_ptr += total_keys;
+	buffer_ptr->key = key;
+	buffer_ptr->pid = pid;
+
+	updateTotalKeys(total_keys + 1);
+	return 0;
+}
+
+/*
+ * Remove the eid-th key and the child pointer behind it.
+ * @param eid[IN] the entry number to remove
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RT GBTNonLeafNode::remove(int eid)
+{
+	int total_keys = getKeyCount();
+
+	if (eid < 0 || eid >= total_keys)
+		return RT_NO_SUCH_RECORD;
+
+	resetPtr();
+	buffer_ptr += eid;
+	memmove(buffer_ptr, buffer_ptr + 1, (total_keys - eid - 1) * SLOT_SIZE);
+
+	updateTotalKeys(total_keys - 1);
+	return 0;
+}
+
+/*
+ * Replace the eid-th key.
+ * @param eid[IN] the entry number to change
+ * @param key[IN] the new key
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RT GBTNonLeafNode::setKey(int eid, uint64_t key)
+{
+	if (eid < 0 || eid >= getKeyCount())
+		return RT_NO_SUCH_RECORD;
+
+	resetPtr();
+	buffer_ptr += eid;
+	buffer_ptr->key = key;
+	return 0;
+}
+
 /*
  * Insert the (key, pid) pair to the node
  * and split the node half and half with sibling.
@@ -440,79 +888,59 @@ RT GBTNonLeafNode::insert(uint64_t key, PageId pid)
  */
 RT GBTNonLeafNode::insertAndSplit(uint64_t key, PageId pid, GBTNonLeafNode& sibling, uint64_t& midKey)
 {
-	RT rc;
-	
-	if (sibling.getKeyCount() != 0)
-		return RT_INVALID_NODE;
-
 	int total_keys = getKeyCount();
 
-	// reset pointer
-	resetPtr();
-
 	// find the spot where the new key should be inserted
+	resetPtr();
 	int key_spot = 0;
 	while (key_spot != total_keys && key > buffer_ptr->key) {
 		++key_spot;
 		++buffer_ptr;
 	}
 
+	return insertAtAndSplit(key_spot, key, pid, sibling, midKey);
+}
 
-	bool is_equal = (key_spot != total_keys && key == buffer_ptr->key);
-	// middle of the node
-	resetPtr();
-	int middle_spot = total_keys / 2;
-	buffer_ptr += middle_spot;
-	int insert_to_sibling = -1;
+/*
+ * Insert (key, pid) as the eid-th entry and split the node half and half,
+ * or by fill, with sibling. The middle key moves up: it is returned in midKey and is
+ * kept in neither node, and the child behind it becomes the first child
+ * of the sibling.
+ * @param eid[IN] the entry number the new key gets
+ * @param key[IN] the key to insert
+ * @param pid[IN] the PageId to insert behind the key
+ * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
+ * @param midKey[OUT] the key to insert to the parent node.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RT GBTNonLeafNode::insertAtAndSplit(int eid, uint64_t key, PageId pid, GBTNonLeafNode& sibling, uint64_t& midKey, int fill)
+{
+	int total_keys = getKeyCount();
 
-	
-	/**
-	* @ if key == buffer_ptr->key , do not insert the key.
-	* @ Author : edward liu
-	* @ Date : 3/20/2014
-	*/
-	PageId firstPid;
-	if(is_equal){
-		firstPid = (buffer_ptr-1)->pid;
-		midKey = (buffer_ptr-1)->key;
-	} else if (key_spot == middle_spot){
-		firstPid = pid;
-		insert_to_sibling = 0;
-		midKey = key;
-	}else if(key_spot < middle_spot) {
-		firstPid = (buffer_ptr-1)->pid;
-		insert_to_sibling = 0; // insert new key to the current node
-		midKey = (buffer_ptr-1)->key;
-	} else {
-		firstPid = (buffer_ptr-1)->pid;
-		insert_to_sibling = 1;
-		midKey = (buffer_ptr-1)->key;
-	}
+	if (sibling.getKeyCount() != 0)
+		return RT_INVALID_NODE;
+	if (eid < 0 || eid > total_keys)
+		return RT_INVALID_CURSOR;
 
-	/**
-	 * @ convert 1 to 0(insert new key to the current node)
-	 * @ Author : edward liu
-	 * @ Date : 3/19/2014
-	 */
-	sibling.insertFirstPid(firstPid);
-	// copy right half to sibling
-	for (int i = middle_spot; i < total_keys; ++i, ++buffer_ptr) {
-		sibling.insert(buffer_ptr->key, buffer_ptr->pid);
-	}
+	// all entries in order, with the new one at eid
+	std::vector<nl_struct> entries(total_keys + 1);
+	resetPtr();
+	memcpy(&entries[0], buffer_ptr, eid * SLOT_SIZE);
+	entries[eid].key = key;
+	entries[eid].pid = pid;
+	memcpy(&entries[eid + 1], buffer_ptr + eid, (total_keys - eid) * SLOT_SIZE);
 
-	// insert new key or not?
-	if (insert_to_sibling != -1) {
-		if (insert_to_sibling == 0) {
-			updateTotalKeys(total_keys - 1); // make it non full
-			if ((rc = insert(key, pid)) < 0) return rc;
-		} else {
-			if ((rc = sibling.insert(key, pid)) < 0) return rc;
-		}
+	int middle_spot = std::min(std::max((total_keys + 1) * fill / 100, 1), total_keys - 1);
+	midKey = entries[middle_spot].key;
 
-		updateTotalKeys(total_keys + 1 - sibling.getKeyCount());
-	} else {
-		updateTotalKeys(total_keys - sibling.getKeyCount());
-	}
+	// the sibling starts with the child behind the middle key
+	sibling.insertFirstPid(entries[middle_spot].pid);
+	sibling.resetPtr();
+	memcpy(sibling.buffer_ptr, &entries[middle_spot + 1], (total_keys - middle_spot) * SLOT_SIZE);
+	sibling.updateTotalKeys(total_keys - middle_spot);
+
+	memcpy(buffer_ptr, &entries[0], middle_spot * SLOT_SIZE);
+	updateTotalKeys(middle_spot);
 
 #ifdef DEBUG
 	printf("None Leaf Current Node: ");
@@ -524,6 +952,32 @@ RT GBTNonLeafNode::insertAndSplit(uint64_t key, PageId pid, GBTNonLeafNode& sibl
 	return 0;
 }
 
+/*
+ * Insert (key, pid) as the eid-th entry of the node.
+ * @param eid[IN] the entry number the new key gets
+ * @param key[IN] the key to insert
+ * @param pid[IN] the PageId to insert behind the key
+ * @return 0 if successful. Return an error code if the node is full.
+ */
+RT GBTNonLeafNode::insertAt(int eid, uint64_t key, PageId pid)
+{
+	int total_keys = getKeyCount();
+
+	if (total_keys == max_keys)
+		return RT_NODE_FULL;
+	if (eid < 0 || eid > total_keys)
+		return RT_INVALID_CURSOR;
+
+	resetPtr();
+	buffer_ptr += eid;
+	shift_r(eid);
+	buffer_ptr->key = key;
+	buffer_ptr->pid = pid;
+
+	updateTotalKeys(total_keys + 1);
+	return 0;
+}
+
 /*
  * Given the searchKey, find the child-node pointer to follow and
  * output it in pid.
@@ -558,6 +1012,62 @@ RT GBTNonLeafNode::locateChildPtr(uint64_t searchKey, PageId& pid)
 	return 0;
 }
 
+/*
+ * Read the eid-th (key, pid) pair of the node.
+ * @param eid[IN] the entry number to read
+ * @param key[OUT] the key of the entry
+ * @param pid[OUT] the PageId behind the key
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RT GBTNonLeafNode::readEntry(int eid, uint64_t& key, PageId& pid)
+{
+	if (eid < 0 || eid >= getKeyCount())
+		return RT_NO_SUCH_RECORD;
+
+	resetPtr();
+	buffer_ptr += eid;
+
+	key = buffer_ptr->key;
+	pid = buffer_ptr->pid;
+
+	return 0;
+}
+
+/*
+ * Return the index-th child pointer of the node.
+ * @param index[IN] the child number
+ * @param pid[OUT] the PageId of the child
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RT GBTNonLeafNode::getChildPtr(int index, PageId& pid)
+{
+	uint64_t key;
+
+	if (index == 0)
+		return getLeftSiblingPid(pid);
+	return readEntry(index - 1, key, pid);
+}
+
+/*
+ * Find the child to follow for searchKey. A key equal to a separator
+ * goes to the child in front of the separator, as in locateChildPtr().
+ * @param searchKey[IN] the searchKey that is being looked up.
+ * @param index[OUT] the number of the child to follow.
+ * @return 0 if successful. Return an error code if there is an error.
+ */
+RT GBTNonLeafNode::locateChildIndex(uint64_t searchKey, int& index)
+{
+	int total_keys = getKeyCount();
+
+	resetPtr();
+	index = 0;
+	while (index < total_keys && searchKey > buffer_ptr->key) {
+		++index;
+		++buffer_ptr;
+	}
+	return 0;
+}
+
 /*
  * Initialize the root node with (pid1, key, pid2).
  * @param pid1[IN] the first PageId to insert
@@ -599,19 +1109,16 @@ RT GBTNonLeafNode::insertFirstPid(PageId id)
 }
 void GBTLeafNode::printN() {
 	printf("Leaf Node");
-	resetPtr();
-	int index = 0;
 	int total_keys = getKeyCount();
 	printf("\n");
-	int total = 0;
-	while (index < total_keys) {
-		printf("%" PRIx64 ", ", buffer_ptr->key);
-		++buffer_ptr;
-		++index;
-		++total;
+	uint64_t key;
+	RecordId rid;
+	for (int index = 0; index < total_keys; ++index) {
+		readEntry(index, key, rid);
+		printf("%" PRIx64 ", ", key);
 	}
 	printf("\n");
-	printf("total: %d\n", total);
+	printf("total: %d\n", total_keys);
 }
 void GBTNonLeafNode::printNL()
 {
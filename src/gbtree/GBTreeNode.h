@@ -10,6 +10,8 @@
 #define GBTREENODE_H_
 
 #include "../storagemanager/GBTFile.h"
+#include <memory>
+#include <utility>
 #include "../base/GBTreeBase.h"
 #include "GBTTable.h"
 
@@ -21,14 +23,53 @@ typedef struct {
 	uint64_t key;
 } l_struct;
 
+/** Some notes
+ * 1. a leaf page is either plain or packed. both keep the pageid of the
+ *    sibling in the last four bytes.
+ * 2. plain: the first four bytes store # of keys, then the l_struct slots.
+ * 3. packed: the first four bytes store # of keys | PACKED_FLAG, then the
+ *    key width in bits and the first key (the base). the RecordIds follow
+ *    in order, then key - base of every key in width bits, packed into
+ *    64-bit words. the keys in a leaf share their high bits, so the width
+ *    is far below 64 and a packed page holds more entries.
+ * 4. if every RecordId of a packed page has a 32-bit row number
+ *    (GBTTable::rowNumber), ROWS_FLAG is set in # of keys as well and
+ *    the row numbers are stored instead of the RecordIds.
+ * 5. OVERFLOW_FLAG in # of keys marks an overflow page of duplicate keys:
+ *    a leaf in the leaf chain that no parent points to and that holds
+ *    more entries of the key its chain follows.
+ * 6. the page size is that of the index file, so how many entries a page
+ *    holds is known at run time only.
+ */
 class GBTLeafNode {
   public:
 	static const int SLOT_SIZE = sizeof(RecordId) + sizeof(uint64_t);
 	// first 4 bytes store number of keys, last 4 bytes store pageid of the sibling
-	static const int MAX_KEY_PER_NODE = (GBTFile::PAGE_SIZE - sizeof(int)*2) / SLOT_SIZE;
+	static int maxKeys(int pageSize) { return (pageSize - sizeof(int)*2) / SLOT_SIZE; }
+
+	static const int PACKED_FLAG = 1 << 30;
+	static const int ROWS_FLAG = 1 << 29;
+	static const int OVERFLOW_FLAG = 1 << 28;
+	static const int PACKED_HEADER = sizeof(int) * 2 + sizeof(uint64_t);
+	// the most entries a packed page holds: all keys equal, width 0, row numbers
+	static int maxEntries(int pageSize) { return (pageSize - PACKED_HEADER - sizeof(PageId)) / sizeof(uint32_t); }
+
+	/* *
+	 * whether leaves are written packed. a leaf that does not fit a
+	 * packed page, or has no more entries than a plain page holds when
+	 * false, is written plain; both formats are always read.
+	 * */
+	static bool pack_keys;
 
 	// constructor
-	GBTLeafNode(bool duplicate = false);
+	GBTLeafNode(bool duplicate = false, int pageSize = GBTFile::PAGE_SIZE);
+	GBTLeafNode(const GBTLeafNode& node);
+	GBTLeafNode& operator=(const GBTLeafNode& node);
+
+   /**
+    * The entries of a plain page, the least a leaf holds before it is full.
+    */
+    int maxKeyCount() const { return max_keys; }
 
    /**
     * Insert the (key, rid) pair to the node.
@@ -39,6 +80,44 @@ class GBTLeafNode {
     */
     RT insert(uint64_t key, const RecordId& rid);
 
+   /**
+    * Whether inserting (key, rid) would overflow the node, so that it has
+    * to be split first. How many entries fit depends on the range of the
+    * keys and on whether the RecordIds have row numbers.
+    * @param key[IN] the key to insert
+    * @param rid[IN] the RecordId to insert
+    * @return true if the node is full for (key, rid)
+    */
+    bool isFull(uint64_t key, const RecordId& rid);
+
+   /**
+    * Whether count entries from firstKey to lastKey fit in a leaf page of
+    * pageSize bytes. rows is true if all their RecordIds have row numbers.
+    */
+    static bool fits(int count, uint64_t firstKey, uint64_t lastKey, bool rows, int pageSize);
+
+   /**
+    * Whether the count (key, rid) pairs in key order fit in a leaf page.
+    */
+    static bool fits(const std::pair<uint64_t, RecordId>* pairs, int count, int pageSize);
+
+   /**
+    * Append the (key, rid) pair after the last entry of the node.
+    * Used by bulk loading, where the pairs arrive in key order;
+    * the caller must not append a key smaller than the last key.
+    * @param key[IN] the key to append
+    * @param rid[IN] the RecordId to append
+    * @return 0 if successful. Return an error code if the node is full.
+    */
+    RT append(uint64_t key, const RecordId& rid);
+
+   /**
+    * Remove the eid-th (key, rid) pair and shift the later pairs left.
+    * @param eid[IN] the entry number to remove
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RT remove(int eid);
+
    /**
     * Insert the (key, rid) pair to the node
     * and split the node half and half with sibling.
@@ -48,9 +127,11 @@ class GBTLeafNode {
     * @param rid[IN] the RecordId to insert.
     * @param sibling[IN] the sibling node to split with. This node MUST be EMPTY when this function is called.
     * @param siblingKey[OUT] the first key in the sibling node after split.
+    * @param fill[IN] the percentage of the entries the node keeps; 100
+    *                 leaves only the last entry to the sibling
     * @return 0 if successful. Return an error code if there is an error.
     */
-    RT insertAndSplit(uint64_t key, const RecordId& rid, GBTLeafNode& sibling, uint64_t& siblingKey);
+    RT insertAndSplit(uint64_t key, const RecordId& rid, GBTLeafNode& sibling, uint64_t& siblingKey, int fill = 50);
 
    /**
     * Find the index entry whose key value is larger than or equal to searchKey
@@ -87,6 +168,12 @@ class GBTLeafNode {
     */
     RT setNextNodePtr(PageId pid);
 
+   /**
+    * Whether the node is an overflow page of duplicate keys.
+    */
+    bool isOverflow();
+    void setOverflow(bool overflow);
+
    /**
     * Return the number of keys stored in the node.
     * @return the number of keys in the node
@@ -102,9 +189,34 @@ class GBTLeafNode {
     * Read the content of the node from the page pid in the GBTFile pf.
     * @param pid[IN] the PageId to read
     * @param pf[IN] GBTFile to read from
-    * @return 0 if successful. Return an error code if there is an error.
+    * @return 0 if successful. Return an error code if there is an error,
+    *   RT_INVALID_FILE_FORMAT if the pages of pf are not of the node's size.
     */
     RT read(PageId pid, const GBTFile& pf);
+
+   /**
+    * Load the content of the node from a page image in memory,
+    * e.g. an old version of a page kept for a snapshot.
+    * @param page[IN] a page of the node's size
+    * @return 0 if successful.
+    */
+    RT load(const char* page);
+
+   /**
+    * The content of the node in the page format.
+    */
+    const char* getBuffer() const;
+
+   /**
+    * Read a leaf page of pageSize bytes in place, in either format; used
+    * where a page is searched without loading a node. A page changed by a
+    * writer at the same time gives wrong values but no read outside the page.
+    */
+    static int keyCountOf(const char* page, int pageSize);
+    static void entryOf(const char* page, int pageSize, int eid, uint64_t& key, RecordId& rid);
+    static int lowerBoundOf(const char* page, int pageSize, uint64_t searchKey);
+    static PageId nextNodeOf(const char* page, int pageSize);
+    static bool overflowOf(const char* page);
     
    /**
     * Write the content of the node to the page pid in the GBTFile pf.
@@ -120,25 +232,41 @@ class GBTLeafNode {
 
   private:
 
+   /**
+    * The page the node was read from, or the node packed for writing
+    * once getBuffer() was called after a change. it is small_page for
+    * pages up to GBTFile::PAGE_SIZE, so that the nodes of such files are
+    * not allocated, and large_page above.
+    */
+    char* buffer;
+    char small_page[GBTFile::PAGE_SIZE];
+    std::unique_ptr<char[]> large_page;
+    mutable bool stale;    /// buffer is older than entries
+    int page_size;
+    int max_keys;          /// maxKeys(page_size)
+    int max_entries;       /// maxEntries(page_size)
+
+    void setPageSize(int pageSize);
 
    /**
-    * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * The entries, count and next pointer of the node. A read node is only
+    * decoded into them by the first change; until then buffer is read
+    * in place, so a scan decodes just the entries it visits. entries is
+    * allocated by the first change.
     */
-    char buffer[GBTFile::PAGE_SIZE];  // buffer contains 1024 characters (1KB), PAGE_SIZE=1024;
+    std::unique_ptr<l_struct[]> entries;
+    int count;
+    PageId next;
+    int wide;    /// entries whose RecordId has no row number
+    bool overflow;
+    bool unpacked;
 
-    /**
-     * Shift all elements in buffer to the right beginning from where buffer_ptr points to
-     */
-    void shift_r(int index);
+    void unpack();
 
-    /**
-     * Move the pointer to the start of the buffer
-     */
-    void resetPtr();
+    static int readHeader(const char* page, int pageSize, int& width, uint64_t& base, bool& rows);
+    static int packedSize(int count, int width, bool rows);
+    static int keyWidth(uint64_t firstKey, uint64_t lastKey);
 
-    l_struct* buffer_ptr;
-	
 	/* *
 	 * Whether support duplicate keys.
 	 * */
@@ -162,11 +290,16 @@ typedef struct {
 
 class GBTNonLeafNode {
   public:
-	GBTNonLeafNode();
+	GBTNonLeafNode(int pageSize = GBTFile::PAGE_SIZE);
 
 	// Non-leaf node
 	static const int SLOT_SIZE = sizeof(nl_struct);
-	static const int MAX_KEY_PER_NODE = (GBTFile::PAGE_SIZE - sizeof(int) * 2) / SLOT_SIZE;
+	static int maxKeys(int pageSize) { return (pageSize - sizeof(int) * 2) / SLOT_SIZE; }
+
+   /**
+    * The most keys the node holds in its page.
+    */
+    int maxKeyCount() const { return max_keys; }
 
    /**
     * Insert a (key, pid) pair to the node.
@@ -177,11 +310,38 @@ class GBTNonLeafNode {
     */
     RT insert(uint64_t key, PageId pid);
 
+   /**
+    * Append the (key, pid) pair after the last entry of the node.
+    * Used by bulk loading, where the keys arrive in order. Unlike insert(),
+    * a key equal to the last key is kept behind it.
+    * @param key[IN] the key to append
+    * @param pid[IN] the PageId to append
+    * @return 0 if successful. Return an error code if the node is full.
+    */
+    RT append(uint64_t key, PageId pid);
+
+   /**
+    * Remove the eid-th key and the child pointer behind it.
+    * Used when the child behind the key is merged into the child in front of it.
+    * @param eid[IN] the entry number to remove
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RT remove(int eid);
+
+   /**
+    * Replace the eid-th key, e.g. after entries moved between two children.
+    * @param eid[IN] the entry number to change
+    * @param key[IN] the new key
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RT setKey(int eid, uint64_t key);
+
    /**
     * Insert the (key, pid) pair to the node
     * and split the node half and half with sibling.
     * The sibling node MUST be empty when this function is called.
-    * The middle key after the split is returned in midKey.
+    * The middle key after the split is returned in midKey; it moves up
+    * to the parent and stays in neither node.
     * Remember that all keys inside a B+tree node should be kept sorted.
     * @param key[IN] the key to insert
     * @param pid[IN] the PageId to insert
@@ -191,6 +351,30 @@ class GBTNonLeafNode {
     */
     RT insertAndSplit(uint64_t key, PageId pid, GBTNonLeafNode& sibling, uint64_t& midKey);
 
+   /**
+    * Insert the (key, pid) pair as the eid-th entry of the node.
+    * Unlike insert(), the position is given, so that among equal keys the
+    * new child ends up right behind the child that was split.
+    * @param eid[IN] the entry number the new key gets
+    * @param key[IN] the key to insert
+    * @param pid[IN] the PageId to insert behind the key
+    * @return 0 if successful. Return an error code if the node is full.
+    */
+    RT insertAt(int eid, uint64_t key, PageId pid);
+
+   /**
+    * insertAt() for a full node, splitting it like insertAndSplit().
+    * @param eid[IN] the entry number the new key gets
+    * @param key[IN] the key to insert
+    * @param pid[IN] the PageId to insert behind the key
+    * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
+    * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
+    * @param fill[IN] the percentage of the keys the node keeps; the sibling
+    *                 gets at least one key
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RT insertAtAndSplit(int eid, uint64_t key, PageId pid, GBTNonLeafNode& sibling, uint64_t& midKey, int fill = 50);
+
    /**
     * Given the searchKey, find the child-node pointer to follow and
     * output it in pid.
@@ -201,6 +385,34 @@ class GBTNonLeafNode {
     */
     RT locateChildPtr(uint64_t searchKey, PageId& pid);
 
+   /**
+    * Read the eid-th (key, pid) pair of the node. pid is the child
+    * behind the key; the child in front of the first key is returned
+    * by getLeftSiblingPid().
+    * @param eid[IN] the entry number to read, from 0 to getKeyCount()-1
+    * @param key[OUT] the key of the entry
+    * @param pid[OUT] the PageId behind the key
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RT readEntry(int eid, uint64_t& key, PageId& pid);
+
+   /**
+    * Return the index-th child pointer. Child 0 is in front of the first
+    * key and child i is behind the (i-1)-th key.
+    * @param index[IN] the child number, from 0 to getKeyCount()
+    * @param pid[OUT] the PageId of the child
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RT getChildPtr(int index, PageId& pid);
+
+   /**
+    * Like locateChildPtr(), but output the child number instead of its pid.
+    * @param searchKey[IN] the searchKey that is being looked up.
+    * @param index[OUT] the number of the child to follow, see getChildPtr().
+    * @return 0 if successful. Return an error code if there is an error.
+    */
+    RT locateChildIndex(uint64_t searchKey, int& index);
+
    /**
     * Initialize the root node with (pid1, key, pid2).
     * @param pid1[IN] the first PageId to insert
@@ -221,9 +433,23 @@ class GBTNonLeafNode {
     * Read the content of the node from the page pid in the GBTFile pf.
     * @param pid[IN] the PageId to read
     * @param pf[IN] GBTFile to read from
-    * @return 0 if successful. Return an error code if there is an error.
+    * @return 0 if successful. Return an error code if there is an error,
+    *   RT_INVALID_FILE_FORMAT if the pages of pf are not of the node's size.
     */
     RT read(PageId pid, const GBTFile& pf);
+
+   /**
+    * Load the content of the node from a page image in memory,
+    * e.g. an old version of a page kept for a snapshot.
+    * @param page[IN] a page of the node's size
+    * @return 0 if successful.
+    */
+    RT load(const char* page);
+
+   /**
+    * The content of the node in the page format.
+    */
+    const char* getBuffer() const { return buffer; }
     
    /**
     * Write the content of the node to the page pid in the GBTFile pf.
@@ -244,9 +470,17 @@ class GBTNonLeafNode {
   private:
    /**
     * The main memory buffer for loading the content of the disk page 
-    * that contains the node.
+    * that contains the node: small_page, or large_page for pages above
+    * GBTFile::PAGE_SIZE.
     */
-    char buffer[GBTFile::PAGE_SIZE];
+    char* buffer;
+    char small_page[GBTFile::PAGE_SIZE];
+    std::unique_ptr<char[]> large_page;
+    int page_size;
+    int max_keys;          /// maxKeys(page_size)
+
+    GBTNonLeafNode(const GBTNonLeafNode&);
+    GBTNonLeafNode& operator=(const GBTNonLeafNode&);
 
     /*
      * Shift all elements in buffer to the right beginning from where buffer_ptr points to
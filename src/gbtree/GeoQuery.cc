@@ -15,8 +15,9 @@
  *
  * =====================================================================================
  */
+#include <math.h>
+#include <algorithm>
 #include <set>
-#include <stack>
 #include "../storagemanager/GBTFile.h"
 #include "../pathmanager/PathManager.h"
 #include "../util/Distance.h"
@@ -41,180 +42,107 @@ RT GeoQuery::RangeQueryImpl(const std::string &table, uint64_t left_down, uint64
 		 std::vector<RecordId>& outputs)
 {
 	RT rt;
-
-	bool z_shape = false;
-	bool bottom_start = true;
-	int tmp_int;// the number of key in leaf node
-	int count_node;
-	uint64_t key;
-	uint64_t max_lat = 0;
-	uint64_t max_lng = 0;
-	uint64_t min_lat = 0;//used for checking whether the range of page is "Z" type.
-	uint64_t tmp_data = 0;
-	uint64_t starter = left_down;
 	GBTreeIndex gbt_index;
-	IndexCursor cursor;
-	RecordId rid;
-	GBTLeafNode l_node;
-	std::stack<uint64_t> min_addresses;
-	std::set<PageId> pages;
-	std::pair<std::set<PageId>::iterator, bool> ret;
 
 	//check whether the range is valid or not.
 	if(! CheckRangeValid(left_down, right_up))
 		return RT_GEOQUERY_INVALID_RANGE;
 
-	min_addresses.push(left_down);
 	//open the index file
 	if((rt = gbt_index.open(PathManager::GetIndexPath(table), 'r')) != 0) return rt;
+	rt = RangeQuery(gbt_index, left_down, right_up, outputs);
+	gbt_index.close();
+	return rt;
+}
+RT GeoQuery::RangeQuery(GBTreeIndex& gbt_index, uint64_t left_down, uint64_t right_up, std::vector<RecordId>& outputs,
+		 std::vector<uint64_t>* keys)
+{
+	RT rt;
+	uint64_t key;
+	uint64_t next;
+	RecordId rid;
+	IndexCursor cursor;
+	IndexSnapshot snapshot;
 
-	//the end 
-	while(min_addresses.size() != 0)
-	{
-		//locate the left-down point in leaf node.
-		left_down = min_addresses.top();
-		min_addresses.pop();
-		if((rt = gbt_index.locate(left_down, cursor)) != 0)
-		{
-			gbt_index.close();
-			return rt;
-		}
-	
-		//judge whether the page has been scanned.
-		ret = pages.insert(cursor.pid);
-		if(ret.second == false)
-			continue;
-
-		//judge whether start the minimal latitude
-		if((left_down & LATITUDE_HOLDER) == (starter & LATITUDE_HOLDER))
-				bottom_start = true;
-		//set the min_lat
-		min_lat = left_down & LATITUDE_HOLDER;
-		max_lat = 0;
-		max_lng = 0;
-		//judge whether the smallest address is located in the page.
-		tmp_int = cursor.eid;
-		cursor.eid = 0;
-		gbt_index.loadLeafNode(cursor.pid, l_node); 
-		l_node.readEntry(cursor.eid, key, rid);
-		if(!((GeoHashCmp(starter, key) == -5) && (GeoHashCmp(right_up, key) == 5)))
-			cursor.eid = tmp_int;
-
-		count_node = l_node.getKeyCount();
-		//scan the pointer 
-		while (cursor.eid != count_node) {
-			l_node.readEntry(cursor.eid, key, rid);
-				
-			if((GeoHashCmp(starter, key) == -5) && (GeoHashCmp(right_up, key) == 5))
-			{
-				outputs.push_back(rid);
-				//get the max latitude.
-				tmp_data = key & LATITUDE_HOLDER;
-				if(tmp_data > (max_lat & LATITUDE_HOLDER))
-					max_lat = key;
-				//judge whether the shape of the page is z.
-				if(min_lat > tmp_data )
-				{
-					min_lat = tmp_data;
-					z_shape = true;
-				}
+	if(! CheckRangeValid(left_down, right_up))
+		return RT_GEOQUERY_INVALID_RANGE;
 
-				tmp_data = key & LONGITUDE_HOLDER;
-				if(tmp_data > (max_lng & LONGITUDE_HOLDER))
-					max_lng = key;
+	// the scan reads one snapshot of the index, so writers running
+	// meanwhile neither move entries under it nor change the leaf chain.
+	if((rt = gbt_index.pinSnapshot(snapshot)) != 0)
+		return rt;
 
-			}
-			cursor.eid++;
-		}
-		if(max_lng == 0 || max_lat == 0)
-			continue;
-		//find the right-down point if top page is z shape.
-		IndexCursor tmp_cursor;
-		tmp_data = (starter & LATITUDE_HOLDER) | (max_lng & LONGITUDE_HOLDER);
-		if((rt = gbt_index.locate(tmp_data, tmp_cursor)) != 0){
-			gbt_index.close();
-			return rt;
-		}
-		if(tmp_cursor.pid == cursor.pid)
-			bottom_start = true;
-		//find the right-down point.
-		if(bottom_start)
-		{
-			tmp_data = min_lat | (max_lng & LONGITUDE_HOLDER);
-			FindRightDownPoint(tmp_data, key);
-			if((tmp_data & LONGITUDE_HOLDER) < (right_up & LONGITUDE_HOLDER))
-				min_addresses.push(tmp_data);
-			bottom_start = false;
-    	
-		}
-		//find the turn point in z shape page
-		if(z_shape)
+	// every key inside the box lies between the geohash of the left-down and
+	// the right-up corner. scan that interval in key order and, whenever the
+	// scan leaves the box, jump to the next key that is inside it again.
+	rt = gbt_index.locate(snapshot, left_down, cursor);
+	while(rt == 0)
+	{
+		if((rt = gbt_index.readForward(snapshot, cursor, key, rid)) != 0)
+			break;
+		if(key > right_up)
+			break;
+		if(InRange(key, left_down, right_up))
 		{
-			FindLeftUpPoint(max_lng, key);
-			tmp_data = max_lat;
-			FindRightDownPoint(tmp_data, key);
-			tmp_data = (max_lng & LATITUDE_HOLDER) | (tmp_data & LONGITUDE_HOLDER);
-			if((GeoHashCmp(starter, tmp_data) == -5) && (GeoHashCmp(right_up, tmp_data) == 5))
-				min_addresses.push(tmp_data);	
-			z_shape = false;
+			outputs.push_back(rid);
+			if(keys != NULL)
+				keys->push_back(key);
+			continue;
 		}
-		//find next left-down point.
-		tmp_data = (left_down & LONGITUDE_HOLDER) | (max_lat & LATITUDE_HOLDER);
-		FindLeftUpPoint(tmp_data, key);
-		if((tmp_data & LATITUDE_HOLDER) < (right_up & LATITUDE_HOLDER))
-			min_addresses.push(tmp_data);
+		if(! NextInRange(key, left_down, right_up, next))
+			break;
+		rt = gbt_index.locate(snapshot, next, cursor);
 	}
-	gbt_index.close();
+	gbt_index.releaseSnapshot(snapshot);
+
+	// running off the end of the tree just ends the scan
+	if(rt != 0 && rt != RT_END_OF_TREE && rt != RT_NO_SUCH_RECORD)
+		return rt;
 	return GEOQUERY_OK;
 }
-RT GeoQuery::FindLeftUpPoint(uint64_t& left_up, uint64_t max_address )
+/* *
+ * BIGMIN of Tropf and Herzog: walk the bits from the top, narrowing the box
+ * [left_down, right_up] to the half that can still hold a key above address.
+ * */
+bool GeoQuery::NextInRange(uint64_t address, uint64_t left_down, uint64_t right_up, uint64_t& next)
 {
-	int i;
-	uint64_t latitude = (uint64_t)ExtractLatLng(left_up, 1);
-	uint64_t longitude ;
-	uint64_t holder = UINT64_C(0x01);
-	while(left_up < max_address)
+	bool found = false;
+	uint64_t holder = 1;
+	for(int i = 63; i >= 0; --i)
 	{
-		latitude += (1 << range_precision);	
-		longitude = left_up & LONGITUDE_HOLDER;
-		for(i = 0; i < 32; i++)
+		uint64_t bit = holder << i;
+		// the lower bits that belong to the same dimension as bit
+		uint64_t lower = (bit - 1) & ((i & 1) ? LONGITUDE_HOLDER : LATITUDE_HOLDER);
+		int a = (address & bit) ? 1 : 0;
+		int l = (left_down & bit) ? 1 : 0;
+		int r = (right_up & bit) ? 1 : 0;
+
+		if(a == 0 && l == 0 && r == 1)
 		{
-			longitude = longitude | ( (latitude<<i) & (holder << (2*i)) );
+			// the upper half starts at left_down with this bit set
+			next = (left_down | bit) & ~lower;
+			found = true;
+			right_up = (right_up & ~bit) | lower;
 		}
-		left_up = longitude;
-	}
-	return 0;
-}
-RT GeoQuery::FindRightDownPoint(uint64_t& left_down, uint64_t max_address)
-{
-	int i;
-	uint64_t longitude = (uint64_t)ExtractLatLng(left_down, 0);
-	uint64_t latitude ;
-	uint64_t holder = UINT64_C(0x2);
-	while(left_down < max_address)
-	{
-		longitude += (1 << range_precision);	
-		latitude = left_down & LATITUDE_HOLDER;
-		for(i = 0; i < 32; i++)
+		else if(a == 0 && l == 1 && r == 1)
+		{
+			next = left_down;
+			return true;
+		}
+		else if(a == 1 && l == 0 && r == 0)
 		{
-			latitude = latitude | ( (longitude<<(i+1)) & (holder << (2*i)) );
+			return found;
+		}
+		else if(a == 1 && l == 0 && r == 1)
+		{
+			left_down = (left_down | bit) & ~lower;
 		}
-		left_down = latitude;
 	}
-	return 0;
+	return found;
 }
-uint32_t GeoQuery::ExtractLatLng(uint64_t address, int type)
+bool GeoQuery::InRange(uint64_t address, uint64_t left_down, uint64_t right_up)
 {
-	uint32_t answer = 0;
-	int i;
-	if(type)
-		for(i = 31; i >= 0; --i)
-			answer = (answer<<1) + ((address>>(2*i)) & 0x01);
-	else
-		for(i = 31; i >= 0; --i)
-			answer = (answer<<1) + (address>>(2*i+1) & 0x01);
-	
-	return answer;
+	return (GeoHashCmp(left_down, address) == -5) && (GeoHashCmp(right_up, address) == 5);
 }
 bool GeoQuery::CheckRangeValid(uint64_t left_down, uint64_t right_up)
 {
@@ -272,17 +200,17 @@ RT GeoQuery::FindPointImpl(GBTreeIndex& gbt_index, uint64_t address, RecordId& o
 	uint64_t key;
 	RecordId rid;
 	uint64_t prec = 1 << range_precision;
+	// the caller owns gbt_index. an address past the last key is not found.
 	if((rt = gbt_index.locate(address, cursor)) != 0){
-		gbt_index.close();
+		if(rt == RT_NO_SUCH_RECORD || rt == RT_END_OF_TREE)
+			return GEOQUERY_NOT_FOUND;
 		return rt;
 	}	
-	if ((rt = gbt_index.readForward(cursor, key, rid)) == 0) {
-		if((key - address) < prec)
-			outputs = rid;
-		else{
-			return GEOQUERY_NOT_FOUND;
-		}
-	}
+	if ((rt = gbt_index.readForward(cursor, key, rid)) != 0)
+		return (rt == RT_END_OF_TREE) ? GEOQUERY_NOT_FOUND : rt;
+	if((key - address) >= prec)
+		return GEOQUERY_NOT_FOUND;
+	outputs = rid;
 	return GEOQUERY_OK;
 
 }
@@ -331,23 +259,29 @@ RT GeoQuery::Nearest(const char *table, uint64_t address, std::vector<NearestRes
 		bit_start += 2;
 		bit_end += 2;
 	}
-	//get max bit length base on the max_distance.
-	if((max_distance - default_max_distance) < DOUBLE_EPSILON)
+	//decode the address
+	if((rt = geohash_decode_64(address, lnglat, lnglat+1)) != GEOHASH_OK){
+		return rt;
+	}
+	//get max bit length base on the max_distance. the neighbors of a cell
+	//cover the distance of its narrower side, and a longitude side, twice
+	//as wide in degrees, narrows with the latitude.
+	if((default_max_distance - max_distance) < DOUBLE_EPSILON)
 		bit_end = DATA_BIT_PRECISION;
 	else{
-		while(((size_t)bit_end < DATA_BIT_PRECISION) && (max_distance - start_precision) > DOUBLE_EPSILON)
+		double cover = start_precision * std::min(1.0, 2 * cos(lnglat[0] * M_PI / 180));
+		while(((size_t)bit_end < DATA_BIT_PRECISION) && (max_distance - cover) > DOUBLE_EPSILON)
 		{
-			start_precision *= 2;
+			cover *= 2;
 			bit_end += 2;
 		}
+		//scan the ring that covers max_distance too
+		if((size_t)bit_end < DATA_BIT_PRECISION)
+			bit_end += 2;
 	}
 	
 	if((min_distance - default_precision) > default_precision)
 		bit_start -= 2;
-	//decode the address
-	if((rt = geohash_decode_64(address, lnglat, lnglat+1)) != GEOHASH_OK){
-		return rt;
-	}
 	
 	if((rt = gbt_index.open(PathManager::GetIndexPath(std::string(table)), 'r')) != 0) return rt;
 	//find the nearest point.
@@ -357,6 +291,8 @@ RT GeoQuery::Nearest(const char *table, uint64_t address, std::vector<NearestRes
 			break;
 		bit_length = DATA_BIT_PRECISION - bit_start;
 		geohash_neighbors_64(address, bit_length, neighbors, &count_neighbors);
+		// the cells are independent: read their leaves all at once
+		gbt_index.prefetch(neighbors, count_neighbors);
 		if((size_t)bit_length == DATA_BIT_PRECISION)
 		{
 			for(i = 0; i < count_neighbors; i++){
@@ -375,12 +311,17 @@ RT GeoQuery::Nearest(const char *table, uint64_t address, std::vector<NearestRes
 		{
 			for(i = 0; i < count_neighbors; i++)
 			{
+				// a neighbor past the last key of the tree holds no answer
 				if((rt = gbt_index.locate(neighbors[i], cursor)) != 0){
+					if(rt == RT_NO_SUCH_RECORD || rt == RT_END_OF_TREE)
+						continue;
 					gbt_index.close();
 					return rt;
 				}
 				neighbors[i] += (holder<<bit_start);
 				if((rt = gbt_index.readForward(cursor, key, rid)) != 0){
+					if(rt == RT_END_OF_TREE)
+						continue;
 					gbt_index.close();
 					return rt;
 				}
@@ -393,6 +334,8 @@ RT GeoQuery::Nearest(const char *table, uint64_t address, std::vector<NearestRes
 					n_result.distance = LatLon2Dist(lnglat[0], lnglat[1], lnglat[2], lnglat[3]);
 					answers.insert(n_result);
 					if((rt = gbt_index.readForward(cursor, key, rid)) != 0){
+						if(rt == RT_END_OF_TREE)
+							break;
 						gbt_index.close();
 						return rt;
 					}
@@ -54,6 +54,24 @@ class GeoQuery
 		 * */
 		static RT RangeQuery(const char* table, uint64_t left_down, uint64_t right_up, std::vector<RecordId>& outputs);
 
+		/* *
+		 * range query on an index that is already open.
+		 * the bits above the box, which are equal in left_down and right_up,
+		 * select a part of the key space such as a time bucket.
+		 * @param keys[OUT] if not NULL, the key of every answer, in the order of outputs.
+		 * */
+		static RT RangeQuery(GBTreeIndex& gbt_index, uint64_t left_down, uint64_t right_up, std::vector<RecordId>& outputs,
+				 std::vector<uint64_t>* keys = NULL);
+
+		/* *
+		 * check whether an address lies inside a range, edges excluded.
+		 * @param address[IN] the address
+		 * @param left_down[IN] leaf-down point of range.
+		 * @param right_up[IN] right-up point of range.
+		 * @return true if the address is inside the range.
+		 * */
+		static bool InRange(uint64_t address, uint64_t left_down, uint64_t right_up);
+
 		/* *
 		 * find n Nearest points arount the point
 		 * @param table[IN] the table name
@@ -88,22 +106,14 @@ class GeoQuery
 				 std::vector<RecordId>& outputs);
 
 		/* *
-		 * find the right up address(namely next leaf-down address).
-		 * */
-		static RT FindLeftUpPoint(uint64_t& left_up, uint64_t max_address );
-
-		/* *
-		 * find the left-down address
-		 * */
-		static RT FindRightDownPoint(uint64_t& left_down, uint64_t max_address);
-
-		/* *
-		 * extract the latitude and longitude.
-		 * @param geo hash address
-		 * @param 0 for longitude, 1 for latitude
-		 * @return longitude or latitude
+		 * find the smallest address larger than address that lies inside the range.
+		 * @param address[IN] an address outside the range
+		 * @param left_down[IN] leaf-down point of range.
+		 * @param right_up[IN] right-up point of range.
+		 * @param next[OUT] the next address inside the range
+		 * @return false if no address after address lies inside the range.
 		 * */
-		static uint32_t ExtractLatLng(uint64_t address, int type);
+		static bool NextInRange(uint64_t address, uint64_t left_down, uint64_t right_up, uint64_t& next);
 	private:
 		static double default_precision;
 		static double default_max_distance;
@@ -198,8 +198,10 @@ geohash_encode_64 ( double latitude, double longitude, uint64_t* code)
 
 static int geohash_decode_64_impl(uint64_t address, double* latitude, double* longitude){
 	uint16_t *interleaved ;
-	size_t intr_length = 4;
-	interleaved = (uint16_t*)malloc(sizeof(uint16_t)*intr_length);
+	size_t intr_length = 8;
+	// the address fills the first 4 entries; the low half of each
+	// coordinate comes out of the other 4, which must be zero
+	interleaved = (uint16_t*)calloc(intr_length, sizeof(uint16_t));
 	if(!interleaved){
 		return GEOHASH_NOMEMORY;
 	}
@@ -16,11 +16,15 @@
  * =====================================================================================
  */
 
+#include <dirent.h>
+#include <string.h>
 #include "PathManager.h"
 
 std::string PathManager::data_directory = "data/";
 const char* PathManager::index_extension = ".idx";
 const char* PathManager::table_extension = ".tbl";
+const char* PathManager::run_extension = ".run.";
+const char* PathManager::object_extension = ".obj";
 
 std::string PathManager::GetIndexPath(std::string table)
 {
@@ -31,3 +35,36 @@ std::string PathManager::GetTablePath(std::string table)
 {
 	return data_directory + table + table_extension;
 }
+
+std::string PathManager::GetRunPrefix(std::string table)
+{
+	return data_directory + table + run_extension;
+}
+
+std::string PathManager::GetObjectPath(std::string table)
+{
+	return data_directory + table + object_extension;
+}
+
+bool PathManager::ListTables(std::string prefix, std::vector<std::string>& suffixes)
+{
+	size_t extension_length = strlen(index_extension);
+	DIR* dir = opendir(data_directory.c_str());
+	if(dir == NULL)
+		return false;
+
+	struct dirent* entry;
+	while((entry = readdir(dir)) != NULL)
+	{
+		std::string name = entry->d_name;
+		if(name.size() <= prefix.size() + extension_length)
+			continue;
+		if(name.compare(0, prefix.size(), prefix) != 0)
+			continue;
+		if(name.compare(name.size() - extension_length, extension_length, index_extension) != 0)
+			continue;
+		suffixes.push_back(name.substr(prefix.size(), name.size() - prefix.size() - extension_length));
+	}
+	closedir(dir);
+	return true;
+}
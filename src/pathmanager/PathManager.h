@@ -11,6 +11,7 @@
 #define PATH_MANAGER_H_
 
 #include <string>
+#include <vector>
 
 class PathManager{
 
@@ -25,9 +26,29 @@ public:
 	static std::string GetIndexPath(std::string table);
 
 	static std::string GetTablePath(std::string table);
+
+	/* *
+	 * get the path prefix of the sort runs written while loading a table
+	 * */
+	static std::string GetRunPrefix(std::string table);
+
+	/* *
+	 * get the object file path of a table kept by GBTObjectStore
+	 * */
+	static std::string GetObjectPath(std::string table);
+
+	/* *
+	 * list the tables named prefix + suffix that have an index file
+	 * in the data directory.
+	 * @param suffixes[OUT] the suffixes of the tables found
+	 * @return false if the data directory cannot be read
+	 * */
+	static bool ListTables(std::string prefix, std::vector<std::string>& suffixes);
 private:
 	static const char* index_extension;
 	static const char* table_extension;
+	static const char* run_extension;
+	static const char* object_extension;
 };
 
 #endif
@@ -0,0 +1,361 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  GBTAsyncIO.cc
+ *
+ *    Description:  asynchronous reads through io_uring or a pread pool
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include "GBTAsyncIO.h"
+
+int GBTAsyncIO::io_threads = 4;
+int GBTAsyncIO::queue_depth = 128;
+
+//
+// the engine is created by the first submit and lives as long as the
+// process, so that its threads never see it destroyed at exit. a child
+// of fork has none of its threads and creates its own.
+//
+struct asyncEngine {
+  bool ring;
+  std::atomic<bool> broken;     // the ring failed; reads go to the pool
+
+  // io_uring: the submission and completion rings mapped from the kernel.
+  // submitters fill the submission ring under submit_lock; one thread
+  // reaps the completion ring.
+  int       ring_fd;
+  unsigned  entries;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  io_uring_sqe* sqes;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  io_uring_cqe* cqes;
+  unsigned  in_flight;          // reads submitted and not reaped
+  std::unordered_set<GBTAsyncIO::request*> on_ring;  // those reads
+  std::atomic<int> fail_error;  // set by failRing
+  std::mutex submit_lock;
+  std::condition_variable slot_free;
+
+  // the pread pool, started when the ring is not available or failed
+  std::deque<GBTAsyncIO::request*> queue;
+  std::mutex queue_lock;
+  std::condition_variable queued;
+  std::once_flag pool_started;
+
+  asyncEngine();
+  bool setupRing();
+  void reapRing();
+  void failRing(int error);
+  void startPool();
+  void runPool();
+  void submitPool(GBTAsyncIO::request** reqs, int count);
+  int submitRing(GBTAsyncIO::request** reqs, int count);
+};
+
+static std::atomic<asyncEngine*> engine(NULL);
+static std::mutex engine_lock;
+
+static void forgetEngine()
+{
+  engine.store(NULL);
+}
+
+static asyncEngine& engineOf()
+{
+  asyncEngine* e = engine.load(std::memory_order_acquire);
+  if (e != NULL)
+    return *e;
+
+  std::lock_guard<std::mutex> lock(engine_lock);
+  static bool forked_away = (::pthread_atfork(NULL, NULL, forgetEngine) == 0);
+  (void) forked_away;
+  if ((e = engine.load()) == NULL) {
+    e = new asyncEngine();
+    engine.store(e, std::memory_order_release);
+  }
+  return *e;
+}
+
+asyncEngine::asyncEngine()
+{
+  in_flight = 0;
+  broken = false;
+  fail_error = 0;
+  ring = setupRing();
+  if (ring)
+    std::thread(&asyncEngine::reapRing, this).detach();
+  else
+    startPool();
+}
+
+void asyncEngine::startPool()
+{
+  std::call_once(pool_started, [this] {
+    for (int i = 0; i < (GBTAsyncIO::io_threads > 0 ? GBTAsyncIO::io_threads : 1); i++)
+      std::thread(&asyncEngine::runPool, this).detach();
+  });
+}
+
+bool asyncEngine::setupRing()
+{
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  unsigned depth = GBTAsyncIO::queue_depth > 0 ? GBTAsyncIO::queue_depth : 1;
+  ring_fd = ::syscall(__NR_io_uring_setup, depth, &params);
+  if (ring_fd < 0)
+    return false;
+
+  size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP)
+    sq_size = cq_size = (sq_size > cq_size ? sq_size : cq_size);
+
+  char* sq = (char*) ::mmap(NULL, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+      ring_fd, IORING_OFF_SQ_RING);
+  char* cq = sq;
+  if (sq != MAP_FAILED && !(params.features & IORING_FEAT_SINGLE_MMAP))
+    cq = (char*) ::mmap(NULL, cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+        ring_fd, IORING_OFF_CQ_RING);
+  void* sqe = MAP_FAILED;
+  if (sq != MAP_FAILED && cq != MAP_FAILED)
+    sqe = ::mmap(NULL, params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd, IORING_OFF_SQES);
+  if (sqe == MAP_FAILED) {
+    ::close(ring_fd);
+    return false;
+  }
+
+  entries  = params.sq_entries;
+  sq_tail  = (unsigned*) (sq + params.sq_off.tail);
+  sq_mask  = (unsigned*) (sq + params.sq_off.ring_mask);
+  sq_array = (unsigned*) (sq + params.sq_off.array);
+  sqes     = (io_uring_sqe*) sqe;
+  cq_head  = (unsigned*) (cq + params.cq_off.head);
+  cq_tail  = (unsigned*) (cq + params.cq_off.tail);
+  cq_mask  = (unsigned*) (cq + params.cq_off.ring_mask);
+  cqes     = (io_uring_cqe*) (cq + params.cq_off.cqes);
+  return true;
+}
+
+/*
+ * At most entries reads are in flight, so the completion ring, which is
+ * at least as large, cannot overflow. A read the kernel did not take is
+ * ended with the error of io_uring_enter. Returns how many of the reads
+ * were taken; once the ring has failed, the rest are left to the pool.
+ */
+int asyncEngine::submitRing(GBTAsyncIO::request** reqs, int count)
+{
+  int taken = 0;
+  while (taken < count) {
+    int n = 0;
+    {
+      std::unique_lock<std::mutex> lock(submit_lock);
+      slot_free.wait(lock, [&] { return broken || in_flight < entries; });
+      if (broken)
+        return taken;
+
+      unsigned tail = *sq_tail;
+      for (; n < count - taken && in_flight < entries; n++, tail++) {
+        GBTAsyncIO::request* req = reqs[n];
+        unsigned index = tail & *sq_mask;
+        io_uring_sqe& sqe = sqes[index];
+        req->iov.iov_base = req->buffer;
+        req->iov.iov_len = req->size;
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_READV;
+        sqe.fd = req->fd;
+        sqe.off = req->offset;
+        sqe.addr = (unsigned long) &req->iov;
+        sqe.len = 1;
+        sqe.user_data = (unsigned long) req;
+        sq_array[index] = index;
+        on_ring.insert(req);
+        in_flight++;
+      }
+      __atomic_store_n(sq_tail, tail, __ATOMIC_RELEASE);
+
+      int submitted = 0;
+      while (submitted < n) {
+        int rc = ::syscall(__NR_io_uring_enter, ring_fd, n - submitted, 0, 0, NULL, 0);
+        if (rc < 0 && errno == EINTR)
+          continue;
+        if (rc <= 0) {
+          // take the reads back from the ring and end them here
+          int error = rc < 0 ? -errno : -EIO;
+          __atomic_store_n(sq_tail, tail - (n - submitted), __ATOMIC_RELEASE);
+          in_flight -= n - submitted;
+          for (int i = submitted; i < n; i++)
+            on_ring.erase(reqs[i]);
+          lock.unlock();
+          for (int i = submitted; i < n; i++) {
+            reqs[i]->result = error;
+            reqs[i]->done(reqs[i]);
+          }
+          lock.lock();
+          break;
+        }
+        submitted += rc;
+      }
+    }
+    reqs += n;
+    taken += n;
+  }
+  return taken;
+}
+
+/*
+ * The reaped reads leave on_ring before their done function runs, since
+ * done may free them or submit them again.
+ */
+void asyncEngine::reapRing()
+{
+  std::vector<GBTAsyncIO::request*> reaped;
+  for (;;) {
+    int rc = ::syscall(__NR_io_uring_enter, ring_fd, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+    if (rc < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+      failRing(-errno);
+      return;
+    }
+
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    reaped.clear();
+    for (; head != tail; head++) {
+      io_uring_cqe& cqe = cqes[head & *cq_mask];
+      GBTAsyncIO::request* req = (GBTAsyncIO::request*) (unsigned long) cqe.user_data;
+      if (req != NULL) {
+        req->result = cqe.res;
+        reaped.push_back(req);
+      }
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    if (!reaped.empty()) {
+      std::lock_guard<std::mutex> lock(submit_lock);
+      for (size_t i = 0; i < reaped.size(); i++)
+        on_ring.erase(reaped[i]);
+      in_flight -= reaped.size();
+      slot_free.notify_all();
+    }
+    for (size_t i = 0; i < reaped.size(); i++)
+      reaped[i]->done(reaped[i]);
+
+    int error = fail_error.load();
+    if (error != 0) {
+      failRing(error);
+      return;
+    }
+  }
+}
+
+/*
+ * The ring is given up: the reads still on it end with error, and the
+ * pool takes the reads submitted from now on.
+ */
+void asyncEngine::failRing(int error)
+{
+  std::vector<GBTAsyncIO::request*> failed;
+  startPool();
+  {
+    std::lock_guard<std::mutex> lock(submit_lock);
+    broken = true;
+    failed.assign(on_ring.begin(), on_ring.end());
+    on_ring.clear();
+    in_flight = 0;
+    slot_free.notify_all();
+  }
+  ::close(ring_fd);
+  for (size_t i = 0; i < failed.size(); i++) {
+    failed[i]->result = error;
+    failed[i]->done(failed[i]);
+  }
+}
+
+void asyncEngine::runPool()
+{
+  for (;;) {
+    GBTAsyncIO::request* req;
+    {
+      std::unique_lock<std::mutex> lock(queue_lock);
+      queued.wait(lock, [&] { return !queue.empty(); });
+      req = queue.front();
+      queue.pop_front();
+    }
+    ssize_t n = ::pread(req->fd, req->buffer, req->size, req->offset);
+    req->result = n < 0 ? -errno : n;
+    req->done(req);
+  }
+}
+
+void asyncEngine::submitPool(GBTAsyncIO::request** reqs, int count)
+{
+  {
+    std::lock_guard<std::mutex> lock(queue_lock);
+    queue.insert(queue.end(), reqs, reqs + count);
+  }
+  queued.notify_all();
+}
+
+void GBTAsyncIO::submit(request** reqs, int count)
+{
+  if (count <= 0)
+    return;
+
+  asyncEngine& e = engineOf();
+  int taken = 0;
+  if (e.ring && !e.broken)
+    taken = e.submitRing(reqs, count);
+  if (taken < count)
+    e.submitPool(reqs + taken, count - taken);
+}
+
+bool GBTAsyncIO::usingRing()
+{
+  asyncEngine& e = engineOf();
+  return e.ring && !e.broken;
+}
+
+/*
+ * A no-op on the ring wakes the reaper, which then fails the ring.
+ */
+void GBTAsyncIO::failRing(int error)
+{
+  asyncEngine& e = engineOf();
+  if (!e.ring)
+    return;
+
+  std::lock_guard<std::mutex> lock(e.submit_lock);
+  if (e.broken)
+    return;
+  e.fail_error = -error;
+  unsigned tail = *e.sq_tail;
+  unsigned index = tail & *e.sq_mask;
+  memset(&e.sqes[index], 0, sizeof(io_uring_sqe));
+  e.sqes[index].opcode = IORING_OP_NOP;
+  e.sq_array[index] = index;
+  __atomic_store_n(e.sq_tail, tail + 1, __ATOMIC_RELEASE);
+  while (::syscall(__NR_io_uring_enter, e.ring_fd, 1, 0, 0, NULL, 0) < 0 && errno == EINTR)
+    ;
+}
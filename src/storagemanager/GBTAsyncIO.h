@@ -0,0 +1,65 @@
+/*
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+#ifndef GBTASYNCIO_H_
+#define GBTASYNCIO_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "../base/GBTreeBase.h"
+
+/**
+ * asynchronous reads. submit() starts the reads and returns; the done
+ * function of each request runs on the thread that reaps it.
+ * the reads go through io_uring, set up with raw system calls, when the
+ * kernel offers it, otherwise through a pool of threads calling pread.
+ * if the ring fails, the reads in flight on it end with the error and
+ * the later ones go to the pool.
+ */
+class GBTAsyncIO {
+ public:
+
+  /**
+   * a read in flight. it must stay valid until done has been called.
+   */
+  struct request {
+    int     fd;
+    off_t   offset;
+    size_t  size;
+    char*   buffer;
+    ssize_t result;               // bytes read, or -errno
+    void  (*done)(request* req);  // called once the read ended
+    struct iovec iov;             // used by the ring
+  };
+
+  /* *
+   * threads of the pread pool, used when io_uring is not available.
+   * read when the first request is submitted.
+   * */
+  static int io_threads;
+
+  /* *
+   * the most reads in flight on the ring; submit() waits for a free slot.
+   * */
+  static int queue_depth;
+
+  /**
+   * start the reads of count requests, all in one system call on the ring.
+   */
+  static void submit(request** reqs, int count);
+
+  /**
+   * @return true if the reads go through io_uring
+   */
+  static bool usingRing();
+
+  /**
+   * make the ring fail as if waiting for its completions had failed with
+   * error, for testing the fallback to the pool. nothing happens if the
+   * reads do not go through the ring.
+   */
+  static void failRing(int error);
+};
+
+#endif
@@ -17,36 +17,72 @@
  */
 
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <new>
 #include "GBTFile.h"
 
 using std::string;
 
-int GBTFile::readCount = 0;
-int GBTFile::writeCount = 0;
-int GBTFile::cacheClock = 1;
-struct GBTFile::cacheStruct GBTFile::readCache[GBTFile::CACHE_COUNT];
+const size_t GBTFile::LOAD_WRITE_BACK_PAGES;
+
+std::atomic<int> GBTFile::readCount(0);
+std::atomic<int> GBTFile::prefetchCount(0);
+std::atomic<int> GBTFile::writeCount(0);
+struct GBTFile::cacheShard GBTFile::readCache[GBTFile::CACHE_SHARDS];
+size_t GBTFile::write_back_pages = 0;
+bool GBTFile::prefetch_pages = false;
+int GBTFile::readahead_bytes = 32 * GBTFile::PAGE_SIZE;
+bool GBTFile::direct_io = false;
+std::map<std::pair<int, PageId>, std::shared_ptr<GBTFile::pendingRead> > GBTFile::pending;
+std::mutex GBTFile::pending_lock;
+std::condition_variable GBTFile::pending_done;
+
+static const char FILE_MAGIC[8] = "GBTFILE";
 
 GBTFile::GBTFile() 
 { 
   fd = -1; 
   epid = 0; 
+  page_size = PAGE_SIZE;
+  direct = false;
+  dirty_limit = 0;
+  hold = false;
+  last_read = -1;
+  run_length = 0;
 }
 
 GBTFile::GBTFile(const string& filename, char mode)
 {
   fd = -1;
   epid = 0;
+  page_size = PAGE_SIZE;
+  direct = false;
+  dirty_limit = 0;
+  hold = false;
+  last_read = -1;
+  run_length = 0;
   open(filename.c_str(), mode);
 }
 
-RT GBTFile::open(const string& filename, char mode)
+// a file that is not closed still gets its dirty pages written
+GBTFile::~GBTFile()
+{
+  if (fd > 0) close();
+}
+
+RT GBTFile::open(const string& filename, char mode, int pageSize)
 {
   RT   rc;
   int  oflag;
   struct stat statbuf;
 
   if (fd > 0) return RT_FILE_OPEN_FAILED;
+  if (pageSize < MIN_PAGE_SIZE || pageSize > MAX_PAGE_SIZE || (pageSize & (pageSize - 1)) != 0)
+    return RT_INVALID_FILE_FORMAT;
 
   // set the unix file flag depending on the file mode
   switch (mode) {
@@ -63,36 +99,204 @@ RT GBTFile::open(const string& filename, char mode)
   }
 
   // open the file
+  direct = direct_io;
+  if (direct) oflag |= O_DIRECT;
   fd = ::open(filename.c_str(), oflag, 0644);
   if (fd < 0) { fd = -1; return RT_FILE_OPEN_FAILED; }
 
   // get the size of the file to set the end pid
   rc = ::fstat(fd, &statbuf);
   if (rc < 0) { ::close(fd); fd = -1; return RT_FILE_OPEN_FAILED; }
-  epid = statbuf.st_size / PAGE_SIZE;
 
+  // a new file gets its header when it can be written
+  page_size = pageSize;
+  if (statbuf.st_size > 0)
+    rc = readHeader();
+  else if (oflag & O_RDWR)
+    rc = writeHeader();
+  if (rc < 0) { ::close(fd); fd = -1; return rc; }
+  epid = (statbuf.st_size > page_size) ? statbuf.st_size / page_size - 1 : 0;
+  dirty_limit = (oflag & O_RDWR) ? write_back_pages : 0;
+  hold = false;
+  last_read = -1;
+  run_length = 0;
+
+  return 0;
+}
+
+GBTFile::pageBuffer::pageBuffer(size_t size)
+{
+  void* memory = NULL;
+  if (::posix_memalign(&memory, MIN_PAGE_SIZE, size) != 0) throw std::bad_alloc();
+  data = (char*) memory;
+}
+
+GBTFile::pageBuffer::~pageBuffer()
+{
+  ::free(data);
+}
+
+/*
+ * The header is read as one MIN_PAGE_SIZE block, which O_DIRECT accepts
+ * before the page size is known, and written as a whole page.
+ */
+RT GBTFile::readHeader()
+{
+  pageBuffer block(MIN_PAGE_SIZE);
+  fileHeader header;
+
+  if (::pread(fd, block.get(), MIN_PAGE_SIZE, 0) < (ssize_t)sizeof(header)) return RT_INVALID_FILE_FORMAT;
+  memcpy(&header, block.get(), sizeof(header));
+  if (memcmp(header.magic, FILE_MAGIC, sizeof(header.magic)) != 0 || header.version != FORMAT_VERSION)
+    return RT_INVALID_FILE_FORMAT;
+  if (header.page_size < (uint32_t)MIN_PAGE_SIZE || header.page_size > (uint32_t)MAX_PAGE_SIZE ||
+      (header.page_size & (header.page_size - 1)) != 0)
+    return RT_INVALID_FILE_FORMAT;
+  page_size = header.page_size;
   return 0;
 }
 
+RT GBTFile::writeHeader()
+{
+  pageBuffer page(page_size);
+  fileHeader header;
+
+  memcpy(header.magic, FILE_MAGIC, sizeof(header.magic));
+  header.version = FORMAT_VERSION;
+  header.page_size = page_size;
+  memset(page.get(), 0, page_size);
+  memcpy(page.get(), &header, sizeof(header));
+  if (::pwrite(fd, page.get(), page_size, 0) != page_size) return RT_FILE_WRITE_FAILED;
+  return 0;
+}
+
+ssize_t GBTFile::readAt(void* buffer, size_t size, off_t offset) const
+{
+  if (!direct || ((uintptr_t)buffer % MIN_PAGE_SIZE) == 0) return ::pread(fd, buffer, size, offset);
+
+  static thread_local pageBuffer bounce(MAX_PAGE_SIZE);
+  ssize_t n = ::pread(fd, bounce.get(), size, offset);
+  if (n > 0) memcpy(buffer, bounce.get(), n);
+  return n;
+}
+
+ssize_t GBTFile::writeAt(const void* buffer, size_t size, off_t offset)
+{
+  if (!direct || ((uintptr_t)buffer % MIN_PAGE_SIZE) == 0) return ::pwrite(fd, buffer, size, offset);
+
+  static thread_local pageBuffer bounce(MAX_PAGE_SIZE);
+  memcpy(bounce.get(), buffer, size);
+  return ::pwrite(fd, bounce.get(), size, offset);
+}
+
 RT GBTFile::close()
 {
   if (fd <= 0) return RT_FILE_CLOSE_FAILED;
 
-  // close the file
-  if (::close(fd) < 0) return RT_FILE_CLOSE_FAILED;
+  // write the dirty pages back; they are dropped even if that fails.
+  // held pages are only written by flush(), so a close drops them
+  RT rc;
+  {
+    std::unique_lock<std::shared_mutex> lock(dirty_lock);
+    rc = hold ? 0 : flushDirty();
+    dirty.clear();
+    dirty_limit = 0;
+    hold = false;
+  }
+
+  // the prefetches of this file must end before fd can be reused
+  {
+    std::unique_lock<std::mutex> lock(pending_lock);
+    pending_done.wait(lock, [&] {
+      std::map<std::pair<int, PageId>, std::shared_ptr<pendingRead> >::const_iterator it =
+          pending.lower_bound(std::make_pair(fd, 0));
+      return it == pending.end() || it->first.first != fd;
+    });
+  }
 
-  // evict all cached pages for this file
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
+  // evict all cached pages for this file while fd is still ours,
+  // so a file that reuses the descriptor cannot see them
+  for (int s = 0; s < CACHE_SHARDS; s++) {
+    cacheShard& shard = readCache[s];
+    std::lock_guard<std::mutex> lock(shard.lock);
+    for (int i = 0; i < SHARD_SLOTS; i++) {
+      if (shard.pages[i].fd == fd && shard.pages[i].lastAccessed != 0) {
+        shard.pages[i].fd = 0;
+        shard.pages[i].pid = 0;
+        shard.pages[i].lastAccessed = 0;
+      }
     }
+    shard.version++;
   }
 
+  // close the file
+  if (::close(fd) < 0) return RT_FILE_CLOSE_FAILED;
+
   // set the fd and epid to the initial state
   fd = -1; 
   epid = 0;
+  direct = false;
+  return rc;
+}
+
+RT GBTFile::flush()
+{
+  std::unique_lock<std::shared_mutex> lock(dirty_lock);
+  return flushDirty();
+}
+
+void GBTFile::holdDirty(bool hold)
+{
+  std::unique_lock<std::shared_mutex> lock(dirty_lock);
+  this->hold = hold;
+}
+
+RT GBTFile::writeBack(size_t pages)
+{
+  if (fd <= 0) return RT_FILE_WRITE_FAILED;
+
+  std::unique_lock<std::shared_mutex> lock(dirty_lock);
+  dirty_limit = pages;
+  if (!hold && !dirty.empty() && dirty.size() >= dirty_limit) return flushDirty();
+  return 0;
+}
+
+void GBTFile::dirtyPages(std::vector<std::pair<PageId, const char*> >& pages) const
+{
+  pages.clear();
+  for (std::map<PageId, pageBuffer>::const_iterator it = dirty.begin(); it != dirty.end(); ++it)
+    pages.push_back(std::make_pair(it->first, it->second.get()));
+}
+
+RT GBTFile::sync()
+{
+  if (::fdatasync(fd) < 0) return RT_FILE_WRITE_FAILED;
+  return 0;
+}
+
+RT GBTFile::flushDirty()
+{
+  struct iovec iov[FLUSH_PAGES];
+  std::map<PageId, pageBuffer>::iterator it = dirty.begin();
+
+  while (it != dirty.end()) {
+    // gather a run of consecutive pages
+    PageId first = it->first;
+    int n = 0;
+    while (it != dirty.end() && n < FLUSH_PAGES && it->first == first + n) {
+      iov[n].iov_base = it->second.get();
+      iov[n].iov_len = page_size;
+      n++;
+      ++it;
+    }
+    if (::pwritev(fd, iov, n, offsetOf(first)) != (ssize_t)n * page_size) {
+      // the pages written so far are clean
+      dirty.erase(dirty.begin(), dirty.find(first));
+      return RT_FILE_WRITE_FAILED;
+    }
+    writeCount += n;
+  }
+  dirty.clear();
   return 0;
 }
 
@@ -101,86 +305,341 @@ PageId GBTFile::endPid() const
   return epid;
 }
 
-RT GBTFile::seek(PageId pid) const
+GBTFile::cacheShard& GBTFile::shardOf(int fd, PageId pid)
 {
-  return (::lseek(fd, pid * PAGE_SIZE, SEEK_SET) < 0) ? RT_FILE_SEEK_FAILED : 0;
+  return readCache[((unsigned)pid * 31 + (unsigned)fd) % CACHE_SHARDS];
 }
 
 RT GBTFile::write(PageId pid, const void* buffer)
 {
-  RT rc;
   if (pid < 0) return RT_INVALID_PID; 
 
-  // seek to the location of the page
-  if ((rc = seek(pid) < 0)) return rc;
-
-  // write the buffer to the disk page
-  if (::write(fd, buffer, PAGE_SIZE) < 0) return RT_FILE_WRITE_FAILED;
+  if (dirty_limit > 0 || hold) {
+    // keep the page until the dirty pages are written together
+    std::unique_lock<std::shared_mutex> lock(dirty_lock);
+    pageBuffer& page = dirty[pid];
+    if (page.get() == NULL) page = pageBuffer(page_size);
+    memcpy(page.get(), buffer, page_size);
+    if (!hold && dirty.size() >= dirty_limit) {
+      RT rc = flushDirty();
+      if (rc < 0) return rc;
+    }
+  } else {
+    // write the buffer to the disk page
+    if (writeAt(buffer, page_size, offsetOf(pid)) != page_size) return RT_FILE_WRITE_FAILED;
+    // increase page write count
+    writeCount++;
+  }
 
   // if the page is in read cache, invalidate it
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid &&
-       readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
-       break;
+  cacheShard& shard = shardOf(fd, pid);
+  {
+    std::lock_guard<std::mutex> lock(shard.lock);
+    for (int i = 0; i < SHARD_SLOTS; i++) {
+      if (shard.pages[i].fd == fd && shard.pages[i].pid == pid &&
+         shard.pages[i].lastAccessed != 0) {
+         shard.pages[i].fd = 0;
+         shard.pages[i].pid = 0;
+         shard.pages[i].lastAccessed = 0;
+         break;
+      }
     }
+    shard.version++;
   }
 
   // if the written pid >= end pid, update the end pid
   if (pid >= epid) epid = pid + 1;
 
-  // increase page write count
-  writeCount++;
-
   return 0;
 }
 
 RT GBTFile::read(PageId pid, void* buffer) const
 {
-  RT rc;
-
   if (pid < 0 || pid >= epid) return RT_INVALID_PID; 
 
+  // a dirty page is newer than the cache and the disk
+  if (dirty_limit > 0 || hold) {
+    std::shared_lock<std::shared_mutex> lock(dirty_lock);
+    std::map<PageId, pageBuffer>::const_iterator it = dirty.find(pid);
+    if (it != dirty.end()) {
+      memcpy(buffer, it->second.get(), page_size);
+      return 0;
+    }
+  }
+
+  // follow the run of consecutive pages; a page read again leaves it as is
+  PageId last = last_read.exchange(pid);
+  int run = run_length;
+  if (pid != last) {
+    run = (pid == last + 1) ? run + 1 : 0;
+    run_length = run;
+  }
+
+  cacheShard& shard = shardOf(fd, pid);
+  int version;
+
   //
   // if the page is in cache, read it from there
   //
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid && 
-        readCache[i].lastAccessed != 0) {
-       memcpy(buffer, readCache[i].buffer, PAGE_SIZE);
-       readCache[i].lastAccessed = ++cacheClock;
-       return 0;
+  {
+    std::lock_guard<std::mutex> lock(shard.lock);
+    for (int i = 0; i < SHARD_SLOTS; i++) {
+      if (shard.pages[i].fd == fd && shard.pages[i].pid == pid && 
+          shard.pages[i].lastAccessed != 0) {
+         memcpy(buffer, shard.buffer + shard.pages[i].offset, page_size);
+         shard.pages[i].lastAccessed = ++shard.clock;
+         return 0;
+      }
     }
+    version = shard.version;
   }
 
-  // seek to the page
-  if ((rc = seek(pid) < 0)) return rc;
-  
-  // find the cache slot to evict
-  int toEvict = 0; 
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].lastAccessed == 0) {
-      toEvict = i;
-      break;
-    }
-    if (readCache[i].lastAccessed < readCache[toEvict].lastAccessed) {
-      toEvict = i;
-    }
-  }
-  readCache[toEvict].fd = fd;
-  readCache[toEvict].pid = pid;
-  readCache[toEvict].lastAccessed = ++cacheClock;
- 
-  // read the page to cache first and copy it to the buffer
-  if (::read(fd, readCache[toEvict].buffer, PAGE_SIZE) < 0) {
+  // a page being prefetched is not read twice
+  if (waitPrefetch(pid, buffer)) return 0;
+
+  // in a run, the pages behind come along
+  if (run > 0 && readaheadPages() > 1 && readAhead(pid, run, buffer)) return 0;
+
+  // read the page without holding the shard
+  if (readAt(buffer, page_size, offsetOf(pid)) < 0) {
     return RT_FILE_READ_FAILED;
   }
-  memcpy(buffer, readCache[toEvict].buffer, PAGE_SIZE);
 
   // increase the page read count
   readCount++;
 
+  cachePage(fd, pid, version, buffer, page_size);
   return 0;
 }
+
+void GBTFile::cachePage(int fd, PageId pid, int version, const void* buffer, int size)
+{
+  cacheShard& shard = shardOf(fd, pid);
+
+  // cache the page unless a write or close invalidated the shard meanwhile,
+  // in which case the page read may already be stale
+  std::lock_guard<std::mutex> lock(shard.lock);
+  if (shard.version != version) return;
+
+  // the last use of each MIN_PAGE_SIZE block of the buffer
+  int slot = -1;
+  int blocks[SHARD_SLOTS] = { 0 };
+  for (int i = 0; i < SHARD_SLOTS; i++) {
+    const cacheStruct& page = shard.pages[i];
+    if (page.lastAccessed == 0) {
+      if (slot < 0) slot = i;
+      continue;
+    }
+    if (page.fd == fd && page.pid == pid) return;  // another reader cached it first
+    for (int b = page.offset / MIN_PAGE_SIZE; b < (page.offset + page.size) / MIN_PAGE_SIZE; b++)
+      blocks[b] = page.lastAccessed;
+  }
+
+  // the page goes at the offset, aligned to its size, whose pages were
+  // used least recently; the pages it overlaps are evicted
+  int offset = 0;
+  int oldest = 0;
+  for (int at = 0; at < SHARD_BYTES; at += size) {
+    int used = 0;
+    for (int b = at / MIN_PAGE_SIZE; b < (at + size) / MIN_PAGE_SIZE; b++)
+      if (blocks[b] > used) used = blocks[b];
+    if (at == 0 || used < oldest) {
+      offset = at;
+      oldest = used;
+    }
+  }
+  for (int i = 0; i < SHARD_SLOTS; i++) {
+    cacheStruct& page = shard.pages[i];
+    if (page.lastAccessed != 0 && page.offset < offset + size && offset < page.offset + page.size) {
+      page.fd = 0;
+      page.pid = 0;
+      page.lastAccessed = 0;
+      if (slot < 0) slot = i;
+    }
+  }
+
+  memcpy(shard.buffer + offset, buffer, size);
+  shard.pages[slot].fd = fd;
+  shard.pages[slot].pid = pid;
+  shard.pages[slot].offset = offset;
+  shard.pages[slot].size = size;
+  shard.pages[slot].lastAccessed = ++shard.clock;
+}
+
+/*
+ * readahead_bytes in pages of this file, at least one.
+ */
+int GBTFile::readaheadPages() const
+{
+  int pages = readahead_bytes / page_size;
+  return pages > 1 ? pages : 1;
+}
+
+/*
+ * The window is the power of two above the run, so a scan reads 2, 4, 8,
+ * ... pages per system call. It stops in front of a dirty page, which is
+ * newer than the disk.
+ */
+bool GBTFile::readAhead(PageId pid, int run, void* buffer) const
+{
+  int most = readaheadPages();
+  int window = 2;
+  while (window <= run && window < most) window *= 2;
+  if (window > most) window = most;
+  if (window > epid - pid) window = epid - pid;
+
+  if (dirty_limit > 0 || hold) {
+    std::shared_lock<std::shared_mutex> lock(dirty_lock);
+    std::map<PageId, pageBuffer>::const_iterator it = dirty.lower_bound(pid + 1);
+    if (it != dirty.end() && it->first < pid + window) window = it->first - pid;
+  }
+  if (window <= 1) return false;
+
+  // the versions are taken before the read, as in read()
+  std::vector<int> versions(window);
+  for (int i = 0; i < window; i++) {
+    cacheShard& shard = shardOf(fd, pid + i);
+    std::lock_guard<std::mutex> lock(shard.lock);
+    versions[i] = shard.version;
+  }
+
+  pageBuffer pages((size_t)window * page_size);
+  ssize_t n = ::pread(fd, pages.get(), (size_t)window * page_size, offsetOf(pid));
+  if (n < page_size) return false;
+
+  int got = n / page_size;
+  readCount += got;
+  for (int i = 0; i < got; i++) {
+    cachePage(fd, pid + i, versions[i], pages.get() + (size_t)i * page_size, page_size);
+  }
+  memcpy(buffer, pages.get(), page_size);
+
+  // the kernel reads the next window while this one is used, unless it
+  // keeps no pages of the file
+  if (!direct)
+    ::posix_fadvise(fd, offsetOf(pid + got), (off_t)window * page_size, POSIX_FADV_WILLNEED);
+  return true;
+}
+
+void GBTFile::prefetch(const PageId* pids, int count) const
+{
+  std::vector<GBTAsyncIO::request*> reads;
+
+  if (!prefetching()) return;
+
+  static bool fork_safe = (::pthread_atfork(holdPending, releasePending, releasePending) == 0);
+  (void) fork_safe;
+
+  for (int i = 0; i < count; i++) {
+    PageId pid = pids[i];
+    if (pid < 0 || pid >= epid) continue;
+
+    // the next page of a run comes with the readahead of read()
+    if (readaheadPages() > 1 && pid == last_read + 1 && run_length > 0) continue;
+
+    if (dirty_limit > 0 || hold) {
+      std::shared_lock<std::shared_mutex> lock(dirty_lock);
+      if (dirty.count(pid)) continue;
+    }
+
+    cacheShard& shard = shardOf(fd, pid);
+    bool cached = false;
+    int version;
+    {
+      std::lock_guard<std::mutex> lock(shard.lock);
+      for (int j = 0; j < SHARD_SLOTS && !cached; j++) {
+        cached = shard.pages[j].fd == fd && shard.pages[j].pid == pid &&
+                 shard.pages[j].lastAccessed != 0;
+      }
+      version = shard.version;
+    }
+    if (cached) continue;
+
+#ifdef RWF_NOWAIT
+    // a page the kernel has cached costs no more than a copy: cache it now
+    // and leave the ring to the pages that must come from the disk
+    char page[MAX_PAGE_SIZE];
+    struct iovec iov = { page, (size_t)page_size };
+    if (!direct && ::preadv2(fd, &iov, 1, offsetOf(pid), RWF_NOWAIT) == page_size) {
+      readCount++;
+      cachePage(fd, pid, version, page, page_size);
+      continue;
+    }
+#endif
+
+    std::lock_guard<std::mutex> lock(pending_lock);
+    std::shared_ptr<pendingRead>& read = pending[std::make_pair(fd, pid)];
+    if (read) continue;  // already in flight
+    read.reset(new pendingRead());
+    read->page = pageBuffer(page_size);
+    read->fd = fd;
+    read->offset = offsetOf(pid);
+    read->size = page_size;
+    read->buffer = read->page.get();
+    read->result = 0;
+    read->done = prefetchDone;
+    read->pid = pid;
+    read->version = version;
+    read->page_size = page_size;
+    read->finished = false;
+    reads.push_back(read.get());
+  }
+
+  if (!reads.empty()) {
+    prefetchCount += reads.size();
+    GBTAsyncIO::submit(&reads[0], reads.size());
+  }
+}
+
+void GBTFile::prefetchDone(GBTAsyncIO::request* req)
+{
+  pendingRead* read = static_cast<pendingRead*>(req);
+
+  if (read->result >= 0) {
+    readCount++;
+    cachePage(read->fd, read->pid, read->version, read->page.get(), read->page_size);
+  }
+
+  // the entry is dropped after the lock, with the last reference
+  std::shared_ptr<pendingRead> entry;
+  std::lock_guard<std::mutex> lock(pending_lock);
+  std::map<std::pair<int, PageId>, std::shared_ptr<pendingRead> >::iterator it =
+      pending.find(std::make_pair(read->fd, read->pid));
+  entry.swap(it->second);
+  pending.erase(it);
+  read->finished = true;
+  pending_done.notify_all();
+}
+
+void GBTFile::holdPending()
+{
+  std::unique_lock<std::mutex> lock(pending_lock);
+  pending_done.wait(lock, [] { return pending.empty(); });
+  lock.release();
+}
+
+void GBTFile::releasePending()
+{
+  pending_lock.unlock();
+}
+
+bool GBTFile::waitPrefetch(PageId pid, void* buffer) const
+{
+  std::shared_ptr<pendingRead> read;
+  {
+    std::unique_lock<std::mutex> lock(pending_lock);
+    std::map<std::pair<int, PageId>, std::shared_ptr<pendingRead> >::const_iterator it =
+        pending.find(std::make_pair(fd, pid));
+    if (it == pending.end()) return false;
+    read = it->second;
+    pending_done.wait(lock, [&] { return read->finished; });
+  }
+  if (read->result < 0) return false;
+
+  // a write since the read was submitted makes it stale
+  cacheShard& shard = shardOf(fd, pid);
+  std::lock_guard<std::mutex> lock(shard.lock);
+  if (shard.version != read->version) return false;
+  memcpy(buffer, read->page.get(), page_size);
+  return true;
+}
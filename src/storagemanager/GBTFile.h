@@ -10,7 +10,15 @@
 #define GBTFILE_H_
 
 #include <string>
+#include <map>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
 #include "../base/GBTreeBase.h"
+#include "GBTAsyncIO.h"
 
 typedef int PageId;
 
@@ -20,25 +28,119 @@ typedef int PageId;
 class GBTFile {
  public:
 
-  static const int PAGE_SIZE = 8196;    // the size of a page is 1KB
+  static const int PAGE_SIZE = 8192;       // the size of a page created by default
+  static const int MIN_PAGE_SIZE = 4096;   // page sizes are powers of two in this range
+  static const int MAX_PAGE_SIZE = 65536;
+  static const int FORMAT_VERSION = 2;     // the version in the header of the files written
 
   GBTFile();
   GBTFile(const std::string& filename, char mode);
+  ~GBTFile();
+
+  /**
+   * the most dirty pages a file opened in 'w' mode keeps in memory.
+   * write() leaves a page in memory until this many pages are dirty, or
+   * until flush() or close(); then all of them are written in PageId
+   * order, a run of consecutive pages in one system call.
+   * 0, the default, writes every page through to the file. a writer that
+   * fills its file in bulk opts in with writeBack().
+   */
+  static size_t write_back_pages;
+
+  /**
+   * the write-back limit the load and insert paths ask for.
+   */
+  static const size_t LOAD_WRITE_BACK_PAGES = 1024;
+
+  /**
+   * whether prefetch() reads pages ahead of a file read through the
+   * kernel page cache. false, the default, ignores it there: a cached
+   * page costs a copy either way. a file opened with O_DIRECT always
+   * prefetches, since each of its reads waits on the disk; batched
+   * locates on a 2M key index run 1.5 to 1.7 times as fast with it.
+   */
+  static bool prefetch_pages;
+
+  /**
+   * the most bytes a sequential read brings in at once. read() keeps
+   * track of the run of consecutive pages a file is read in; a page
+   * missing in the cache in the middle of a run is read together with
+   * the pages behind it in one system call, and the kernel is asked to
+   * read the window after that. the window doubles with the run up to
+   * this size, whatever the page size. a size up to one page reads a
+   * page at a time.
+   */
+  static int readahead_bytes;
+
+  /**
+   * whether files are opened with O_DIRECT, so that their pages bypass
+   * the kernel page cache and the cache of GBTFile is the only one.
+   * the reads and writes go through buffers aligned to MIN_PAGE_SIZE.
+   * read when a file is opened.
+   */
+  static bool direct_io;
 
   /**
    * open a file in read or write mode.
    * when opened in 'w' mode, if the file does not exist, it is created.
+   * the file begins with a header page that records the format version
+   * and the page size; the pages of the caller follow it.
    * @param filename[IN] the name of the file to open
    * @param mode[IN] 'r' for read, 'w' for write
-   * @return error code. 0 if no error
+   * @param pageSize[IN] the page size of a new file. a file that has a
+   *   header keeps its own; see pageSize()
+   * @return error code. 0 if no error. RT_INVALID_FILE_FORMAT if the
+   *   file has no valid header or pageSize is not a power of two from
+   *   MIN_PAGE_SIZE to MAX_PAGE_SIZE
    */
-  RT open(const std::string& filename, char mode);
+  RT open(const std::string& filename, char mode, int pageSize = PAGE_SIZE);
 
   /**
-   * close the file.
+   * close the file. the dirty pages are written back first.
    * @return error code. 0 if no error
    */
   RT close();
+
+  /**
+   * write the dirty pages back to the file.
+   * @return error code. 0 if no error
+   */
+  RT flush();
+
+  /**
+   * keep the dirty pages, however many, until flush(), for an owner that
+   * must decide when the file changes on disk; close() drops them. the
+   * file must be open in 'w' mode.
+   */
+  void holdDirty(bool hold);
+
+  /**
+   * set the write-back limit of this file (see write_back_pages). the
+   * dirty pages are written back if they reach the new limit. the file
+   * must be open in 'w' mode, and the writer sets it before readers
+   * share the file.
+   * @param pages[IN] the most dirty pages to keep, 0 to write through
+   * @return error code. 0 if no error
+   */
+  RT writeBack(size_t pages);
+
+  /**
+   * the write-back limit of this file, 0 if it writes through.
+   */
+  size_t writeBackLimit() const { return dirty_limit; }
+
+  /**
+   * the dirty pages in PageId order. only the writer may call these; the
+   * pointers are valid until its next write or flush.
+   */
+  size_t dirtyCount() const { return dirty.size(); }
+  void dirtyPages(std::vector<std::pair<PageId, const char*> >& pages) const;
+
+  /**
+   * wait until the pages written to the file are on the disk.
+   * @return error code. 0 if no error
+   */
+  RT sync();
   
   /**
    * read a disk page into memory buffer.
@@ -47,11 +149,27 @@ class GBTFile {
    * @return error code. 0 if no error
    */
   RT read(PageId pid, void *buffer) const;
+
+  /**
+   * start reading the pages into the cache without waiting for them,
+   * all of them in flight at once (see GBTAsyncIO). a read() of a page
+   * still in flight waits for it instead of reading it again. pages that
+   * are dirty, cached or outside the file are skipped.
+   * @param pids[IN] the pages to read
+   * @param count[IN] the number of pages
+   */
+  void prefetch(const PageId* pids, int count) const;
+
+  /**
+   * @return whether prefetch() reads pages of this file ahead
+   */
+  bool prefetching() const { return fd >= 0 && (prefetch_pages || direct); }
   
   /**
    * write the memory buffer to the disk page.
    * if (pid >= endPid()), the file is expanded such that
    * endPid() becomes (pid + 1).
+   * in write-back mode the page only reaches the disk at the next flush.
    * @param pid[IN] page to write to
    * @param buffer[IN] the content to write
    * @return error code. 0 if no error
@@ -65,47 +183,164 @@ class GBTFile {
    */
   PageId endPid() const;
 
+  /**
+   * @return the size of the pages of the file, in bytes
+   */
+  int pageSize() const { return page_size; }
+
   /**
    * @return the total # of disk reads
    */
   static int getPageReadCount()  { return readCount; }
-  
+
   /**
-   * @return the total # of disk writes
+   * @return the total # of reads prefetch() started
    */
-  static int getPageWriteCount() { return writeCount; }
-
- protected:
+  static int getPrefetchCount()  { return prefetchCount; }
+  
   /**
-   * move the file cursor to the beginning of a page.
-   * this is an internal function not exposed to public.
-   * @param pid[IN] page to seek to
-   * @return error code. 0 if no error
+   * @return the total # of disk writes. a page written back counts once
+   * however often it was written in memory.
    */
-  RT seek(PageId pid) const;
+  static int getPageWriteCount() { return writeCount; }
 
  private:
   int     fd;     // file descriptor of the associated unix file
-  PageId  epid;   // (last page id + 1) of the file
+  std::atomic<PageId> epid;   // (last page id + 1) of the file. grows while readers run
+  int     page_size;          // bytes per page, from the header
+  bool    direct;             // the file is open with O_DIRECT
+
+  //
+  // the header in the first page of the file. page pid is stored behind
+  // it, at (pid + 1) * page_size, so the pages stay aligned.
+  //
+  struct fileHeader {
+    char     magic[8];        // "GBTFILE"
+    uint32_t version;         // FORMAT_VERSION
+    uint32_t page_size;
+  };
+
+  RT readHeader();
+  RT writeHeader();
+  off_t offsetOf(PageId pid) const { return (off_t)(pid + 1) * page_size; }
 
   //
-  // the following set of members implement LRU caching 
+  // memory for whole pages, aligned as O_DIRECT wants it
   //
-  static const int CACHE_COUNT = 10;
+  class pageBuffer {
+   public:
+    pageBuffer() : data(NULL) {}
+    explicit pageBuffer(size_t size);
+    pageBuffer(pageBuffer&& other) : data(other.data) { other.data = NULL; }
+    pageBuffer& operator=(pageBuffer&& other) { std::swap(data, other.data); return *this; }
+    ~pageBuffer();
+    char* get() const { return data; }
+   private:
+    pageBuffer(const pageBuffer&);
+    pageBuffer& operator=(const pageBuffer&);
+    char* data;
+  };
 
-  static int cacheClock; // clock tick counter for LRU policy
+  // pread and pwrite of whole pages. with O_DIRECT a buffer that is not
+  // aligned goes through an aligned one of the thread
+  ssize_t readAt(void* buffer, size_t size, off_t offset) const;
+  ssize_t writeAt(const void* buffer, size_t size, off_t offset);
+
+  //
+  // the following set of members implement LRU caching.
+  // the cache is split into shards by (fd, pid), each with its own lock
+  // and LRU clock, so readers of different pages rarely wait for each
+  // other. pages are read with pread, which leaves no shared file offset.
+  // a shard holds SHARD_BYTES of pages, so the cache holds the same bytes
+  // whatever the page size: 128 pages of 8 KB, 16 of 64 KB. files of
+  // different page sizes share a shard: a page sits at an offset aligned
+  // to its size, and evicts only the pages in the way of it.
+  //
+  static const int CACHE_SHARDS = 16;
+  static const int SHARD_BYTES = MAX_PAGE_SIZE;
+  static const int SHARD_SLOTS = SHARD_BYTES / MIN_PAGE_SIZE;  // pages per shard at most
 
   // the actual cache data structure
-  static struct cacheStruct {
+  struct cacheStruct {
     int    fd;              // file id of the cached page
     PageId pid;             // page id of the cached page
+    int    offset;          // where the page is in the buffer of the shard
+    int    size;            // the page size
     int    lastAccessed;    // the last time the cached page was accessed
-                            //   (lastAccessed == 0) means that the buffer is empty
-    char buffer[PAGE_SIZE]; // the buffer used for caching
-  } readCache[CACHE_COUNT];
+                            //   (lastAccessed == 0) means that the slot is empty
+  };
+
+  static struct cacheShard {
+    std::mutex  lock;
+    int         clock;      // clock tick counter for LRU policy
+    int         version;    // bumped by every invalidation, see read()
+    cacheStruct pages[SHARD_SLOTS];
+    char        buffer[SHARD_BYTES];
+  } readCache[CACHE_SHARDS];
+
+  // the shard that caches a page
+  static cacheShard& shardOf(int fd, PageId pid);
+
+  // cache a page read from the disk, unless the shard was invalidated
+  // since version was taken, in which case the page may be stale
+  static void cachePage(int fd, PageId pid, int version, const void* buffer, int size);
+
+  //
+  // the pages prefetch() is reading, by (fd, pid). the entry is removed
+  // when the read ended; read() of the page waits for that.
+  //
+  struct pendingRead : GBTAsyncIO::request {
+    PageId pid;
+    int    version;         // the version of the shard when it was submitted
+    int    page_size;
+    bool   finished;
+    pageBuffer page;
+  };
+  static std::map<std::pair<int, PageId>, std::shared_ptr<pendingRead> > pending;
+  static std::mutex pending_lock;
+  static std::condition_variable pending_done;
+
+  static void prefetchDone(GBTAsyncIO::request* req);
+
+  // fork waits for the prefetches in flight, which the child could not end
+  static void holdPending();
+  static void releasePending();
+
+  // wait for a prefetch of the page and copy it. false if there is none,
+  // or it failed or went stale
+  bool waitPrefetch(PageId pid, void* buffer) const;
+
+  //
+  // sequential readahead. the run is kept loosely: readers of the same
+  // file at different places only make it shorter.
+  //
+  mutable std::atomic<PageId> last_read;  // the page read last
+  mutable std::atomic<int>    run_length; // consecutive pages before it
+
+  // the largest window in pages of this file, from readahead_bytes
+  int readaheadPages() const;
+
+  // read the window of pages starting at pid into the cache and pid into
+  // buffer. false if the window is a single page
+  bool readAhead(PageId pid, int run, void* buffer) const;
+
+  //
+  // write-back pages of this file. read() finds a dirty page here before
+  // it looks at the cache or the disk. the writer changes the table under
+  // the exclusive lock and readers look it up under the shared one.
+  //
+  static const int FLUSH_PAGES = 64;  // most pages per system call of a flush
+  std::map<PageId, pageBuffer> dirty;  // in PageId order
+  size_t dirty_limit;       // write_back_pages, or 0 if the file writes through
+  bool   hold;              // the dirty pages are only written by flush()
+  mutable std::shared_mutex dirty_lock;
+
+  // write the dirty pages; the caller holds dirty_lock
+  RT flushDirty();
 
-  static int readCount;  // total # of page reads 
-  static int writeCount; // total # of page writes 
+  static std::atomic<int> readCount;  // total # of page reads 
+  static std::atomic<int> writeCount; // total # of page writes 
+  static std::atomic<int> prefetchCount; // total # of prefetches started
 };
 
 #endif
@@ -0,0 +1,74 @@
+/*
+ * =====================================================================================
+ *
+ *       Filename:  GBTMappedFile.cc
+ *
+ *    Description:  read-only memory mapping of an input file
+ *
+ *        Version:  1.0
+ *       Revision:  none
+ *       Compiler:  g++
+ *
+ * =====================================================================================
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "GBTMappedFile.h"
+
+GBTMappedFile::GBTMappedFile()
+{
+  fd = -1;
+  addr = NULL;
+  length = 0;
+}
+
+GBTMappedFile::~GBTMappedFile()
+{
+  if (fd >= 0) close();
+}
+
+RT GBTMappedFile::open(const std::string& filename)
+{
+  struct stat statbuf;
+
+  if (fd >= 0) return RT_FILE_OPEN_FAILED;
+
+  fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0) { fd = -1; return RT_FILE_OPEN_FAILED; }
+
+  if (::fstat(fd, &statbuf) < 0) { ::close(fd); fd = -1; return RT_FILE_OPEN_FAILED; }
+  length = statbuf.st_size;
+
+  // an empty file cannot be mapped, but it is still a valid (empty) input
+  if (length == 0) return 0;
+
+  void* ptr = ::mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (ptr == MAP_FAILED) {
+    ::close(fd);
+    fd = -1;
+    length = 0;
+    return RT_FILE_READ_FAILED;
+  }
+  addr = (char*) ptr;
+
+  // the loaders scan the file front to back
+  ::madvise(addr, length, MADV_SEQUENTIAL);
+
+  return 0;
+}
+
+RT GBTMappedFile::close()
+{
+  if (fd < 0) return RT_FILE_CLOSE_FAILED;
+
+  if (addr != NULL) ::munmap(addr, length);
+  ::close(fd);
+
+  fd = -1;
+  addr = NULL;
+  length = 0;
+  return 0;
+}
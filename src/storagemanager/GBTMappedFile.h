@@ -0,0 +1,53 @@
+/*
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+#ifndef GBTMAPPEDFILE_H_
+#define GBTMAPPEDFILE_H_
+
+#include <stddef.h>
+#include <string>
+#include "../base/GBTreeBase.h"
+
+/**
+ * map a whole file read-only into memory.
+ * used by the loaders to parse input files without copying them.
+ */
+class GBTMappedFile {
+ public:
+  GBTMappedFile();
+  ~GBTMappedFile();
+
+  /**
+   * map the file into memory.
+   * @param filename[IN] the name of the file to map
+   * @return error code. 0 if no error
+   */
+  RT open(const std::string& filename);
+
+  /**
+   * unmap the file. pointers returned by data() become invalid.
+   * @return error code. 0 if no error
+   */
+  RT close();
+
+  /**
+   * @return the first byte of the mapping. NULL if the file is empty
+   */
+  const char* data() const { return addr; }
+
+  /**
+   * @return the size of the mapping in bytes
+   */
+  size_t size() const { return length; }
+
+ private:
+  GBTMappedFile(const GBTMappedFile&);
+  GBTMappedFile& operator=(const GBTMappedFile&);
+
+  int    fd;      // file descriptor of the mapped file
+  char*  addr;    // start of the mapping
+  size_t length;  // size of the mapping
+};
+
+#endif
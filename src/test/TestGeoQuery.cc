@@ -15,17 +15,43 @@
  *
  * =====================================================================================
  */
+#include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <assert.h>
+#include <errno.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <random>
+#include <set>
 #include <vector>
 #include <string>
 #include "TestGeoQuery.h"
 #include "../gbtree/GBTEngine.h"
+#include "../gbtree/GBTCoordinator.h"
+#include "../gbtree/GBTTable.h"
+#include "../gbtree/GBTObjectStore.h"
+#include "../gbtree/GBTPartitionedTable.h"
+#include "../gbtree/GBTTrajectory.h"
+#include "../gbtree/GBTWal.h"
+#include "../gbtree/GBTreeIndex.h"
+#include "../gbtree/GeoQuery.h"
+#include "../gbtree/Geohash.h"
 #include "../pathmanager/PathManager.h"
+#include "../storagemanager/GBTAsyncIO.h"
 #include "../storagemanager/GBTFile.h"
 
 
+static long ElapsedMicroseconds(const struct timeval& start, const struct timeval& stop)
+{
+	return (stop.tv_sec - start.tv_sec) * 1000000L + (stop.tv_usec - start.tv_usec);
+}
+
 static void GetData(std::string table, double *coordinates)
 {
 
@@ -102,8 +128,9 @@ int TestPointSelect(const char* table_name, const char*data_file)
 	gettimeofday(&stop, NULL);
 	epagecnt = GBTFile::getPageReadCount();
 	count *= 3;
-	double duration = (double)(stop.tv_usec - start.tv_usec) / 1000000.0;
-	fprintf(stdout, "-- the duration is %.5f, the qps is %.5f, read %d pages\n", duration,  ((float)count) / duration, epagecnt - bpagecnt);
+	double duration = (double)ElapsedMicroseconds(start, stop) / 1000000.0;
+	fprintf(stdout, "--Page size is %d, -- the duration is %.5f, the qps is %.5f, read %d pages\n",
+			GBTEngine::page_size, duration,  ((float)count) / duration, epagecnt - bpagecnt);
 	return 0;
 }
 static void GetRange(std::string name, double *lnglat)
@@ -126,17 +153,31 @@ int TestRangeQuery(const char* table_name, const char*data_file)
 
 	double lnglat[4];
 	GetRange(table, lnglat);
+	int count = 1000;
+	int i;
+	uint64_t left_down = 0, right_up = 0;
+	std::vector<RecordId> rids;
 	struct timeval start, stop;
 	int     bpagecnt, epagecnt;
+	geohash_encode_64(lnglat[1], lnglat[0], &left_down);
+	geohash_encode_64(lnglat[3], lnglat[2], &right_up);
 	bpagecnt = GBTFile::getPageReadCount();
 
-	gettimeofday(&start, NULL);
+	// one query through the engine reports the outputs, the rest are timed
+	// as in TestPointSelect
 	rt = GBTEngine::RangeSelect(table, lnglat, outputs);
+	assert(rt == 0);
+	gettimeofday(&start, NULL);
+	for(i = 0; i < count; i++)
+	{
+		rids.clear();
+		GeoQuery::RangeQuery(table.c_str(), left_down, right_up, rids);
+	}
 	gettimeofday(&stop, NULL);
 	epagecnt = GBTFile::getPageReadCount();
-	fprintf(stdout, "--Page size is %d,  -- %lu microseconds to run the range command. Read %d pages\n",
-			GBTFile::PAGE_SIZE, stop.tv_usec - start.tv_usec, epagecnt - bpagecnt);
-	assert(rt == 0);
+	double duration = (double)ElapsedMicroseconds(start, stop) / 1000000.0;
+	fprintf(stdout, "--Page size is %d, -- the duration is %.5f, the qps is %.5f, read %d pages\n",
+			GBTEngine::page_size, duration,  ((float)count) / duration, epagecnt - bpagecnt);
 	return rt;
 }
 static void GetNearestCenter(std::string table, double *coordinates)
@@ -182,17 +223,1338 @@ int TestNearestQuery(const char* table_name, const char*data_file)
 	double min_distance = 0;
 	double max_distance = 0;
 	count = 2000;
+	int repeats = 100;
+	int i;
+	uint64_t center = 0;
+	std::vector<NearestResult> nearests;
 	struct timeval start, stop;
 	int     bpagecnt, epagecnt;
+	geohash_encode_64(lnglat[1], lnglat[0], &center);
 	bpagecnt = GBTFile::getPageReadCount();
 
-	gettimeofday(&start, NULL);
+	// one query through the engine reports the outputs, the rest are timed
+	// as in TestPointSelect
 	rt = GBTEngine::NearestSelect(table, lnglat, outputs, count, min_distance, max_distance);
+	assert(rt == 0);
+	gettimeofday(&start, NULL);
+	for(i = 0; i < repeats; i++)
+	{
+		nearests.clear();
+		GeoQuery::Nearest(table.c_str(), center, nearests, count, min_distance, max_distance);
+	}
+	gettimeofday(&stop, NULL);
+	epagecnt = GBTFile::getPageReadCount();
+	double duration = (double)ElapsedMicroseconds(start, stop) / 1000000.0;
+	fprintf(stdout, "--Page size is %d, -- the duration is %.5f, the qps is %.5f, read %d pages\n",
+			GBTEngine::page_size, duration,  ((float)repeats) / duration, epagecnt - bpagecnt);
+
+	// NearestSelect leaves outputs empty; the query gives at most count
+	// points, nearest first
+	bool sorted = (nearests.size() <= count);
+	for(size_t j = 1; sorted && j < nearests.size(); j++)
+		sorted = (nearests[j - 1].distance <= nearests[j].distance);
+	assert(sorted);
+	return (rt == 0 && sorted) ? 0 : -1;
+}
+
+// the latitude and the longitude bits of an address
+static const uint64_t LATITUDE_BITS = UINT64_C(0x5555555555555555);
+static const uint64_t LONGITUDE_BITS = UINT64_C(0xaaaaaaaaaaaaaaaa);
+
+static bool InsideRange(uint64_t left_down, uint64_t right_up, uint64_t key)
+{
+	return (left_down & LATITUDE_BITS) < (key & LATITUDE_BITS) && (key & LATITUDE_BITS) < (right_up & LATITUDE_BITS) &&
+		(left_down & LONGITUDE_BITS) < (key & LONGITUDE_BITS) && (key & LONGITUDE_BITS) < (right_up & LONGITUDE_BITS);
+}
+
+/* *
+ * encode the corners of a box
+ * @param lnglat[IN] the left, down, right and up edge of the box
+ * @return false if the box is empty
+ * */
+static bool MakeBox(const double lnglat[4], uint64_t& left_down, uint64_t& right_up)
+{
+	left_down = right_up = 0;
+	geohash_encode_64(lnglat[1], lnglat[0], &left_down);
+	geohash_encode_64(lnglat[3], lnglat[2], &right_up);
+	return (left_down & LATITUDE_BITS) < (right_up & LATITUDE_BITS) && (left_down & LONGITUDE_BITS) < (right_up & LONGITUDE_BITS);
+}
+
+/* *
+ * read the points of a load file
+ * @param keys[OUT] the geohash of every point
+ * @param lngs[OUT] the longitudes
+ * @param lats[OUT] the latitudes
+ * */
+static int ReadPoints(const char* data_file, std::vector<uint64_t>& keys, std::vector<double>& lngs, std::vector<double>& lats)
+{
+	char line[1024];
+	double lng, lat;
+	uint64_t key;
+
+	FILE *file = fopen(data_file, "r");
+	if(file == NULL)
+		return RT_FILE_OPEN_FAILED;
+	while(fgets(line, sizeof(line), file) != NULL){
+		if(sscanf(line, "%lf,%lf", &lng, &lat) != 2)
+			continue;
+		key = 0;
+		if(geohash_encode_64(lat, lng, &key) != GEOHASH_OK)
+			continue;
+		keys.push_back(key);
+		lngs.push_back(lng);
+		lats.push_back(lat);
+	}
+	fclose(file);
+	return keys.size() == 0 ? RT_FILE_OPEN_FAILED : 0;
+}
+
+int TestRangeCheck(const char* table_name, const char*data_file)
+{
+	int rt;
+	int bad = 0;
+	int boxes = 20;
+	int i;
+	size_t j;
+	uint64_t key, left_down, right_up;
+	std::string value;
+	std::string table(table_name);
+	std::string loadfile(data_file);
+	std::vector<uint64_t> keys;
+	std::vector<double> lngs, lats;
+	GBTTable table_file;
+
+	// the points of the load file are the reference
+	if((rt = ReadPoints(data_file, keys, lngs, lats)) != 0)
+		return rt;
+
+	// an index without duplicate keys keeps a row of each address, so only
+	// the addresses are compared; with duplicate keys every row must come back
+	for(int duplicate = 0; duplicate < 2; duplicate++)
+	{
+		unlink(PathManager::GetIndexPath(table).c_str());
+		unlink(PathManager::GetTablePath(table).c_str());
+		rt = GBTEngine::load(table, loadfile, duplicate != 0);
+		assert(rt == 0);
+		if((rt = table_file.open(PathManager::GetTablePath(table), 'r')) != 0)
+			return rt;
+
+		// the box of the range benchmark, then boxes spanned by two points
+		// of the data set
+		double lnglat[4];
+		GetRange(table, lnglat);
+		srand(1);
+		for(i = 0; i < boxes; i++)
+		{
+			if(i > 0){
+				size_t a = rand() % keys.size(), b = rand() % keys.size();
+				lnglat[0] = std::min(lngs[a], lngs[b]);
+				lnglat[1] = std::min(lats[a], lats[b]);
+				lnglat[2] = std::max(lngs[a], lngs[b]);
+				lnglat[3] = std::max(lats[a], lats[b]);
+			}
+			if(!MakeBox(lnglat, left_down, right_up))
+				continue;
+
+			std::vector<uint64_t> want, got;
+			for(j = 0; j < keys.size(); j++)
+				if(InsideRange(left_down, right_up, keys[j]))
+					want.push_back(keys[j]);
+			std::sort(want.begin(), want.end());
+
+			std::vector<RecordId> outputs;
+			if((rt = GeoQuery::RangeQuery(table.c_str(), left_down, right_up, outputs)) != 0){
+				bad++;
+				continue;
+			}
+			for(j = 0; j < outputs.size(); j++){
+				if(table_file.read(outputs[j], key, value) == 0)
+					got.push_back(key);
+			}
+			std::sort(got.begin(), got.end());
+			if(! duplicate){
+				want.erase(std::unique(want.begin(), want.end()), want.end());
+				got.erase(std::unique(got.begin(), got.end()), got.end());
+			}
+			if(want != got){
+				fprintf(stdout, "box %d: %lu outputs, %lu points inside. ", i, got.size(), want.size());
+				bad++;
+			}
+		}
+		table_file.close();
+	}
+	fprintf(stdout, "%d boxes checked against a scan of %lu points, %d wrong\n", 2 * boxes, keys.size(), bad);
+	return bad == 0 ? 0 : -1;
+}
+int TestClusterQuery(const char* table_name, const char*data_file)
+{
+	int rt;
+	int servers = 4;
+	size_t count = 2000;
+	std::string table(table_name);
+	GBTShardedTable sharded;
+	GBTCoordinator coordinator;
+	std::vector<ShardRecord> local, remote;
+
+	rt = sharded.open(table);
+	assert(rt == 0);
+	rt = sharded.load(std::string(data_file), false);
+	assert(rt == 0);
+	rt = coordinator.start(table, servers);
+	assert(rt == 0);
+
+	double lnglat[4];
+	uint64_t left_down = 0, right_up = 0, center = 0;
+	GetRange(table, lnglat);
+	geohash_encode_64(lnglat[1], lnglat[0], &left_down);
+	geohash_encode_64(lnglat[3], lnglat[2], &right_up);
+	GetNearestCenter(table, lnglat);
+	geohash_encode_64(lnglat[1], lnglat[0], &center);
+
+	struct timeval start, stop;
+	gettimeofday(&start, NULL);
+	rt = coordinator.rangeQuery(left_down, right_up, remote);
+	gettimeofday(&stop, NULL);
+	assert(rt == 0);
+	sharded.rangeQuery(left_down, right_up, local);
+	fprintf(stdout, "%lu shards, %d servers: the number of outputs is %lu. -- %ld microseconds to run the range command. ",
+			sharded.getShards().size(), servers, remote.size(), ElapsedMicroseconds(start, stop));
+	assert(remote.size() == local.size());
+
+	local.clear();
+	remote.clear();
+	gettimeofday(&start, NULL);
+	rt = coordinator.nearest(center, remote, count);
+	gettimeofday(&stop, NULL);
+	assert(rt == 0);
+	sharded.nearest(center, local, count);
+	fprintf(stdout, "the number of outputs is %lu. -- %ld microseconds to run the nearest command.\n",
+			remote.size(), ElapsedMicroseconds(start, stop));
+	assert(remote.size() == local.size());
+
+	return coordinator.stop();
+}
+
+typedef std::pair<uint64_t, int64_t> IndexPair;  // a key and the row number of its rid
+
+/* *
+ * compare the pairs in an index with the reference: a scan of the whole
+ * index, and the pairs locate() finds for every 64th key of the reference.
+ * @return the number of differences
+ * */
+static int CheckIndex(GBTreeIndex& index, std::vector<IndexPair> reference)
+{
+	int bad = 0;
+	RT rt;
+	uint64_t key, last = 0;
+	RecordId rid;
+	IndexCursor cursor;
+	std::vector<IndexPair> scanned;
+
+	std::sort(reference.begin(), reference.end());
+	if(index.pointToSmallestKey(cursor) == 0){
+		while((rt = index.readForward(cursor, key, rid)) == 0){
+			if(key < last)
+				bad++;  // out of order
+			last = key;
+			scanned.push_back(IndexPair(key, GBTTable::rowNumber(rid)));
+		}
+		if(rt != RT_END_OF_TREE)
+			bad++;
+	}
+	std::sort(scanned.begin(), scanned.end());
+	if(scanned != reference)
+		bad++;
+
+	for(size_t i = 0; i < reference.size(); i += 64)
+	{
+		std::vector<IndexPair> want, got;
+		for(size_t j = i; j < reference.size() && reference[j].first == reference[i].first; j++)
+			want.push_back(reference[j]);
+		for(size_t j = i; j-- > 0 && reference[j].first == reference[i].first; )
+			want.push_back(reference[j]);
+		if(index.locate(reference[i].first, cursor) == 0)
+			while(index.readForward(cursor, key, rid) == 0 && key == reference[i].first)
+				got.push_back(IndexPair(key, GBTTable::rowNumber(rid)));
+		std::sort(want.begin(), want.end());
+		std::sort(got.begin(), got.end());
+		if(got != want)
+			bad++;
+	}
+	return bad;
+}
+
+/* *
+ * bulk load random keys into an empty index held in memory, and check it
+ * in memory and again from the file it is written back to
+ * @return the number of failed calls and differences
+ * */
+static int CheckMemoryLoad(const std::string& path, int count)
+{
+	int bad = 0;
+	std::mt19937_64 random(count);
+	std::vector<IndexPair> pairs;
+	GBTreeIndex index, disk;
+
+	for(int i = 0; i < count; i++)
+		pairs.push_back(IndexPair(random(), i));
+	std::sort(pairs.begin(), pairs.end());
+
+	unlink(path.c_str());
+	if(index.openInMemory(path) != 0)
+		return 1;
+	if(index.bulkLoadBegin() != 0)
+		bad++;
+	for(size_t i = 0; i < pairs.size(); i++)
+		if(index.bulkLoadAppend(pairs[i].first, GBTTable::rowRecord(pairs[i].second)) != 0)
+			bad++;
+	if(index.bulkLoadEnd() != 0)
+		bad++;
+	bad += CheckIndex(index, pairs);
+	int height = index.getTreeHeight();
+	if(index.close() != 0)
+		bad++;
+
+	if(disk.open(path, 'r') != 0)
+		return bad + 1;
+	bad += CheckIndex(disk, pairs);
+	disk.close();
+	unlink(path.c_str());
+	fprintf(stdout, "memory load: %d keys, height %d, %d wrong\n", count, height, bad);
+	return bad;
+}
+
+int TestMemoryQuery(const char* table_name, const char*data_file)
+{
+	int rt;
+	std::string table(table_name);
+	GBTreeIndex disk, memory;
+	std::vector<RecordId> disk_outputs, memory_outputs;
+
+	rt = GBTEngine::load(table, std::string(data_file), false);
+	assert(rt == 0);
+	rt = disk.open(PathManager::GetIndexPath(table), 'r');
+	assert(rt == 0);
+
+	double lnglat[4];
+	uint64_t left_down = 0, right_up = 0;
+	GetRange(table, lnglat);
+	geohash_encode_64(lnglat[1], lnglat[0], &left_down);
+	geohash_encode_64(lnglat[3], lnglat[2], &right_up);
+
+	struct timeval start, stop;
+	int     bpagecnt, epagecnt;
+	bpagecnt = GBTFile::getPageReadCount();
+	gettimeofday(&start, NULL);
+	rt = GeoQuery::RangeQuery(disk, left_down, right_up, disk_outputs);
+	gettimeofday(&stop, NULL);
+	epagecnt = GBTFile::getPageReadCount();
+	assert(rt == 0);
+	fprintf(stdout, "disk: the number of outputs is %lu. -- %ld microseconds to run the range command. Read %d pages\n",
+			disk_outputs.size(), ElapsedMicroseconds(start, stop), epagecnt - bpagecnt);
+	disk.close();
+
+	rt = memory.openInMemory(PathManager::GetIndexPath(table));
+	assert(rt == 0);
+	bpagecnt = GBTFile::getPageReadCount();
+	gettimeofday(&start, NULL);
+	rt = GeoQuery::RangeQuery(memory, left_down, right_up, memory_outputs);
 	gettimeofday(&stop, NULL);
 	epagecnt = GBTFile::getPageReadCount();
-	fprintf(stdout, "--Page size is %d,  -- %lu microseconds to run the range command. Read %d pages\n",
-			GBTFile::PAGE_SIZE, stop.tv_usec - start.tv_usec, epagecnt - bpagecnt);
-	assert(outputs.size() == count);
+	assert(rt == 0);
+	fprintf(stdout, "memory: the number of outputs is %lu. -- %ld microseconds to run the range command. Read %d pages\n",
+			memory_outputs.size(), ElapsedMicroseconds(start, stop), epagecnt - bpagecnt);
+	assert(memory_outputs.size() == disk_outputs.size());
+	if((rt = memory.close()) != 0)
+		return rt;
+
+	return CheckMemoryLoad(PathManager::GetIndexPath(table + ".load"), 200000) == 0 ? 0 : -1;
+}
+
+static std::atomic<bool> stalled_done(false);
 
+static void StalledDone(GBTAsyncIO::request* req)
+{
+	stalled_done = true;
+}
+
+/* *
+ * wait up to five seconds for the stalled read to end
+ * */
+static bool WaitStalled()
+{
+	for(int i = 0; i < 5000 && !stalled_done; i++)
+		usleep(1000);
+	return stalled_done;
+}
+
+int TestPrefetchFallback(const char* table_name, const char*data_file)
+{
+	int rt;
+	size_t count = 2000;
+	std::string table(table_name);
+	std::vector<NearestResult> before, after;
+
+	rt = GBTEngine::load(table, std::string(data_file), false);
+	assert(rt == 0);
+
+	double lnglat[2];
+	uint64_t center = 0;
+	GetNearestCenter(table, lnglat);
+	geohash_encode_64(lnglat[1], lnglat[0], &center);
+	GBTFile::prefetch_pages = false;
+	rt = GeoQuery::Nearest(table.c_str(), center, before, count);
+	assert(rt == 0);
+
+	// a read of an empty pipe stays in flight until the ring fails
+	int fds[2];
+	char byte;
+	GBTAsyncIO::request stalled;
+	GBTAsyncIO::request* reqs[1] = { &stalled };
+	rt = pipe(fds);
+	assert(rt == 0);
+	stalled.fd = fds[0];
+	stalled.offset = 0;
+	stalled.size = 1;
+	stalled.buffer = &byte;
+	stalled.result = 0;
+	stalled.done = StalledDone;
+	bool ring = GBTAsyncIO::usingRing();
+	GBTAsyncIO::submit(reqs, 1);
+	GBTAsyncIO::failRing(EIO);
+	bool failed = WaitStalled();
+	if(!failed && write(fds[1], "x", 1) == 1)
+		WaitStalled();  // the pool read the pipe
+	close(fds[0]);
+	close(fds[1]);
+
+	// the pool prefetches for the queries from now on
+	GBTFile::prefetch_pages = true;
+	rt = GeoQuery::Nearest(table.c_str(), center, after, count);
+	assert(rt == 0);
+	bool same = (after.size() == before.size());
+	for(size_t i = 0; same && i < after.size(); i++)
+		same = (after[i].distance == before[i].distance);
+	fprintf(stdout, "ring %d, the read in flight %s (%ld), ring after the failure %d. the number of outputs is %lu, %s\n",
+			ring, failed ? "failed" : "went on", (long)stalled.result, GBTAsyncIO::usingRing(),
+			after.size(), same ? "same as without prefetch" : "DIFFERENT from without prefetch");
+	assert(!ring || (failed && stalled.result == -EIO));
+	assert(!GBTAsyncIO::usingRing());
+	assert(same);
+	return (same && (!ring || failed) && !GBTAsyncIO::usingRing()) ? 0 : -1;
+}
+
+/* *
+ * run the nearest and a range query around the center of the table
+ * @param elapsed[OUT] the microseconds both took
+ * */
+static RT CenterQueries(const std::string& table, uint64_t center, const double lnglat[2],
+		std::vector<NearestResult>& nearests, std::vector<RecordId>& rids, long& elapsed)
+{
+	RT rt;
+	uint64_t left_down, right_up;
+	double box[4] = { lnglat[0] - 0.5, lnglat[1] - 0.5, lnglat[0] + 0.5, lnglat[1] + 0.5 };
+	struct timeval start, stop;
+
+	MakeBox(box, left_down, right_up);
+	gettimeofday(&start, NULL);
+	if((rt = GeoQuery::Nearest(table.c_str(), center, nearests, 2000)) != 0)
+		return rt;
+	rt = GeoQuery::RangeQuery(table.c_str(), left_down, right_up, rids);
+	gettimeofday(&stop, NULL);
+	elapsed = ElapsedMicroseconds(start, stop);
 	return rt;
 }
+
+int TestDirectPrefetch(const char* table_name, const char*data_file)
+{
+	int rt;
+	std::string table(table_name);
+	std::vector<NearestResult> before, after;
+	std::vector<RecordId> before_rids, after_rids;
+	long buffered_us, direct_us;
+
+	rt = GBTEngine::load(table, std::string(data_file), false);
+	assert(rt == 0);
+
+	double lnglat[2];
+	uint64_t center = 0;
+	GetNearestCenter(table, lnglat);
+	geohash_encode_64(lnglat[1], lnglat[0], &center);
+	GBTFile::prefetch_pages = false;
+	rt = CenterQueries(table, center, lnglat, before, before_rids, buffered_us);
+	assert(rt == 0);
+
+	// the files opened with O_DIRECT prefetch through the ring
+	GBTFile::direct_io = true;
+	int prefetches = GBTFile::getPrefetchCount();
+	rt = CenterQueries(table, center, lnglat, after, after_rids, direct_us);
+	assert(rt == 0);
+	prefetches = GBTFile::getPrefetchCount() - prefetches;
+	GBTFile::direct_io = false;
+
+	bool same = (after.size() == before.size() && after_rids.size() == before_rids.size());
+	for(size_t i = 0; same && i < after.size(); i++)
+		same = (after[i].distance == before[i].distance);
+	for(size_t i = 0; same && i < after_rids.size(); i++)
+		same = (after_rids[i].pid == before_rids[i].pid && after_rids[i].sid == before_rids[i].sid);
+	fprintf(stdout, "ring %d, %d prefetches with O_DIRECT. %lu nearest and %lu in range, %s. %ld us buffered, %ld us direct\n",
+			GBTAsyncIO::usingRing(), prefetches, after.size(), after_rids.size(),
+			same ? "same as buffered" : "DIFFERENT from buffered", buffered_us, direct_us);
+	assert(same);
+	assert(prefetches > 0);
+	return (same && prefetches > 0) ? 0 : -1;
+}
+
+int TestRemove(const char* table_name, const char*data_file)
+{
+	int bad = 0;
+	int count = 200000;
+	int page_sizes[] = { GBTFile::MIN_PAGE_SIZE, GBTFile::MAX_PAGE_SIZE };
+	std::string path = PathManager::GetIndexPath(std::string(table_name));
+
+	for(int p = 0; p < 2; p++)
+	{
+		int failed = 0, wrong = 0;
+		std::mt19937_64 random(p);
+		std::set<uint64_t> used;
+		std::vector<IndexPair> pairs;
+		GBTreeIndex index;
+
+		unlink(path.c_str());
+		if(index.open(path, 'w', page_sizes[p]) != 0)
+			return -1;
+		for(int i = 0; i < count; i++)
+		{
+			uint64_t key = random();
+			if(!used.insert(key).second)
+				continue;
+			pairs.push_back(IndexPair(key, i));
+			if(index.insert(key, GBTTable::rowRecord(i)) != 0)
+				failed++;
+		}
+		int height = index.getTreeHeight();
+
+		// remove 90% in random order, check, and check the pages again on disk
+		std::shuffle(pairs.begin(), pairs.end(), random);
+		size_t removed = pairs.size() * 9 / 10;
+		for(size_t i = 0; i < removed; i++)
+			if(index.remove(pairs[i].first, GBTTable::rowRecord(pairs[i].second)) != 0)
+				failed++;
+		std::vector<IndexPair> kept(pairs.begin() + removed, pairs.end());
+		wrong += CheckIndex(index, kept);
+		if(index.remove(pairs[0].first, GBTTable::rowRecord(pairs[0].second)) != RT_NO_SUCH_RECORD)
+			failed++;
+		index.close();
+		if(index.open(path, 'w') != 0)
+			return -1;
+		wrong += CheckIndex(index, kept);
+
+		// and the rest, down to an empty tree
+		for(size_t i = removed; i < pairs.size(); i++)
+			if(index.remove(pairs[i].first, GBTTable::rowRecord(pairs[i].second)) != 0)
+				failed++;
+		wrong += CheckIndex(index, std::vector<IndexPair>());
+		if(index.getTreeHeight() != 0)
+			wrong++;
+		index.close();
+
+		fprintf(stdout, "page size %d: %lu pairs, height %d, %d failed, %d wrong. ",
+				page_sizes[p], pairs.size(), height, failed, wrong);
+		bad += failed + wrong;
+	}
+	fprintf(stdout, "\n");
+	unlink(path.c_str());
+	return bad == 0 ? 0 : -1;
+}
+
+/* *
+ * insert, update and remove rows of a table and its index, and check the
+ * index against a reference and the tombstones of the table after each step
+ * @return the number of failed calls and differences
+ * */
+static int CheckUpdate(const std::string& index_path, const std::string& table_path,
+		int page_size, bool duplicate, int count)
+{
+	int bad = 0, wrong = 0;
+	int heights[3];
+	std::mt19937_64 random(page_size + duplicate);
+	// with duplicate keys about four rows share a key
+	uint64_t keys = duplicate ? count / 4 : UINT64_MAX;
+	std::set<uint64_t> used;
+	std::vector<IndexPair> pairs, removed;
+	GBTreeIndex index(duplicate);
+	GBTTable table;
+
+	unlink(index_path.c_str());
+	unlink(table_path.c_str());
+	if(index.open(index_path, 'w', page_size) != 0 || table.open(table_path, 'w', page_size) != 0)
+		return 1;
+	for(int i = 0; i < count; i++)
+	{
+		uint64_t key = random() % keys;
+		RecordId rid;
+		if(table.append(key, "", rid) != 0 || index.insert(key, rid) != 0)
+			bad++;
+		pairs.push_back(IndexPair(key, GBTTable::rowNumber(rid)));
+		if(!used.insert(key).second && !duplicate)
+			bad++;  // a repeated random key; it would need duplicate_key
+	}
+	heights[0] = index.getTreeHeight();
+
+	// move a third of the rows, half of them by one, the other half anywhere
+	std::shuffle(pairs.begin(), pairs.end(), random);
+	for(size_t i = 0; i < pairs.size() / 3; i++)
+	{
+		uint64_t key = (i % 2 == 0) ? pairs[i].first + 1 : random() % keys;
+		if(!duplicate && !used.insert(key).second)
+			continue;
+		if(index.update(pairs[i].first, key, GBTTable::rowRecord(pairs[i].second)) != 0)
+			bad++;
+		used.erase(pairs[i].first);
+		pairs[i].first = key;
+	}
+	wrong += CheckIndex(index, pairs);
+
+	// remove 90% of the rows from the index and the table
+	std::shuffle(pairs.begin(), pairs.end(), random);
+	size_t kept = pairs.size() / 10;
+	while(pairs.size() > kept)
+	{
+		RecordId rid = GBTTable::rowRecord(pairs.back().second);
+		if(index.remove(pairs.back().first, rid) != 0 || table.remove(rid) != 0)
+			bad++;
+		removed.push_back(pairs.back());
+		pairs.pop_back();
+	}
+	heights[1] = index.getTreeHeight();
+	RecordId rid = GBTTable::rowRecord(removed[0].second);
+	if(index.remove(removed[0].first, rid) != RT_NO_SUCH_RECORD || table.remove(rid) != RT_RECORD_DELETED)
+		bad++;
+	wrong += CheckIndex(index, pairs);
+
+	// the same after reopening both files
+	index.close();
+	table.close();
+	if(index.open(index_path, 'w') != 0 || table.open(table_path, 'r') != 0)
+		return bad + 1;
+	wrong += CheckIndex(index, pairs);
+	for(size_t i = 0; i < removed.size(); i++)
+	{
+		bool deleted = false;
+		uint64_t key;
+		std::string value;
+		rid = GBTTable::rowRecord(removed[i].second);
+		if(table.isDeleted(rid, deleted) != 0 || !deleted || table.read(rid, key, value) != RT_RECORD_DELETED)
+			wrong++;
+	}
+	for(size_t i = 0; i < pairs.size(); i++)
+	{
+		bool deleted = true;
+		if(table.isDeleted(GBTTable::rowRecord(pairs[i].second), deleted) != 0 || deleted)
+			wrong++;
+	}
+
+	// and the rest, down to an empty tree
+	for(size_t i = 0; i < pairs.size(); i++)
+		if(index.remove(pairs[i].first, GBTTable::rowRecord(pairs[i].second)) != 0)
+			bad++;
+	wrong += CheckIndex(index, std::vector<IndexPair>());
+	heights[2] = index.getTreeHeight();
+	if(heights[1] > heights[0] || heights[2] != 0)
+		wrong++;
+	index.close();
+	table.close();
+
+	fprintf(stdout, "page size %d%s: height %d, %d, %d, %d failed, %d wrong. ", page_size,
+			duplicate ? " with duplicate keys" : "", heights[0], heights[1], heights[2], bad, wrong);
+	return bad + wrong;
+}
+
+int TestUpdate(const char* table_name, const char*data_file)
+{
+	int bad = 0;
+	int page_sizes[] = { GBTFile::MIN_PAGE_SIZE, 8192, GBTFile::MAX_PAGE_SIZE };
+	std::string index_path = PathManager::GetIndexPath(std::string(table_name));
+	std::string table_path = PathManager::GetTablePath(std::string(table_name));
+
+	for(int p = 0; p < 3; p++)
+		for(int duplicate = 0; duplicate < 2; duplicate++)
+			bad += CheckUpdate(index_path, table_path, page_sizes[p], duplicate != 0, 200000);
+	fprintf(stdout, "\n");
+	unlink(index_path.c_str());
+	unlink(table_path.c_str());
+	return bad == 0 ? 0 : -1;
+}
+
+/* *
+ * look up every object of a store
+ * @param last[IN] the point each object was moved to last, -1 if it was removed
+ * @param current[OUT] the (key, rid) the store holds for each object
+ * @return the number of objects not where they should be
+ * */
+static int FindObjects(GBTObjectStore& store, const std::vector<uint64_t>& keys, const std::vector<int64_t>& last,
+		std::vector<std::pair<uint64_t, RecordId> >& current)
+{
+	int bad = 0;
+	uint64_t key;
+	RecordId rid;
+
+	for(size_t i = 0; i < last.size(); i++)
+	{
+		RT found = store.find(i, key, rid);
+		if(last[i] < 0){
+			if(found != RT_NO_SUCH_RECORD)
+				bad++;
+			continue;
+		}
+		if(found != 0 || key != keys[last[i]])
+			bad++;
+		current.push_back(std::make_pair(key, rid));
+	}
+	if(store.getObjectCount() != current.size())
+		bad++;
+	return bad;
+}
+
+int TestObjectStore(const char* table_name, const char*data_file)
+{
+	int rt;
+	int bad = 0;
+	size_t i, objects = 1000, live = 0;
+	uint64_t key;
+	RecordId rid;
+	std::string value;
+	std::string table(table_name);
+	std::vector<uint64_t> keys;
+	std::vector<double> lngs, lats;
+	std::vector<std::pair<uint64_t, RecordId> > current, indexed;
+	// the point each object was moved to last, -1 once it is removed
+	std::vector<int64_t> last(objects, -1);
+	GBTObjectStore store;
+
+	if((rt = ReadPoints(data_file, keys, lngs, lats)) != 0)
+		return rt;
+	unlink(PathManager::GetIndexPath(table).c_str());
+	unlink(PathManager::GetTablePath(table).c_str());
+	unlink(PathManager::GetObjectPath(table).c_str());
+
+	// every object moves through the points of the load file in turn,
+	// and every tenth object is removed on the way
+	if((rt = store.open(table)) != 0)
+		return rt;
+	for(i = 0; i < keys.size(); i++)
+	{
+		value = std::to_string(i);
+		if(store.update(i % objects, keys[i], value.data(), value.size()) != 0)
+			bad++;
+		last[i % objects] = i;
+	}
+	for(i = 0; i < objects; i += 10)
+	{
+		if(store.remove(i) != 0 || store.remove(i) != RT_NO_SUCH_RECORD)
+			bad++;
+		last[i] = -1;
+	}
+	store.close();
+
+	// reopen the store and move the objects once more
+	if((rt = store.open(table)) != 0)
+		return rt;
+	bad += FindObjects(store, keys, last, current);
+	for(i = 0; i < objects; i++)
+	{
+		if(last[i] < 0)
+			continue;
+		last[i] = (last[i] + 1) % keys.size();
+		value = std::to_string(last[i]);
+		if(store.update(i, keys[last[i]], value.data(), value.size()) != 0)
+			bad++;
+	}
+	store.close();
+
+	// the object map, the index and the live records of the table must all
+	// hold one entry per object, at its last point
+	if((rt = store.open(table)) != 0)
+		return rt;
+	current.clear();
+	bad += FindObjects(store, keys, last, current);
+	store.close();
+
+	GBTreeIndex index(true);
+	IndexCursor cursor;
+	if((rt = index.open(PathManager::GetIndexPath(table), 'r')) != 0)
+		return rt;
+	if(index.pointToSmallestKey(cursor) == 0)
+		while(index.readForward(cursor, key, rid) == 0)
+			indexed.push_back(std::make_pair(key, rid));
+	index.close();
+	std::sort(current.begin(), current.end());
+	std::sort(indexed.begin(), indexed.end());
+	if(indexed != current)
+		bad++;
+
+	GBTTable table_file;
+	if((rt = table_file.open(PathManager::GetTablePath(table), 'r')) != 0)
+		return rt;
+	for(i = 0; i < current.size(); i++)
+		if(table_file.read(current[i].second, key, value) != 0 || key != current[i].first
+				|| keys[atoi(value.c_str())] != key)
+			bad++;
+	for(rid.pid = 0; rid.pid <= table_file.endRid().pid; rid.pid++)
+		for(rid.sid = 0; rid.sid < table_file.recordsPerPage() && rid < table_file.endRid(); rid.sid++)
+		{
+			bool deleted = true;
+			if(table_file.isDeleted(rid, deleted) == 0 && !deleted)
+				live++;
+		}
+	table_file.close();
+	if(live != current.size())
+		bad++;
+
+	fprintf(stdout, "%lu objects after %lu moves, %lu index entries, %lu live records, %d wrong\n",
+			current.size(), keys.size() + objects, indexed.size(), live, bad);
+	return bad == 0 ? 0 : -1;
+}
+
+// finds the points of the load file in a box during a time window
+typedef std::function<RT(uint64_t, uint64_t, int64_t, int64_t, std::vector<size_t>&)> WindowQuery;
+
+/* *
+ * run box and time window queries and compare them with a scan of the points:
+ * the box of all points over the whole span, then boxes spanned by two
+ * points over windows of up to six hours that start inside an hour
+ * @param times[IN] the timestamp of every point
+ * @param alive[IN] false for the points that must not be found
+ * @param found[OUT] the number of points found
+ * @return the number of queries that failed or found the wrong points
+ * */
+static int CheckWindows(const std::vector<uint64_t>& keys, const std::vector<double>& lngs, const std::vector<double>& lats,
+		const std::vector<int64_t>& times, const std::vector<bool>& alive, const WindowQuery& query, size_t& found)
+{
+	int bad = 0;
+	uint64_t left_down, right_up;
+	int64_t first = times.front(), span = times.back() - times.front() + 1;
+	int64_t begin = first, end = times.back();
+	double lnglat[4];
+
+	lnglat[0] = *std::min_element(lngs.begin(), lngs.end()) - 0.001;
+	lnglat[1] = *std::min_element(lats.begin(), lats.end()) - 0.001;
+	lnglat[2] = *std::max_element(lngs.begin(), lngs.end()) + 0.001;
+	lnglat[3] = *std::max_element(lats.begin(), lats.end()) + 0.001;
+	srand(1);
+	for(int q = 0; q < 20; q++)
+	{
+		if(q > 0){
+			size_t a = rand() % keys.size(), b = rand() % keys.size();
+			lnglat[0] = std::min(lngs[a], lngs[b]);
+			lnglat[1] = std::min(lats[a], lats[b]);
+			lnglat[2] = std::max(lngs[a], lngs[b]);
+			lnglat[3] = std::max(lats[a], lats[b]);
+			begin = first + rand() % span;
+			end = begin + rand() % (6 * 3600);
+		}
+		if(!MakeBox(lnglat, left_down, right_up))
+			continue;
+
+		std::vector<size_t> want, got;
+		for(size_t i = 0; i < keys.size(); i++)
+			if(alive[i] && begin <= times[i] && times[i] <= end && InsideRange(left_down, right_up, keys[i]))
+				want.push_back(i);
+		if(query(left_down, right_up, begin, end, got) != 0){
+			bad++;
+			continue;
+		}
+		std::sort(got.begin(), got.end());
+		if(want != got){
+			fprintf(stdout, "query %d: %lu outputs, %lu points inside. ", q, got.size(), want.size());
+			bad++;
+		}
+		found += got.size();
+	}
+	return bad;
+}
+
+/* *
+ * the point of the load file a record was appended for
+ * @return -1 if the record does not match the point
+ * */
+static int64_t PointOf(const std::vector<uint64_t>& keys, const std::vector<int64_t>& times,
+		int64_t timestamp, uint64_t address, const std::string& value)
+{
+	size_t n = atoi(value.c_str());
+	if(n >= keys.size() || timestamp != times[n] || address != keys[n])
+		return -1;
+	return n;
+}
+
+int TestTrajectory(const char* table_name, const char*data_file)
+{
+	int rt;
+	int bad = 0;
+	size_t i, found = 0;
+	int64_t first = 20372 * (int64_t)86400, span = 3 * 86400;
+	std::string table(table_name);
+	std::vector<uint64_t> keys;
+	std::vector<double> lngs, lats;
+	std::vector<int64_t> times;
+	GBTTrajectory trajectory;
+
+	// the points of the load file, spread evenly over three days
+	if((rt = ReadPoints(data_file, keys, lngs, lats)) != 0)
+		return rt;
+	unlink(PathManager::GetIndexPath(table).c_str());
+	unlink(PathManager::GetTablePath(table).c_str());
+	if((rt = trajectory.open(table, 'w')) != 0)
+		return rt;
+	for(i = 0; i < keys.size(); i++)
+	{
+		times.push_back(first + (int64_t)i * span / keys.size());
+		if(trajectory.append(times[i], lngs[i], lats[i], std::to_string(i)) != 0)
+			bad++;
+	}
+	trajectory.close();
+	if((rt = trajectory.open(table, 'r')) != 0)
+		return rt;
+
+	bad += CheckWindows(keys, lngs, lats, times, std::vector<bool>(keys.size(), true),
+		[&](uint64_t left_down, uint64_t right_up, int64_t begin, int64_t end, std::vector<size_t>& points) {
+			RT rc;
+			int64_t timestamp;
+			uint64_t address;
+			std::string value;
+			std::vector<RecordId> outputs;
+			if((rc = trajectory.query(left_down, right_up, begin, end, outputs)) != 0)
+				return rc;
+			for(size_t j = 0; j < outputs.size(); j++)
+			{
+				if((rc = trajectory.read(outputs[j], timestamp, address, value)) != 0)
+					return rc;
+				points.push_back(PointOf(keys, times, timestamp, address, value));
+			}
+			return 0;
+		}, found);
+	trajectory.close();
+	fprintf(stdout, "20 queries checked against a scan of %lu points, %lu outputs, %d wrong\n",
+			keys.size(), found, bad);
+	return bad == 0 ? 0 : -1;
+}
+
+/* *
+ * @return true if neither file of a partition is left
+ * */
+static bool PartitionGone(const std::string& table, int partition)
+{
+	std::string name = GBTPartitionedTable::PartitionName(table, partition);
+	return access(PathManager::GetIndexPath(name).c_str(), F_OK) != 0
+		&& access(PathManager::GetTablePath(name).c_str(), F_OK) != 0;
+}
+
+int TestPartitions(const char* table_name, const char*data_file)
+{
+	int rt;
+	int bad = 0;
+	size_t i, found = 0;
+	int day = 20372;
+	int64_t first = day * GBTPartitionedTable::PARTITION_SECONDS, span = 3 * GBTPartitionedTable::PARTITION_SECONDS;
+	std::string table(table_name);
+	std::vector<uint64_t> keys;
+	std::vector<double> lngs, lats;
+	std::vector<int64_t> times;
+	std::vector<bool> alive;
+	GBTPartitionedTable partitioned;
+
+	// the points of the load file, spread evenly over three days
+	if((rt = ReadPoints(data_file, keys, lngs, lats)) != 0)
+		return rt;
+	if((rt = partitioned.open(table)) != 0)
+		return rt;
+	while(!partitioned.getPartitions().empty())
+		if((rt = partitioned.drop(partitioned.getPartitions()[0])) != 0)
+			return rt;
+	for(i = 0; i < keys.size(); i++)
+	{
+		times.push_back(first + (int64_t)i * span / keys.size());
+		if(partitioned.append(times[i], lngs[i], lats[i], std::to_string(i)) != 0)
+			bad++;
+	}
+	alive.assign(keys.size(), true);
+	partitioned.close();
+
+	WindowQuery query = [&](uint64_t left_down, uint64_t right_up, int64_t begin, int64_t end, std::vector<size_t>& points) {
+		RT rc;
+		int64_t timestamp;
+		uint64_t address;
+		std::string value;
+		std::vector<PartitionRecord> outputs;
+		if((rc = partitioned.query(left_down, right_up, begin, end, outputs)) != 0)
+			return rc;
+		for(size_t j = 0; j < outputs.size(); j++)
+		{
+			if((rc = partitioned.read(outputs[j], timestamp, address, value)) != 0)
+				return rc;
+			int64_t n = PointOf(keys, times, timestamp, address, value);
+			if(n < 0 || outputs[j].partition != times[n] / GBTPartitionedTable::PARTITION_SECONDS)
+				n = -1;
+			points.push_back(n);
+		}
+		return 0;
+	};
+
+	// all three days, then after dropping the first day, then after
+	// dropping the second with dropBefore() and opening the table again
+	if((rt = partitioned.open(table)) != 0)
+		return rt;
+	if(partitioned.getPartitions() != std::vector<int>({ day, day + 1, day + 2 }))
+		bad++;
+	bad += CheckWindows(keys, lngs, lats, times, alive, query, found);
+
+	if(partitioned.drop(day) != 0 || partitioned.drop(day) != RT_NO_SUCH_RECORD || !PartitionGone(table, day))
+		bad++;
+	for(i = 0; i < keys.size(); i++)
+		alive[i] = times[i] >= first + GBTPartitionedTable::PARTITION_SECONDS;
+	bad += CheckWindows(keys, lngs, lats, times, alive, query, found);
+
+	if(partitioned.dropBefore(first + 2 * GBTPartitionedTable::PARTITION_SECONDS) != 0 || !PartitionGone(table, day + 1))
+		bad++;
+	partitioned.close();
+	if((rt = partitioned.open(table)) != 0)
+		return rt;
+	if(partitioned.getPartitions() != std::vector<int>({ day + 2 }))
+		bad++;
+	for(i = 0; i < keys.size(); i++)
+		alive[i] = times[i] >= first + 2 * GBTPartitionedTable::PARTITION_SECONDS;
+	bad += CheckWindows(keys, lngs, lats, times, alive, query, found);
+
+	if(partitioned.drop(day + 2) != 0 || !PartitionGone(table, day + 2))
+		bad++;
+	partitioned.close();
+	fprintf(stdout, "60 queries over 3, 2 and 1 partitions checked against a scan of %lu points, %lu outputs, %d wrong\n",
+			keys.size(), found, bad);
+	return bad == 0 ? 0 : -1;
+}
+
+/* *
+ * rows on a few keys that spill from their leaf into chains of overflow
+ * pages, among rows on distinct keys, removed in random order
+ * @return the number of failed calls and differences
+ * */
+static int CheckOverflow(const std::string& path, int page_size)
+{
+	int bad = 0, wrong = 0;
+	int row = 0;
+	std::mt19937_64 random(page_size);
+	std::vector<IndexPair> pairs;
+	GBTreeIndex index(true);
+
+	// 30000 distinct keys, and 6000, 3000 and 4000 rows on three keys
+	// among them; a 4K leaf holds about 1000 rows of one key. the last key
+	// is above all others, so its leaf has no separator behind it
+	uint64_t hot[] = { random(), random(), UINT64_MAX - 10 };
+	int rows[] = { 6000, 3000, 4000 };
+	for(int i = 0; i < 30000; i++)
+		pairs.push_back(IndexPair(random(), row++));
+	for(int h = 0; h < 3; h++)
+		for(int i = 0; i < rows[h]; i++)
+			pairs.push_back(IndexPair(hot[h], row++));
+	std::shuffle(pairs.begin(), pairs.end(), random);
+
+	unlink(path.c_str());
+	if(index.open(path, 'w', page_size) != 0)
+		return 1;
+	for(size_t i = 0; i < pairs.size(); i++)
+		if(index.insert(pairs[i].first, GBTTable::rowRecord(pairs[i].second)) != 0)
+			bad++;
+
+	// keys next to the chains, which go to their leaves or behind them
+	for(int h = 0; h < 3; h++)
+		for(int i = 0; i < 100; i++)
+		{
+			pairs.push_back(IndexPair(hot[h] + (i % 2 ? 1 : -1), row++));
+			if(index.insert(pairs.back().first, GBTTable::rowRecord(pairs.back().second)) != 0)
+				bad++;
+		}
+	// and a fourth chain, taken off again newest first, which empties
+	// the overflow page in front of the chain before the others
+	uint64_t last = random();
+	for(int i = 0; i < 2000; i++)
+		if(index.insert(last, GBTTable::rowRecord(row + i)) != 0)
+			bad++;
+	int pages = index.getPageCount();
+	for(int i = 2000; i-- > 1000; )
+		if(index.remove(last, GBTTable::rowRecord(row + i)) != 0)
+			bad++;
+	for(int i = 0; i < 1000; i++)
+		pairs.push_back(IndexPair(last, row++));
+	row += 1000;
+	wrong += CheckIndex(index, pairs);
+
+	// remove half of the rows, from the leaves and from the chains
+	std::shuffle(pairs.begin(), pairs.end(), random);
+	size_t kept = pairs.size() / 2;
+	for(size_t i = kept; i < pairs.size(); i++)
+		if(index.remove(pairs[i].first, GBTTable::rowRecord(pairs[i].second)) != 0)
+			bad++;
+	for(size_t i = kept; i < pairs.size(); i += 97)
+		if(index.remove(pairs[i].first, GBTTable::rowRecord(pairs[i].second)) != RT_NO_SUCH_RECORD)
+			bad++;
+	pairs.resize(kept);
+	wrong += CheckIndex(index, pairs);
+	index.close();
+
+	// remove finds every pair that is left; the hot keys go last
+	if(index.open(path, 'w') != 0)
+		return bad + 1;
+	wrong += CheckIndex(index, pairs);
+	std::stable_partition(pairs.begin(), pairs.end(), [&](const IndexPair& pair) {
+		return pair.first != hot[0] && pair.first != hot[1] && pair.first != hot[2] && pair.first != last;
+	});
+	for(size_t i = 0; i < pairs.size(); i++)
+	{
+		if(index.remove(pairs[i].first, GBTTable::rowRecord(pairs[i].second)) != 0)
+			bad++;
+		if(i == pairs.size() / 2)
+			wrong += CheckIndex(index, std::vector<IndexPair>(pairs.begin() + i + 1, pairs.end()));
+	}
+	wrong += CheckIndex(index, std::vector<IndexPair>());
+	if(index.getTreeHeight() != 0)
+		wrong++;
+	index.close();
+
+	fprintf(stdout, "page size %d: %d rows, %d pages, %d failed, %d wrong. ", page_size, row, pages, bad, wrong);
+	return bad + wrong;
+}
+
+int TestOverflow(const char* table_name, const char*data_file)
+{
+	int bad = 0;
+	std::string path = PathManager::GetIndexPath(std::string(table_name));
+
+	bad += CheckOverflow(path, GBTFile::MIN_PAGE_SIZE);
+	bad += CheckOverflow(path, 8192);
+	fprintf(stdout, "\n");
+	unlink(path.c_str());
+	return bad == 0 ? 0 : -1;
+}
+
+/* *
+ * a round of inserts of new keys, removes and updates of the pairs in
+ * an index with unique keys; the last one is an insert
+ * @param pairs[IN] the pairs in the index before the round
+ * @param row[IN/OUT] the row number of the next insert
+ * @param ops[OUT] the operations, in the format of the log
+ * */
+static void MakeWalOperations(std::mt19937_64& random, std::set<IndexPair> pairs, int count, int64_t& row,
+		std::vector<LogRecord>& ops)
+{
+	std::set<uint64_t> keys;
+	for(std::set<IndexPair>::iterator it = pairs.begin(); it != pairs.end(); ++it)
+		keys.insert(it->first);
+
+	for(int i = 0; i < count; i++)
+	{
+		LogRecord op;
+		memset(&op, 0, sizeof(op));
+		int type = random() % 4;
+		if(pairs.empty() || type < 2 || i == count - 1){
+			op.type = GBTWal::LOG_INSERT;
+			do op.key = random(); while(!keys.insert(op.key).second);
+			op.rid = GBTTable::rowRecord(row++);
+			pairs.insert(IndexPair(op.key, GBTTable::rowNumber(op.rid)));
+			ops.push_back(op);
+			continue;
+		}
+		// a pair near a random key
+		std::set<IndexPair>::iterator it = pairs.lower_bound(IndexPair(random(), 0));
+		if(it == pairs.end())
+			it = pairs.begin();
+		IndexPair pair = *it;
+		pairs.erase(it);
+		keys.erase(pair.first);
+		op.type = (type == 2) ? GBTWal::LOG_REMOVE : GBTWal::LOG_UPDATE;
+		op.key = pair.first;
+		op.rid = GBTTable::rowRecord(pair.second);
+		if(op.type == GBTWal::LOG_UPDATE){
+			do op.new_key = random(); while(!keys.insert(op.new_key).second);
+			pairs.insert(IndexPair(op.new_key, pair.second));
+		}
+		ops.push_back(op);
+	}
+}
+
+/* *
+ * apply the first count operations to the pairs of an index
+ * */
+static void ApplyWalOperations(std::set<IndexPair>& pairs, const std::vector<LogRecord>& ops, size_t count)
+{
+	for(size_t i = 0; i < count; i++)
+	{
+		IndexPair pair(ops[i].key, GBTTable::rowNumber(ops[i].rid));
+		if(ops[i].type != GBTWal::LOG_INSERT)
+			pairs.erase(pair);
+		if(ops[i].type == GBTWal::LOG_UPDATE)
+			pair.first = ops[i].new_key;
+		if(ops[i].type != GBTWal::LOG_REMOVE)
+			pairs.insert(pair);
+	}
+}
+
+int TestWalRecovery(const char* table_name, const char*data_file)
+{
+	int bad = 0;
+	int count = 20000;
+	int64_t row = 0;
+	std::mt19937_64 random(1);
+	std::set<IndexPair> pairs;
+	std::string path = PathManager::GetIndexPath(std::string(table_name));
+	std::string log_path = path + ".wal";
+	const char* tails[] = { "intact", "torn", "with a bad checksum" };
+
+	unlink(path.c_str());
+	unlink(log_path.c_str());
+	GBTreeIndex::write_ahead_log = true;
+
+	// in every round a writer logs the operations, takes a checkpoint
+	// half way, and is killed once the last one has returned
+	for(int round = 0; round < 3; round++)
+	{
+		std::vector<LogRecord> ops;
+		MakeWalOperations(random, pairs, count, row, ops);
+
+		pid_t writer = fork();
+		if(writer < 0)
+			return -1;
+		if(writer == 0){
+			GBTreeIndex index;
+			if(index.open(path, 'w', GBTFile::MIN_PAGE_SIZE) != 0)
+				_exit(1);
+			for(size_t i = 0; i < ops.size(); i++)
+			{
+				RT rc;
+				if(ops[i].type == GBTWal::LOG_INSERT)
+					rc = index.insert(ops[i].key, ops[i].rid);
+				else if(ops[i].type == GBTWal::LOG_REMOVE)
+					rc = index.remove(ops[i].key, ops[i].rid);
+				else
+					rc = index.update(ops[i].key, ops[i].new_key, ops[i].rid);
+				if(rc != 0 || (i == ops.size() / 2 && index.checkpoint() != 0))
+					_exit(1);
+			}
+			kill(getpid(), SIGKILL);
+			_exit(1);
+		}
+		int status;
+		if(waitpid(writer, &status, 0) != writer || !WIFSIGNALED(status) || WTERMSIG(status) != SIGKILL){
+			fprintf(stdout, "round %d: the writer failed. ", round);
+			bad++;
+			break;
+		}
+
+		// tear the record of the last insert, or break its checksum:
+		// recovery has to stop in front of it
+		struct stat st;
+		size_t replayed = ops.size();
+		if(stat(log_path.c_str(), &st) != 0 || st.st_size < (off_t)sizeof(LogRecord))
+			bad++;
+		else if(round == 1){
+			if(truncate(log_path.c_str(), st.st_size - 7) != 0)
+				bad++;
+			replayed--;
+		}
+		else if(round == 2){
+			FILE* log = fopen(log_path.c_str(), "r+b");
+			uint64_t key = ops.back().key ^ 1;
+			if(log == NULL || fseek(log, st.st_size - sizeof(LogRecord) + offsetof(LogRecord, key), SEEK_SET) != 0
+					|| fwrite(&key, sizeof(key), 1, log) != 1)
+				bad++;
+			if(log != NULL)
+				fclose(log);
+			replayed--;
+		}
+		ApplyWalOperations(pairs, ops, replayed);
+
+		// opening in 'w' mode replays the log, and a clean close removes it
+		GBTreeIndex index;
+		int wrong = 0;
+		if(index.open(path, 'w') != 0)
+			return -1;
+		wrong += CheckIndex(index, std::vector<IndexPair>(pairs.begin(), pairs.end()));
+		if(index.close() != 0 || access(log_path.c_str(), F_OK) == 0)
+			wrong++;
+		fprintf(stdout, "round %d, log %s: %lu of %lu operations replayed, %lu pairs, %d wrong. ",
+				round, tails[round], replayed, ops.size(), pairs.size(), wrong);
+		bad += wrong;
+	}
+	fprintf(stdout, "\n");
+	GBTreeIndex::write_ahead_log = false;
+	unlink(path.c_str());
+	unlink(log_path.c_str());
+	return bad == 0 ? 0 : -1;
+}
+
+/* *
+ * read the pages of the files in turn, one page of each at a time
+ * @return the number of pages that differ from what was written
+ * */
+static int ReadInTurn(GBTFile* files, const int* page_sizes, int count, int pages)
+{
+	int wrong = 0;
+	std::vector<char> page(GBTFile::MAX_PAGE_SIZE);
+
+	for(int pid = 0; pid < pages; pid++)
+		for(int f = 0; f < count; f++)
+		{
+			if(files[f].read(pid, &page[0]) != 0 || page[0] != (char)(pid + f) ||
+					page[page_sizes[f] - 1] != (char)(pid * 3 + f))
+				wrong++;
+		}
+	return wrong;
+}
+
+int TestMixedPageSizes(const char* table_name, const char*data_file)
+{
+	int wrong = 0;
+	int pages = 24;
+	int page_sizes[] = { 8192, 16384 };
+	std::string paths[2];
+	GBTFile files[2];
+	std::vector<char> page(GBTFile::MAX_PAGE_SIZE);
+
+	for(int f = 0; f < 2; f++)
+	{
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), ".pages%d", page_sizes[f]);
+		paths[f] = PathManager::GetIndexPath(std::string(table_name) + suffix);
+		unlink(paths[f].c_str());
+		if(files[f].open(paths[f], 'w', page_sizes[f]) != 0)
+			return -1;
+		for(int pid = 0; pid < pages; pid++)
+		{
+			page[0] = (char)(pid + f);
+			page[page_sizes[f] - 1] = (char)(pid * 3 + f);
+			if(files[f].write(pid, &page[0]) != 0)
+				return -1;
+		}
+		files[f].close();
+	}
+
+	// the 576 KB of both files fit in the cache together, so the second
+	// round reads nothing from the disk
+	for(int f = 0; f < 2; f++)
+		if(files[f].open(paths[f], 'r') != 0)
+			return -1;
+	wrong += ReadInTurn(files, page_sizes, 2, pages);
+	int bpagecnt = GBTFile::getPageReadCount();
+	wrong += ReadInTurn(files, page_sizes, 2, pages);
+	int reads = GBTFile::getPageReadCount() - bpagecnt;
+	for(int f = 0; f < 2; f++)
+	{
+		files[f].close();
+		unlink(paths[f].c_str());
+	}
+
+	fprintf(stdout, "pages of %d and %d bytes read in turn: %d wrong, %d read again from the disk\n",
+			page_sizes[0], page_sizes[1], wrong, reads);
+	assert(wrong == 0 && reads == 0);
+	return (wrong == 0 && reads == 0) ? 0 : -1;
+}
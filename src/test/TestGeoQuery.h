@@ -21,6 +21,69 @@ int TestRangeQuery(const char* table_name, const char*data_file);
  * Test the Nearest query
  * */
 int TestNearestQuery(const char* table_name, const char*data_file);
+/* *
+ * Check range queries against a scan of the load file
+ * */
+int TestRangeCheck(const char* table_name, const char*data_file);
+/* *
+ * Test the range and Nearest query through shard servers
+ * */
+int TestClusterQuery(const char* table_name, const char*data_file);
+/* *
+ * Test the range query on the index held in memory, and a bulk load
+ * into an empty one
+ * */
+int TestMemoryQuery(const char* table_name, const char*data_file);
+/* *
+ * Test that a failed io_uring ends its reads in flight and hands the
+ * prefetches to the pread pool
+ * */
+int TestPrefetchFallback(const char* table_name, const char*data_file);
+/* *
+ * Test that the files opened with O_DIRECT prefetch, and answer the
+ * nearest and range queries as the buffered ones
+ * */
+int TestDirectPrefetch(const char* table_name, const char*data_file);
+/* *
+ * Check inserts and removes against a reference at the smallest and the
+ * largest page size
+ * */
+int TestRemove(const char* table_name, const char*data_file);
+/* *
+ * Check inserts, updates and removes of a table and its index against a
+ * reference, with and without duplicate keys, at several page sizes
+ * */
+int TestUpdate(const char* table_name, const char*data_file);
+/* *
+ * Move objects through the points of the load file and check that the
+ * store keeps one index entry and one live record per object
+ * */
+int TestObjectStore(const char* table_name, const char*data_file);
+/* *
+ * Check box and time window queries of a trajectory table against a scan
+ * of the load file
+ * */
+int TestTrajectory(const char* table_name, const char*data_file);
+/* *
+ * Check queries of a table partitioned by day against a scan of the load
+ * file, while the partitions are dropped one by one
+ * */
+int TestPartitions(const char* table_name, const char*data_file);
+/* *
+ * Check inserts and removes of many rows on one key, which continue in
+ * overflow pages behind their leaf
+ * */
+int TestOverflow(const char* table_name, const char*data_file);
+/* *
+ * Kill a writer of an index with a write-ahead log, and check that opening
+ * the index again replays the log, up to a torn or damaged last record
+ * */
+int TestWalRecovery(const char* table_name, const char*data_file);
+/* *
+ * Test that two files of different page sizes read in turn keep their
+ * pages in the cache
+ * */
+int TestMixedPageSizes(const char* table_name, const char*data_file);
 
 #endif
 
@@ -1,21 +1,47 @@
+#include <stdlib.h>
 #include <exception>  
 #include <iostream>
 #include "../gbtree/GBTEngine.h"
+#include "../storagemanager/GBTFile.h"
 #include "TestGeoQuery.h"
 
 int main(int args, char *argv[])
 {
     try
     {
-        if (args != 4)
+        if (args != 4 && args != 5)
         {
-      	  std::cerr << "Usage: " << argv[0] << " table_name input_file query_type[point | range | nearest]." << std::endl;
+      	  std::cerr << "Usage: " << argv[0] << " table_name input_file query_type[point | range | nearest | rangecheck | cluster | memory | fallback | remove | update | objects | trajectory | partitions | overflow | wal | direct | pagesizes] [page_size]." << std::endl;
       	  return -1;
         }
+        if (args == 5)
+        {
+      	  int page_size = atoi(argv[4]);
+      	  if (page_size < GBTFile::MIN_PAGE_SIZE || page_size > GBTFile::MAX_PAGE_SIZE || (page_size & (page_size - 1)) != 0)
+      	  {
+      		  std::cerr << "The page size must be a power of two from " << GBTFile::MIN_PAGE_SIZE
+      				  << " to " << GBTFile::MAX_PAGE_SIZE << "." << std::endl;
+      		  return -1;
+      	  }
+      	  GBTEngine::page_size = page_size;
+        }
         uint32_t query_type = 0;
         if (strcmp(argv[3], "point") == 0) query_type = 0;
         else if (strcmp(argv[3], "range") == 0) query_type = 1;
         else if (strcmp(argv[3], "nearest") == 0) query_type = 2;
+        else if (strcmp(argv[3], "rangecheck") == 0) query_type = 3;
+        else if (strcmp(argv[3], "cluster") == 0) query_type = 4;
+        else if (strcmp(argv[3], "memory") == 0) query_type = 5;
+        else if (strcmp(argv[3], "fallback") == 0) query_type = 6;
+        else if (strcmp(argv[3], "remove") == 0) query_type = 7;
+        else if (strcmp(argv[3], "update") == 0) query_type = 8;
+        else if (strcmp(argv[3], "objects") == 0) query_type = 9;
+        else if (strcmp(argv[3], "trajectory") == 0) query_type = 10;
+        else if (strcmp(argv[3], "partitions") == 0) query_type = 11;
+        else if (strcmp(argv[3], "overflow") == 0) query_type = 12;
+        else if (strcmp(argv[3], "wal") == 0) query_type = 13;
+        else if (strcmp(argv[3], "direct") == 0) query_type = 14;
+        else if (strcmp(argv[3], "pagesizes") == 0) query_type = 15;
         else
         {
       	  std::cerr << "Unknown query type." << std::endl;
@@ -27,7 +53,33 @@ int main(int args, char *argv[])
         else if(query_type == 1)
       	  TestRangeQuery(argv[1], argv[2]);
         else if(query_type == 2)
-      	  TestNearestQuery(argv[1], argv[2]);
+      	  return TestNearestQuery(argv[1], argv[2]) == 0 ? 0 : -1;
+        else if(query_type == 3)
+      	  return TestRangeCheck(argv[1], argv[2]) == 0 ? 0 : -1;
+        else if(query_type == 4)
+      	  TestClusterQuery(argv[1], argv[2]);
+        else if(query_type == 5)
+      	  return TestMemoryQuery(argv[1], argv[2]) == 0 ? 0 : -1;
+        else if(query_type == 6)
+      	  return TestPrefetchFallback(argv[1], argv[2]) == 0 ? 0 : -1;
+        else if(query_type == 7)
+      	  return TestRemove(argv[1], argv[2]) == 0 ? 0 : -1;
+        else if(query_type == 8)
+      	  return TestUpdate(argv[1], argv[2]) == 0 ? 0 : -1;
+        else if(query_type == 9)
+      	  return TestObjectStore(argv[1], argv[2]) == 0 ? 0 : -1;
+        else if(query_type == 10)
+      	  return TestTrajectory(argv[1], argv[2]) == 0 ? 0 : -1;
+        else if(query_type == 11)
+      	  return TestPartitions(argv[1], argv[2]) == 0 ? 0 : -1;
+        else if(query_type == 12)
+      	  return TestOverflow(argv[1], argv[2]) == 0 ? 0 : -1;
+        else if(query_type == 13)
+      	  return TestWalRecovery(argv[1], argv[2]) == 0 ? 0 : -1;
+        else if(query_type == 14)
+      	  return TestDirectPrefetch(argv[1], argv[2]) == 0 ? 0 : -1;
+        else if(query_type == 15)
+      	  return TestMixedPageSizes(argv[1], argv[2]) == 0 ? 0 : -1;
     }
     catch (std::exception& e)
     {
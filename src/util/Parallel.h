@@ -0,0 +1,38 @@
+/*
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <stddef.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+/* *
+ * call work(i) for every i in [0, n) on up to hardware_concurrency threads.
+ * the calling thread is one of the workers; each worker takes the next
+ * index until none is left.
+ * */
+template <typename Work>
+void ParallelFor(size_t n, Work work)
+{
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		size_t i;
+		while ((i = next++) < n)
+			work(i);
+	};
+
+	size_t workers = std::min((size_t)std::max(std::thread::hardware_concurrency(), 1u), n);
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < workers; i++)
+		threads.push_back(std::thread(worker));
+	worker();
+	for (size_t i = 0; i < threads.size(); i++)
+		threads[i].join();
+}
+
+#endif
@@ -0,0 +1,41 @@
+#!/bin/sh
+# Program:
+#   Page size sweep for GB-Tree: every data set is loaded with each page
+#   size and queried, and the throughput and the pages read are reported.
+#   Every query type is repeated and timed as a whole, and the read cache
+#   and the readahead hold the same bytes at every page size, so only the
+#   page size changes. PAGE_SIZES and DATA_SETS may be set to sweep other
+#   values.
+
+#define some variables
+DATA_DIRECTORY=data/
+INDEX_EXTENSION=.idx
+TABLE_EXTENSION=.tbl
+DATA_FILE_EXTENSION=.txt
+PAGE_SIZES=${PAGE_SIZES:-"4096 8192 16384 32768 65536"}
+DATA_SETS=${DATA_SETS:-"small middle"}
+QUERIES="point range nearest"
+
+printf "%-8s %-8s %9s %14s %11s\n" "data set" "query" "page size" "queries/s" "pages read"
+for NAME in $DATA_SETS
+do
+	for QUERY in $QUERIES
+	do
+		for PAGE_SIZE in $PAGE_SIZES
+		do
+			rm -f "$DATA_DIRECTORY$NAME$INDEX_EXTENSION" "$DATA_DIRECTORY$NAME$TABLE_EXTENSION"
+			OUTPUT=$(./gbtree $NAME "$DATA_DIRECTORY$NAME$DATA_FILE_EXTENSION" $QUERY $PAGE_SIZE) || exit 1
+			echo "$OUTPUT" | awk -v name=$NAME -v query=$QUERY -v size=$PAGE_SIZE '
+				{
+					for (i = 1; i <= NF; i++) {
+						if ($i == "qps" && $(i+1) == "is") qps = $(i+2) + 0
+						if (tolower($i) == "read" && $(i+2) ~ /^pages/) pages = $(i+1) + 0
+					}
+				}
+				END {
+					printf "%-8s %-8s %9d %14.1f %11d\n", name, query, size, qps, pages
+				}'
+		done
+	done
+	rm -f "$DATA_DIRECTORY$NAME$INDEX_EXTENSION" "$DATA_DIRECTORY$NAME$TABLE_EXTENSION"
+done